@@ -32,6 +32,7 @@
 #include "structures/dict_lsa.hh"
 #include "structures/sset_lsa.hh"
 #include "structures/hll.hh"
+#include "structures/roaring_lsa.hh"
 #include "core/timer-set.hh"
 #include "util/log.hh"
 #include "keys.hh"
@@ -101,6 +102,7 @@ enum class entry_type {
     ENTRY_SET   = 5,
     ENTRY_SSET  = 6,
     ENTRY_HLL   = 7,
+    ENTRY_BITMAP = 8,
 };
 class cache_entry
 {
@@ -118,6 +120,7 @@ protected:
         managed_ref<list_lsa> _list;
         managed_ref<dict_lsa> _dict;
         managed_ref<sset_lsa> _sset;
+        managed_ref<roaring_lsa> _bitmap;
         storage() {}
         ~storage() {}
     } _storage;
@@ -140,7 +143,7 @@ public:
         _storage._float_number = data;
     }
 
-    cache_entry(const bytes key, size_t hash, int64_t data) noexcept
+    cache_entry(const bytes& key, size_t hash, int64_t data) noexcept
         : cache_entry(key, hash, entry_type::ENTRY_INT64)
     {
         _storage._integer_number = data;
@@ -157,6 +160,19 @@ public:
     {
         _storage._bytes = make_managed<managed_bytes>(bytes_view{data.data(), data.size()});
     }
+    // takes the ownership of the bytes, e.g. the result of BITOP.
+    cache_entry(const bytes& key, size_t hash, managed_ref<managed_bytes>&& data) noexcept
+        : cache_entry(key, hash, entry_type::ENTRY_BYTES)
+    {
+        new (&_storage._bytes) managed_ref<managed_bytes>(std::move(data));
+    }
+
+    cache_entry(const bytes& key, size_t hash, managed_ref<roaring_lsa>&& data) noexcept
+        : cache_entry(key, hash, entry_type::ENTRY_BITMAP)
+    {
+        new (&_storage._bitmap) managed_ref<roaring_lsa>(std::move(data));
+    }
+
     struct list_initializer {};
     cache_entry(const bytes& key, size_t hash, list_initializer) noexcept
         : cache_entry(key, hash, entry_type::ENTRY_LIST)
@@ -178,18 +194,38 @@ public:
         _storage._dict = make_managed<dict_lsa>();
     }
 
+    cache_entry(const bytes& key, size_t hash, set_initializer, managed_ref<dict_lsa>&& data) noexcept
+        : cache_entry(key, hash, entry_type::ENTRY_SET)
+    {
+        new (&_storage._dict) managed_ref<dict_lsa>(std::move(data));
+    }
+
     struct sset_initializer {};
+    cache_entry(const bytes& key, size_t hash, sset_initializer, managed_ref<sset_lsa>&& data) noexcept
+        : cache_entry(key, hash, entry_type::ENTRY_SSET)
+    {
+        new (&_storage._sset) managed_ref<sset_lsa>(std::move(data));
+    }
+
     cache_entry(const bytes& key, size_t hash, sset_initializer) noexcept
         : cache_entry(key, hash, entry_type::ENTRY_SSET)
     {
         _storage._sset = make_managed<sset_lsa>();
     }
 
+    struct bitmap_initializer {};
+    cache_entry(const bytes& key, size_t hash, bitmap_initializer) noexcept
+        : cache_entry(key, hash, entry_type::ENTRY_BITMAP)
+    {
+        _storage._bitmap = make_managed<roaring_lsa>();
+    }
+
     struct hll_initializer {};
     cache_entry(const bytes& key, size_t hash, hll_initializer) noexcept
         : cache_entry(key, hash, entry_type::ENTRY_HLL)
     {
-        //_storage._bytes = make_managed<managed_bytes>(HLL_BYTES_SIZE, 0);
+        auto empty = hll::empty();
+        _storage._bytes = make_managed<managed_bytes>(bytes_view { empty });
     }
 
     cache_entry(cache_entry&& o) noexcept
@@ -219,6 +255,9 @@ public:
             case entry_type::ENTRY_SSET:
                 _storage._sset = std::move(o._storage._sset);
                 break;
+            case entry_type::ENTRY_BITMAP:
+                _storage._bitmap = std::move(o._storage._bitmap);
+                break;
         }
     }
 
@@ -242,9 +281,21 @@ public:
             case entry_type::ENTRY_SSET:
                 _storage._sset.~managed_ref<sset_lsa>();
                 break;
+            case entry_type::ENTRY_BITMAP:
+                _storage._bitmap.~managed_ref<roaring_lsa>();
+                break;
         }
     }
 
+private:
+    inline void release_value_bytes()
+    {
+        assert(_type == entry_type::ENTRY_BYTES || _type == entry_type::ENTRY_INT64 || _type == entry_type::ENTRY_FLOAT);
+        if (_type == entry_type::ENTRY_BYTES) {
+            _storage._bytes.~managed_ref<managed_bytes>();
+        }
+    }
+public:
     const bytes type_name() const
     {
         return {};
@@ -287,6 +338,11 @@ public:
         return _expiry.set_never_expired();
     }
 
+    inline const expiration& expiry() const
+    {
+        return _expiry;
+    }
+
     inline void set_expiry(const expiration& expiry)
     {
         _expiry = expiry;
@@ -362,6 +418,9 @@ public:
     inline bool type_of_hll() const {
         return _type == entry_type::ENTRY_HLL;
     }
+    inline bool type_of_bitmap() const {
+        return _type == entry_type::ENTRY_BITMAP;
+    }
     inline int64_t value_integer() const
     {
         return _storage._integer_number;
@@ -376,6 +435,31 @@ public:
         return _storage._float_number;
     }
 
+    // The string value is encoded as bytes, int64_t or double, the encoding is changed
+    // in place, so the entry keeps its expiry and the reference to it is still valid.
+    // They are used on the strings only, and must run in the allocator of the entry.
+    inline void set_value_integer(int64_t value)
+    {
+        release_value_bytes();
+        _type = entry_type::ENTRY_INT64;
+        _storage._integer_number = value;
+    }
+
+    inline void set_value_float(double value)
+    {
+        release_value_bytes();
+        _type = entry_type::ENTRY_FLOAT;
+        _storage._float_number = value;
+    }
+
+    inline void set_value_bytes(bytes_view value)
+    {
+        auto b = make_managed<managed_bytes>(value);
+        release_value_bytes();
+        _type = entry_type::ENTRY_BYTES;
+        new (&_storage._bytes) managed_ref<managed_bytes>(std::move(b));
+    }
+
     inline void value_float_incr(double step)
     {
         _storage._float_number += step;
@@ -410,6 +494,12 @@ public:
     inline const sset_lsa& value_sset() const {
         return *(_storage._sset);
     }
+    inline roaring_lsa& value_bitmap() {
+        return *(_storage._bitmap);
+    }
+    inline const roaring_lsa& value_bitmap() const {
+        return *(_storage._bitmap);
+    }
 };
 
 static constexpr const size_t DEFAULT_INITIAL_SIZE = 1 << 20;
@@ -522,6 +612,25 @@ public:
         return res;
     }
 
+    // Replaces the entry of the same key, the new entry keeps its expiry, e.g. when
+    // the value is converted to another encoding.
+    inline void replace_keeping_expiry(cache_entry* entry)
+    {
+        static auto hash_fn = [] (const cache_entry& e) -> size_t { return e.key_hash(); };
+        auto it = _store.find(*entry, hash_fn, cache_entry::compare());
+        if (it != _store.end()) {
+            if (it->ever_expires()) {
+                entry->set_expiry(it->expiry());
+                _alive.remove(*it);
+            }
+            _store.erase_and_dispose(it, current_deleter<cache_entry>());
+        }
+        insert(entry);
+        if (entry->ever_expires() && _alive.insert(*entry)) {
+            _timer.rearm(entry->get_timeout());
+        }
+    }
+
     // return value: true if the entry was inserted, otherwise false.
     inline bool insert_if(cache_entry* entry, long expired, bool nx, bool xx)
     {
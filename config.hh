@@ -274,6 +274,18 @@ public:
             "Throttles compaction to the specified total throughput across the entire system. The faster you insert data, the faster you need to compact in order to keep the SSTable count down. The recommended Value is 16 to 32 times the rate of write throughput (in MBs/second). Setting the value to 0 disables compaction throttling.\n"  \
             "Related information: Configuring compaction"   \
     )                                                   \
+    val(compaction_strategy, sstring, "LeveledCompactionStrategy", Used,     \
+            "The compaction strategy of the column families:\n"   \
+            "\n"    \
+            "\tLeveledCompactionStrategy : Merges every level into the next one which is ten times larger. The reads touch few sstables, but every partition is rewritten once per level.\n"   \
+            "\tSizeTieredCompactionStrategy : Merges the runs of the similarly sized sstables. The write amplification is far lower, which suits the write heavy column families.\n"  \
+    )                                                   \
+    val(compaction_strategy_options, string_map, /* defaults */, Used,     \
+            "The options of the compaction strategy: min_threshold, max_threshold, bucket_low, bucket_high and min_sstable_size of the SizeTieredCompactionStrategy, and sstable_size_in_mb and level0_compaction_trigger of the LeveledCompactionStrategy."  \
+    )                                                   \
+    val(column_family_compaction_strategies, string_map, /* none */, Used,     \
+            "Overrides the compaction_strategy of the column families, maps the name of a column family to its strategy."  \
+    )                                                   \
     val(compaction_large_partition_warning_threshold_mb, uint32_t, 100, Unused, \
             "Log a warning when compacting partitions larger than this value"   \
     )                                               \
@@ -376,6 +388,15 @@ public:
             "See memtable_heap_space_in_mb"  \
     )   \
     /* Cache and index settings */  \
+    val(sstable_bloom_filter_bits_per_key, uint32_t, 10, Used,     \
+            "The bits of the bloom filter of every sstable per key. The lookups skip the sstables whose filters reject the key, about 10 bits give a false positive rate of 1%. Setting the value to 0 writes no filters."  \
+    )   \
+    val(sstable_level_compression, sstring, "none,lz4", Used,     \
+            "The codecs of the sstable data blocks by the level, separated by the commas: none, lz4, snappy or deflate. The last one applies to the deeper levels. The blocks which compress poorly are stored uncompressed."  \
+    )   \
+    val(sstable_block_cache_size_in_mb, uint32_t, 64, Used,     \
+            "The memory of the uncompressed sstable data blocks which were read recently, per column family. Setting the value to 0 disables the cache."  \
+    )   \
     val(column_index_size_in_kb, uint32_t, 64, Unused,     \
             "Granularity of the index of rows within a partition. For huge rows, decrease this setting to improve seek time. If you use key cache, be careful not to make this setting too large because key cache will be overwhelmed. If you're unsure of the size of the rows, it's best to use the default setting."  \
     )   \
@@ -795,6 +816,11 @@ public:
     val(abort_on_lsa_bad_alloc, bool, false, Used, "Abort when allocation in LSA region fails") \
     val(murmur3_partitioner_ignore_msb_bits, unsigned, 0, Used, "Number of most siginificant token bits to ignore in murmur3 partitioner; increase for very large clusters") \
     val(virtual_dirty_soft_limit, double, 0.6, Used, "Soft limit of virtual dirty memory expressed as a portion of the hard limit") \
+    val(list_max_chunk_size, uint32_t, 8192, Used, "The max size in bytes of a packed chunk of the list values. Larger chunks use less memory, but the insertions in the middle of the list copy more bytes.") \
+    val(list_max_chunk_entries, uint32_t, 128, Used, "The max number of elements in a packed chunk of the list values, like the positive list-max-ziplist-size of redis. Set to 0 to limit the chunks by list_max_chunk_size only.") \
+    val(list_compress_depth, uint32_t, 0, Used, "The number of chunks on each end of a list which are never compressed. The interior chunks are compressed by LZ4. Set to 0 to disable the compression.") \
+    val(hll_sparse_max_bytes, uint32_t, 3000, Used, "The max size in bytes of the sparse encoding of a HyperLogLog value, it is promoted to the dense encoding (12K bytes) when exceeding this limit.") \
+    val(pubsub_output_limit_in_mb, uint32_t, 32, Used, "The max size in MB of the published messages which are not written to a subscriber yet. A slow consumer which exceeds the limit loses its subscriptions.") \
     /* done! */
 
 #define _make_value_member(name, type, deflt, status, desc, ...)    \
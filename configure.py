@@ -166,6 +166,16 @@ modes = {
 }
 
 scylla_tests = [
+    'tests/perf/perf_memtable',
+    'tests/level_manifest_test',
+    'tests/blocking_pop_test',
+    'tests/list_lsa_test',
+    'tests/hll_test',
+    'tests/hll_kernels_test',
+    'tests/bits_kernels_test',
+    'tests/roaring_lsa_test',
+    'tests/commit_log_test',
+    'tests/column_family_test',
 ]
 
 apps = [
@@ -234,6 +244,9 @@ scylla_core = ([
         'utils/large_bitset.cc',
         'utils/runtime.cc',
         'utils/murmur_hash.cc',
+        'utils/bloom_filter.cc',
+        'utils/bloom_calculations.cc',
+        'utils/i_filter.cc',
         'utils/uuid.cc',
         'utils/big_decimal.cc',
         'utils/types.cc',
@@ -265,12 +278,20 @@ scylla_core = ([
       'redis.cc',
       'server.cc',
       'db.cc',
+      'pubsub.cc',
       'redis_protocol_parser.rl',
       'redis_protocol.cc',
       'structures/dict_lsa.cc',
+      'structures/sset_lsa.cc',
       'structures/geo.cc',
+      'structures/geo_kernels.cc',
       'structures/hll.cc',
+      'structures/hll_kernels.cc',
+      'structures/bits_kernels.cc',
+      'structures/roaring_lsa.cc',
       'structures/bits_operation.cc',
+      'structures/numeric_string.cc',
+      'structures/scan.cc',
       'structures/list_lsa.cc',
       'cache.cc',
       'reply_builder.cc',
@@ -281,7 +302,6 @@ scylla_core = ([
       'init.cc',
       'token.cc',
       'keys.cc',
-      'store/table/block.cc',
       'store/table/block_builder.cc',
       'store/comparator.cc',
                ]
@@ -295,6 +315,24 @@ store = [
         'store/util/logging.cc',
         'store/file_writer.cc',
         'store/file_reader.cc',
+        'store/memtable.cc',
+        'store/commit_log.cc',
+        'store/commit_log_replayer.cc',
+        'store/util/coding.cc',
+        'store/table/format.cc',
+        'store/table/table_builder.cc',
+        'store/table/block.cc',
+        'store/table/table.cc',
+        'store/table/filter_block.cc',
+        'store/table/compression.cc',
+        'store/table/block_cache.cc',
+        'store/combined_reader.cc',
+        'store/version_edit.cc',
+        'store/level_manifest.cc',
+        'store/compaction.cc',
+        'store/compaction_strategy.cc',
+        'store/backlog_controller.cc',
+        'partition.cc',
         ]
 scylla_tests_dependencies = scylla_core + api +  [
 ]
@@ -306,10 +344,14 @@ deps = {
     'pedis': ['main.cc'] + scylla_core + store + api,
 }
 
+for t in scylla_tests:
+    deps[t] = [t + '.cc'] + scylla_tests_dependencies + store
+
 pure_boost_tests = set([
 ])
 
 tests_not_using_seastar_test_framework = set([
+    'tests/perf/perf_memtable',
 ]) | pure_boost_tests
 
 for t in tests_not_using_seastar_test_framework:
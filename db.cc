@@ -22,11 +22,19 @@
 #include <random>
 #include <chrono>
 #include <algorithm>
+#include <unordered_set>
+#include <queue>
+#include <cmath>
 #include "util/log.hh"
 #include "structures/bits_operation.hh"
+#include "structures/numeric_string.hh"
 #include "core/metrics.hh"
 #include "structures/hll.hh"
+#include "structures/hll_kernels.hh"
+#include "structures/bits_kernels.hh"
+#include "structures/geo_kernels.hh"
 #include "partition.hh"
+#include <boost/range/irange.hpp>
 
 using logger =  seastar::logger;
 static logger db_log ("db");
@@ -75,6 +83,11 @@ database::~database()
     with_allocator(allocator(), [this] {
         db_log.info("total {} entries were released in cache", _cache.size());
         _cache.flush_all();
+        _bitmap_stages.clear();
+        _roaring_stages.clear();
+        _set_stages.clear();
+        _zset_stages.clear();
+        _zset_sorts.clear();
     });
 }
 
@@ -86,12 +99,97 @@ size_t database::sum_expiring_entries()
 void database::setup_metrics()
 {
     namespace sm = seastar::metrics;
+    _metrics.add_group("commitlog", {
+        sm::make_derive("replayed_segments", _replay_stats._segments,
+                        sm::description("Counts the commit log segments which were replayed by this shard.")),
+        sm::make_derive("replayed_records", _replay_stats._records,
+                        sm::description("Counts the commit log records which were applied to this shard.")),
+        sm::make_derive("replayed_bytes", _replay_stats._bytes,
+                        sm::description("Counts the bytes of the commit log records which were replayed by this shard.")),
+        sm::make_derive("replay_corrupted", _replay_stats._corrupted,
+                        sm::description("Counts the corrupted groups and records found by the replay.")),
+        sm::make_derive("replay_skipped", _replay_stats._skipped,
+                        sm::description("Counts the replayed records whose types are not applied to the cache.")),
+    });
+}
+
+// The integer and float encoded strings.
+static inline bool type_of_number(const cache_entry* e)
+{
+    return e->type_of_integer() || e->type_of_float();
+}
+
+// The values which are strings for the string and bitmap commands.
+static inline bool type_of_bitmap_value(const cache_entry* e)
+{
+    return e->type_of_bytes() || e->type_of_bitmap() || type_of_number(e);
+}
+
+// Returns the size of the string, or the size of the equivalent string of the roaring bitmap.
+static inline size_t bitmap_byte_size(const cache_entry* e)
+{
+    if (e->type_of_bitmap()) {
+        return e->value_bitmap().byte_size();
+    }
+    if (type_of_number(e)) {
+        return reply_builder::format_number(e).size();
+    }
+    return e->value_bytes_size();
+}
+
+// Runs func(const managed_bytes&) on the string of the value, the number is formatted
+// to a temporary string.
+template <typename Func>
+static inline auto with_bytes_value(const cache_entry* e, Func&& func) -> decltype(func(e->value_bytes()))
+{
+    if (type_of_number(e)) {
+        auto n = reply_builder::format_number(e);
+        managed_bytes v(bytes_view { n.data(), n.size() });
+        return func(v);
+    }
+    return func(e->value_bytes());
+}
+
+// The number is decoded to the bytes in place before it is changed as a string.
+static inline void decode_number(cache_entry* e)
+{
+    if (type_of_number(e)) {
+        auto n = reply_builder::format_number(e);
+        e->set_value_bytes(bytes_view { n.data(), n.size() });
+    }
+}
+
+// The canonical integer is stored as int64_t, so INCR updates it in place.
+static inline cache_entry* make_string_entry(const redis_key& rk, const bytes& val)
+{
+    int64_t number = 0;
+    if (numeric_string::to_int64(val.data(), val.size(), number)) {
+        return current_allocator().construct<cache_entry>(rk.key(), rk.hash(), number);
+    }
+    return current_allocator().construct<cache_entry>(rk.key(), rk.hash(), val);
+}
+
+// The write is logged to the commit log, and resolves once the commit log acknowledged
+// it, which depends on the sync mode of the commit log. The write waits for the flush
+// queue before it is logged, then it is logged and inserted at once, so every memtable
+// holds the records up to its replay position.
+future<> database::write_to_disk(const redis_key& rk, partition&& p)
+{
+    return _store->throttle_write().then([this, key = to_decorated_key(rk), p = std::move(p)] () mutable {
+        if (!_commit_log) {
+            _store->apply(std::move(key), std::move(p));
+            return make_ready_future<>();
+        }
+        auto logged = _commit_log->append(key, p);
+        _store->apply(std::move(key), std::move(p), _commit_log->position());
+        return logged;
+    });
 }
 
 future<scattered_message_ptr> database::set(const redis_key& rk, bytes& val, long expired, uint32_t flag)
 {
     return with_allocator(allocator(), [this, &rk, &val, expired, flag] {
-        auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), val);
+        auto entry = make_string_entry(rk, val);
         bool result = true;
         if (_cache.insert_if(entry, expired, flag & FLAG_SET_NX, flag & FLAG_SET_XX)) {
         }
@@ -101,7 +199,7 @@ future<scattered_message_ptr> database::set(const redis_key& rk, bytes& val, lon
         }
         if (result && _enable_write_disk) {
             auto partition_entry = make_sstring_partition(rk.key(), val);
-            return _store->write(_write_opt, to_decorated_key(rk), std::move(partition_entry)).then([this] {
+            return write_to_disk(rk, std::move(partition_entry)).then([this] {
                 return reply_builder::build(msg_ok);
             });
         }
@@ -116,7 +214,7 @@ future<scattered_message_ptr> database::del(const redis_key& rk)
         auto result =  _cache.erase(*e);
         if (result && _enable_write_disk) {
             auto partition_entry = make_removable_partition(rk.key());
-            return _store->write(_write_opt, to_decorated_key(rk), std::move(partition_entry)).then([this] {
+            return write_to_disk(rk, std::move(partition_entry)).then([this] {
                 return reply_builder::build(msg_one);
             });
         }
@@ -128,7 +226,7 @@ future<scattered_message_ptr> database::get(const redis_key& rk)
 {
     // all keys should be cached in the memory.
     return _cache.with_entry_run(rk, [this] (const cache_entry* e) {
-       if (e && e->type_of_bytes() == false) {
+       if (e && !type_of_bitmap_value(e)) {
            return reply_builder::build(msg_type_err);
        }
        else {
@@ -136,13 +234,1747 @@ future<scattered_message_ptr> database::get(const redis_key& rk)
        }
     });
 }
-future<> database::start()
+
+future<scattered_message_ptr> database::getset(const redis_key& rk, bytes& val)
+{
+    return with_allocator(allocator(), [this, &rk, &val] {
+        return _cache.with_entry_run(rk, [this, &rk, &val] (cache_entry* e) {
+            if (e && !type_of_bitmap_value(e)) {
+                return reply_builder::build(msg_type_err);
+            }
+            // the old value is replied before it is replaced.
+            auto reply = reply_builder::build<false, true>(e);
+            _cache.replace(make_string_entry(rk, val));
+            if (_enable_write_disk) {
+                auto partition_entry = make_sstring_partition(rk.key(), val);
+                return write_to_disk(rk, std::move(partition_entry)).then([reply = std::move(reply)] () mutable {
+                    return std::move(reply);
+                });
+            }
+            return reply;
+        });
+    });
+}
+
+// Reads the value as an integer, returns REDIS_ERR if it is not a canonical integer.
+static int integer_value(const cache_entry* e, int64_t& value)
+{
+    if (e->type_of_integer()) {
+        value = e->value_integer();
+        return REDIS_OK;
+    }
+    if (!type_of_bitmap_value(e)) {
+        return REDIS_WRONG_TYPE;
+    }
+    auto size = bitmap_byte_size(e);
+    if (size > numeric_string::INT64_MAX_CHARS) {
+        return REDIS_ERR;
+    }
+    char buf[numeric_string::INT64_MAX_CHARS];
+    reply_builder::copy_string_range(e, 0, size, buf);
+    return numeric_string::to_int64(buf, size, value) ? REDIS_OK : REDIS_ERR;
+}
+
+static int float_value(const cache_entry* e, double& value)
+{
+    if (e->type_of_float()) {
+        value = e->value_float();
+        return REDIS_OK;
+    }
+    if (e->type_of_integer()) {
+        value = static_cast<double>(e->value_integer());
+        return REDIS_OK;
+    }
+    if (!type_of_bitmap_value(e)) {
+        return REDIS_WRONG_TYPE;
+    }
+    auto size = bitmap_byte_size(e);
+    if (size >= numeric_string::DOUBLE_MAX_CHARS) {
+        return REDIS_ERR;
+    }
+    char buf[numeric_string::DOUBLE_MAX_CHARS];
+    reply_builder::copy_string_range(e, 0, size, buf);
+    return numeric_string::to_double(buf, size, value) ? REDIS_OK : REDIS_ERR;
+}
+
+// Changes the string to the number in place, the roaring bitmap is replaced and its TTL
+// is kept.
+template <typename Setter>
+static cache_entry* set_number(cache& c, const redis_key& rk, cache_entry* e, Setter&& setter)
+{
+    if (e->type_of_bitmap()) {
+        auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), int64_t(0));
+        c.replace_keeping_expiry(entry);
+        e = entry;
+    }
+    setter(e);
+    return e;
+}
+
+future<scattered_message_ptr> database::incrby(const redis_key& rk, int64_t step)
+{
+    return with_allocator(allocator(), [this, &rk, step] {
+        return _cache.with_entry_run(rk, [this, &rk, step] (cache_entry* e) {
+            if (!e) {
+                _cache.insert(current_allocator().construct<cache_entry>(rk.key(), rk.hash(), step));
+                return reply_builder::build_integer(step);
+            }
+            if (e->type_of_integer()) {
+                // the common case, updates the counter in place without any allocation.
+                int64_t result = 0;
+                if (__builtin_add_overflow(e->value_integer(), step, &result)) {
+                    return reply_builder::build(msg_incr_overflow_err);
+                }
+                e->value_integer_incr(step);
+                return reply_builder::build_integer(result);
+            }
+            int64_t value = 0;
+            auto status = integer_value(e, value);
+            if (status == REDIS_WRONG_TYPE) {
+                return reply_builder::build(msg_type_err);
+            }
+            if (status == REDIS_ERR) {
+                return reply_builder::build(msg_value_not_integer_err);
+            }
+            if (__builtin_add_overflow(value, step, &value)) {
+                return reply_builder::build(msg_incr_overflow_err);
+            }
+            // the string is encoded as the integer once.
+            set_number(_cache, rk, e, [value] (cache_entry* entry) { entry->set_value_integer(value); });
+            return reply_builder::build_integer(value);
+        });
+    });
+}
+
+future<scattered_message_ptr> database::incrbyfloat(const redis_key& rk, double step)
+{
+    return with_allocator(allocator(), [this, &rk, step] {
+        return _cache.with_entry_run(rk, [this, &rk, step] (cache_entry* e) {
+            double value = 0;
+            if (e) {
+                auto status = float_value(e, value);
+                if (status == REDIS_WRONG_TYPE) {
+                    return reply_builder::build(msg_type_err);
+                }
+                if (status == REDIS_ERR) {
+                    return reply_builder::build(msg_value_not_float_err);
+                }
+            }
+            value += step;
+            if (std::isnan(value) || std::isinf(value)) {
+                return reply_builder::build(msg_incr_nan_err);
+            }
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), value);
+                _cache.insert(e);
+            }
+            else {
+                e = set_number(_cache, rk, e, [value] (cache_entry* entry) { entry->set_value_float(value); });
+            }
+            return reply_builder::build<false, true>(e);
+        });
+    });
+}
+
+// The roaring bitmap is converted back to the plain string before it is changed as a string,
+// the TTL of the key is kept.
+static cache_entry* bitmap_to_string(cache& c, const redis_key& rk, const cache_entry* e)
+{
+    auto& bitmap = e->value_bitmap();
+    auto value = make_managed<managed_bytes>(managed_bytes::initialized_later(), bitmap.byte_size());
+    size_t offset = 0;
+    value->for_each_fragment(0, bitmap.byte_size(), [&bitmap, &offset] (char* data, size_t size) {
+        bitmap.copy_range(offset, size, reinterpret_cast<uint8_t*>(data));
+        offset += size;
+        return true;
+    });
+    auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), std::move(value));
+    c.replace_keeping_expiry(entry);
+    return entry;
+}
+
+future<scattered_message_ptr> database::append(const redis_key& rk, const bytes& val)
+{
+    return with_allocator(allocator(), [this, &rk, &val] {
+        return _cache.with_entry_run(rk, [this, &rk, &val] (cache_entry* e) {
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), val);
+                _cache.insert(e);
+                return reply_builder::build(static_cast<size_t>(val.size()));
+            }
+            if (!type_of_bitmap_value(e)) {
+                return reply_builder::build(msg_type_err);
+            }
+            if (bitmap_byte_size(e) + val.size() > STRING_MAX_SIZE) {
+                return reply_builder::build(msg_string_size_err);
+            }
+            if (e->type_of_bitmap()) {
+                e = bitmap_to_string(_cache, rk, e);
+            }
+            decode_number(e);
+            // the spare capacity of the value absorbs the appended bytes.
+            e->value_bytes().append(bytes_view { val.data(), val.size() });
+            return reply_builder::build(static_cast<size_t>(e->value_bytes_size()));
+        });
+    });
+}
+
+future<scattered_message_ptr> database::setrange(const redis_key& rk, size_t offset, const bytes& val)
+{
+    return with_allocator(allocator(), [this, &rk, offset, &val] {
+        return _cache.with_entry_run(rk, [this, &rk, offset, &val] (cache_entry* e) {
+            if (e && !type_of_bitmap_value(e)) {
+                return reply_builder::build(msg_type_err);
+            }
+            // an empty value does not create the key, nor change the existing one.
+            if (val.empty()) {
+                return reply_builder::build(e ? bitmap_byte_size(e) : size_t(0));
+            }
+            if (offset + val.size() > STRING_MAX_SIZE) {
+                return reply_builder::build(msg_string_size_err);
+            }
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), bytes {});
+                _cache.insert(e);
+            }
+            else if (e->type_of_bitmap()) {
+                e = bitmap_to_string(_cache, rk, e);
+            }
+            decode_number(e);
+            e->value_bytes().write(offset, bytes_view { val.data(), val.size() });
+            return reply_builder::build(static_cast<size_t>(e->value_bytes_size()));
+        });
+    });
+}
+
+future<scattered_message_ptr> database::getrange(const redis_key& rk, long start, long end)
+{
+    return _cache.with_entry_run(rk, [start, end] (const cache_entry* e) mutable {
+        if (e && !type_of_bitmap_value(e)) {
+            return reply_builder::build(msg_type_err);
+        }
+        long size = e ? static_cast<long>(bitmap_byte_size(e)) : 0;
+        if (start < 0) start = size + start;
+        if (end < 0) end = size + end;
+        if (start < 0) start = 0;
+        if (end < 0) end = 0;
+        if (end >= size) end = size - 1;
+        if (size == 0 || start > end) {
+            return reply_builder::build(msg_empty_bulk);
+        }
+        return reply_builder::build_range(e, static_cast<size_t>(start), static_cast<size_t>(end - start + 1));
+    });
+}
+
+future<scattered_message_ptr> database::pfadd(const redis_key& rk, std::vector<bytes>& elements)
+{
+    return with_allocator(allocator(), [this, &rk, &elements] {
+        return _cache.with_entry_run(rk, [this, &rk, &elements] (cache_entry* e) {
+            if (e && e->type_of_hll() == false) {
+                return reply_builder::build(msg_type_err);
+            }
+            bool created = false;
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::hll_initializer());
+                _cache.insert(e);
+                created = true;
+            }
+            auto result = hll::append(e->value_bytes(), elements);
+            return reply_builder::build((result || created) ? msg_one : msg_zero);
+        });
+    });
+}
+
+future<scattered_message_ptr> database::pfcount(const redis_key& rk)
+{
+    return _cache.with_entry_run(rk, [] (cache_entry* e) {
+        if (!e) {
+            return reply_builder::build(msg_zero);
+        }
+        if (e->type_of_hll() == false) {
+            return reply_builder::build(msg_type_err);
+        }
+        if (!hll::is_valid(reinterpret_cast<const uint8_t*>(e->value_bytes_data()), e->value_bytes_size())) {
+            return reply_builder::build(msg_invalid_hll_err);
+        }
+        return reply_builder::build(hll::count(e->value_bytes()));
+    });
+}
+
+future<hll_registers_ptr> database::pf_fetch_registers(std::vector<redis_key>& keys)
+{
+    auto result = make_lw_shared<hll_registers>();
+    for (auto& rk : keys) {
+        auto status = _cache.with_entry_run(rk, [&result] (const cache_entry* e) {
+            if (!e) {
+                return REDIS_OK;
+            }
+            if (e->type_of_hll() == false) {
+                return REDIS_WRONG_TYPE;
+            }
+            if (!result->_found) {
+                result->_registers = bytes(hll::REGISTERS_COUNT, 0);
+                result->_found = true;
+            }
+            auto registers = reinterpret_cast<uint8_t*>(result->_registers.data());
+            auto data = reinterpret_cast<const uint8_t*>(e->value_bytes_data());
+            return hll::merge_to_registers(data, e->value_bytes_size(), registers) ? REDIS_OK : REDIS_ERR;
+        });
+        if (status != REDIS_OK) {
+            result->_status = status;
+            break;
+        }
+    }
+    return make_ready_future<hll_registers_ptr>(make_foreign(result));
+}
+
+future<scattered_message_ptr> database::pf_store_registers(const redis_key& rk, const bytes& registers)
+{
+    return with_allocator(allocator(), [this, &rk, &registers] {
+        return _cache.with_entry_run(rk, [this, &rk, &registers] (cache_entry* e) {
+            if (e && e->type_of_hll() == false) {
+                return reply_builder::build(msg_type_err);
+            }
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::hll_initializer());
+                _cache.insert(e);
+            }
+            if (!hll::store_registers(e->value_bytes(), reinterpret_cast<const uint8_t*>(registers.data()))) {
+                return reply_builder::build(msg_invalid_hll_err);
+            }
+            return reply_builder::build(msg_ok);
+        });
+    });
+}
+
+// A point matched by GEOSEARCH, the entries don't move because the search never yields.
+struct geo_candidate {
+    double _dist;
+    const sset_entry* _entry;
+};
+
+// The sorted set is seeked to every geohash box through its index of the scores, the
+// points are filtered by batches. With COUNT (and without ANY), the nearest (or the
+// farthest) points are kept in a bounded heap, and the boxes which can't have a nearer
+// point than the heap are skipped.
+static void geo_search_points(const sset_lsa& sset, const geo_shape& shape, const std::vector<geo_search_range>& ranges,
+                              const geo_search_args& args, std::vector<geo_candidate>& candidates)
+{
+    if (ranges.empty()) {
+        return;
+    }
+    geo_filter filter(shape);
+    bool any = args._flags & GEOSEARCH_ANY;
+    bool desc = args._flags & GEORADIUS_DESC;
+    bool bounded = args._count > 0 && !any;
+    // the heap keeps the worst of the kept points at the front.
+    auto better = [desc] (const geo_candidate& l, const geo_candidate& r) {
+        return desc ? l._dist > r._dist : l._dist < r._dist;
+    };
+    double scores[geo_filter::BATCH_SIZE];
+    const sset_entry* entries[geo_filter::BATCH_SIZE];
+    uint32_t indexes[geo_filter::BATCH_SIZE];
+    double dists[geo_filter::BATCH_SIZE];
+    size_t batched = 0;
+    auto flush = [&] {
+        auto matched = filter.filter(scores, batched, indexes, dists);
+        for (size_t i = 0; i < matched; ++i) {
+            geo_candidate c { dists[i], entries[indexes[i]] };
+            if (!bounded) {
+                candidates.push_back(c);
+            }
+            else if (candidates.size() < args._count) {
+                candidates.push_back(c);
+                std::push_heap(candidates.begin(), candidates.end(), better);
+            }
+            else if (better(c, candidates.front())) {
+                std::pop_heap(candidates.begin(), candidates.end(), better);
+                candidates.back() = c;
+                std::push_heap(candidates.begin(), candidates.end(), better);
+            }
+        }
+        batched = 0;
+    };
+    auto enough = [&] {
+        return any && candidates.size() >= args._count;
+    };
+    for (const auto& range : ranges) {
+        if (bounded && !desc && candidates.size() == args._count && range._min_dist > candidates.front()._dist) {
+            continue;
+        }
+        sset.scan_by_score(range._min, [&] (const sset_entry& e) {
+            auto score = e.score();
+            if (score >= range._max) {
+                return false;
+            }
+            scores[batched] = score;
+            entries[batched] = &e;
+            if (++batched == geo_filter::BATCH_SIZE) {
+                flush();
+                return !enough();
+            }
+            return true;
+        });
+        flush();
+        if (enough()) {
+            break;
+        }
+    }
+    if (any && candidates.size() > args._count) {
+        candidates.resize(args._count);
+    }
+    // COUNT without ANY sorts the points from the nearest, as redis does.
+    if ((args._flags & (GEORADIUS_ASC | GEORADIUS_DESC)) || bounded) {
+        std::sort(candidates.begin(), candidates.end(), better);
+    }
+}
+
+future<geo_search_result_ptr> database::geosearch(const redis_key& rk, const geo_search_args& args)
+{
+    auto result = make_lw_shared<geo_search_result>();
+    _cache.with_entry_run(rk, [&result, &args] (const cache_entry* e) {
+        if (!e) {
+            result->_status = REDIS_NONE;
+            return;
+        }
+        if (e->type_of_sset() == false) {
+            result->_status = REDIS_WRONG_TYPE;
+            return;
+        }
+        auto& sset = e->value_sset();
+        auto shape = args._shape;
+        if (args._from_member) {
+            auto score = sset.score(sstring(args._member.data(), args._member.size()));
+            if (!score) {
+                result->_status = REDIS_ERR;
+                return;
+            }
+            geo::decode_from_geohash(*score, shape._longitude, shape._latitude);
+        }
+        std::vector<geo_search_range> ranges;
+        if (geo::search_ranges(shape, ranges) == false) {
+            return;
+        }
+        std::vector<geo_candidate> candidates;
+        geo_search_points(sset, shape, ranges, args, candidates);
+        result->_points.reserve(candidates.size());
+        for (auto& c : candidates) {
+            double longitude = 0, latitude = 0;
+            auto score = c._entry->score();
+            geo::decode_from_geohash(score, longitude, latitude);
+            result->_points.emplace_back(sstring(c._entry->key_data(), c._entry->key_size()), score, c._dist, longitude, latitude);
+        }
+    });
+    return make_ready_future<geo_search_result_ptr>(make_foreign(result));
+}
+
+future<scattered_message_ptr> database::geo_store(const redis_key& rk, const geo_search_result& result, int flags)
+{
+    return with_allocator(allocator(), [this, &rk, &result, flags] {
+        auto& points = result._points;
+        if (points.empty()) {
+            _cache.erase(rk);
+            return reply_builder::build(msg_zero);
+        }
+        auto score_of = [flags] (const std::tuple<sstring, double, double, double, double>& p) {
+            if (flags & GEORADIUS_STORE_DIST) {
+                double dist = std::get<2>(p);
+                geo::from_meters(dist, flags);
+                return dist;
+            }
+            return std::get<1>(p);
+        };
+        // the members are inserted from the highest score, so every one is inserted at
+        // the front of the ordered list.
+        std::vector<const std::tuple<sstring, double, double, double, double>*> ordered;
+        ordered.reserve(points.size());
+        for (auto& p : points) {
+            ordered.push_back(&p);
+        }
+        std::sort(ordered.begin(), ordered.end(), [&score_of] (auto l, auto r) {
+            return score_of(*l) > score_of(*r);
+        });
+        auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::sset_initializer());
+        auto& sset = entry->value_sset();
+        for (auto p : ordered) {
+            sset.insert(current_allocator().construct<sset_entry>(std::get<0>(*p), score_of(*p)));
+        }
+        _cache.replace(entry);
+        return reply_builder::build(points.size());
+    });
+}
+
+// Runs func(entry, offset, length) on the chunks of the bitmap in [offset, end), func returns
+// false to stop. The entry is looked up again for every chunk, because it may be changed,
+// removed or moved by the LSA while the command yields between the chunks.
+template <typename Func>
+static future<> for_each_bitmap_chunk(cache& c, const redis_key& rk, size_t offset, size_t end, Func&& func)
+{
+    auto position = make_lw_shared<size_t>(offset);
+    return repeat([&c, &rk, end, position, func = std::forward<Func>(func)] () mutable {
+        auto done = c.with_entry_run(rk, [end, position, &func] (const cache_entry* e) {
+            if (!e || !type_of_bitmap_value(e) || bitmap_byte_size(e) <= *position) {
+                return true;
+            }
+            auto chunk_end = std::min({ end, *position + BITMAP_CHUNK_BYTES, bitmap_byte_size(e) });
+            auto next = func(e, *position, chunk_end - *position);
+            *position = chunk_end;
+            return !next || *position >= end;
+        });
+        return make_ready_future<stop_iteration>(done ? stop_iteration::yes : stop_iteration::no);
+    });
+}
+
+future<scattered_message_ptr> database::sadd(const redis_key& rk, std::vector<bytes>& members)
+{
+    return with_allocator(allocator(), [this, &rk, &members] {
+        return _cache.with_entry_run(rk, [this, &rk, &members] (cache_entry* e) {
+            if (e && !e->type_of_set()) {
+                return reply_builder::build(msg_type_err);
+            }
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::set_initializer());
+                _cache.insert(e);
+            }
+            auto& set = e->value_set();
+            size_t added = 0;
+            for (auto& m : members) {
+                sstring member(m.data(), m.size());
+                if (!set.exists(member)) {
+                    set.insert(current_allocator().construct<dict_entry>(member));
+                    ++added;
+                }
+            }
+            return reply_builder::build(added);
+        });
+    });
+}
+
+future<scattered_message_ptr> database::srem(const redis_key& rk, std::vector<bytes>& members)
+{
+    return with_allocator(allocator(), [this, &rk, &members] {
+        return _cache.with_entry_run(rk, [this, &members] (cache_entry* e) {
+            if (!e) {
+                return reply_builder::build(msg_zero);
+            }
+            if (!e->type_of_set()) {
+                return reply_builder::build(msg_type_err);
+            }
+            auto& set = e->value_set();
+            size_t removed = 0;
+            for (auto& m : members) {
+                if (set.erase(sstring(m.data(), m.size()))) {
+                    ++removed;
+                }
+            }
+            if (set.empty()) {
+                _cache.erase(*e);
+            }
+            return reply_builder::build(removed);
+        });
+    });
+}
+
+future<scattered_message_ptr> database::scard(const redis_key& rk)
+{
+    return _cache.with_entry_run(rk, [] (const cache_entry* e) {
+        if (!e) {
+            return reply_builder::build(msg_zero);
+        }
+        if (!e->type_of_set()) {
+            return reply_builder::build(msg_type_err);
+        }
+        return reply_builder::build(e->value_set().size());
+    });
+}
+
+future<scattered_message_ptr> database::sismember(const redis_key& rk, const bytes& member)
+{
+    return _cache.with_entry_run(rk, [&member] (const cache_entry* e) {
+        if (!e) {
+            return reply_builder::build(msg_zero);
+        }
+        if (!e->type_of_set()) {
+            return reply_builder::build(msg_type_err);
+        }
+        return reply_builder::build(e->value_set().exists(sstring(member.data(), member.size())) ? msg_one : msg_zero);
+    });
+}
+
+// Selects the count random members in O(count) without walking the set. A negative count
+// allows the repeated members, otherwise the members are distinct (Floyd's sampling).
+static void sample_members(const dict_lsa& set, long count, std::vector<const dict_entry*>& entries)
+{
+    size_t size = set.size();
+    if (count < 0) {
+        size_t n = static_cast<size_t>(-count);
+        entries.reserve(n);
+        for (size_t i = 0; i < n; ++i) {
+            entries.push_back(set.slot_at(rand_generater::rand_less_than(size)));
+        }
+        return;
+    }
+    size_t n = std::min(static_cast<size_t>(count), size);
+    entries.reserve(n);
+    if (n == size) {
+        for (size_t i = 0; i < size; ++i) {
+            entries.push_back(set.slot_at(i));
+        }
+        return;
+    }
+    std::unordered_set<size_t> picked;
+    picked.reserve(n);
+    for (size_t j = size - n; j < size; ++j) {
+        auto t = rand_generater::rand_less_than(j + 1);
+        if (!picked.insert(t).second) {
+            picked.insert(j);
+            t = j;
+        }
+        entries.push_back(set.slot_at(t));
+    }
+}
+
+future<scattered_message_ptr> database::srandmember(const redis_key& rk, long count, bool count_given)
+{
+    return _cache.with_entry_run(rk, [count, count_given] (const cache_entry* e) {
+        if (!e) {
+            return reply_builder::build(count_given ? msg_empty_multi_bulk : msg_nil);
+        }
+        if (!e->type_of_set()) {
+            return reply_builder::build(msg_type_err);
+        }
+        auto& set = e->value_set();
+        if (!count_given) {
+            return reply_builder::build_member(set.slot_at(rand_generater::rand_less_than(set.size())));
+        }
+        std::vector<const dict_entry*> entries;
+        sample_members(set, count, entries);
+        return reply_builder::build_members(entries);
+    });
+}
+
+future<scattered_message_ptr> database::spop(const redis_key& rk, size_t count, bool count_given)
+{
+    return with_allocator(allocator(), [this, count, count_given, &rk] {
+        return _cache.with_entry_run(rk, [this, count, count_given] (cache_entry* e) {
+            if (!e) {
+                return reply_builder::build(count_given ? msg_empty_multi_bulk : msg_nil);
+            }
+            if (!e->type_of_set()) {
+                return reply_builder::build(msg_type_err);
+            }
+            auto& set = e->value_set();
+            std::vector<const dict_entry*> entries;
+            if (!count_given) {
+                entries.push_back(set.slot_at(rand_generater::rand_less_than(set.size())));
+            }
+            else {
+                sample_members(set, static_cast<long>(std::min(count, set.size())), entries);
+            }
+            // the reply copies the members, so they are removed after it is built.
+            auto reply = count_given ? reply_builder::build_members(entries) : reply_builder::build_member(entries.front());
+            if (entries.size() == set.size()) {
+                _cache.erase(*e);
+            }
+            else {
+                for (auto entry : entries) {
+                    set.erase(entry);
+                }
+            }
+            return reply;
+        });
+    });
+}
+
+static sstring copy_key(const managed_bytes& key)
+{
+    sstring data(sstring::initialized_later(), key.size());
+    key.copy_to(0, key.size(), data.begin());
+    return data;
+}
+
+static sstring dict_value_string(const dict_entry& e)
+{
+    if (e.type_of_integer()) {
+        char buf[numeric_string::INT64_MAX_CHARS];
+        return sstring(buf, numeric_string::from_int64(buf, e.value_integer()));
+    }
+    if (e.type_of_float()) {
+        char buf[numeric_string::DOUBLE_MAX_CHARS];
+        return sstring(buf, numeric_string::from_double(buf, e.value_float()));
+    }
+    return copy_key(e.value());
+}
+
+// Runs the scan of the collection, func appends the items of a matched entry.
+template <typename Collection, typename Func>
+static future<scattered_message_ptr> scan_collection(const Collection& c, const scan_options& opts, Func&& func)
+{
+    std::vector<sstring> items;
+    auto cursor = c.scan(opts.cursor, opts.count, [&opts, &items, &func] (const auto& e) {
+        auto key = copy_key(e.key());
+        if (opts.match(key.data(), key.size())) {
+            func(e, std::move(key), items);
+        }
+    });
+    return reply_builder::build_scan(cursor, items);
+}
+
+future<scattered_message_ptr> database::sscan(const redis_key& rk, const scan_options& opts)
+{
+    return _cache.with_entry_run(rk, [&opts] (const cache_entry* e) {
+        std::vector<sstring> items;
+        if (!e) {
+            return reply_builder::build_scan(0, items);
+        }
+        if (!e->type_of_set()) {
+            return reply_builder::build(msg_type_err);
+        }
+        return scan_collection(e->value_set(), opts, [] (const dict_entry&, sstring&& key, std::vector<sstring>& items) {
+            items.emplace_back(std::move(key));
+        });
+    });
+}
+
+future<scattered_message_ptr> database::hscan(const redis_key& rk, const scan_options& opts)
+{
+    return _cache.with_entry_run(rk, [&opts] (const cache_entry* e) {
+        std::vector<sstring> items;
+        if (!e) {
+            return reply_builder::build_scan(0, items);
+        }
+        if (!e->type_of_map()) {
+            return reply_builder::build(msg_type_err);
+        }
+        return scan_collection(e->value_map(), opts, [] (const dict_entry& field, sstring&& key, std::vector<sstring>& items) {
+            items.emplace_back(std::move(key));
+            items.emplace_back(dict_value_string(field));
+        });
+    });
+}
+
+future<scattered_message_ptr> database::zscan(const redis_key& rk, const scan_options& opts)
+{
+    return _cache.with_entry_run(rk, [&opts] (const cache_entry* e) {
+        std::vector<sstring> items;
+        if (!e) {
+            return reply_builder::build_scan(0, items);
+        }
+        if (!e->type_of_sset()) {
+            return reply_builder::build(msg_type_err);
+        }
+        char buf[numeric_string::DOUBLE_MAX_CHARS];
+        return scan_collection(e->value_sset(), opts, [&buf] (const sset_entry& member, sstring&& key, std::vector<sstring>& items) {
+            items.emplace_back(std::move(key));
+            items.emplace_back(sstring(buf, numeric_string::from_double(buf, member.score())));
+        });
+    });
+}
+
+// Clamps the inclusive range [start, end] of a collection as LRANGE does, returns the
+// number of the items in it.
+static size_t clamp_range(long size, range_stream& s)
+{
+    auto start = s._start, end = s._end;
+    if (start < 0) {
+        start += size;
+    }
+    if (end < 0) {
+        end += size;
+    }
+    if (start < 0) {
+        start = 0;
+    }
+    if (start > end || start >= size) {
+        return 0;
+    }
+    if (end >= size) {
+        end = size - 1;
+    }
+    s._cursor = static_cast<size_t>(start);
+    return static_cast<size_t>(end - start + 1);
+}
+
+// Appends a chunk of the stream. begin returns the length of the array, or sets the error;
+// fill appends the items of the chunk, and returns false if the collection is exhausted.
+template <typename Begin, typename Fill>
+static future<scattered_message_ptr> stream_chunk(const cache_entry* e, range_stream& s, Begin&& begin, Fill&& fill)
+{
+    auto m = make_lw_shared<scattered_message<char>>();
+    if (!s._started) {
+        s._started = true;
+        const bytes* err = nullptr;
+        s._remaining = e ? begin(e, err) : 0;
+        if (err) {
+            m->append_static(*err);
+            s._done = true;
+            return make_ready_future<scattered_message_ptr>(foreign_ptr<lw_shared_ptr<scattered_message<char>>>(m));
+        }
+        reply_builder::append_array_header(*m, s._remaining);
+    }
+    if (s._remaining > 0 && !s._exhausted && !fill(e, *m)) {
+        s._exhausted = true;
+    }
+    if (s._exhausted) {
+        auto n = std::min(s._remaining, RANGE_STREAM_CHUNK_ITEMS);
+        for (size_t i = 0; i < n; ++i) {
+            m->append_static(msg_null_blik);
+        }
+        s._remaining -= n;
+    }
+    s._done = s._remaining == 0;
+    return make_ready_future<scattered_message_ptr>(foreign_ptr<lw_shared_ptr<scattered_message<char>>>(m));
+}
+
+static void stream_item(range_stream& s, scattered_message<char>& m, sstring&& item)
+{
+    reply_builder::append_bulk(m, std::move(item));
+    --s._remaining;
+}
+
+// The entries of a dict are streamed by the hash cursor (see structures/scan.hh), the
+// members which are beyond the length of the array are dropped.
+static bool fill_dict(const dict_lsa& d, range_stream& s, scattered_message<char>& m, bool values)
+{
+    const size_t per_entry = values ? 2 : 1;
+    s._cursor = d.scan(s._cursor, RANGE_STREAM_CHUNK_ITEMS / per_entry, [&s, &m, values, per_entry] (const dict_entry& e) {
+        if (s._remaining < per_entry) {
+            return;
+        }
+        stream_item(s, m, copy_key(e.key()));
+        if (values) {
+            stream_item(s, m, dict_value_string(e));
+        }
+    });
+    return s._cursor != 0;
+}
+
+future<scattered_message_ptr> database::smembers_chunk(const redis_key& rk, range_stream& s)
+{
+    return _cache.with_entry_run(rk, [&s] (const cache_entry* e) {
+        return stream_chunk(e, s, [] (const cache_entry* e, const bytes*& err) -> size_t {
+            if (!e->type_of_set()) {
+                err = &msg_type_err;
+                return 0;
+            }
+            return e->value_set().size();
+        }, [&s] (const cache_entry* e, scattered_message<char>& m) {
+            return e && e->type_of_set() && fill_dict(e->value_set(), s, m, false);
+        });
+    });
+}
+
+future<scattered_message_ptr> database::hgetall_chunk(const redis_key& rk, range_stream& s)
+{
+    return _cache.with_entry_run(rk, [&s] (const cache_entry* e) {
+        return stream_chunk(e, s, [] (const cache_entry* e, const bytes*& err) -> size_t {
+            if (!e->type_of_map()) {
+                err = &msg_type_err;
+                return 0;
+            }
+            return e->value_map().size() * 2;
+        }, [&s] (const cache_entry* e, scattered_message<char>& m) {
+            return e && e->type_of_map() && fill_dict(e->value_map(), s, m, true);
+        });
+    });
+}
+
+future<scattered_message_ptr> database::lrange_chunk(const redis_key& rk, range_stream& s)
+{
+    return _cache.with_entry_run(rk, [&s] (const cache_entry* e) {
+        return stream_chunk(e, s, [&s] (const cache_entry* e, const bytes*& err) -> size_t {
+            if (!e->type_of_list()) {
+                err = &msg_type_err;
+                return 0;
+            }
+            return clamp_range(static_cast<long>(e->value_list().size()), s);
+        }, [&s] (const cache_entry* e, scattered_message<char>& m) {
+            if (!e || !e->type_of_list() || s._cursor >= e->value_list().size()) {
+                return false;
+            }
+            auto& list = e->value_list();
+            auto n = std::min(std::min(s._remaining, RANGE_STREAM_CHUNK_ITEMS), list.size() - s._cursor);
+            list.reduce(s._cursor, s._cursor + n, [&s, &m] (bytes_view v) {
+                stream_item(s, m, sstring(v.data(), v.size()));
+            });
+            s._cursor += n;
+            return true;
+        });
+    });
+}
+
+future<scattered_message_ptr> database::zrange_chunk(const redis_key& rk, range_stream& s)
+{
+    return _cache.with_entry_run(rk, [&s] (const cache_entry* e) {
+        return stream_chunk(e, s, [&s] (const cache_entry* e, const bytes*& err) -> size_t {
+            if (!e->type_of_sset()) {
+                err = &msg_type_err;
+                return 0;
+            }
+            return clamp_range(static_cast<long>(e->value_sset().size()), s) * (s._with_scores ? 2 : 1);
+        }, [&s] (const cache_entry* e, scattered_message<char>& m) {
+            if (!e || !e->type_of_sset()) {
+                return false;
+            }
+            char buf[numeric_string::DOUBLE_MAX_CHARS];
+            size_t items = 0;
+            bool stopped = false;
+            auto visit = [&s, &m, &buf, &items, &stopped] (const sset_entry& member) {
+                if (s._remaining == 0) {
+                    stopped = true;
+                    return false;
+                }
+                auto key = copy_key(member.key());
+                if (items >= RANGE_STREAM_CHUNK_ITEMS) {
+                    // the position of the next chunk.
+                    s._has_member = true;
+                    s._member = std::move(key);
+                    s._score = member.score();
+                    stopped = true;
+                    return false;
+                }
+                stream_item(s, m, std::move(key));
+                if (s._with_scores) {
+                    stream_item(s, m, sstring(buf, numeric_string::from_double(buf, member.score())));
+                }
+                ++items;
+                return true;
+            };
+            auto& sset = e->value_sset();
+            if (!s._has_member) {
+                sset.scan_by_rank(s._cursor, visit);
+            }
+            else {
+                sset.scan_from_member(s._member, s._score, visit);
+            }
+            return stopped;
+        });
+    });
+}
+
+future<scattered_message_ptr> database::push(const redis_key& rk, std::vector<bytes>& values, bool head)
+{
+    return with_allocator(allocator(), [this, &rk, &values, head] {
+        return _cache.with_entry_run(rk, [this, &rk, &values, head] (cache_entry* e) {
+            if (e && !e->type_of_list()) {
+                return reply_builder::build(msg_type_err);
+            }
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::list_initializer());
+                _cache.insert(e);
+            }
+            auto& list = e->value_list();
+            for (auto& v : values) {
+                if (head) {
+                    list.insert_head(bytes_view {v.data(), v.size()});
+                }
+                else {
+                    list.insert_tail(bytes_view {v.data(), v.size()});
+                }
+            }
+            return reply_builder::build(list.size());
+        });
+    });
+}
+
+future<scattered_message_ptr> database::pop(const redis_key& rk, bool head)
+{
+    return pop_value(rk, head ? pop_side::HEAD : pop_side::TAIL).then([] (auto&& p) {
+        if (p->_status == REDIS_NONE) {
+            return reply_builder::build(msg_null_blik);
+        }
+        if (p->_status != REDIS_OK) {
+            return reply_builder::build(msg_type_err);
+        }
+        auto m = make_lw_shared<scattered_message<char>>();
+        reply_builder::append_bulk(*m, sstring(p->_value.data(), p->_value.size()));
+        return make_ready_future<scattered_message_ptr>(foreign_ptr<lw_shared_ptr<scattered_message<char>>>(m));
+    });
+}
+
+future<scattered_message_ptr> database::zadd(const redis_key& rk, std::unordered_map<sstring, double>& members)
+{
+    return with_allocator(allocator(), [this, &rk, &members] {
+        return _cache.with_entry_run(rk, [this, &rk, &members] (cache_entry* e) {
+            if (e && !e->type_of_sset()) {
+                return reply_builder::build(msg_type_err);
+            }
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::sset_initializer());
+                _cache.insert(e);
+            }
+            auto& sset = e->value_sset();
+            size_t added = 0;
+            for (auto& member : members) {
+                if (!sset.update_score(member.first, member.second)) {
+                    sset.insert(current_allocator().construct<sset_entry>(member.first, member.second));
+                    ++added;
+                }
+            }
+            return reply_builder::build(added);
+        });
+    });
+}
+
+future<popped_value_ptr> database::pop_value(const redis_key& rk, pop_side side)
 {
+    return with_allocator(allocator(), [this, &rk, side] {
+        return _cache.with_entry_run(rk, [this, side] (cache_entry* e) {
+            auto p = make_lw_shared<popped_value>();
+            if (!e) {
+                p->_status = REDIS_NONE;
+            }
+            else if (side == pop_side::MIN ? !e->type_of_sset() : !e->type_of_list()) {
+                p->_status = REDIS_ERR;
+            }
+            else if (side == pop_side::MIN) {
+                auto& sset = e->value_sset();
+                std::vector<const sset_entry*> entries;
+                sset.fetch_by_rank(0, 0, entries);
+                const auto& first = *entries.front();
+                p->_value = bytes(first.key_data(), first.key_size());
+                p->_score = first.score();
+                sset.erase(entries);
+                if (sset.empty()) {
+                    _cache.erase(*e);
+                }
+            }
+            else {
+                auto& list = e->value_list();
+                if (side == pop_side::HEAD) {
+                    p->_value = list.front();
+                    list.pop_front();
+                }
+                else {
+                    p->_value = list.back();
+                    list.pop_back();
+                }
+                if (list.empty()) {
+                    _cache.erase(*e);
+                }
+            }
+            return make_ready_future<popped_value_ptr>(foreign_ptr<lw_shared_ptr<popped_value>>(p));
+        });
+    });
+}
+
+future<int> database::push_value(const redis_key& rk, pop_side side, const bytes& value, double score)
+{
+    return with_allocator(allocator(), [this, &rk, side, &value, score] {
+        return _cache.with_entry_run(rk, [this, &rk, side, &value, score] (cache_entry* e) {
+            if (side == pop_side::MIN) {
+                if (e && !e->type_of_sset()) {
+                    return make_ready_future<int>(REDIS_ERR);
+                }
+                if (!e) {
+                    e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::sset_initializer());
+                    _cache.insert(e);
+                }
+                // a member which was added again meanwhile keeps its new score.
+                std::unordered_map<sstring, double> members { { sstring(value.data(), value.size()), score } };
+                e->value_sset().insert_if_not_exists(members);
+                return make_ready_future<int>(REDIS_OK);
+            }
+            if (e && !e->type_of_list()) {
+                return make_ready_future<int>(REDIS_ERR);
+            }
+            if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::list_initializer());
+                _cache.insert(e);
+            }
+            if (side == pop_side::HEAD) {
+                e->value_list().insert_head(bytes_view {value.data(), value.size()});
+            }
+            else {
+                e->value_list().insert_tail(bytes_view {value.data(), value.size()});
+            }
+            return make_ready_future<int>(REDIS_OK);
+        });
+    });
+}
+
+future<scattered_message_ptr> database::setbit(const redis_key& rk, size_t offset, bool value)
+{
+    return with_allocator(allocator(), [this, &rk, offset, value] {
+        return _cache.with_entry_run(rk, [this, &rk, offset, value] (cache_entry* e) {
+            if (e && type_of_number(e)) {
+                decode_number(e);
+            }
+            if (e && e->type_of_bytes()) {
+                if (offset / 8 < e->value_bytes_size()) {
+                    auto old = bits_operation::set(e->value_bytes(), offset, value);
+                    return reply_builder::build(old ? msg_one : msg_zero);
+                }
+                // the string would grow, it is converted to the roaring bitmap instead.
+                auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::bitmap_initializer());
+                entry->value_bitmap().assign(e->value_bytes());
+                _cache.replace_keeping_expiry(entry);
+                e = entry;
+            }
+            else if (e && e->type_of_bitmap() == false) {
+                return reply_builder::build(msg_type_err);
+            }
+            else if (!e) {
+                e = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::bitmap_initializer());
+                _cache.insert(e);
+            }
+            auto old = e->value_bitmap().set(offset, value);
+            return reply_builder::build(old ? msg_one : msg_zero);
+        });
+    });
+}
+
+future<scattered_message_ptr> database::getbit(const redis_key& rk, size_t offset)
+{
+    return _cache.with_entry_run(rk, [offset] (const cache_entry* e) {
+        if (!e) {
+            return reply_builder::build(msg_zero);
+        }
+        if (e->type_of_bitmap()) {
+            return reply_builder::build(e->value_bitmap().get(offset) ? msg_one : msg_zero);
+        }
+        if (type_of_bitmap_value(e)) {
+            auto bit = with_bytes_value(e, [offset] (const managed_bytes& v) { return bits_operation::get(v, offset); });
+            return reply_builder::build(bit ? msg_one : msg_zero);
+        }
+        return reply_builder::build(msg_type_err);
+    });
+}
+
+future<scattered_message_ptr> database::bitcount(const redis_key& rk, long start, long end)
+{
+    size_t cardinality = 0;
+    bool whole = false;
+    auto status = _cache.with_entry_run(rk, [&start, &end, &cardinality, &whole] (const cache_entry* e) {
+        if (!e) {
+            return REDIS_NONE;
+        }
+        if (type_of_bitmap_value(e) == false) {
+            return REDIS_WRONG_TYPE;
+        }
+        auto size = bitmap_byte_size(e);
+        if (!bits_operation::normalize_range(start, end, size)) {
+            return REDIS_NONE;
+        }
+        if (e->type_of_bitmap() && start == 0 && static_cast<size_t>(end) + 1 == size) {
+            // the roaring bitmap keeps the count of the whole bitmap.
+            cardinality = e->value_bitmap().cardinality();
+            whole = true;
+        }
+        return REDIS_OK;
+    });
+    if (status == REDIS_WRONG_TYPE) {
+        return reply_builder::build(msg_type_err);
+    }
+    if (status == REDIS_NONE) {
+        return reply_builder::build(msg_zero);
+    }
+    if (whole) {
+        return reply_builder::build(cardinality);
+    }
+    auto count = make_lw_shared<size_t>(0);
+    return for_each_bitmap_chunk(_cache, rk, start, end + 1, [count] (const cache_entry* e, size_t offset, size_t length) {
+        if (e->type_of_bitmap()) {
+            *count += e->value_bitmap().count(offset, length);
+        }
+        else {
+            *count += with_bytes_value(e, [offset, length] (const managed_bytes& v) {
+                return bits_operation::count_range(v, offset, length);
+            });
+        }
+        return true;
+    }).then([count] {
+        return reply_builder::build(*count);
+    });
+}
+
+future<scattered_message_ptr> database::bitpos(const redis_key& rk, bool bit, long start, long end, bool end_given)
+{
+    size_t size = 0;
+    auto status = _cache.with_entry_run(rk, [&size] (const cache_entry* e) {
+        if (!e) {
+            return REDIS_NONE;
+        }
+        if (type_of_bitmap_value(e) == false) {
+            return REDIS_WRONG_TYPE;
+        }
+        size = bitmap_byte_size(e);
+        return REDIS_OK;
+    });
+    if (status == REDIS_WRONG_TYPE) {
+        return reply_builder::build(msg_type_err);
+    }
+    if (status == REDIS_NONE) {
+        return reply_builder::build(bit ? msg_neg_one : msg_zero);
+    }
+    if (!end_given) {
+        end = static_cast<long>(size) - 1;
+    }
+    if (!bits_operation::normalize_range(start, end, size)) {
+        return reply_builder::build(msg_neg_one);
+    }
+    auto result = make_lw_shared<long>(-1);
+    return for_each_bitmap_chunk(_cache, rk, start, end + 1, [result, bit] (const cache_entry* e, size_t offset, size_t length) {
+        if (e->type_of_bitmap()) {
+            *result = e->value_bitmap().position(bit, offset, length);
+            return *result < 0;
+        }
+        return with_bytes_value(e, [result, bit, offset, length] (const managed_bytes& v) {
+            auto index = bits_operation::find_byte(v, bit, offset, length);
+            if (index < 0) {
+                return true;
+            }
+            *result = index * 8 + bits_operation::first_bit_in_byte(uint8_t(v[index]), bit);
+            return false;
+        });
+    }).then([result, bit, end, end_given] {
+        if (*result >= 0) {
+            return reply_builder::build(static_cast<size_t>(*result));
+        }
+        // looking for the clear bit, the string is considered to be padded with zeros
+        // on the right if the end was not given.
+        if (!bit && !end_given) {
+            return reply_builder::build(static_cast<size_t>(end + 1) * 8);
+        }
+        return reply_builder::build(msg_neg_one);
+    });
+}
+
+future<bitmap_meta> database::bitmap_describe(const redis_key& rk)
+{
+    return _cache.with_entry_run(rk, [] (const cache_entry* e) {
+        bitmap_meta meta;
+        if (!e) {
+            meta._status = REDIS_NONE;
+        }
+        else if (type_of_bitmap_value(e) == false) {
+            meta._status = REDIS_WRONG_TYPE;
+        }
+        else {
+            meta._size = bitmap_byte_size(e);
+            meta._roaring = e->type_of_bitmap();
+        }
+        return make_ready_future<bitmap_meta>(meta);
+    });
+}
+
+future<foreign_ptr<lw_shared_ptr<bytes>>> database::bitmap_fetch(const redis_key& rk, size_t offset, size_t length)
+{
+    auto result = make_lw_shared<bytes>();
+    _cache.with_entry_run(rk, [&result, offset, length] (const cache_entry* e) {
+        if (e && type_of_bitmap_value(e) && bitmap_byte_size(e) > offset) {
+            auto n = std::min(length, bitmap_byte_size(e) - offset);
+            *result = bytes(bytes::initialized_later(), n);
+            auto out = reinterpret_cast<uint8_t*>(result->begin());
+            reply_builder::copy_string_range(e, offset, n, reinterpret_cast<char*>(out));
+        }
+    });
+    return make_ready_future<foreign_ptr<lw_shared_ptr<bytes>>>(make_foreign(result));
+}
+
+future<roaring_chunk_ptr> database::roaring_fetch(const redis_key& rk, uint32_t first_key, uint32_t last_key)
+{
+    auto result = make_lw_shared<roaring_chunk>();
+    _cache.with_entry_run(rk, [&result, first_key, last_key] (const cache_entry* e) {
+        if (e && e->type_of_bitmap()) {
+            result->_next = e->value_bitmap().serialize(first_key, last_key, result->_data);
+        }
+    });
+    return make_ready_future<roaring_chunk_ptr>(make_foreign(result));
+}
+
+future<uint64_t> database::bitmap_stage_begin(size_t size)
+{
+    return with_allocator(allocator(), [this, size] {
+        auto stage = _next_bitmap_stage++;
+        _bitmap_stages.emplace(stage, make_managed<managed_bytes>(managed_bytes::initialized_later(), size));
+        return make_ready_future<uint64_t>(stage);
+    });
+}
+
+future<> database::bitmap_stage_write(uint64_t stage, size_t offset, const bytes& data)
+{
+    auto it = _bitmap_stages.find(stage);
+    if (it != _bitmap_stages.end()) {
+        bits_operation::write_range(*(it->second), offset, reinterpret_cast<const uint8_t*>(data.begin()), data.size());
+    }
     return make_ready_future<>();
 }
 
+future<> database::bitmap_stage_commit(const redis_key& rk, uint64_t stage)
+{
+    return with_allocator(allocator(), [this, &rk, stage] {
+        auto it = _bitmap_stages.find(stage);
+        if (it != _bitmap_stages.end()) {
+            auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), std::move(it->second));
+            _bitmap_stages.erase(it);
+            _cache.replace(entry);
+        }
+        return make_ready_future<>();
+    });
+}
+
+future<> database::bitmap_stage_abort(uint64_t stage)
+{
+    return with_allocator(allocator(), [this, stage] {
+        _bitmap_stages.erase(stage);
+        _roaring_stages.erase(stage);
+        return make_ready_future<>();
+    });
+}
+
+future<uint64_t> database::roaring_stage_begin()
+{
+    return with_allocator(allocator(), [this] {
+        auto stage = _next_bitmap_stage++;
+        _roaring_stages.emplace(stage, make_managed<roaring_lsa>());
+        return make_ready_future<uint64_t>(stage);
+    });
+}
+
+future<> database::roaring_stage_append(uint64_t stage, const std::vector<uint8_t>& data)
+{
+    return with_allocator(allocator(), [this, stage, &data] {
+        auto it = _roaring_stages.find(stage);
+        if (it != _roaring_stages.end()) {
+            it->second->append_serialized(data.data(), data.size());
+        }
+        return make_ready_future<>();
+    });
+}
+
+future<> database::roaring_stage_commit(const redis_key& rk, uint64_t stage, size_t byte_size)
+{
+    return with_allocator(allocator(), [this, &rk, stage, byte_size] {
+        auto it = _roaring_stages.find(stage);
+        if (it != _roaring_stages.end()) {
+            it->second->set_byte_size(byte_size);
+            auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), std::move(it->second));
+            _roaring_stages.erase(it);
+            _cache.replace(entry);
+        }
+        return make_ready_future<>();
+    });
+}
+
+future<set_meta> database::set_describe(const redis_key& rk)
+{
+    set_meta meta;
+    _cache.with_entry_run(rk, [&meta] (const cache_entry* e) {
+        if (!e) {
+            meta._status = REDIS_NONE;
+        }
+        else if (!e->type_of_set()) {
+            meta._status = REDIS_WRONG_TYPE;
+        }
+        else {
+            meta._size = e->value_set().size();
+        }
+    });
+    return make_ready_future<set_meta>(meta);
+}
+
+future<set_chunk_ptr> database::set_fetch(const redis_key& rk, size_t cursor, size_t count)
+{
+    auto chunk = make_lw_shared<set_chunk>();
+    _cache.with_entry_run(rk, [&chunk, cursor, count] (const cache_entry* e) {
+        if (e && e->type_of_set()) {
+            chunk->_members.reserve(count);
+            chunk->_next = e->value_set().scan(cursor, count, [&chunk] (const dict_entry& member) {
+                chunk->_members.emplace_back(copy_key(member.key()));
+            });
+        }
+    });
+    return make_ready_future<set_chunk_ptr>(make_foreign(chunk));
+}
+
+future<set_probe_ptr> database::set_probe(const redis_key& rk, const std::vector<sstring>& members)
+{
+    auto result = make_lw_shared<std::vector<uint8_t>>(members.size(), 0);
+    _cache.with_entry_run(rk, [&result, &members] (const cache_entry* e) {
+        if (e && e->type_of_set()) {
+            auto& set = e->value_set();
+            for (size_t i = 0; i < members.size(); ++i) {
+                (*result)[i] = set.exists(members[i]) ? 1 : 0;
+            }
+        }
+    });
+    return make_ready_future<set_probe_ptr>(make_foreign(result));
+}
+
+future<uint64_t> database::set_stage_begin()
+{
+    return with_allocator(allocator(), [this] {
+        auto stage = _next_set_stage++;
+        _set_stages.emplace(stage, make_managed<dict_lsa>());
+        return make_ready_future<uint64_t>(stage);
+    });
+}
+
+future<> database::set_stage_append(uint64_t stage, const std::vector<sstring>& members)
+{
+    return with_allocator(allocator(), [this, stage, &members] {
+        auto it = _set_stages.find(stage);
+        if (it != _set_stages.end()) {
+            auto& set = *(it->second);
+            for (auto& member : members) {
+                if (!set.exists(member)) {
+                    set.insert(current_allocator().construct<dict_entry>(member));
+                }
+            }
+        }
+        return make_ready_future<>();
+    });
+}
+
+future<size_t> database::set_stage_commit(const redis_key& rk, uint64_t stage)
+{
+    return with_allocator(allocator(), [this, &rk, stage] {
+        size_t size = 0;
+        auto it = _set_stages.find(stage);
+        if (it != _set_stages.end()) {
+            size = it->second->size();
+            if (size == 0) {
+                _cache.erase(rk);
+            }
+            else {
+                auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::set_initializer(), std::move(it->second));
+                _cache.replace(entry);
+            }
+            _set_stages.erase(it);
+        }
+        return make_ready_future<size_t>(size);
+    });
+}
+
+future<> database::set_stage_abort(uint64_t stage)
+{
+    return with_allocator(allocator(), [this, stage] {
+        _set_stages.erase(stage);
+        return make_ready_future<>();
+    });
+}
+
+future<set_meta> database::zset_describe(const redis_key& rk)
+{
+    set_meta meta;
+    _cache.with_entry_run(rk, [&meta] (const cache_entry* e) {
+        if (!e) {
+            meta._status = REDIS_NONE;
+        }
+        else if (e->type_of_sset()) {
+            meta._size = e->value_sset().size();
+        }
+        else if (e->type_of_set()) {
+            meta._size = e->value_set().size();
+        }
+        else {
+            meta._status = REDIS_WRONG_TYPE;
+        }
+    });
+    return make_ready_future<set_meta>(meta);
+}
+
+static inline bool zset_item_less(const zset_item& l, const zset_item& r)
+{
+    if (l._hash != r._hash) {
+        return l._hash < r._hash;
+    }
+    return l._member < r._member;
+}
+
+static inline double zset_weighted(double score, double weight)
+{
+    auto result = score * weight;
+    // 0 * inf is NaN, redis takes it as 0.
+    return std::isnan(result) ? 0 : result;
+}
+
+static inline double zset_aggregate(double a, double b, int aggregate)
+{
+    if (aggregate & ZAGGREGATE_MIN) {
+        return std::min(a, b);
+    }
+    if (aggregate & ZAGGREGATE_MAX) {
+        return std::max(a, b);
+    }
+    auto sum = a + b;
+    // inf + -inf is NaN, redis takes it as 0.
+    return std::isnan(sum) ? 0 : sum;
+}
+
+// The k-way merge of the lists which are sorted by (hash, member), the items of a member
+// are aggregated to one.
+static void merge_zset_items(const std::vector<const std::vector<zset_item>*>& lists, int aggregate, std::vector<zset_item>& out)
+{
+    using position = std::pair<size_t, size_t>;
+    auto greater = [&lists] (const position& a, const position& b) {
+        return zset_item_less((*lists[b.first])[b.second], (*lists[a.first])[a.second]);
+    };
+    std::priority_queue<position, std::vector<position>, decltype(greater)> heap(greater);
+    size_t total = 0;
+    for (size_t i = 0; i < lists.size(); ++i) {
+        if (!lists[i]->empty()) {
+            heap.emplace(i, 0);
+            total += lists[i]->size();
+        }
+    }
+    out.reserve(total);
+    while (!heap.empty()) {
+        auto p = heap.top();
+        heap.pop();
+        auto& item = (*lists[p.first])[p.second];
+        if (!out.empty() && out.back()._hash == item._hash && out.back()._member == item._member) {
+            out.back()._score = zset_aggregate(out.back()._score, item._score, aggregate);
+            out.back()._sources += item._sources;
+        }
+        else {
+            out.push_back(item);
+        }
+        if (++p.second < lists[p.first]->size()) {
+            heap.push(p);
+        }
+    }
+}
+
+future<zset_items_ptr> database::zset_fetch_window(const std::vector<zset_source>& sources, size_t first, size_t last, int aggregate)
+{
+    std::vector<std::vector<zset_item>> local(sources.size());
+    for (size_t i = 0; i < sources.size(); ++i) {
+        auto weight = sources[i]._weight;
+        auto& items = local[i];
+        _cache.with_entry_run(sources[i]._key, [&items, weight, first, last] (const cache_entry* e) {
+            if (e && e->type_of_sset()) {
+                e->value_sset().scan_range(first, last, [&items, weight] (const sset_entry& member) {
+                    items.emplace_back(zset_item { member._key_hash, copy_key(member.key()), zset_weighted(member.score(), weight), 1 });
+                });
+            }
+            else if (e && e->type_of_set()) {
+                e->value_set().scan_range(first, last, [&items, weight] (const dict_entry& member) {
+                    items.emplace_back(zset_item { member._key_hash, copy_key(member.key()), zset_weighted(1, weight), 1 });
+                });
+            }
+        });
+    }
+    auto result = make_lw_shared<std::vector<zset_item>>();
+    if (local.size() == 1) {
+        *result = std::move(local[0]);
+    }
+    else {
+        std::vector<const std::vector<zset_item>*> lists;
+        for (auto& items : local) {
+            lists.push_back(&items);
+        }
+        merge_zset_items(lists, aggregate, *result);
+    }
+    return make_ready_future<zset_items_ptr>(make_foreign(result));
+}
+
+future<uint64_t> database::zset_stage_begin()
+{
+    return with_allocator(allocator(), [this] {
+        auto stage = _next_zset_stage++;
+        _zset_stages.emplace(stage, make_managed<sset_lsa>());
+        return make_ready_future<uint64_t>(stage);
+    });
+}
+
+future<> database::zset_stage_merge(uint64_t stage, const std::vector<zset_items_ptr>& shards, int aggregate, uint32_t required)
+{
+    return with_allocator(allocator(), [this, stage, &shards, aggregate, required] {
+        auto it = _zset_stages.find(stage);
+        if (it == _zset_stages.end()) {
+            return make_ready_future<>();
+        }
+        std::vector<const std::vector<zset_item>*> lists;
+        for (auto& items : shards) {
+            if (items) {
+                lists.push_back(items.get());
+            }
+        }
+        std::vector<zset_item> merged;
+        merge_zset_items(lists, aggregate, merged);
+        // every window is appended as a run of the ordered scores, which the sort merges.
+        std::sort(merged.begin(), merged.end(), [] (const zset_item& l, const zset_item& r) {
+            if (l._score != r._score) {
+                return l._score < r._score;
+            }
+            return l._member < r._member;
+        });
+        auto& sset = *(it->second);
+        for (auto& item : merged) {
+            if (required > 0 && item._sources < required) {
+                continue;
+            }
+            // the windows are disjoint, so a member is never appended twice.
+            auto entry = current_allocator().construct<sset_entry>(item._member, item._score);
+            if (!sset.bulk_insert(entry)) {
+                current_allocator().destroy<sset_entry>(entry);
+            }
+        }
+        return make_ready_future<>();
+    });
+}
+
+// the entries the sort visits per chunk.
+static constexpr const size_t ZSET_SORT_STEPS = 4096;
+
+future<bool> database::zset_stage_sort(uint64_t stage)
+{
+    return with_allocator(allocator(), [this, stage] {
+        auto it = _zset_stages.find(stage);
+        if (it == _zset_stages.end()) {
+            return make_ready_future<bool>(true);
+        }
+        auto sorted = it->second->sort_by_score_step(_zset_sorts[stage], ZSET_SORT_STEPS);
+        if (sorted) {
+            _zset_sorts.erase(stage);
+        }
+        return make_ready_future<bool>(sorted);
+    });
+}
+
+future<size_t> database::zset_stage_commit(const redis_key& rk, uint64_t stage)
+{
+    return with_allocator(allocator(), [this, &rk, stage] {
+        size_t size = 0;
+        auto it = _zset_stages.find(stage);
+        if (it != _zset_stages.end()) {
+            size = it->second->size();
+            if (size == 0) {
+                _cache.erase(rk);
+            }
+            else {
+                auto entry = current_allocator().construct<cache_entry>(rk.key(), rk.hash(), cache_entry::sset_initializer(), std::move(it->second));
+                _cache.replace(entry);
+            }
+            _zset_stages.erase(it);
+        }
+        _zset_sorts.erase(stage);
+        return make_ready_future<size_t>(size);
+    });
+}
+
+future<> database::zset_stage_abort(uint64_t stage)
+{
+    return with_allocator(allocator(), [this, stage] {
+        _zset_stages.erase(stage);
+        _zset_sorts.erase(stage);
+        return make_ready_future<>();
+    });
+}
+
+void database::configure(const redis::config& cfg)
+{
+    _config = std::make_unique<redis::config>(cfg);
+    list_lsa::configure(cfg.list_max_chunk_size(), cfg.list_max_chunk_entries(), cfg.list_compress_depth());
+    hll::configure(cfg.hll_sparse_max_bytes());
+    db_log.info("hyperloglog registers kernels: {}", hll_kernels::implementation());
+    db_log.info("bitmap kernels: {}", bits_kernels::implementation());
+    db_log.info("geo kernels: {}", geo_kernels::implementation());
+}
+
+future<> database::start()
+{
+    if (!_enable_write_disk) {
+        return make_ready_future<>();
+    }
+    store::commit_log::options opt;
+    opt._directory = _config->commitlog_directory();
+    opt._segment_size = size_t(_config->commitlog_segment_size_in_mb()) * 1024 * 1024;
+    opt._mode = store::commit_log::parse_sync_mode(_config->commitlog_sync());
+    opt._sync_period = std::chrono::milliseconds(_config->commitlog_sync_period_in_ms());
+    opt._batch_window = std::chrono::milliseconds(_config->commitlog_sync_batch_window_in_ms());
+    if (_config->commitlog_total_space_in_mb() > 0) {
+        opt._total_space = size_t(_config->commitlog_total_space_in_mb()) * 1024 * 1024;
+    }
+    // every shard replays its own segments, the records are sent to the shards which
+    // own their keys in batches.
+    auto replayer = make_lw_shared<commit_log_replayer>(opt._directory, [] (std::vector<commit_log_record> records) {
+        std::vector<std::vector<commit_log_record>> shards(smp::count);
+        for (auto& r : records) {
+            redis_key rk { r._key };
+            shards[rk.get_cpu()].push_back(std::move(r));
+        }
+        return do_with(std::move(shards), [] (auto& shards) {
+            return parallel_for_each(boost::irange<unsigned>(0, smp::count), [&shards] (unsigned cpu) {
+                if (shards[cpu].empty()) {
+                    return make_ready_future<>();
+                }
+                return get_database().invoke_on(cpu, [records = std::move(shards[cpu])] (database& db) mutable {
+                    db.apply_replayed(std::move(records));
+                });
+            });
+        });
+    });
+    return replayer->replay().then([this, replayer, opt = std::move(opt)] () mutable {
+        auto& stats = replayer->get_stats();
+        _replay_stats._segments += stats._segments;
+        _replay_stats._bytes += stats._bytes;
+        _replay_stats._corrupted += stats._corrupted;
+        _commit_log = make_lw_shared<commit_log>(std::move(opt));
+        // the segments grow past the total space, the memtables are flushed, so the
+        // segments they hold are recycled.
+        _commit_log->set_flush_handler([this] (uint64_t) {
+            if (_store) {
+                _store->seal_active_memtable().handle_exception([] (auto) {});
+            }
+        });
+        if (_store) {
+            _store->set_commit_log(_commit_log);
+        }
+        return _commit_log->start(replayer->adopted());
+    });
+}
+
+// Applies the records which were replayed from the commit log, they are not logged again.
+void database::apply_replayed(std::vector<commit_log_record> records)
+{
+    with_allocator(allocator(), [this, &records] {
+        for (auto& r : records) {
+            redis_key rk { r._key };
+            if (r._type == partition_type::string) {
+                _cache.replace(make_string_entry(rk, r._value));
+            } else if (r._type == partition_type::unknown) {
+                _cache.erase(rk);
+            } else {
+                ++_replay_stats._skipped;
+                continue;
+            }
+            ++_replay_stats._records;
+            // the records have no position in the commit log of this shard, the replayed
+            // segments are kept until flush_replayed() completes on all shards.
+            if (_store) {
+                _store->apply(to_decorated_key(rk), make_serialized_partition(r._type, r._key, r._value));
+            }
+        }
+    });
+}
+
+future<> database::flush_replayed()
+{
+    if (!_store || !_commit_log) {
+        return make_ready_future<>();
+    }
+    return _store->flush();
+}
+
+void database::release_replayed_segments()
+{
+    if (_commit_log) {
+        _commit_log->release_replayed_segments();
+    }
+}
+
 future<> database::stop()
 {
-    return make_ready_future<>();
+    // the flushes in progress discard the commit log segments.
+    auto stopped = _store ? _store->stop() : make_ready_future<>();
+    return stopped.then([this] {
+        if (!_commit_log) {
+            return make_ready_future<>();
+        }
+        return _commit_log->stop();
+    });
 }
 }
@@ -30,6 +30,7 @@
 #include "structures/geo.hh"
 #include "structures/bits_operation.hh"
 #include <tuple>
+#include <unordered_map>
 #include "cache.hh"
 #include "reply_builder.hh"
 #include  <experimental/vector>
@@ -37,6 +38,7 @@
 #include "utils/bytes.hh"
 #include "store/column_family.hh"
 #include "store/commit_log.hh"
+#include "store/commit_log_replayer.hh"
 #include "keys.hh"
 #include "store/options.hh"
 namespace stdx = std::experimental;
@@ -53,6 +55,134 @@ inline database& get_local_database() {
     return _the_database.local();
 }
 
+// The registers of the HLL values of the keys which are owned by a shard, the
+// coordinator of the multi-key PFCOUNT & PFMERGE merges them without copying.
+struct hll_registers {
+    int _status = REDIS_OK;
+    bool _found = false;
+    bytes _registers;
+};
+using hll_registers_ptr = foreign_ptr<lw_shared_ptr<hll_registers>>;
+
+// The description of a BITOP source.
+struct bitmap_meta {
+    int _status = REDIS_OK;
+    // the size of the equivalent string.
+    size_t _size = 0;
+    bool _roaring = false;
+};
+
+// The serialized containers of a roaring bitmap (see roaring_lsa::serialize), and
+// the key of the next container after them, or -1.
+struct roaring_chunk {
+    std::vector<uint8_t> _data;
+    long _next = -1;
+};
+using roaring_chunk_ptr = foreign_ptr<lw_shared_ptr<roaring_chunk>>;
+
+enum class set_algebra_op : uint8_t {
+    INTER = 0,
+    UNION = 1,
+    DIFF  = 2,
+};
+
+// The description of a source of SINTERSTORE, SUNIONSTORE or SDIFFSTORE, the status is
+// REDIS_NONE if the key does not exist.
+struct set_meta {
+    int _status = REDIS_OK;
+    size_t _size = 0;
+};
+
+// The members of a set in the order of their hashes, and the cursor of the next chunk,
+// or 0 if there is none.
+struct set_chunk {
+    std::vector<sstring> _members;
+    size_t _next = 0;
+};
+using set_chunk_ptr = foreign_ptr<lw_shared_ptr<set_chunk>>;
+using set_probe_ptr = foreign_ptr<lw_shared_ptr<std::vector<uint8_t>>>;
+
+// A source of ZUNIONSTORE or ZINTERSTORE: a sorted set, or a set whose scores are 1.
+struct zset_source {
+    redis_key _key;
+    double _weight;
+};
+
+// A member of the result of ZUNIONSTORE or ZINTERSTORE. The items are sorted by (hash,
+// member) as the dicts are, so they are merged without sorting.
+struct zset_item {
+    size_t _hash;
+    sstring _member;
+    double _score;
+    // the number of the sources which have the member, ZINTERSTORE keeps the members
+    // of all sources only.
+    uint32_t _sources;
+};
+using zset_items_ptr = foreign_ptr<lw_shared_ptr<std::vector<zset_item>>>;
+
+// The end of a list or a sorted set which is popped by the blocking commands, the
+// sorted set is popped from its lowest score (BZPOPMIN).
+enum class pop_side : uint8_t {
+    HEAD = 0,
+    TAIL = 1,
+    MIN  = 2,
+};
+
+// An element which is popped for a blocking command: a list element, or a member and
+// its score. The status is REDIS_NONE if the key does not exist.
+struct popped_value {
+    int _status = REDIS_OK;
+    bytes _value;
+    double _score = 0;
+};
+using popped_value_ptr = foreign_ptr<lw_shared_ptr<popped_value>>;
+
+// The options of GEOSEARCH and GEOSEARCHSTORE, the flags are the GEORADIUS_* and the
+// GEOSEARCH_* ones, the count 0 means no limit.
+struct geo_search_args {
+    geo_shape _shape;
+    bool _from_member = false;
+    bytes _member;
+    int _flags = 0;
+    size_t _count = 0;
+};
+
+// The matched points: [member, score, dist, longitude, latitude], as the reply_builder expects.
+struct geo_search_result {
+    int _status = REDIS_OK;
+    std::vector<std::tuple<sstring, double, double, double, double>> _points;
+};
+using geo_search_result_ptr = foreign_ptr<lw_shared_ptr<geo_search_result>>;
+
+// The state of a streamed reply of SMEMBERS, HGETALL, LRANGE or ZRANGE. The owner shard
+// appends one chunk of the reply per call, so the memory of a reply in flight is bounded
+// by a chunk, and the command yields between the chunks. The length of the array is fixed
+// by the first chunk, so the consistency is weak: a member which exists during the whole
+// reply is sent once (or at its position of a range), a member which is added meanwhile
+// may be missed, and the members which are removed meanwhile are replaced by the nils at
+// the end of the array.
+static constexpr const size_t RANGE_STREAM_CHUNK_ITEMS = 1024;
+struct range_stream {
+    bool _started = false;
+    bool _done = false;
+    bool _exhausted = false;
+    // the number of the items which are not sent yet.
+    size_t _remaining = 0;
+    // the hash cursor of a dict, or the next index of a list.
+    size_t _cursor = 0;
+    // the range of LRANGE and ZRANGE, the indexes are inclusive as redis.
+    long _start = 0;
+    long _end = -1;
+    bool _with_scores = false;
+    // the next member of ZRANGE and its score, which locate the position after a yield.
+    bool _has_member = false;
+    sstring _member;
+    double _score = 0;
+};
+
+// the max size of a string value, as redis (proto-max-bulk-len).
+static constexpr const size_t STRING_MAX_SIZE = 512 * 1024 * 1024;
+
 enum {
     FLAG_SET_NO = 1 << 0,
     FLAG_SET_EX = 1 << 1,
@@ -73,8 +203,150 @@ public:
 
     future<scattered_message_ptr> get(const redis_key& key);
 
+    // Replies the old value and replaces it, the canonical integer is stored as int64_t as SET.
+    future<scattered_message_ptr> getset(const redis_key& rk, bytes& val);
+
+    // The integer encoded value is updated in place, the string is converted to the integer
+    // (or float) encoding by the first INCR (or INCRBYFLOAT).
+    future<scattered_message_ptr> incrby(const redis_key& rk, int64_t step);
+
+    future<scattered_message_ptr> incrbyfloat(const redis_key& rk, double step);
+
+    // APPEND and SETRANGE change the string in place, the string keeps a spare capacity
+    // so the repeated appends are amortized O(appended bytes).
+    future<scattered_message_ptr> append(const redis_key& rk, const bytes& val);
+
+    future<scattered_message_ptr> setrange(const redis_key& rk, size_t offset, const bytes& val);
+
+    future<scattered_message_ptr> getrange(const redis_key& rk, long start, long end);
+
+    future<scattered_message_ptr> pfadd(const redis_key& rk, std::vector<bytes>& elements);
+
+    future<scattered_message_ptr> pfcount(const redis_key& rk);
+
+    // Merges the registers of the HLL values of the keys, all keys must be owned by this shard.
+    future<hll_registers_ptr> pf_fetch_registers(std::vector<redis_key>& keys);
+
+    // Merges the registers to the HLL value of the key, it is created if it does not exist.
+    future<scattered_message_ptr> pf_store_registers(const redis_key& rk, const bytes& registers);
+
+    // Returns the points of the key which are in the shape of the args. REDIS_ERR is
+    // returned if the member of FROMMEMBER does not exist.
+    future<geo_search_result_ptr> geosearch(const redis_key& rk, const geo_search_args& args);
+
+    // Replaces the sorted set with the points, the scores are the distances if the flags
+    // have GEORADIUS_STORE_DIST. The key is removed if there is no point.
+    future<scattered_message_ptr> geo_store(const redis_key& rk, const geo_search_result& result, int flags);
+
+    future<scattered_message_ptr> sadd(const redis_key& rk, std::vector<bytes>& members);
+
+    future<scattered_message_ptr> srem(const redis_key& rk, std::vector<bytes>& members);
+
+    future<scattered_message_ptr> scard(const redis_key& rk);
+
+    future<scattered_message_ptr> sismember(const redis_key& rk, const bytes& member);
+
+    // The random members are selected from the dense array of the set in O(1) each, a
+    // negative count allows the same member to be returned more than once.
+    future<scattered_message_ptr> srandmember(const redis_key& rk, long count, bool count_given);
+
+    future<scattered_message_ptr> spop(const redis_key& rk, size_t count, bool count_given);
+
+    // Every call visits opts.count entries at most, see structures/scan.hh for the cursor.
+    future<scattered_message_ptr> sscan(const redis_key& rk, const scan_options& opts);
+
+    future<scattered_message_ptr> hscan(const redis_key& rk, const scan_options& opts);
+
+    future<scattered_message_ptr> zscan(const redis_key& rk, const scan_options& opts);
+
+    // Every call appends the next chunk of the reply, see range_stream.
+    future<scattered_message_ptr> smembers_chunk(const redis_key& rk, range_stream& s);
+
+    future<scattered_message_ptr> hgetall_chunk(const redis_key& rk, range_stream& s);
+
+    future<scattered_message_ptr> lrange_chunk(const redis_key& rk, range_stream& s);
+
+    future<scattered_message_ptr> zrange_chunk(const redis_key& rk, range_stream& s);
+
+    future<scattered_message_ptr> push(const redis_key& rk, std::vector<bytes>& values, bool head);
+
+    future<scattered_message_ptr> pop(const redis_key& rk, bool head);
+
+    future<scattered_message_ptr> zadd(const redis_key& rk, std::unordered_map<sstring, double>& members);
+
+    // BLPOP, BRPOP, BLMOVE and BZPOPMIN pop a single element, and give it back by
+    // push_value if the blocked client was gone meanwhile.
+    future<popped_value_ptr> pop_value(const redis_key& rk, pop_side side);
+    future<int> push_value(const redis_key& rk, pop_side side, const bytes& value, double score);
+
+    // SETBIT creates the roaring bitmap, the existing string is converted to it when
+    // SETBIT would grow the string.
+    future<scattered_message_ptr> setbit(const redis_key& rk, size_t offset, bool value);
+
+    future<scattered_message_ptr> getbit(const redis_key& rk, size_t offset);
+
+    future<scattered_message_ptr> bitcount(const redis_key& rk, long start, long end);
+
+    future<scattered_message_ptr> bitpos(const redis_key& rk, bool bit, long start, long end, bool end_given);
+
+    future<bitmap_meta> bitmap_describe(const redis_key& rk);
+
+    // Returns a copy of the bytes [offset, offset + length) of the string (or the roaring
+    // bitmap), it is shorter than the length if the string is.
+    future<foreign_ptr<lw_shared_ptr<bytes>>> bitmap_fetch(const redis_key& rk, size_t offset, size_t length);
+
+    // Returns the containers of the roaring bitmap in the keys range [first_key, last_key).
+    future<roaring_chunk_ptr> roaring_fetch(const redis_key& rk, uint32_t first_key, uint32_t last_key);
+
+    // The result of BITOP is written to a staging string chunk by chunk, and it
+    // replaces the destination once all chunks were written.
+    future<uint64_t> bitmap_stage_begin(size_t size);
+    future<> bitmap_stage_write(uint64_t stage, size_t offset, const bytes& data);
+    future<> bitmap_stage_commit(const redis_key& rk, uint64_t stage);
+    future<> bitmap_stage_abort(uint64_t stage);
+
+    // The result of BITOP on roaring bitmaps is staged as a roaring bitmap, the containers
+    // are appended in the order of their keys.
+    future<uint64_t> roaring_stage_begin();
+    future<> roaring_stage_append(uint64_t stage, const std::vector<uint8_t>& data);
+    future<> roaring_stage_commit(const redis_key& rk, uint64_t stage, size_t byte_size);
+
+    // The sources of the set algebra commands are read chunk by chunk, so the command
+    // never runs as one long loop on a shard.
+    future<set_meta> set_describe(const redis_key& rk);
+    future<set_chunk_ptr> set_fetch(const redis_key& rk, size_t cursor, size_t count);
+    // Returns 1 for every member which exists in the set, otherwise 0.
+    future<set_probe_ptr> set_probe(const redis_key& rk, const std::vector<sstring>& members);
+
+    // The result is built in a staging set, which replaces the destination at once.
+    future<uint64_t> set_stage_begin();
+    future<> set_stage_append(uint64_t stage, const std::vector<sstring>& members);
+    // Returns the size of the result, an empty result removes the destination.
+    future<size_t> set_stage_commit(const redis_key& rk, uint64_t stage);
+    future<> set_stage_abort(uint64_t stage);
+
+    // ZUNIONSTORE and ZINTERSTORE split the hashes to the windows. For a window, every
+    // shard merges its own sources (applying the weights), then the shard of the
+    // destination merges the results of the shards into the staging sorted set.
+    future<set_meta> zset_describe(const redis_key& rk);
+    future<zset_items_ptr> zset_fetch_window(const std::vector<zset_source>& sources, size_t first, size_t last, int aggregate);
+    future<uint64_t> zset_stage_begin();
+    // Only the members of the required number of sources are kept, 0 keeps all.
+    future<> zset_stage_merge(uint64_t stage, const std::vector<zset_items_ptr>& shards, int aggregate, uint32_t required);
+    // Sorts the staging sorted set by the scores in chunks, the future resolves to true
+    // once it is sorted.
+    future<bool> zset_stage_sort(uint64_t stage);
+    future<size_t> zset_stage_commit(const redis_key& rk, uint64_t stage);
+    future<> zset_stage_abort(uint64_t stage);
+
     future<> start();
     future<> stop();
+    void configure(const redis::config& cfg);
+    void apply_replayed(std::vector<store::commit_log_record> records);
+    // Runs on all shards once all of them were started: the memtables which hold the
+    // replayed records are flushed, then the replayed segments are recycled.
+    future<> flush_replayed();
+    void release_replayed_segments();
 
     const redis::config& get_config() const {
         return *_config;
@@ -88,8 +360,24 @@ private:
     write_options _write_opt;
     read_options _read_opt;
     bool _enable_write_disk { false };
+    struct replay_stats {
+        uint64_t _segments = 0;
+        uint64_t _records = 0;
+        uint64_t _bytes = 0;
+        uint64_t _corrupted = 0;
+        uint64_t _skipped = 0;
+    } _replay_stats;
     void setup_metrics();
+    future<> write_to_disk(const redis_key& rk, partition&& p);
     size_t sum_expiring_entries();
     std::unique_ptr<redis::config> _config;
+    std::unordered_map<uint64_t, managed_ref<managed_bytes>> _bitmap_stages;
+    std::unordered_map<uint64_t, managed_ref<roaring_lsa>> _roaring_stages;
+    uint64_t _next_bitmap_stage = 0;
+    std::unordered_map<uint64_t, managed_ref<dict_lsa>> _set_stages;
+    uint64_t _next_set_stage = 0;
+    std::unordered_map<uint64_t, managed_ref<sset_lsa>> _zset_stages;
+    std::unordered_map<uint64_t, sset_sort_cursor> _zset_sorts;
+    uint64_t _next_zset_stage = 0;
 };
 }
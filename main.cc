@@ -23,6 +23,7 @@
 #include "redis.hh"
 #include "redis_protocol.hh"
 #include "server.hh"
+#include "pubsub.hh"
 #include "util/log.hh"
 //#include "core/prometheus.hh"
 #include "proxy.hh"
@@ -85,18 +86,32 @@ int main(int ac, char** av) {
                 auto& redis = redis::get_service();
                 auto& px = redis::get_proxy();
                 auto& ss = redis::get_service();
+                auto& ps = redis::get_pubsub();
 
                 engine().at_exit([&] { return db.stop(); });
                 engine().at_exit([&] { return server.stop(); });
                 engine().at_exit([&] { return redis.stop(); });
                 engine().at_exit([&] { return px.stop(); });
                 engine().at_exit([&] { return ss.stop(); });
+                engine().at_exit([&] { return ps.stop(); });
                 //engine().at_exit([&] { return prometheus_server.stop(); });
 
                 //auto port = cfg->storage_port();
                 //auto pport = cfg->prometheus_port();
                 // start databse
                 db.start().get();
+                db.invoke_on_all([c = cfg.get()] (redis::database& d) {
+                    d.configure(*c);
+                }).get();
+                db.invoke_on_all(&redis::database::start).get();
+                // the records of a shard's segments were replayed into the memtables of
+                // all shards, so the segments are recycled once all shards flushed them.
+                db.invoke_on_all(&redis::database::flush_replayed).get();
+                db.invoke_on_all(&redis::database::release_replayed_segments).get();
+                ps.start().get();
+                ps.invoke_on_all([c = cfg.get()] (redis::pubsub& p) {
+                    p.configure(*c);
+                }).get();
 
                 // start gossper
                 sstring listen_address = cfg->listen_address();
@@ -6,36 +6,41 @@
 
 bytes partition::serialize() const
 {
-    return _impl->serialize();
+    return _impl ? _impl->serialize() : bytes {};
+}
+
+bytes partition::key() const
+{
+    return _impl ? _impl->key() : bytes {};
 }
 
 partition_type partition::type() const
 {
-    return _impl->type();
+    return _impl ? _impl->type() : partition_type::null;
 }
 
 class null_partition_impl : public partition_impl {
 public:
-    removable_partition_impl() : partition(partition_type::null, {}) {}
+    null_partition_impl() : partition_impl(partition_type::null, {}) {}
     virtual bytes serialize() override {
         return {};
     }
 };
 
 partition make_null_partition() {
-    return partition(std::unique_ptr<null_partition_impl>());
+    return partition(std::make_unique<null_partition_impl>());
 }
 
 class removable_partition_impl : public partition_impl {
 public:
-    removable_partition_impl(const bytes& key) : partition(partition_type::unknown, key) {}
+    removable_partition_impl(const bytes& key) : partition_impl(partition_type::unknown, key) {}
     virtual bytes serialize() override {
         return _key;
     }
 };
 
 partition make_removable_partition(const bytes& key) {
-    return partition(std::unique<removable_partition_impl>(key));
+    return partition(std::make_unique<removable_partition_impl>(key));
 }
 
 class string_partition_impl : public partition_impl {
@@ -52,5 +57,22 @@ public:
 };
 
 partition make_sstring_partition(const bytes& key, const bytes& value) {
-    return partition(std::unique<string_partition>(key, value));
+    return partition(std::make_unique<string_partition_impl>(key, value));
+}
+
+class serialized_partition_impl : public partition_impl {
+   bytes _data;
+public:
+   serialized_partition_impl(partition_type type, const bytes& key, const bytes& data)
+       : partition_impl(type, key)
+       , _data(data)
+   {
+   }
+   virtual bytes serialize() override {
+       return _data;
+   }
+};
+
+partition make_serialized_partition(partition_type type, const bytes& key, const bytes& data) {
+    return partition(std::make_unique<serialized_partition_impl>(type, key, data));
 }
@@ -16,16 +16,19 @@ enum class partition_type : unsigned {
 using partition_generation_type = size_t;
 
 class partition_impl {
+protected:
     partition_type _type;
-    partition_generation_type _gen;
+    partition_generation_type _gen = 0;
     bytes _key;
 public:
     partition_impl() = default;
     partition_impl(const partition_impl&) = default;
     partition_impl& operator = (const partition_impl&) = default;
     partition_impl(partition_type type, const bytes& key) : _type(type), _key(key) {}
+    virtual ~partition_impl() {}
     virtual bytes serialize() = 0;
     partition_type type() const { return _type; }
+    const bytes& key() const { return _key; }
 };
 
 class partition {
@@ -44,10 +47,13 @@ public:
     partition(std::unique_ptr<partition_impl> impl) : _impl(std::move(impl)) {}
     bytes serialize() const;
     partition_type type() const;
+    bytes key() const;
     void replace_if_newer(partition&& p) {}
-    bool empty() const { return false; }
+    bool empty() const { return type() == partition_type::null; }
 };
 
 partition make_null_partition();
 partition make_removable_partition(const bytes& key);
 partition make_sstring_partition(const bytes& key, const bytes& value);
+// The partition which was serialized already, e.g. read from the memtable.
+partition make_serialized_partition(partition_type type, const bytes& key, const bytes& data);
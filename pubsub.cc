@@ -0,0 +1,611 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#include "pubsub.hh"
+#include <algorithm>
+#include "core/reactor.hh"
+#include "core/future-util.hh"
+#include "util/log.hh"
+namespace redis {
+
+using logger =  seastar::logger;
+static logger pubsub_log ("pubsub");
+
+distributed<pubsub> _the_pubsub;
+
+static inline bool glob_special(char c)
+{
+    return c == '*' || c == '?' || c == '[' || c == '\\';
+}
+
+size_t pattern_matcher::literal_prefix(const sstring& pattern)
+{
+    size_t prefix = 0;
+    while (prefix < pattern.size() && !glob_special(pattern[prefix])) {
+        ++prefix;
+    }
+    return prefix;
+}
+
+pattern_matcher::pattern_matcher(const sstring& pattern)
+    : _prefix(literal_prefix(pattern))
+{
+    using kind = token::kind;
+    size_t p = _prefix;
+    while (p < pattern.size()) {
+        switch (pattern[p]) {
+        case '*':
+            // the adjacent stars match as one.
+            if (_tokens.empty() || _tokens.back()._kind != kind::star) {
+                _tokens.push_back(token { kind::star, 0, 0 });
+            }
+            ++p;
+            break;
+        case '?':
+            _tokens.push_back(token { kind::any, 0, 0 });
+            ++p;
+            break;
+        case '\\':
+            if (p + 1 < pattern.size()) {
+                _tokens.push_back(token { kind::literal, pattern[p + 1], 0 });
+                p += 2;
+            } else {
+                _tokens.push_back(token { kind::literal, '\\', 0 });
+                ++p;
+            }
+            break;
+        case '[': {
+            std::bitset<256> set;
+            size_t i = p + 1;
+            bool negate = i < pattern.size() && pattern[i] == '^';
+            if (negate) {
+                ++i;
+            }
+            while (i < pattern.size() && pattern[i] != ']') {
+                if (pattern[i] == '\\' && i + 1 < pattern.size()) {
+                    set.set(static_cast<unsigned char>(pattern[i + 1]));
+                    i += 2;
+                } else if (i + 2 < pattern.size() && pattern[i + 1] == '-') {
+                    auto start = pattern[i], end = pattern[i + 2];
+                    if (start > end) {
+                        std::swap(start, end);
+                    }
+                    // the chars are compared as string_match() does.
+                    for (unsigned v = 0; v < 256; ++v) {
+                        auto c = static_cast<char>(v);
+                        if (c >= start && c <= end) {
+                            set.set(v);
+                        }
+                    }
+                    i += 3;
+                } else {
+                    set.set(static_cast<unsigned char>(pattern[i]));
+                    ++i;
+                }
+            }
+            if (negate) {
+                set.flip();
+            }
+            _tokens.push_back(token { kind::set, 0, static_cast<uint32_t>(_sets.size()) });
+            _sets.push_back(set);
+            // an unterminated class ends at the end of the pattern, as redis.
+            p = i < pattern.size() ? i + 1 : i;
+            break;
+        }
+        default:
+            _tokens.push_back(token { kind::literal, pattern[p], 0 });
+            ++p;
+            break;
+        }
+    }
+}
+
+bool pattern_matcher::match_token(const token& t, char c) const
+{
+    switch (t._kind) {
+    case token::kind::literal:
+        return t._char == c;
+    case token::kind::set:
+        return _sets[t._set].test(static_cast<unsigned char>(c));
+    default:
+        return true;
+    }
+}
+
+bool pattern_matcher::match(const sstring& channel) const
+{
+    // the trie matched the prefix, the stars backtrack to the last one only.
+    auto s = channel.data() + _prefix;
+    auto size = channel.size() - _prefix;
+    size_t p = 0, i = 0;
+    bool starred = false;
+    size_t star_p = 0, star_i = 0;
+    while (i < size) {
+        if (p < _tokens.size() && _tokens[p]._kind == token::kind::star) {
+            if (++p == _tokens.size()) {
+                return true;
+            }
+            starred = true;
+            star_p = p;
+            star_i = i;
+            continue;
+        }
+        if (p < _tokens.size() && match_token(_tokens[p], s[i])) {
+            ++p;
+            ++i;
+            continue;
+        }
+        if (!starred) {
+            return false;
+        }
+        p = star_p;
+        i = ++star_i;
+    }
+    while (p < _tokens.size() && _tokens[p]._kind == token::kind::star) {
+        ++p;
+    }
+    return p == _tokens.size();
+}
+
+bool pattern_trie::add(const sstring& pattern, lw_shared_ptr<subscriber> s)
+{
+    pattern_matcher matcher(pattern);
+    node* n = &_root;
+    for (size_t i = 0; i < matcher._prefix; ++i) {
+        auto& child = n->_children[pattern[i]];
+        if (!child) {
+            child = std::make_unique<node>();
+        }
+        n = child.get();
+    }
+    auto it = n->_patterns.find(pattern);
+    if (it == n->_patterns.end()) {
+        it = n->_patterns.emplace(pattern, entry { std::move(matcher), {} }).first;
+    }
+    auto& subscribers = it->second._subscribers;
+    if (std::find(subscribers.begin(), subscribers.end(), s) != subscribers.end()) {
+        return false;
+    }
+    subscribers.emplace_back(std::move(s));
+    ++_size;
+    return true;
+}
+
+bool pattern_trie::remove(const sstring& pattern, const subscriber* s)
+{
+    auto prefix = pattern_matcher::literal_prefix(pattern);
+    std::vector<node*> path { &_root };
+    for (size_t i = 0; i < prefix; ++i) {
+        auto it = path.back()->_children.find(pattern[i]);
+        if (it == path.back()->_children.end()) {
+            return false;
+        }
+        path.push_back(it->second.get());
+    }
+    auto& patterns = path.back()->_patterns;
+    auto it = patterns.find(pattern);
+    if (it == patterns.end()) {
+        return false;
+    }
+    auto& subscribers = it->second._subscribers;
+    auto sit = std::find_if(subscribers.begin(), subscribers.end(), [s] (const lw_shared_ptr<subscriber>& o) {
+        return o.get() == s;
+    });
+    if (sit == subscribers.end()) {
+        return false;
+    }
+    subscribers.erase(sit);
+    --_size;
+    if (subscribers.empty()) {
+        patterns.erase(it);
+    }
+    // the empty nodes are pruned from the leaf.
+    for (size_t i = prefix; i > 0; --i) {
+        auto n = path[i];
+        if (!n->_children.empty() || !n->_patterns.empty()) {
+            break;
+        }
+        path[i - 1]->_children.erase(pattern[i - 1]);
+    }
+    return true;
+}
+
+struct pubsub::outgoing_batch {
+    std::vector<publication> _items;
+    std::vector<promise<size_t>> _receivers;
+    bool _in_flight = false;
+};
+
+pubsub::pubsub()
+    : _active_shards(smp::count, false)
+{
+    for (unsigned cpu = 0; cpu < smp::count; ++cpu) {
+        _outgoing.emplace_back(make_lw_shared<outgoing_batch>());
+    }
+}
+
+pubsub::~pubsub()
+{
+}
+
+future<> pubsub::start()
+{
+    return make_ready_future<>();
+}
+
+future<> pubsub::stop()
+{
+    return make_ready_future<>();
+}
+
+void pubsub::configure(const redis::config& cfg)
+{
+    _output_limit = size_t(cfg.pubsub_output_limit_in_mb()) * 1024 * 1024;
+}
+
+static sstring bulk(const sstring& data)
+{
+    return sstring("$") + to_sstring(data.size()) + sstring("\r\n") + data + sstring("\r\n");
+}
+
+static sstring subscription_reply(const char* kind, const sstring* name, size_t count)
+{
+    return sstring("*3\r\n") + bulk(sstring(kind)) + (name ? bulk(*name) : sstring("$-1\r\n")) + sstring(":") + to_sstring(count) + sstring("\r\n");
+}
+
+lw_shared_ptr<subscriber> pubsub::get_subscriber(output_stream<char>& out)
+{
+    auto it = _subscribers.find(&out);
+    if (it == _subscribers.end()) {
+        it = _subscribers.emplace(&out, make_lw_shared<subscriber>(out)).first;
+    }
+    return it->second;
+}
+
+future<> pubsub::subscribe(std::vector<sstring> channels, output_stream<char>& out)
+{
+    auto s = get_subscriber(out);
+    sstring reply;
+    for (auto& channel : channels) {
+        if (s->_channels.insert(channel).second) {
+            _channels[channel].emplace_back(s);
+        }
+        reply += subscription_reply("subscribe", &channel, s->subscriptions());
+    }
+    // the reply is sent once all shards know this shard has subscribers, so the
+    // messages published after the reply are received.
+    return announce().then([this, s, reply = std::move(reply)] () mutable {
+        return write(s, std::move(reply));
+    });
+}
+
+future<> pubsub::psubscribe(std::vector<sstring> patterns, output_stream<char>& out)
+{
+    auto s = get_subscriber(out);
+    sstring reply;
+    for (auto& pattern : patterns) {
+        if (s->_patterns.insert(pattern).second) {
+            _patterns.add(pattern, s);
+        }
+        reply += subscription_reply("psubscribe", &pattern, s->subscriptions());
+    }
+    return announce().then([this, s, reply = std::move(reply)] () mutable {
+        return write(s, std::move(reply));
+    });
+}
+
+future<> pubsub::unsubscribe(std::vector<sstring> channels, output_stream<char>& out)
+{
+    auto it = _subscribers.find(&out);
+    if (it == _subscribers.end()) {
+        sstring reply;
+        for (auto& channel : channels) {
+            reply += subscription_reply("unsubscribe", &channel, 0);
+        }
+        return out.write(channels.empty() ? subscription_reply("unsubscribe", nullptr, 0) : reply);
+    }
+    auto s = it->second;
+    if (channels.empty()) {
+        channels.assign(s->_channels.begin(), s->_channels.end());
+    }
+    sstring reply;
+    for (auto& channel : channels) {
+        if (s->_channels.erase(channel)) {
+            remove_channel(channel, s.get());
+        }
+        reply += subscription_reply("unsubscribe", &channel, s->subscriptions());
+    }
+    if (channels.empty()) {
+        reply = subscription_reply("unsubscribe", nullptr, s->subscriptions());
+    }
+    return announce().then([this, s, reply = std::move(reply)] () mutable {
+        return write(s, std::move(reply));
+    });
+}
+
+future<> pubsub::punsubscribe(std::vector<sstring> patterns, output_stream<char>& out)
+{
+    auto it = _subscribers.find(&out);
+    if (it == _subscribers.end()) {
+        sstring reply;
+        for (auto& pattern : patterns) {
+            reply += subscription_reply("punsubscribe", &pattern, 0);
+        }
+        return out.write(patterns.empty() ? subscription_reply("punsubscribe", nullptr, 0) : reply);
+    }
+    auto s = it->second;
+    if (patterns.empty()) {
+        patterns.assign(s->_patterns.begin(), s->_patterns.end());
+    }
+    sstring reply;
+    for (auto& pattern : patterns) {
+        if (s->_patterns.erase(pattern)) {
+            _patterns.remove(pattern, s.get());
+        }
+        reply += subscription_reply("punsubscribe", &pattern, s->subscriptions());
+    }
+    if (patterns.empty()) {
+        reply = subscription_reply("punsubscribe", nullptr, s->subscriptions());
+    }
+    return announce().then([this, s, reply = std::move(reply)] () mutable {
+        return write(s, std::move(reply));
+    });
+}
+
+future<size_t> pubsub::publish(sstring channel, sstring message)
+{
+    std::vector<future<size_t>> receivers;
+    for (unsigned cpu = 0; cpu < smp::count; ++cpu) {
+        if (!_active_shards[cpu]) {
+            continue;
+        }
+        auto& batch = _outgoing[cpu];
+        batch->_items.emplace_back(publication { channel, message });
+        batch->_receivers.emplace_back();
+        receivers.emplace_back(batch->_receivers.back().get_future());
+        if (!batch->_in_flight) {
+            flush(cpu);
+        }
+    }
+    return when_all(receivers.begin(), receivers.end()).then([] (std::vector<future<size_t>> results) {
+        size_t total = 0;
+        for (auto& f : results) {
+            total += f.get0();
+        }
+        return total;
+    });
+}
+
+void pubsub::flush(unsigned cpu)
+{
+    auto batch = _outgoing[cpu];
+    if (batch->_items.empty()) {
+        batch->_in_flight = false;
+        return;
+    }
+    batch->_in_flight = true;
+    auto items = make_lw_shared<std::vector<publication>>(std::move(batch->_items));
+    auto receivers = make_lw_shared<std::vector<promise<size_t>>>(std::move(batch->_receivers));
+    batch->_items.clear();
+    batch->_receivers.clear();
+    get_pubsub().invoke_on(cpu, &pubsub::deliver, std::cref(*items)).then_wrapped([this, cpu, items, receivers] (future<std::vector<size_t>> f) {
+        try {
+            auto counts = f.get0();
+            for (size_t i = 0; i < receivers->size(); ++i) {
+                (*receivers)[i].set_value(counts[i]);
+            }
+        } catch (...) {
+            auto ep = std::current_exception();
+            for (auto& p : *receivers) {
+                p.set_exception(ep);
+            }
+        }
+        // the messages which were published meanwhile are sent as the next batch.
+        flush(cpu);
+    });
+}
+
+static temporary_buffer<char> message_reply(const publication& p)
+{
+    return (sstring("*3\r\n$7\r\nmessage\r\n") + bulk(p._channel) + bulk(p._message)).release();
+}
+
+static temporary_buffer<char> pmessage_reply(const sstring& pattern, const publication& p)
+{
+    return (sstring("*4\r\n$8\r\npmessage\r\n") + bulk(pattern) + bulk(p._channel) + bulk(p._message)).release();
+}
+
+future<std::vector<size_t>> pubsub::deliver(const std::vector<publication>& items)
+{
+    std::vector<size_t> counts(items.size(), 0);
+    std::vector<lw_shared_ptr<subscriber>> touched;
+    // the subscribers share the message which was built once.
+    auto enqueue = [&touched] (const lw_shared_ptr<subscriber>& s, temporary_buffer<char>& data) {
+        if (s->_batch.empty()) {
+            touched.push_back(s);
+        }
+        s->_batch.push_back(data.share());
+    };
+    for (size_t i = 0; i < items.size(); ++i) {
+        auto& item = items[i];
+        auto it = _channels.find(item._channel);
+        if (it != _channels.end()) {
+            auto data = message_reply(item);
+            for (auto& s : it->second) {
+                enqueue(s, data);
+            }
+            counts[i] += it->second.size();
+        }
+        _patterns.match(item._channel, [&] (const sstring& pattern, const std::vector<lw_shared_ptr<subscriber>>& subscribers) {
+            auto data = pmessage_reply(pattern, item);
+            for (auto& s : subscribers) {
+                enqueue(s, data);
+            }
+            counts[i] += subscribers.size();
+        });
+    }
+    // every subscriber receives the messages of the batch by one write.
+    for (auto& s : touched) {
+        write_batch(s);
+    }
+    return make_ready_future<std::vector<size_t>>(std::move(counts));
+}
+
+void pubsub::set_active(unsigned cpu, bool active)
+{
+    _active_shards[cpu] = active;
+}
+
+future<> pubsub::announce()
+{
+    return with_semaphore(_announce_lock, 1, [this] {
+        bool active = has_subscriptions();
+        if (active == _announced) {
+            return make_ready_future<>();
+        }
+        _announced = active;
+        auto cpu = engine().cpu_id();
+        return get_pubsub().invoke_on_all([cpu, active] (pubsub& p) {
+            p.set_active(cpu, active);
+        });
+    });
+}
+
+void pubsub::remove_channel(const sstring& channel, const subscriber* s)
+{
+    auto it = _channels.find(channel);
+    if (it == _channels.end()) {
+        return;
+    }
+    auto& subscribers = it->second;
+    subscribers.erase(std::remove_if(subscribers.begin(), subscribers.end(), [s] (const lw_shared_ptr<subscriber>& o) {
+        return o.get() == s;
+    }), subscribers.end());
+    if (subscribers.empty()) {
+        _channels.erase(it);
+    }
+}
+
+void pubsub::remove_subscriptions(const lw_shared_ptr<subscriber>& s)
+{
+    for (auto& channel : s->_channels) {
+        remove_channel(channel, s.get());
+    }
+    for (auto& pattern : s->_patterns) {
+        _patterns.remove(pattern, s.get());
+    }
+    s->_channels.clear();
+    s->_patterns.clear();
+}
+
+void pubsub::drop(lw_shared_ptr<subscriber> s)
+{
+    pubsub_log.warn("a subscriber exceeded the output limit ({} bytes), its subscriptions were dropped", _output_limit);
+    remove_subscriptions(s);
+    s->_batch.clear();
+    // the error is written in the gate of the subscriber, so disconnect() waits for it.
+    try {
+        with_gate(s->_writes, [this, s] {
+            return announce().then([this, s] {
+                return write(s, sstring("-ERR pubsub output limit reached, the subscriptions were dropped\r\n"));
+            });
+        }).handle_exception([] (auto ep) {
+            pubsub_log.debug("failed to drop a subscriber: {}", ep);
+        });
+    } catch (seastar::gate_closed_exception&) {
+    }
+}
+
+future<> pubsub::disconnect(output_stream<char>& out)
+{
+    auto it = _subscribers.find(&out);
+    if (it == _subscribers.end()) {
+        return make_ready_future<>();
+    }
+    auto s = it->second;
+    _subscribers.erase(it);
+    remove_subscriptions(s);
+    return announce().then([s] {
+        return s->_writes.close();
+    });
+}
+
+future<> pubsub::reply(output_stream<char>& out, sstring data)
+{
+    auto it = _subscribers.find(&out);
+    if (it == _subscribers.end()) {
+        return out.write(data);
+    }
+    return write(it->second, std::move(data));
+}
+
+future<> pubsub::write(lw_shared_ptr<subscriber> s, sstring data)
+{
+    auto d = make_lw_shared<sstring>(std::move(data));
+    try {
+        return with_gate(s->_writes, [s, d] {
+            return with_semaphore(s->_write_lock, 1, [s, d] {
+                return s->_out.write(*d).then([s, d] {
+                    return s->_out.flush();
+                });
+            });
+        }).handle_exception([] (auto ep) {
+            pubsub_log.debug("failed to write to a subscriber: {}", ep);
+        });
+    } catch (seastar::gate_closed_exception&) {
+        return make_ready_future<>();
+    }
+}
+
+void pubsub::write_batch(lw_shared_ptr<subscriber> s)
+{
+    size_t size = 0;
+    for (auto& m : s->_batch) {
+        size += m.size();
+    }
+    if (s->_pending_bytes + size > _output_limit) {
+        drop(s);
+        return;
+    }
+    s->_pending_bytes += size;
+    auto batch = make_lw_shared<std::vector<temporary_buffer<char>>>(std::move(s->_batch));
+    s->_batch.clear();
+    try {
+        with_gate(s->_writes, [s, batch] {
+            return with_semaphore(s->_write_lock, 1, [s, batch] {
+                return do_for_each(*batch, [s] (temporary_buffer<char>& m) {
+                    return s->_out.write(std::move(m));
+                }).then([s, batch] {
+                    return s->_out.flush();
+                });
+            });
+        }).then_wrapped([s, size] (future<> f) {
+            s->_pending_bytes -= size;
+            try {
+                f.get();
+            } catch (...) {
+                pubsub_log.debug("failed to write to a subscriber: {}", std::current_exception());
+            }
+        });
+    } catch (seastar::gate_closed_exception&) {
+        s->_pending_bytes -= size;
+    }
+}
+}
@@ -0,0 +1,219 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#pragma once
+#include "core/sharded.hh"
+#include "core/sstring.hh"
+#include "core/future.hh"
+#include "core/gate.hh"
+#include "core/semaphore.hh"
+#include "core/shared_ptr.hh"
+#include "core/stream.hh"
+#include "core/iostream.hh"
+#include "core/temporary_buffer.hh"
+#include <bitset>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "config.hh"
+namespace redis {
+
+class pubsub;
+extern distributed<pubsub> _the_pubsub;
+inline distributed<pubsub>& get_pubsub() {
+    return _the_pubsub;
+}
+inline pubsub& local_pubsub() {
+    return _the_pubsub.local();
+}
+
+// A connection which subscribed to the channels or the patterns. The messages are
+// written to the connection in the background, so they and the replies of the
+// commands are serialized by the write lock. As redis does, a subscribed connection
+// runs only the subscription commands and PING, and all their replies take the lock.
+// The bytes which are not written yet are limited, a slow consumer which exceeds the
+// limit loses its subscriptions.
+struct subscriber {
+    output_stream<char>& _out;
+    semaphore _write_lock { 1 };
+    gate _writes;
+    size_t _pending_bytes = 0;
+    std::unordered_set<sstring> _channels;
+    std::unordered_set<sstring> _patterns;
+    // the messages of the batch being delivered, they are written at once. A message is
+    // built once and shared by all its receivers.
+    std::vector<temporary_buffer<char>> _batch;
+
+    explicit subscriber(output_stream<char>& out) : _out(out)
+    {
+    }
+
+    size_t subscriptions() const
+    {
+        return _channels.size() + _patterns.size();
+    }
+};
+
+// A glob pattern of PSUBSCRIBE. The literal prefix (before the first special char)
+// is matched by the trie, the rest of the pattern is compiled to the tokens once it is
+// subscribed, so a publish does not parse the pattern again. The tokens match as
+// string_match() does.
+struct pattern_matcher {
+    struct token {
+        enum class kind : uint8_t { literal, any, set, star };
+        kind _kind;
+        char _char;
+        // the index of the class in _sets.
+        uint32_t _set;
+    };
+    size_t _prefix;
+    std::vector<token> _tokens;
+    std::vector<std::bitset<256>> _sets;
+
+    explicit pattern_matcher(const sstring& pattern);
+    bool match(const sstring& channel) const;
+
+    // Returns the size of the literal prefix.
+    static size_t literal_prefix(const sstring& pattern);
+private:
+    bool match_token(const token& t, char c) const;
+};
+
+// The pattern subscriptions indexed by their literal prefixes, a channel visits the
+// nodes along its own chars only, instead of matching all the patterns.
+class pattern_trie {
+    struct entry {
+        pattern_matcher _matcher;
+        std::vector<lw_shared_ptr<subscriber>> _subscribers;
+    };
+    struct node {
+        std::map<char, std::unique_ptr<node>> _children;
+        std::unordered_map<sstring, entry> _patterns;
+    };
+    node _root;
+    size_t _size = 0;
+public:
+    // Returns false if the subscriber has the pattern already.
+    bool add(const sstring& pattern, lw_shared_ptr<subscriber> s);
+    bool remove(const sstring& pattern, const subscriber* s);
+
+    // Calls func(pattern, subscribers) for every pattern which matches the channel.
+    template <typename Func>
+    void match(const sstring& channel, Func&& func) const
+    {
+        const node* n = &_root;
+        for (size_t i = 0; ; ++i) {
+            for (auto& p : n->_patterns) {
+                if (p.second._matcher.match(channel)) {
+                    func(p.first, p.second._subscribers);
+                }
+            }
+            if (i == channel.size()) {
+                return;
+            }
+            auto it = n->_children.find(channel[i]);
+            if (it == n->_children.end()) {
+                return;
+            }
+            n = it->second.get();
+        }
+    }
+
+    // Returns the number of the pattern subscriptions.
+    size_t size() const
+    {
+        return _size;
+    }
+};
+
+// A message published to a channel.
+struct publication {
+    sstring _channel;
+    sstring _message;
+};
+
+// Every shard keeps the subscribers of its own connections. A shard which has any
+// subscription is announced to all shards, so a publish sends one message to every
+// shard which has subscribers. The messages to a shard are batched: while a batch is
+// in flight, the next messages are queued, and sent together once it completes.
+class pubsub {
+    std::unordered_map<output_stream<char>*, lw_shared_ptr<subscriber>> _subscribers;
+    std::unordered_map<sstring, std::vector<lw_shared_ptr<subscriber>>> _channels;
+    pattern_trie _patterns;
+    // the shards which have subscribers, as they were announced.
+    std::vector<bool> _active_shards;
+    bool _announced = false;
+    semaphore _announce_lock { 1 };
+    struct outgoing_batch;
+    std::vector<lw_shared_ptr<outgoing_batch>> _outgoing;
+    size_t _output_limit = 32 * 1024 * 1024;
+public:
+    pubsub();
+    ~pubsub();
+
+    future<> start();
+    future<> stop();
+    void configure(const redis::config& cfg);
+
+    future<> subscribe(std::vector<sstring> channels, output_stream<char>& out);
+    future<> psubscribe(std::vector<sstring> patterns, output_stream<char>& out);
+    // The empty names remove all subscriptions of the kind.
+    future<> unsubscribe(std::vector<sstring> channels, output_stream<char>& out);
+    future<> punsubscribe(std::vector<sstring> patterns, output_stream<char>& out);
+    // Returns the number of the receivers on all shards.
+    future<size_t> publish(sstring channel, sstring message);
+
+    // Removes the subscriptions of a closed connection, and waits for the messages
+    // which are being written to it.
+    future<> disconnect(output_stream<char>& out);
+
+    // Returns true if the connection is in the subscribed mode, it has any subscription.
+    bool subscribed(output_stream<char>& out) const
+    {
+        auto it = _subscribers.find(&out);
+        return it != _subscribers.end() && it->second->subscriptions() > 0;
+    }
+    // Writes the reply of a command, after the messages which are being written to a
+    // subscribed connection.
+    future<> reply(output_stream<char>& out, sstring data);
+
+    // Runs on the shard of the subscribers, returns the number of the receivers of
+    // every message.
+    future<std::vector<size_t>> deliver(const std::vector<publication>& items);
+    void set_active(unsigned cpu, bool active);
+private:
+    lw_shared_ptr<subscriber> get_subscriber(output_stream<char>& out);
+    void remove_channel(const sstring& channel, const subscriber* s);
+    void remove_subscriptions(const lw_shared_ptr<subscriber>& s);
+    // Drops the subscriptions of a slow consumer.
+    void drop(lw_shared_ptr<subscriber> s);
+    bool has_subscriptions() const
+    {
+        return !_channels.empty() || _patterns.size() > 0;
+    }
+    future<> announce();
+    void flush(unsigned cpu);
+    // Writes the replies of the subscribe commands after the pending messages.
+    future<> write(lw_shared_ptr<subscriber> s, sstring data);
+    void write_batch(lw_shared_ptr<subscriber> s);
+};
+}
@@ -22,8 +22,11 @@
 #include <iomanip>
 #include <sstream>
 #include <algorithm>
+#include <cmath>
+#include <limits>
 #include "core/app-template.hh"
 #include "core/future-util.hh"
+#include "core/reactor.hh"
 #include "core/timer-set.hh"
 #include "core/shared_ptr.hh"
 #include "core/stream.hh"
@@ -41,10 +44,13 @@
 #include <cstdlib>
 #include "redis_protocol.hh"
 #include "db.hh"
+#include "pubsub.hh"
 #include "reply_builder.hh"
 #include  <experimental/vector>
 #include "core/metrics.hh"
 #include "request_wrapper.hh"
+#include "structures/numeric_string.hh"
+#include <boost/range/irange.hpp>
 using namespace net;
 namespace redis {
 
@@ -56,6 +62,30 @@ namespace stdx = std::experimental;
 
 distributed<redis_service> _the_redis;
 
+struct redis_service::blocked_client {
+    uint64_t _id = 0;
+    pop_side _side;
+    std::vector<redis_key> _keys;
+    int _status = REDIS_OK;
+    bool _served = false;
+    // the key which served the client, and the popped element.
+    bytes _key;
+    bytes _value;
+    double _score = 0;
+    promise<> _wakeup;
+    timer<> _timer;
+    // the connection of the client, its clients are released when it is closed.
+    output_stream<char>* _out = nullptr;
+};
+
+redis_service::redis_service()
+{
+}
+
+redis_service::~redis_service()
+{
+}
+
 future<> redis_service::start()
 {
     return make_ready_future<>();
@@ -63,6 +93,12 @@ future<> redis_service::start()
 
 future<> redis_service::stop()
 {
+    // the blocked clients are released as if they timed out.
+    auto clients = std::move(_blocked_clients);
+    for (auto& c : clients) {
+        c.second->_timer.cancel();
+        c.second->_wakeup.set_value();
+    }
     return make_ready_future<>();
 }
 
@@ -173,4 +209,1816 @@ future<> redis_service::get(request_wrapper& args, output_stream<char>& out)
         return out.write(std::move(*m));
     });
 }
+
+future<> redis_service::getset(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    bytes& val = args._args[1];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::getset, std::move(rk), std::ref(val)).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::counter_by(request_wrapper& args, output_stream<char>& out, int64_t step)
+{
+    bytes& key = args._args[0];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::incrby, std::move(rk), step).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::incr(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1) {
+        return out.write(msg_syntax_err);
+    }
+    return counter_by(args, out, 1);
+}
+
+future<> redis_service::decr(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1) {
+        return out.write(msg_syntax_err);
+    }
+    return counter_by(args, out, -1);
+}
+
+future<> redis_service::incrby(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    int64_t step = 0;
+    auto& s = args._args[1];
+    if (!numeric_string::to_int64(s.data(), s.size(), step)) {
+        return out.write(msg_value_not_integer_err);
+    }
+    return counter_by(args, out, step);
+}
+
+future<> redis_service::decrby(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    int64_t step = 0;
+    auto& s = args._args[1];
+    if (!numeric_string::to_int64(s.data(), s.size(), step)) {
+        return out.write(msg_value_not_integer_err);
+    }
+    if (step == std::numeric_limits<int64_t>::min()) {
+        return out.write(msg_incr_overflow_err);
+    }
+    return counter_by(args, out, -step);
+}
+
+future<> redis_service::incrbyfloat(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    double step = 0;
+    auto& s = args._args[1];
+    if (!numeric_string::to_double(s.data(), s.size(), step) || std::isinf(step)) {
+        return out.write(msg_value_not_float_err);
+    }
+    bytes& key = args._args[0];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::incrbyfloat, std::move(rk), step).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::append(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    bytes& val = args._args[1];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::append, std::move(rk), std::cref(val)).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::setrange(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 3) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    long offset = 0;
+    try {
+        offset = std::stol(args._args[1].c_str());
+    } catch (const std::exception&) {
+        return out.write(msg_syntax_err);
+    }
+    if (offset < 0) {
+        return out.write(msg_offset_err);
+    }
+    bytes& val = args._args[2];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::setrange, std::move(rk), static_cast<size_t>(offset), std::cref(val)).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::getrange(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 3) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    long start = 0, end = 0;
+    try {
+        start = std::stol(args._args[1].c_str());
+        end = std::stol(args._args[2].c_str());
+    } catch (const std::exception&) {
+        return out.write(msg_syntax_err);
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::getrange, std::move(rk), start, end).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::pfadd(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 1) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    for (size_t i = 1; i < args._args_count; ++i) {
+        args._tmp_keys.emplace_back(std::move(args._args[i]));
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::pfadd, std::move(rk), std::ref(args._tmp_keys)).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+struct redis_service::pf_gather_state {
+    std::vector<std::vector<redis_key>> _keys;
+    int _status = REDIS_OK;
+    bool _found = false;
+    bytes _registers;
+};
+
+// Every shard merges the HLL values of its own keys, then the coordinator merges
+// the registers of the shards, which are read through the foreign pointers.
+future<lw_shared_ptr<redis_service::pf_gather_state>> redis_service::pf_gather_registers(std::vector<bytes>& keys)
+{
+    auto state = make_lw_shared<pf_gather_state>();
+    state->_keys.resize(smp::count);
+    for (auto& key : keys) {
+        redis_key rk { key };
+        auto cpu = get_cpu(rk);
+        state->_keys[cpu].emplace_back(std::move(rk));
+    }
+    state->_registers = bytes(hll::REGISTERS_COUNT, 0);
+    return parallel_for_each(boost::irange<unsigned>(0, smp::count), [state] (unsigned cpu) {
+        if (state->_keys[cpu].empty()) {
+            return make_ready_future<>();
+        }
+        return get_database().invoke_on(cpu, &database::pf_fetch_registers, std::ref(state->_keys[cpu])).then([state] (auto&& r) {
+            if (r->_status != REDIS_OK) {
+                state->_status = r->_status;
+            }
+            else if (r->_found) {
+                hll::merge_registers(reinterpret_cast<uint8_t*>(state->_registers.data()), reinterpret_cast<const uint8_t*>(r->_registers.data()));
+                state->_found = true;
+            }
+        });
+    }).then([state] {
+        return state;
+    });
+}
+
+static inline const bytes& pf_status_message(int status)
+{
+    return status == REDIS_WRONG_TYPE ? msg_type_err : msg_invalid_hll_err;
+}
+
+future<> redis_service::pfcount(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 1) {
+        return out.write(msg_syntax_err);
+    }
+    if (args._args_count == 1) {
+        bytes& key = args._args[0];
+        redis_key rk { key };
+        auto cpu = get_cpu(rk);
+        return get_database().invoke_on(cpu, &database::pfcount, std::move(rk)).then([&out] (auto&& m) {
+            return out.write(std::move(*m));
+        });
+    }
+    return pf_gather_registers(args._args).then([&out] (auto state) {
+        if (state->_status != REDIS_OK) {
+            return out.write(pf_status_message(state->_status));
+        }
+        size_t card = 0;
+        if (state->_found) {
+            card = hll::count_registers(reinterpret_cast<const uint8_t*>(state->_registers.data()));
+        }
+        return reply_builder::build_local(out, card);
+    });
+}
+
+future<> redis_service::pfmerge(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 1) {
+        return out.write(msg_syntax_err);
+    }
+    // the destination is merged too, as redis does.
+    return pf_gather_registers(args._args).then([this, &args, &out] (auto state) {
+        if (state->_status != REDIS_OK) {
+            return out.write(pf_status_message(state->_status));
+        }
+        bytes& key = args._args[0];
+        redis_key rk { key };
+        auto cpu = get_cpu(rk);
+        return get_database().invoke_on(cpu, &database::pf_store_registers, std::move(rk), std::cref(state->_registers)).then([&out, state] (auto&& m) {
+            return out.write(std::move(*m));
+        });
+    });
+}
+
+static bool parse_geo_unit(const bytes& arg, int& flags)
+{
+    sstring unit { arg.c_str(), arg.size() };
+    std::transform(unit.begin(), unit.end(), unit.begin(), ::tolower);
+    if (unit == "m") {
+        flags |= GEO_UNIT_M;
+    }
+    else if (unit == "km") {
+        flags |= GEO_UNIT_KM;
+    }
+    else if (unit == "mi") {
+        flags |= GEO_UNIT_MI;
+    }
+    else if (unit == "ft") {
+        flags |= GEO_UNIT_FT;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+// Parses the options of GEOSEARCH (or GEOSEARCHSTORE) from the argument first, returns
+// the error message, or nullptr if the options are valid.
+static const bytes* parse_geosearch_args(request_wrapper& args, size_t first, bool store, geo_search_args& search)
+{
+    bool from = false, by = false;
+    auto& shape = search._shape;
+    try {
+        for (size_t i = first; i < args._args_count; ++i) {
+            sstring o { args._args[i].c_str(), args._args[i].size() };
+            std::transform(o.begin(), o.end(), o.begin(), ::tolower);
+            auto left = args._args_count - i - 1;
+            if (o == "frommember" && left >= 1) {
+                if (from) {
+                    return &msg_geo_from_err;
+                }
+                from = true;
+                search._from_member = true;
+                search._member = args._args[++i];
+            }
+            else if (o == "fromlonlat" && left >= 2) {
+                if (from) {
+                    return &msg_geo_from_err;
+                }
+                from = true;
+                shape._longitude = std::stod(args._args[++i].c_str());
+                shape._latitude = std::stod(args._args[++i].c_str());
+                double score = 0;
+                if (geo::encode_to_geohash(shape._longitude, shape._latitude, score) == false) {
+                    return &msg_geo_lonlat_err;
+                }
+            }
+            else if (o == "byradius" && left >= 2) {
+                if (by) {
+                    return &msg_geo_by_err;
+                }
+                by = true;
+                shape._radius = std::stod(args._args[++i].c_str());
+                if (!parse_geo_unit(args._args[++i], search._flags)) {
+                    return &msg_geo_unit_err;
+                }
+            }
+            else if (o == "bybox" && left >= 3) {
+                if (by) {
+                    return &msg_geo_by_err;
+                }
+                by = true;
+                shape._box = true;
+                shape._width = std::stod(args._args[++i].c_str());
+                shape._height = std::stod(args._args[++i].c_str());
+                if (!parse_geo_unit(args._args[++i], search._flags)) {
+                    return &msg_geo_unit_err;
+                }
+            }
+            else if (o == "asc") {
+                search._flags |= GEORADIUS_ASC;
+            }
+            else if (o == "desc") {
+                search._flags |= GEORADIUS_DESC;
+            }
+            else if (o == "count" && left >= 1) {
+                auto count = std::stol(args._args[++i].c_str());
+                if (count <= 0) {
+                    return &msg_geo_count_err;
+                }
+                search._count = static_cast<size_t>(count);
+                search._flags |= GEORADIUS_COUNT;
+                if (left >= 2) {
+                    sstring any { args._args[i + 1].c_str(), args._args[i + 1].size() };
+                    std::transform(any.begin(), any.end(), any.begin(), ::tolower);
+                    if (any == "any") {
+                        search._flags |= GEOSEARCH_ANY;
+                        ++i;
+                    }
+                }
+            }
+            else if (o == "any") {
+                return &msg_geo_any_err;
+            }
+            else if (o == "withcoord" && !store) {
+                search._flags |= GEORADIUS_WITHCOORD;
+            }
+            else if (o == "withdist" && !store) {
+                search._flags |= GEORADIUS_WITHDIST;
+            }
+            else if (o == "withhash" && !store) {
+                search._flags |= GEORADIUS_WITHHASH;
+            }
+            else if (o == "storedist" && store) {
+                search._flags |= GEORADIUS_STORE_DIST;
+            }
+            else {
+                return &msg_syntax_err;
+            }
+        }
+    } catch (const std::exception&) {
+        return &msg_syntax_err;
+    }
+    if (!from) {
+        return &msg_geo_from_err;
+    }
+    if (!by) {
+        return &msg_geo_by_err;
+    }
+    if ((search._flags & GEORADIUS_ASC) && (search._flags & GEORADIUS_DESC)) {
+        return &msg_syntax_err;
+    }
+    geo::to_meters(shape._radius, search._flags);
+    geo::to_meters(shape._width, search._flags);
+    geo::to_meters(shape._height, search._flags);
+    if (shape._radius < 0 || shape._width < 0 || shape._height < 0) {
+        return &msg_syntax_err;
+    }
+    return nullptr;
+}
+
+future<> redis_service::geosearch(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 1) {
+        return out.write(msg_syntax_err);
+    }
+    auto search = make_lw_shared<geo_search_args>();
+    auto err = parse_geosearch_args(args, 1, false, *search);
+    if (err) {
+        return out.write(*err);
+    }
+    redis_key rk { args._args[0] };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::geosearch, std::move(rk), std::cref(*search)).then([search, &out] (auto&& result) {
+        if (result->_status == REDIS_WRONG_TYPE) {
+            return out.write(msg_type_err);
+        }
+        if (result->_status == REDIS_ERR) {
+            return out.write(msg_geo_member_err);
+        }
+        return reply_builder::build_local(out, result->_points, search->_flags);
+    });
+}
+
+// The source and the destination may be owned by the different shards, the points are
+// searched on the shard of the source, and stored by the shard of the destination.
+future<> redis_service::geosearchstore(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 2) {
+        return out.write(msg_syntax_err);
+    }
+    auto search = make_lw_shared<geo_search_args>();
+    auto err = parse_geosearch_args(args, 2, true, *search);
+    if (err) {
+        return out.write(*err);
+    }
+    redis_key source { args._args[1] };
+    auto cpu = get_cpu(source);
+    return get_database().invoke_on(cpu, &database::geosearch, std::move(source), std::cref(*search)).then([this, search, &args, &out] (auto&& result) {
+        if (result->_status == REDIS_WRONG_TYPE) {
+            return out.write(msg_type_err);
+        }
+        if (result->_status == REDIS_ERR) {
+            return out.write(msg_geo_member_err);
+        }
+        if (result->_status == REDIS_NONE) {
+            return out.write(msg_zero);
+        }
+        auto points = make_lw_shared<geo_search_result_ptr>(std::move(result));
+        redis_key dest { args._args[0] };
+        auto dest_cpu = get_cpu(dest);
+        return get_database().invoke_on(dest_cpu, &database::geo_store, std::move(dest), std::cref(**points), search->_flags).then([points, &out] (auto&& m) {
+            return out.write(std::move(*m));
+        });
+    });
+}
+
+static bool parse_bit_offset(const bytes& arg, size_t& offset)
+{
+    try {
+        if (arg.empty() || arg[0] == '-') {
+            return false;
+        }
+        offset = std::stoull(arg.c_str());
+    } catch (const std::exception&) {
+        return false;
+    }
+    return offset < roaring_lsa::MAX_BITS;
+}
+
+future<> redis_service::sadd(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 2) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    for (size_t i = 1; i < args._args_count; ++i) {
+        args._tmp_keys.emplace_back(std::move(args._args[i]));
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::sadd, std::move(rk), std::ref(args._tmp_keys)).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::srem(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 2) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    for (size_t i = 1; i < args._args_count; ++i) {
+        args._tmp_keys.emplace_back(std::move(args._args[i]));
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::srem, std::move(rk), std::ref(args._tmp_keys)).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::scard(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::scard, std::move(rk)).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::sismember(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    bytes& member = args._args[1];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::sismember, std::move(rk), std::cref(member)).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::srandmember(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1 && args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    int64_t count = 0;
+    bool count_given = args._args_count == 2;
+    if (count_given) {
+        auto& s = args._args[1];
+        if (!numeric_string::to_int64(s.data(), s.size(), count)) {
+            return out.write(msg_value_not_integer_err);
+        }
+        if (count == std::numeric_limits<int64_t>::min()) {
+            return out.write(msg_value_not_positive_err);
+        }
+    }
+    bytes& key = args._args[0];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::srandmember, std::move(rk), static_cast<long>(count), count_given).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::spop(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1 && args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    int64_t count = 0;
+    bool count_given = args._args_count == 2;
+    if (count_given) {
+        auto& s = args._args[1];
+        if (!numeric_string::to_int64(s.data(), s.size(), count)) {
+            return out.write(msg_value_not_integer_err);
+        }
+        if (count < 0) {
+            return out.write(msg_value_not_positive_err);
+        }
+    }
+    bytes& key = args._args[0];
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::spop, std::move(rk), static_cast<size_t>(count), count_given).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+// Parses "key cursor [MATCH pattern] [COUNT count]", returns the error message, or
+// nullptr if the options are valid.
+static const bytes* parse_scan_args(request_wrapper& args, scan_options& opts)
+{
+    auto& c = args._args[1];
+    uint64_t cursor = 0;
+    if (!numeric_string::to_uint64(c.data(), c.size(), cursor)) {
+        return &msg_invalid_cursor_err;
+    }
+    opts.cursor = static_cast<size_t>(cursor);
+    for (size_t i = 2; i < args._args_count; ++i) {
+        sstring o { args._args[i].c_str(), args._args[i].size() };
+        std::transform(o.begin(), o.end(), o.begin(), ::tolower);
+        auto left = args._args_count - i - 1;
+        if (o == "match" && left >= 1) {
+            auto& pattern = args._args[++i];
+            opts.pattern = sstring(pattern.data(), pattern.size());
+            // "*" matches every key, it is not worth filtering.
+            opts.has_pattern = opts.pattern != "*";
+        }
+        else if (o == "count" && left >= 1) {
+            auto& s = args._args[++i];
+            int64_t count = 0;
+            if (!numeric_string::to_int64(s.data(), s.size(), count)) {
+                return &msg_value_not_integer_err;
+            }
+            if (count < 1) {
+                return &msg_syntax_err;
+            }
+            opts.count = static_cast<size_t>(count);
+        }
+        else {
+            return &msg_syntax_err;
+        }
+    }
+    return nullptr;
+}
+
+future<> redis_service::scan_impl(request_wrapper& args, output_stream<char>& out, scan_func func)
+{
+    if (args._args_count < 2) {
+        return out.write(msg_syntax_err);
+    }
+    auto opts = make_lw_shared<scan_options>();
+    auto err = parse_scan_args(args, *opts);
+    if (err) {
+        return out.write(*err);
+    }
+    redis_key rk { args._args[0] };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, func, std::move(rk), std::cref(*opts)).then([opts, &out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::sscan(request_wrapper& args, output_stream<char>& out)
+{
+    return scan_impl(args, out, &database::sscan);
+}
+
+future<> redis_service::hscan(request_wrapper& args, output_stream<char>& out)
+{
+    return scan_impl(args, out, &database::hscan);
+}
+
+future<> redis_service::zscan(request_wrapper& args, output_stream<char>& out)
+{
+    return scan_impl(args, out, &database::zscan);
+}
+
+// The reply is streamed chunk by chunk (see range_stream), the next chunk is built only
+// after the previous one was written to the client, so a slow client holds one chunk.
+future<> redis_service::stream_impl(request_wrapper& args, output_stream<char>& out, lw_shared_ptr<range_stream> s, stream_func func)
+{
+    redis_key rk { args._args[0] };
+    auto cpu = get_cpu(rk);
+    return do_with(std::move(rk), [this, &out, s, cpu, func] (auto& rk) {
+        return repeat([this, &out, &rk, s, cpu, func] {
+            return get_database().invoke_on(cpu, func, std::cref(rk), std::ref(*s)).then([&out, s] (auto&& m) {
+                return out.write(std::move(*m)).then([s] {
+                    return s->_done ? stop_iteration::yes : stop_iteration::no;
+                });
+            });
+        });
+    });
+}
+
+// Parses the inclusive range "start stop" of LRANGE and ZRANGE from the argument first.
+static bool parse_range_args(request_wrapper& args, size_t first, range_stream& s)
+{
+    int64_t start = 0, end = 0;
+    auto& a = args._args[first];
+    auto& b = args._args[first + 1];
+    if (!numeric_string::to_int64(a.data(), a.size(), start) || !numeric_string::to_int64(b.data(), b.size(), end)) {
+        return false;
+    }
+    s._start = static_cast<long>(start);
+    s._end = static_cast<long>(end);
+    return true;
+}
+
+future<> redis_service::smembers(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1) {
+        return out.write(msg_syntax_err);
+    }
+    return stream_impl(args, out, make_lw_shared<range_stream>(), &database::smembers_chunk);
+}
+
+future<> redis_service::hgetall(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1) {
+        return out.write(msg_syntax_err);
+    }
+    return stream_impl(args, out, make_lw_shared<range_stream>(), &database::hgetall_chunk);
+}
+
+future<> redis_service::lrange(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 3) {
+        return out.write(msg_syntax_err);
+    }
+    auto s = make_lw_shared<range_stream>();
+    if (!parse_range_args(args, 1, *s)) {
+        return out.write(msg_value_not_integer_err);
+    }
+    return stream_impl(args, out, s, &database::lrange_chunk);
+}
+
+future<> redis_service::zrange(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 3 && args._args_count != 4) {
+        return out.write(msg_syntax_err);
+    }
+    auto s = make_lw_shared<range_stream>();
+    if (args._args_count == 4) {
+        sstring o { args._args[3].c_str(), args._args[3].size() };
+        std::transform(o.begin(), o.end(), o.begin(), ::tolower);
+        if (o != "withscores") {
+            return out.write(msg_syntax_err);
+        }
+        s->_with_scores = true;
+    }
+    if (!parse_range_args(args, 1, *s)) {
+        return out.write(msg_value_not_integer_err);
+    }
+    return stream_impl(args, out, s, &database::zrange_chunk);
+}
+
+future<> redis_service::setbit(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 3) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    size_t offset = 0;
+    if (!parse_bit_offset(args._args[1], offset)) {
+        return out.write(msg_bit_offset_err);
+    }
+    bytes& v = args._args[2];
+    if (v.size() != 1 || (v[0] != '0' && v[0] != '1')) {
+        return out.write(msg_bit_value_err);
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::setbit, std::move(rk), offset, v[0] == '1').then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::getbit(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    size_t offset = 0;
+    if (!parse_bit_offset(args._args[1], offset)) {
+        return out.write(msg_bit_offset_err);
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::getbit, std::move(rk), offset).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::bitcount(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1 && args._args_count != 3) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    long start = 0, end = -1;
+    if (args._args_count == 3) {
+        try {
+            start = std::stol(args._args[1].c_str());
+            end = std::stol(args._args[2].c_str());
+        } catch (const std::exception&) {
+            return out.write(msg_syntax_err);
+        }
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::bitcount, std::move(rk), start, end).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::bitpos(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 2 || args._args_count > 4) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    bytes& b = args._args[1];
+    if (b.size() != 1 || (b[0] != '0' && b[0] != '1')) {
+        return out.write(msg_bit_arg_err);
+    }
+    bool bit = b[0] == '1';
+    long start = 0, end = -1;
+    bool end_given = args._args_count == 4;
+    try {
+        if (args._args_count > 2) {
+            start = std::stol(args._args[2].c_str());
+        }
+        if (end_given) {
+            end = std::stol(args._args[3].c_str());
+        }
+    } catch (const std::exception&) {
+        return out.write(msg_syntax_err);
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::bitpos, std::move(rk), bit, start, end, end_given).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+struct redis_service::bitop_state {
+    bitop_type _op;
+    // the destination, then the sources.
+    std::vector<redis_key> _keys;
+    std::vector<bitmap_meta> _metas;
+    size_t _size = 0;
+    uint64_t _stage = 0;
+    bool _staged = false;
+    std::vector<foreign_ptr<lw_shared_ptr<bytes>>> _sources;
+    bytes _chunk;
+    // the state of the BITOP on the roaring bitmaps.
+    uint32_t _next_key = 0;
+    std::vector<roaring_chunk_ptr> _containers;
+    std::vector<uint8_t> _result;
+};
+
+// Fetches the chunk of every source from the owning shards, then the coordinator
+// applies the operation and sends the result to the staging string of the destination.
+future<> redis_service::bitop_chunk(lw_shared_ptr<bitop_state> state, size_t offset, unsigned dest_cpu)
+{
+    auto length = std::min(BITMAP_CHUNK_BYTES, state->_size - offset);
+    auto sources = state->_keys.size() - 1;
+    state->_sources.clear();
+    state->_sources.resize(sources);
+    return parallel_for_each(boost::irange<size_t>(0, sources), [this, state, offset, length] (size_t i) {
+        auto& rk = state->_keys[i + 1];
+        if (state->_metas[i + 1]._status != REDIS_OK || state->_metas[i + 1]._size <= offset) {
+            return make_ready_future<>();
+        }
+        return get_database().invoke_on(get_cpu(rk), &database::bitmap_fetch, std::cref(rk), offset, length).then([state, i] (auto&& data) {
+            state->_sources[i] = std::move(data);
+        });
+    }).then([state, offset, length, dest_cpu] {
+        // the sources which are shorter than the chunk are padded with zero bytes.
+        state->_chunk = bytes(length, 0);
+        auto dest = reinterpret_cast<uint8_t*>(state->_chunk.begin());
+        for (size_t i = 0; i < state->_sources.size(); ++i) {
+            auto& source = state->_sources[i];
+            size_t n = source ? source->size() : 0;
+            auto src = n > 0 ? reinterpret_cast<const uint8_t*>(source->begin()) : nullptr;
+            if (i == 0) {
+                if (n > 0) {
+                    memcpy(dest, src, n);
+                }
+                if (state->_op == bitop_type::NOT) {
+                    bits_operation::apply(bitop_type::NOT, dest, nullptr, length);
+                }
+                continue;
+            }
+            bits_operation::apply(state->_op, dest, src, n);
+            if (state->_op == bitop_type::AND) {
+                memset(dest + n, 0, length - n);
+            }
+        }
+        return get_database().invoke_on(dest_cpu, &database::bitmap_stage_write, state->_stage, offset, std::cref(state->_chunk));
+    });
+}
+
+// The containers of 1MB of the bitmap are combined at a time.
+static constexpr const uint32_t ROARING_CHUNK_CONTAINERS = BITMAP_CHUNK_BYTES / roaring_lsa::CONTAINER_BYTES;
+
+// Fetches the serialized containers of the sources in the next keys range, the coordinator
+// combines them and appends the result to the staging roaring bitmap of the destination.
+future<> redis_service::bitop_roaring_chunk(lw_shared_ptr<bitop_state> state, unsigned dest_cpu)
+{
+    auto first_key = state->_next_key;
+    auto last_key = first_key + ROARING_CHUNK_CONTAINERS;
+    auto sources = state->_keys.size() - 1;
+    state->_containers.clear();
+    state->_containers.resize(sources);
+    return parallel_for_each(boost::irange<size_t>(0, sources), [this, state, first_key, last_key] (size_t i) {
+        auto& rk = state->_keys[i + 1];
+        if (state->_metas[i + 1]._status != REDIS_OK) {
+            return make_ready_future<>();
+        }
+        return get_database().invoke_on(get_cpu(rk), &database::roaring_fetch, std::cref(rk), first_key, last_key).then([state, i] (auto&& c) {
+            state->_containers[i] = std::move(c);
+        });
+    }).then([state, first_key, last_key, dest_cpu] {
+        std::vector<std::pair<const uint8_t*, size_t>> sources;
+        long next = -1;
+        for (auto& c : state->_containers) {
+            if (!c) {
+                sources.emplace_back(nullptr, 0);
+                continue;
+            }
+            sources.emplace_back(c->_data.data(), c->_data.size());
+            if (c->_next >= 0 && (next < 0 || c->_next < next)) {
+                next = c->_next;
+            }
+        }
+        state->_result.clear();
+        roaring_lsa::combine(state->_op, sources, first_key, last_key, state->_size, state->_result);
+        // NOT visits all keys, the others skip the keys which no source has.
+        if (state->_op == bitop_type::NOT) {
+            state->_next_key = last_key;
+        }
+        else {
+            state->_next_key = next < 0 ? std::numeric_limits<uint32_t>::max() : static_cast<uint32_t>(next);
+        }
+        if (state->_result.empty()) {
+            return make_ready_future<>();
+        }
+        return get_database().invoke_on(dest_cpu, &database::roaring_stage_append, state->_stage, std::cref(state->_result));
+    });
+}
+
+// BITOP on the roaring bitmaps never materializes the strings, only the containers
+// which exist in the sources are transferred between the shards.
+future<> redis_service::bitop_roaring(lw_shared_ptr<bitop_state> state, unsigned dest_cpu)
+{
+    return get_database().invoke_on(dest_cpu, &database::roaring_stage_begin).then([this, state, dest_cpu] (uint64_t stage) {
+        state->_stage = stage;
+        state->_staged = true;
+        auto end_key = static_cast<uint32_t>((state->_size + roaring_lsa::CONTAINER_BYTES - 1) / roaring_lsa::CONTAINER_BYTES);
+        return repeat([this, state, dest_cpu, end_key] {
+            if (state->_next_key >= end_key) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            return bitop_roaring_chunk(state, dest_cpu).then([] {
+                return stop_iteration::no;
+            });
+        });
+    }).then([state, dest_cpu] {
+        return get_database().invoke_on(dest_cpu, &database::roaring_stage_commit, std::cref(state->_keys[0]), state->_stage, state->_size);
+    });
+}
+
+// BITOP is not atomic: the sources are read chunk by chunk and the command yields between
+// the chunks, so a concurrent write to a source may be partially observed. The destination
+// is replaced only once the whole result was written.
+future<> redis_service::bitop(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 3) {
+        return out.write(msg_syntax_err);
+    }
+    sstring o { args._args[0].c_str(), args._args[0].size() };
+    std::transform(o.begin(), o.end(), o.begin(), ::tolower);
+    auto state = make_lw_shared<bitop_state>();
+    if (o == "and") {
+        state->_op = bitop_type::AND;
+    }
+    else if (o == "or") {
+        state->_op = bitop_type::OR;
+    }
+    else if (o == "xor") {
+        state->_op = bitop_type::XOR;
+    }
+    else if (o == "not") {
+        state->_op = bitop_type::NOT;
+        if (args._args_count != 3) {
+            return out.write(msg_bitop_not_err);
+        }
+    }
+    else {
+        return out.write(msg_syntax_err);
+    }
+    for (size_t i = 1; i < args._args_count; ++i) {
+        state->_keys.emplace_back(redis_key { args._args[i] });
+    }
+    state->_metas.resize(state->_keys.size());
+    auto dest_cpu = get_cpu(state->_keys[0]);
+    return parallel_for_each(boost::irange<size_t>(1, state->_keys.size()), [this, state] (size_t i) {
+        auto& rk = state->_keys[i];
+        return get_database().invoke_on(get_cpu(rk), &database::bitmap_describe, std::cref(rk)).then([state, i] (bitmap_meta meta) {
+            state->_metas[i] = meta;
+        });
+    }).then([this, state, dest_cpu, &out] {
+        bool roaring = true;
+        for (size_t i = 1; i < state->_metas.size(); ++i) {
+            auto& meta = state->_metas[i];
+            if (meta._status == REDIS_WRONG_TYPE) {
+                return out.write(msg_type_err);
+            }
+            if (meta._status == REDIS_OK) {
+                roaring = roaring && meta._roaring;
+                state->_size = std::max(state->_size, meta._size);
+            }
+        }
+        if (state->_size == 0) {
+            // the destination is removed if the result is empty, as redis does.
+            return get_database().invoke_on(dest_cpu, &database::del, std::cref(state->_keys[0])).then([&out] (auto&&) {
+                return out.write(msg_zero);
+            });
+        }
+        auto done = roaring ? bitop_roaring(state, dest_cpu) : get_database().invoke_on(dest_cpu, &database::bitmap_stage_begin, state->_size).then([this, state, dest_cpu] (uint64_t stage) {
+            state->_stage = stage;
+            state->_staged = true;
+            auto chunks = (state->_size + BITMAP_CHUNK_BYTES - 1) / BITMAP_CHUNK_BYTES;
+            return do_for_each(boost::irange<size_t>(0, chunks), [this, state, dest_cpu] (size_t chunk) {
+                return bitop_chunk(state, chunk * BITMAP_CHUNK_BYTES, dest_cpu);
+            });
+        }).then([state, dest_cpu] {
+            return get_database().invoke_on(dest_cpu, &database::bitmap_stage_commit, std::cref(state->_keys[0]), state->_stage);
+        });
+        return done.then([state, &out] {
+            state->_staged = false;
+            return reply_builder::build_local(out, state->_size);
+        }).handle_exception([state, dest_cpu, &out] (auto ep) {
+            redis_log.warn("failed to run BITOP: {}", ep);
+            auto abort = state->_staged ? get_database().invoke_on(dest_cpu, &database::bitmap_stage_abort, state->_stage) : make_ready_future<>();
+            return abort.then([&out] {
+                return out.write(msg_err);
+            });
+        });
+    });
+}
+
+static constexpr const size_t SET_ALGEBRA_CHUNK_MEMBERS = 1024;
+
+// Yields if the task quota of the core is used up, so a long command never starves
+// the other requests of the core.
+static future<> maybe_yield()
+{
+    return need_preempt() ? later() : make_ready_future<>();
+}
+
+struct redis_service::set_algebra_state {
+    set_algebra_op _op;
+    // the destination, then the sources.
+    std::vector<redis_key> _keys;
+    std::vector<set_meta> _metas;
+    // the sources which are read chunk by chunk: the smallest one for SINTERSTORE, the
+    // first one for SDIFFSTORE, and all of them for SUNIONSTORE.
+    std::vector<size_t> _drivers;
+    // the sources which are probed for the members of a chunk of the driver.
+    std::vector<size_t> _probes;
+    size_t _driver = 0;
+    size_t _cursor = 0;
+    uint64_t _stage = 0;
+    bool _staged = false;
+    set_chunk_ptr _chunk;
+    std::vector<set_probe_ptr> _present;
+    std::vector<sstring> _result;
+};
+
+// Runs one chunk of the driver: a member is kept by SINTERSTORE if all probes have it,
+// by SDIFFSTORE if none of them has it, and by SUNIONSTORE always.
+future<stop_iteration> redis_service::set_algebra_chunk(lw_shared_ptr<set_algebra_state> state, unsigned dest_cpu)
+{
+    if (state->_driver >= state->_drivers.size()) {
+        return make_ready_future<stop_iteration>(stop_iteration::yes);
+    }
+    auto& rk = state->_keys[state->_drivers[state->_driver]];
+    return get_database().invoke_on(get_cpu(rk), &database::set_fetch, std::cref(rk), state->_cursor, SET_ALGEBRA_CHUNK_MEMBERS).then([this, state] (set_chunk_ptr chunk) {
+        state->_chunk = std::move(chunk);
+        state->_present.clear();
+        state->_present.resize(state->_probes.size());
+        if (state->_chunk->_members.empty()) {
+            return make_ready_future<>();
+        }
+        return parallel_for_each(boost::irange<size_t>(0, state->_probes.size()), [this, state] (size_t i) {
+            auto& probe = state->_keys[state->_probes[i]];
+            return get_database().invoke_on(get_cpu(probe), &database::set_probe, std::cref(probe), std::cref(state->_chunk->_members)).then([state, i] (set_probe_ptr present) {
+                state->_present[i] = std::move(present);
+            });
+        });
+    }).then([state, dest_cpu] {
+        auto& members = state->_chunk->_members;
+        const bool wanted = state->_op == set_algebra_op::INTER;
+        state->_result.clear();
+        for (size_t j = 0; j < members.size(); ++j) {
+            auto keep = std::all_of(state->_present.begin(), state->_present.end(), [j, wanted] (const set_probe_ptr& present) {
+                return ((*present)[j] != 0) == wanted;
+            });
+            if (keep) {
+                state->_result.push_back(members[j]);
+            }
+        }
+        state->_cursor = state->_chunk->_next;
+        if (state->_cursor == 0) {
+            ++state->_driver;
+        }
+        if (state->_result.empty()) {
+            return make_ready_future<>();
+        }
+        return get_database().invoke_on(dest_cpu, &database::set_stage_append, state->_stage, std::cref(state->_result));
+    }).then([] {
+        return maybe_yield();
+    }).then([] {
+        return stop_iteration::no;
+    });
+}
+
+// SINTERSTORE, SUNIONSTORE and SDIFFSTORE are not atomic: the sources are read chunk by
+// chunk and the command yields between the chunks, so a concurrent write to a source may
+// be partially observed. The destination is replaced only once the whole result is staged.
+future<> redis_service::set_algebra_store(request_wrapper& args, output_stream<char>& out, set_algebra_op op)
+{
+    if (args._args_count < 2) {
+        return out.write(msg_syntax_err);
+    }
+    auto state = make_lw_shared<set_algebra_state>();
+    state->_op = op;
+    for (size_t i = 0; i < args._args_count; ++i) {
+        state->_keys.emplace_back(redis_key { args._args[i] });
+    }
+    state->_metas.resize(state->_keys.size());
+    auto dest_cpu = get_cpu(state->_keys[0]);
+    return parallel_for_each(boost::irange<size_t>(1, state->_keys.size()), [this, state] (size_t i) {
+        auto& rk = state->_keys[i];
+        return get_database().invoke_on(get_cpu(rk), &database::set_describe, std::cref(rk)).then([state, i] (set_meta meta) {
+            state->_metas[i] = meta;
+        });
+    }).then([this, state, dest_cpu, &out] {
+        auto& metas = state->_metas;
+        bool empty = false;
+        for (size_t i = 1; i < metas.size(); ++i) {
+            if (metas[i]._status == REDIS_WRONG_TYPE) {
+                return out.write(msg_type_err);
+            }
+        }
+        if (state->_op == set_algebra_op::INTER) {
+            // the smallest source drives the intersection, the others are only probed.
+            size_t driver = 1;
+            for (size_t i = 1; i < metas.size(); ++i) {
+                if (metas[i]._status == REDIS_NONE) {
+                    empty = true;
+                }
+                if (metas[i]._size < metas[driver]._size) {
+                    driver = i;
+                }
+            }
+            state->_drivers.push_back(driver);
+            for (size_t i = 1; i < metas.size(); ++i) {
+                if (i != driver) {
+                    state->_probes.push_back(i);
+                }
+            }
+        }
+        else if (state->_op == set_algebra_op::DIFF) {
+            empty = metas[1]._status == REDIS_NONE;
+            state->_drivers.push_back(1);
+            for (size_t i = 2; i < metas.size(); ++i) {
+                if (metas[i]._status == REDIS_OK) {
+                    state->_probes.push_back(i);
+                }
+            }
+        }
+        else {
+            for (size_t i = 1; i < metas.size(); ++i) {
+                if (metas[i]._status == REDIS_OK) {
+                    state->_drivers.push_back(i);
+                }
+            }
+            empty = state->_drivers.empty();
+        }
+        if (empty) {
+            // the destination is removed if the result is empty, as redis does.
+            return get_database().invoke_on(dest_cpu, &database::del, std::cref(state->_keys[0])).then([&out] (auto&&) {
+                return out.write(msg_zero);
+            });
+        }
+        return get_database().invoke_on(dest_cpu, &database::set_stage_begin).then([this, state, dest_cpu] (uint64_t stage) {
+            state->_stage = stage;
+            state->_staged = true;
+            return repeat([this, state, dest_cpu] {
+                return set_algebra_chunk(state, dest_cpu);
+            });
+        }).then([state, dest_cpu] {
+            return get_database().invoke_on(dest_cpu, &database::set_stage_commit, std::cref(state->_keys[0]), state->_stage);
+        }).then([state, &out] (size_t size) {
+            state->_staged = false;
+            return reply_builder::build_local(out, size);
+        }).handle_exception([state, dest_cpu, &out] (auto ep) {
+            redis_log.warn("failed to run the set algebra command: {}", ep);
+            auto abort = state->_staged ? get_database().invoke_on(dest_cpu, &database::set_stage_abort, state->_stage) : make_ready_future<>();
+            return abort.then([&out] {
+                return out.write(msg_err);
+            });
+        });
+    });
+}
+
+future<> redis_service::sinterstore(request_wrapper& args, output_stream<char>& out)
+{
+    return set_algebra_store(args, out, set_algebra_op::INTER);
+}
+
+future<> redis_service::sunionstore(request_wrapper& args, output_stream<char>& out)
+{
+    return set_algebra_store(args, out, set_algebra_op::UNION);
+}
+
+future<> redis_service::sdiffstore(request_wrapper& args, output_stream<char>& out)
+{
+    return set_algebra_store(args, out, set_algebra_op::DIFF);
+}
+
+// the expected number of the members of a window of ZUNIONSTORE and ZINTERSTORE.
+static constexpr const size_t ZSET_WINDOW_MEMBERS = 1024;
+
+struct redis_service::zset_algebra_state {
+    bool _inter = false;
+    int _aggregate = ZAGGREGATE_SUM;
+    // the destination, then the sources.
+    std::vector<redis_key> _keys;
+    std::vector<double> _weights;
+    std::vector<set_meta> _metas;
+    // the sources which are owned by every shard, and the shards which own any source.
+    std::vector<std::vector<zset_source>> _shard_sources;
+    std::vector<unsigned> _shards;
+    std::vector<zset_items_ptr> _items;
+    size_t _windows = 1;
+    size_t _window = 0;
+    uint64_t _stage = 0;
+    bool _staged = false;
+};
+
+// The members are hashed uniformly, so the hashes are split to the windows of the same
+// width, and a window holds about ZSET_WINDOW_MEMBERS members. The shards fetch a window
+// in parallel, and the destination merges their results.
+future<stop_iteration> redis_service::zset_algebra_window(lw_shared_ptr<zset_algebra_state> state, unsigned dest_cpu)
+{
+    if (state->_window >= state->_windows) {
+        return make_ready_future<stop_iteration>(stop_iteration::yes);
+    }
+    const size_t width = std::numeric_limits<size_t>::max() / state->_windows;
+    const size_t first = state->_window == 0 ? 0 : state->_window * width + 1;
+    const size_t last = state->_window + 1 == state->_windows ? std::numeric_limits<size_t>::max() : (state->_window + 1) * width;
+    state->_items.clear();
+    state->_items.resize(state->_shards.size());
+    return parallel_for_each(boost::irange<size_t>(0, state->_shards.size()), [this, state, first, last] (size_t i) {
+        auto cpu = state->_shards[i];
+        return get_database().invoke_on(cpu, &database::zset_fetch_window, std::cref(state->_shard_sources[cpu]), first, last, state->_aggregate).then([state, i] (zset_items_ptr items) {
+            state->_items[i] = std::move(items);
+        });
+    }).then([state, dest_cpu] {
+        uint32_t required = state->_inter ? static_cast<uint32_t>(state->_keys.size() - 1) : 0;
+        return get_database().invoke_on(dest_cpu, &database::zset_stage_merge, state->_stage, std::cref(state->_items), state->_aggregate, required);
+    }).then([state] {
+        state->_items.clear();
+        ++state->_window;
+        return maybe_yield();
+    }).then([] {
+        return stop_iteration::no;
+    });
+}
+
+// ZUNIONSTORE and ZINTERSTORE are not atomic, the sources are read window by window as
+// SUNIONSTORE does, and the destination is replaced once the whole result is staged.
+future<> redis_service::zset_algebra_store(request_wrapper& args, output_stream<char>& out, bool inter)
+{
+    if (args._args_count < 3) {
+        return out.write(msg_syntax_err);
+    }
+    int64_t numkeys = 0;
+    auto& n = args._args[1];
+    if (!numeric_string::to_int64(n.data(), n.size(), numkeys)) {
+        return out.write(msg_value_not_integer_err);
+    }
+    if (numkeys < 1) {
+        return out.write(msg_zset_numkeys_err);
+    }
+    if (static_cast<size_t>(numkeys) > args._args_count - 2) {
+        return out.write(msg_syntax_err);
+    }
+    auto state = make_lw_shared<zset_algebra_state>();
+    state->_inter = inter;
+    state->_keys.emplace_back(redis_key { args._args[0] });
+    for (size_t i = 0; i < static_cast<size_t>(numkeys); ++i) {
+        state->_keys.emplace_back(redis_key { args._args[i + 2] });
+    }
+    state->_weights.resize(numkeys, 1.0);
+    for (size_t i = numkeys + 2; i < args._args_count; ++i) {
+        sstring o { args._args[i].c_str(), args._args[i].size() };
+        std::transform(o.begin(), o.end(), o.begin(), ::tolower);
+        auto left = args._args_count - i - 1;
+        if (o == "weights" && left >= static_cast<size_t>(numkeys)) {
+            for (size_t j = 0; j < static_cast<size_t>(numkeys); ++j) {
+                auto& w = args._args[++i];
+                if (!numeric_string::to_double(w.data(), w.size(), state->_weights[j])) {
+                    return out.write(msg_zset_weight_err);
+                }
+            }
+        }
+        else if (o == "aggregate" && left >= 1) {
+            auto& v = args._args[++i];
+            sstring a { v.c_str(), v.size() };
+            std::transform(a.begin(), a.end(), a.begin(), ::tolower);
+            if (a == "sum") {
+                state->_aggregate = ZAGGREGATE_SUM;
+            }
+            else if (a == "min") {
+                state->_aggregate = ZAGGREGATE_MIN;
+            }
+            else if (a == "max") {
+                state->_aggregate = ZAGGREGATE_MAX;
+            }
+            else {
+                return out.write(msg_syntax_err);
+            }
+        }
+        else {
+            return out.write(msg_syntax_err);
+        }
+    }
+    state->_metas.resize(state->_keys.size());
+    auto dest_cpu = get_cpu(state->_keys[0]);
+    return parallel_for_each(boost::irange<size_t>(1, state->_keys.size()), [this, state] (size_t i) {
+        auto& rk = state->_keys[i];
+        return get_database().invoke_on(get_cpu(rk), &database::zset_describe, std::cref(rk)).then([state, i] (set_meta meta) {
+            state->_metas[i] = meta;
+        });
+    }).then([this, state, dest_cpu, &out] {
+        size_t total = 0;
+        bool empty = false;
+        state->_shard_sources.resize(smp::count);
+        for (size_t i = 1; i < state->_metas.size(); ++i) {
+            auto& meta = state->_metas[i];
+            if (meta._status == REDIS_WRONG_TYPE) {
+                return out.write(msg_type_err);
+            }
+            if (meta._status == REDIS_NONE) {
+                empty = empty || state->_inter;
+                continue;
+            }
+            total += meta._size;
+            auto cpu = get_cpu(state->_keys[i]);
+            if (state->_shard_sources[cpu].empty()) {
+                state->_shards.push_back(cpu);
+            }
+            state->_shard_sources[cpu].emplace_back(zset_source { state->_keys[i], state->_weights[i - 1] });
+        }
+        if (empty || total == 0) {
+            // the destination is removed if the result is empty, as redis does.
+            return get_database().invoke_on(dest_cpu, &database::del, std::cref(state->_keys[0])).then([&out] (auto&&) {
+                return out.write(msg_zero);
+            });
+        }
+        state->_windows = std::max(size_t(1), (total + ZSET_WINDOW_MEMBERS - 1) / ZSET_WINDOW_MEMBERS);
+        return get_database().invoke_on(dest_cpu, &database::zset_stage_begin).then([this, state, dest_cpu] (uint64_t stage) {
+            state->_stage = stage;
+            state->_staged = true;
+            return repeat([this, state, dest_cpu] {
+                return zset_algebra_window(state, dest_cpu);
+            });
+        }).then([state, dest_cpu] {
+            // the staged windows are sorted by the scores chunk by chunk, so the shard of
+            // the destination is not stalled by a large result.
+            return repeat([state, dest_cpu] {
+                return get_database().invoke_on(dest_cpu, &database::zset_stage_sort, state->_stage).then([] (bool sorted) {
+                    return sorted ? stop_iteration::yes : stop_iteration::no;
+                });
+            });
+        }).then([state, dest_cpu] {
+            return get_database().invoke_on(dest_cpu, &database::zset_stage_commit, std::cref(state->_keys[0]), state->_stage);
+        }).then([state, &out] (size_t size) {
+            state->_staged = false;
+            return reply_builder::build_local(out, size);
+        }).handle_exception([state, dest_cpu, &out] (auto ep) {
+            redis_log.warn("failed to run ZUNIONSTORE/ZINTERSTORE: {}", ep);
+            auto abort = state->_staged ? get_database().invoke_on(dest_cpu, &database::zset_stage_abort, state->_stage) : make_ready_future<>();
+            return abort.then([&out] {
+                return out.write(msg_err);
+            });
+        });
+    });
+}
+
+future<> redis_service::zunionstore(request_wrapper& args, output_stream<char>& out)
+{
+    return zset_algebra_store(args, out, false);
+}
+
+future<> redis_service::zinterstore(request_wrapper& args, output_stream<char>& out)
+{
+    return zset_algebra_store(args, out, true);
+}
+
+future<foreign_ptr<lw_shared_ptr<message>>> redis_service::push_local(const redis_key& rk, std::vector<bytes>& values, bool head)
+{
+    return get_local_database().push(rk, values, head).then([this, &rk] (auto&& m) {
+        return wake_waiters(rk).then([m = std::move(m)] () mutable {
+            return std::move(m);
+        });
+    });
+}
+
+future<foreign_ptr<lw_shared_ptr<message>>> redis_service::zadd_local(const redis_key& rk, std::unordered_map<sstring, double>& members)
+{
+    return get_local_database().zadd(rk, members).then([this, &rk] (auto&& m) {
+        return wake_waiters(rk).then([m = std::move(m)] () mutable {
+            return std::move(m);
+        });
+    });
+}
+
+future<int> redis_service::push_value_local(const redis_key& rk, pop_side side, const bytes& value, double score)
+{
+    return get_local_database().push_value(rk, side, value, score).then([this, &rk] (int status) {
+        if (status != REDIS_OK) {
+            return make_ready_future<int>(status);
+        }
+        return wake_waiters(rk).then([status] {
+            return status;
+        });
+    });
+}
+
+future<> redis_service::push_impl(request_wrapper& args, output_stream<char>& out, bool head)
+{
+    if (args._args_count < 2) {
+        return out.write(msg_syntax_err);
+    }
+    bytes& key = args._args[0];
+    for (size_t i = 1; i < args._args_count; ++i) {
+        args._tmp_keys.emplace_back(std::move(args._args[i]));
+    }
+    redis_key rk { key };
+    auto cpu = get_cpu(rk);
+    return get_redis_service().invoke_on(cpu, &redis_service::push_local, std::move(rk), std::ref(args._tmp_keys), head).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::lpush(request_wrapper& args, output_stream<char>& out)
+{
+    return push_impl(args, out, true);
+}
+
+future<> redis_service::rpush(request_wrapper& args, output_stream<char>& out)
+{
+    return push_impl(args, out, false);
+}
+
+future<> redis_service::lpop(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1) {
+        return out.write(msg_syntax_err);
+    }
+    redis_key rk { args._args[0] };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::pop, std::move(rk), true).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::rpop(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 1) {
+        return out.write(msg_syntax_err);
+    }
+    redis_key rk { args._args[0] };
+    auto cpu = get_cpu(rk);
+    return get_database().invoke_on(cpu, &database::pop, std::move(rk), false).then([&out] (auto&& m) {
+        return out.write(std::move(*m));
+    });
+}
+
+future<> redis_service::zadd(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 3 || (args._args_count - 1) % 2 != 0) {
+        return out.write(msg_syntax_err);
+    }
+    std::unordered_map<sstring, double> members;
+    for (size_t i = 1; i < args._args_count; i += 2) {
+        auto& s = args._args[i];
+        auto& m = args._args[i + 1];
+        double score = 0;
+        if (!numeric_string::to_double(s.data(), s.size(), score) || std::isnan(score)) {
+            return out.write(msg_value_not_float_err);
+        }
+        members[sstring(m.data(), m.size())] = score;
+    }
+    redis_key rk { args._args[0] };
+    auto cpu = get_cpu(rk);
+    return do_with(std::move(rk), std::move(members), [cpu, &out] (auto& rk, auto& members) {
+        return get_redis_service().invoke_on(cpu, &redis_service::zadd_local, std::cref(rk), std::ref(members)).then([&out] (auto&& m) {
+            return out.write(std::move(*m));
+        });
+    });
+}
+
+// The timeout of the blocking commands is in seconds, 0 blocks forever.
+static const bytes* parse_timeout(const bytes& arg, double& timeout)
+{
+    if (!numeric_string::to_double(arg.data(), arg.size(), timeout) || std::isnan(timeout) || std::isinf(timeout)) {
+        return &msg_timeout_err;
+    }
+    if (timeout < 0) {
+        return &msg_timeout_negative_err;
+    }
+    return nullptr;
+}
+
+future<lw_shared_ptr<redis_service::blocked_client>> redis_service::blocking_pop(std::vector<bytes>& keys, pop_side side, double timeout, output_stream<char>& out)
+{
+    auto c = make_lw_shared<blocked_client>();
+    c->_side = side;
+    c->_out = &out;
+    for (auto& key : keys) {
+        c->_keys.emplace_back(redis_key { key });
+    }
+    // the keys are tried in order, the client blocks only if all of them are empty.
+    return do_with(size_t { 0 }, [this, c] (size_t& i) {
+        return repeat([this, c, &i] {
+            if (i == c->_keys.size()) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto& rk = c->_keys[i++];
+            return get_database().invoke_on(get_cpu(rk), &database::pop_value, std::cref(rk), c->_side).then([c, &rk] (auto&& p) {
+                if (p->_status == REDIS_NONE) {
+                    return stop_iteration::no;
+                }
+                c->_status = p->_status;
+                if (p->_status == REDIS_OK) {
+                    c->_served = true;
+                    c->_key = rk.key();
+                    c->_value = std::move(p->_value);
+                    c->_score = p->_score;
+                }
+                return stop_iteration::yes;
+            });
+        });
+    }).then([this, c, timeout] {
+        if (c->_served || c->_status != REDIS_OK) {
+            return make_ready_future<lw_shared_ptr<blocked_client>>(c);
+        }
+        auto id = _next_blocked_id++;
+        auto cpu = engine().cpu_id();
+        c->_id = id;
+        _blocked_clients.emplace(id, c);
+        if (timeout > 0) {
+            c->_timer.set_callback([this, id] { expire_blocked(id); });
+            c->_timer.arm(std::chrono::duration_cast<steady_clock_type::duration>(std::chrono::duration<double>(timeout)));
+        }
+        return parallel_for_each(c->_keys.begin(), c->_keys.end(), [this, c, cpu, id] (const redis_key& rk) {
+            return get_redis_service().invoke_on(get_cpu(rk), &redis_service::block_on, std::cref(rk), cpu, id, c->_side);
+        }).then([c] {
+            return c->_wakeup.get_future();
+        }).then([this, c, cpu, id] {
+            // the client leaves the queues of the other keys.
+            return parallel_for_each(c->_keys.begin(), c->_keys.end(), [this, cpu, id] (const redis_key& rk) {
+                return get_redis_service().invoke_on(get_cpu(rk), &redis_service::unblock_on, std::cref(rk), cpu, id);
+            });
+        }).then([c] {
+            return c;
+        });
+    });
+}
+
+future<> redis_service::block_on(const redis_key& rk, unsigned cpu, uint64_t id, pop_side side)
+{
+    _wait_queues[rk.key()].push_back(blocked_waiter { cpu, id, side });
+    // the element which was pushed after the client tried the key is popped at once.
+    return wake_waiters(rk);
+}
+
+future<> redis_service::unblock_on(const redis_key& rk, unsigned cpu, uint64_t id)
+{
+    auto it = _wait_queues.find(rk.key());
+    if (it != _wait_queues.end()) {
+        auto& waiters = it->second;
+        waiters.erase(std::remove_if(waiters.begin(), waiters.end(), [cpu, id] (const blocked_waiter& w) {
+            return w._cpu == cpu && w._id == id;
+        }), waiters.end());
+        if (waiters.empty()) {
+            _wait_queues.erase(it);
+        }
+    }
+    return make_ready_future<>();
+}
+
+future<> redis_service::wake_waiters(const redis_key& rk)
+{
+    if (_wait_queues.find(rk.key()) == _wait_queues.end()) {
+        return make_ready_future<>();
+    }
+    auto key = make_lw_shared<redis_key>(rk);
+    return repeat([this, key] {
+        auto it = _wait_queues.find(key->key());
+        if (it == _wait_queues.end()) {
+            return make_ready_future<stop_iteration>(stop_iteration::yes);
+        }
+        auto w = it->second.front();
+        it->second.pop_front();
+        if (it->second.empty()) {
+            _wait_queues.erase(it);
+        }
+        return get_local_database().pop_value(*key, w._side).then([this, key, w] (auto&& p) {
+            if (p->_status == REDIS_NONE) {
+                // nothing to pop, the waiter keeps its place.
+                _wait_queues[key->key()].push_front(w);
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            if (p->_status != REDIS_OK) {
+                // the key holds the other type for this waiter (a sorted set for BLPOP, or
+                // a list for BZPOPMIN), it gets the error and the next waiters are served.
+                return get_redis_service().invoke_on(w._cpu, &redis_service::fail_blocked, w._id, p->_status).then([] {
+                    return stop_iteration::no;
+                });
+            }
+            auto value = make_lw_shared<popped_value>(std::move(*p));
+            return get_redis_service().invoke_on(w._cpu, &redis_service::unblock, w._id, key->key(), value->_value, value->_score).then([key, w, value] (bool served) {
+                if (served) {
+                    return make_ready_future<stop_iteration>(stop_iteration::no);
+                }
+                // the waiter was gone, the element is given back to the same end, and
+                // the next waiter is served by it.
+                return get_local_database().push_value(*key, w._side, value->_value, value->_score).then([] (int) {
+                    return stop_iteration::no;
+                });
+            });
+        });
+    });
+}
+
+future<bool> redis_service::unblock(uint64_t id, bytes key, bytes value, double score)
+{
+    auto it = _blocked_clients.find(id);
+    if (it == _blocked_clients.end()) {
+        return make_ready_future<bool>(false);
+    }
+    auto c = it->second;
+    _blocked_clients.erase(it);
+    c->_timer.cancel();
+    c->_served = true;
+    c->_key = std::move(key);
+    c->_value = std::move(value);
+    c->_score = score;
+    c->_wakeup.set_value();
+    return make_ready_future<bool>(true);
+}
+
+future<> redis_service::fail_blocked(uint64_t id, int status)
+{
+    auto it = _blocked_clients.find(id);
+    if (it != _blocked_clients.end()) {
+        auto c = it->second;
+        _blocked_clients.erase(it);
+        c->_timer.cancel();
+        c->_status = status;
+        c->_wakeup.set_value();
+    }
+    return make_ready_future<>();
+}
+
+void redis_service::expire_blocked(uint64_t id)
+{
+    auto it = _blocked_clients.find(id);
+    if (it == _blocked_clients.end()) {
+        return;
+    }
+    auto c = it->second;
+    _blocked_clients.erase(it);
+    c->_timer.cancel();
+    c->_wakeup.set_value();
+}
+
+future<> redis_service::disconnect(output_stream<char>& out)
+{
+    // the clients are released as if they timed out, so the elements pushed later are
+    // given to the other waiters instead of the closed connection.
+    std::vector<uint64_t> ids;
+    for (auto& c : _blocked_clients) {
+        if (c.second->_out == &out) {
+            ids.push_back(c.first);
+        }
+    }
+    for (auto id : ids) {
+        expire_blocked(id);
+    }
+    return make_ready_future<>();
+}
+
+future<> redis_service::blocking_pop_impl(request_wrapper& args, output_stream<char>& out, pop_side side)
+{
+    if (args._args_count < 2) {
+        return out.write(msg_syntax_err);
+    }
+    double timeout = 0;
+    if (auto err = parse_timeout(args._args[args._args_count - 1], timeout)) {
+        return out.write(*err);
+    }
+    for (size_t i = 0; i + 1 < args._args_count; ++i) {
+        args._tmp_keys.emplace_back(std::move(args._args[i]));
+    }
+    return blocking_pop(args._tmp_keys, side, timeout, out).then([side, &out] (auto c) {
+        if (c->_status != REDIS_OK) {
+            return out.write(msg_type_err);
+        }
+        if (!c->_served) {
+            return out.write(msg_null_multi_bulk);
+        }
+        scattered_message<char> m;
+        reply_builder::append_array_header(m, side == pop_side::MIN ? 3 : 2);
+        reply_builder::append_bulk(m, sstring(c->_key.data(), c->_key.size()));
+        reply_builder::append_bulk(m, sstring(c->_value.data(), c->_value.size()));
+        if (side == pop_side::MIN) {
+            char buf[numeric_string::DOUBLE_MAX_CHARS];
+            reply_builder::append_bulk(m, sstring(buf, numeric_string::from_double(buf, c->_score)));
+        }
+        return out.write(std::move(m));
+    });
+}
+
+future<> redis_service::blpop(request_wrapper& args, output_stream<char>& out)
+{
+    return blocking_pop_impl(args, out, pop_side::HEAD);
+}
+
+future<> redis_service::brpop(request_wrapper& args, output_stream<char>& out)
+{
+    return blocking_pop_impl(args, out, pop_side::TAIL);
+}
+
+future<> redis_service::bzpopmin(request_wrapper& args, output_stream<char>& out)
+{
+    return blocking_pop_impl(args, out, pop_side::MIN);
+}
+
+static bool parse_list_side(const bytes& arg, pop_side& side)
+{
+    sstring o { arg.c_str(), arg.size() };
+    std::transform(o.begin(), o.end(), o.begin(), ::tolower);
+    if (o == "left") {
+        side = pop_side::HEAD;
+    }
+    else if (o == "right") {
+        side = pop_side::TAIL;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+future<> redis_service::blmove(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 5) {
+        return out.write(msg_syntax_err);
+    }
+    pop_side from, to;
+    if (!parse_list_side(args._args[2], from) || !parse_list_side(args._args[3], to)) {
+        return out.write(msg_syntax_err);
+    }
+    double timeout = 0;
+    if (auto err = parse_timeout(args._args[4], timeout)) {
+        return out.write(*err);
+    }
+    args._tmp_keys.emplace_back(std::move(args._args[0]));
+    auto dest = make_lw_shared<redis_key>(args._args[1]);
+    return blocking_pop(args._tmp_keys, from, timeout, out).then([this, dest, from, to, &out] (auto c) {
+        if (c->_status != REDIS_OK) {
+            return out.write(msg_type_err);
+        }
+        if (!c->_served) {
+            return out.write(msg_null_multi_bulk);
+        }
+        // the element is handed off to the shard of the destination, which may serve
+        // the clients blocked on it.
+        return get_redis_service().invoke_on(get_cpu(*dest), &redis_service::push_value_local, std::cref(*dest), to, std::cref(c->_value), 0.0).then([this, c, from, &out] (int status) {
+            if (status != REDIS_OK) {
+                // the destination is not a list, the element is given back to the source.
+                auto& source = c->_keys[0];
+                return get_redis_service().invoke_on(get_cpu(source), &redis_service::push_value_local, std::cref(source), from, std::cref(c->_value), 0.0).then([&out] (int) {
+                    return out.write(msg_type_err);
+                });
+            }
+            scattered_message<char> m;
+            reply_builder::append_bulk(m, sstring(c->_value.data(), c->_value.size()));
+            return out.write(std::move(m));
+        });
+    });
+}
+
+static std::vector<sstring> pubsub_names(request_wrapper& args)
+{
+    std::vector<sstring> names;
+    for (size_t i = 0; i < args._args_count; ++i) {
+        names.emplace_back(args._args[i].data(), args._args[i].size());
+    }
+    return names;
+}
+
+future<> redis_service::subscribe(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 1) {
+        return out.write(msg_syntax_err);
+    }
+    return local_pubsub().subscribe(pubsub_names(args), out);
+}
+
+future<> redis_service::psubscribe(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count < 1) {
+        return out.write(msg_syntax_err);
+    }
+    return local_pubsub().psubscribe(pubsub_names(args), out);
+}
+
+future<> redis_service::unsubscribe(request_wrapper& args, output_stream<char>& out)
+{
+    return local_pubsub().unsubscribe(pubsub_names(args), out);
+}
+
+future<> redis_service::punsubscribe(request_wrapper& args, output_stream<char>& out)
+{
+    return local_pubsub().punsubscribe(pubsub_names(args), out);
+}
+
+future<> redis_service::publish(request_wrapper& args, output_stream<char>& out)
+{
+    if (args._args_count != 2) {
+        return out.write(msg_syntax_err);
+    }
+    auto& channel = args._args[0];
+    auto& message = args._args[1];
+    return local_pubsub().publish(sstring(channel.data(), channel.size()), sstring(message.data(), message.size())).then([&out] (size_t receivers) {
+        return reply_builder::build_local(out, receivers);
+    });
+}
 }
@@ -41,6 +41,8 @@
 #include "net/packet-data-source.hh"
 #include <unistd.h>
 #include <cstdlib>
+#include <deque>
+#include <unordered_map>
 #include "keys.hh"
 #include "structures/geo.hh"
 namespace redis {
@@ -58,6 +60,10 @@ inline redis_service& local_redis_service() {
 
 struct request_wrapper;
 class database;
+struct scan_options;
+struct range_stream;
+enum class set_algebra_op : uint8_t;
+enum class pop_side : uint8_t;
 using message = scattered_message<char>;
 class redis_service {
 private:
@@ -68,18 +74,121 @@ private:
         return key.hash() % smp::count;
     }
 public:
-    redis_service()
-    {
-    }
+    redis_service();
+    ~redis_service();
 
     future<> start();
     future<> stop();
+    // Releases the clients of the connection which are blocked on the lists, so their
+    // requests complete before the connection is closed.
+    future<> disconnect(output_stream<char>& out);
+    size_t blocked_client_count() const {
+        return _blocked_clients.size();
+    }
 
     future<> set(request_wrapper& args, output_stream<char>& out);
     future<> del(request_wrapper& args, output_stream<char>& out);
     future<> get(request_wrapper& args, output_stream<char>& out);
+    future<> getset(request_wrapper& args, output_stream<char>& out);
+    future<> incr(request_wrapper& args, output_stream<char>& out);
+    future<> decr(request_wrapper& args, output_stream<char>& out);
+    future<> incrby(request_wrapper& args, output_stream<char>& out);
+    future<> decrby(request_wrapper& args, output_stream<char>& out);
+    future<> incrbyfloat(request_wrapper& args, output_stream<char>& out);
+    future<> append(request_wrapper& args, output_stream<char>& out);
+    future<> setrange(request_wrapper& args, output_stream<char>& out);
+    future<> getrange(request_wrapper& args, output_stream<char>& out);
+    future<> pfadd(request_wrapper& args, output_stream<char>& out);
+    future<> pfcount(request_wrapper& args, output_stream<char>& out);
+    future<> pfmerge(request_wrapper& args, output_stream<char>& out);
+    future<> geosearch(request_wrapper& args, output_stream<char>& out);
+    future<> geosearchstore(request_wrapper& args, output_stream<char>& out);
+    future<> sadd(request_wrapper& args, output_stream<char>& out);
+    future<> srem(request_wrapper& args, output_stream<char>& out);
+    future<> scard(request_wrapper& args, output_stream<char>& out);
+    future<> sismember(request_wrapper& args, output_stream<char>& out);
+    future<> srandmember(request_wrapper& args, output_stream<char>& out);
+    future<> spop(request_wrapper& args, output_stream<char>& out);
+    future<> sscan(request_wrapper& args, output_stream<char>& out);
+    future<> hscan(request_wrapper& args, output_stream<char>& out);
+    future<> zscan(request_wrapper& args, output_stream<char>& out);
+    future<> smembers(request_wrapper& args, output_stream<char>& out);
+    future<> hgetall(request_wrapper& args, output_stream<char>& out);
+    future<> lrange(request_wrapper& args, output_stream<char>& out);
+    future<> zrange(request_wrapper& args, output_stream<char>& out);
+    future<> sinterstore(request_wrapper& args, output_stream<char>& out);
+    future<> sunionstore(request_wrapper& args, output_stream<char>& out);
+    future<> sdiffstore(request_wrapper& args, output_stream<char>& out);
+    future<> zunionstore(request_wrapper& args, output_stream<char>& out);
+    future<> zinterstore(request_wrapper& args, output_stream<char>& out);
+    future<> lpush(request_wrapper& args, output_stream<char>& out);
+    future<> rpush(request_wrapper& args, output_stream<char>& out);
+    future<> lpop(request_wrapper& args, output_stream<char>& out);
+    future<> rpop(request_wrapper& args, output_stream<char>& out);
+    future<> zadd(request_wrapper& args, output_stream<char>& out);
+    future<> blpop(request_wrapper& args, output_stream<char>& out);
+    future<> brpop(request_wrapper& args, output_stream<char>& out);
+    future<> blmove(request_wrapper& args, output_stream<char>& out);
+    future<> bzpopmin(request_wrapper& args, output_stream<char>& out);
+    future<> subscribe(request_wrapper& args, output_stream<char>& out);
+    future<> psubscribe(request_wrapper& args, output_stream<char>& out);
+    future<> unsubscribe(request_wrapper& args, output_stream<char>& out);
+    future<> punsubscribe(request_wrapper& args, output_stream<char>& out);
+    future<> publish(request_wrapper& args, output_stream<char>& out);
+    future<> setbit(request_wrapper& args, output_stream<char>& out);
+    future<> getbit(request_wrapper& args, output_stream<char>& out);
+    future<> bitcount(request_wrapper& args, output_stream<char>& out);
+    future<> bitpos(request_wrapper& args, output_stream<char>& out);
+    future<> bitop(request_wrapper& args, output_stream<char>& out);
 private:
     future<bool> remove_impl(bytes& key);
+    future<> counter_by(request_wrapper& args, output_stream<char>& out, int64_t step);
+    using scan_func = future<foreign_ptr<lw_shared_ptr<message>>> (database::*)(const redis_key&, const scan_options&);
+    future<> scan_impl(request_wrapper& args, output_stream<char>& out, scan_func func);
+    using stream_func = future<foreign_ptr<lw_shared_ptr<message>>> (database::*)(const redis_key&, range_stream&);
+    future<> stream_impl(request_wrapper& args, output_stream<char>& out, lw_shared_ptr<range_stream> s, stream_func func);
+    struct pf_gather_state;
+    future<lw_shared_ptr<pf_gather_state>> pf_gather_registers(std::vector<bytes>& keys);
+    struct bitop_state;
+    future<> bitop_chunk(lw_shared_ptr<bitop_state> state, size_t offset, unsigned dest_cpu);
+    future<> bitop_roaring_chunk(lw_shared_ptr<bitop_state> state, unsigned dest_cpu);
+    future<> bitop_roaring(lw_shared_ptr<bitop_state> state, unsigned dest_cpu);
+    struct set_algebra_state;
+    future<> set_algebra_store(request_wrapper& args, output_stream<char>& out, set_algebra_op op);
+    future<stop_iteration> set_algebra_chunk(lw_shared_ptr<set_algebra_state> state, unsigned dest_cpu);
+    struct zset_algebra_state;
+    future<> zset_algebra_store(request_wrapper& args, output_stream<char>& out, bool inter);
+    future<stop_iteration> zset_algebra_window(lw_shared_ptr<zset_algebra_state> state, unsigned dest_cpu);
+    future<> push_impl(request_wrapper& args, output_stream<char>& out, bool head);
+    // The writes which may serve the blocked clients run on the shard of the key, and
+    // wake the waiters of the key before they reply.
+    future<foreign_ptr<lw_shared_ptr<message>>> push_local(const redis_key& rk, std::vector<bytes>& values, bool head);
+    future<foreign_ptr<lw_shared_ptr<message>>> zadd_local(const redis_key& rk, std::unordered_map<sstring, double>& members);
+    future<int> push_value_local(const redis_key& rk, pop_side side, const bytes& value, double score);
+    // A blocked client lives on the shard of its connection, and waits in the queues
+    // of its keys on the shards which own them. A write to a key on the owner shard
+    // pops an element for the oldest waiter of the key, and sends it to the shard of
+    // the waiter; the element is given back if the waiter was served by another key
+    // or timed out meanwhile.
+    struct blocked_client;
+    struct blocked_waiter {
+        unsigned _cpu;
+        uint64_t _id;
+        pop_side _side;
+    };
+    future<lw_shared_ptr<blocked_client>> blocking_pop(std::vector<bytes>& keys, pop_side side, double timeout, output_stream<char>& out);
+    future<> blocking_pop_impl(request_wrapper& args, output_stream<char>& out, pop_side side);
+    // Runs on the shards which own the keys.
+    future<> block_on(const redis_key& rk, unsigned cpu, uint64_t id, pop_side side);
+    future<> unblock_on(const redis_key& rk, unsigned cpu, uint64_t id);
+    future<> wake_waiters(const redis_key& rk);
+    // Runs on the shard of the blocked client, returns false if the client was gone.
+    future<bool> unblock(uint64_t id, bytes key, bytes value, double score);
+    future<> fail_blocked(uint64_t id, int status);
+    void expire_blocked(uint64_t id);
+    std::unordered_map<uint64_t, lw_shared_ptr<blocked_client>> _blocked_clients;
+    uint64_t _next_blocked_id = 0;
+    std::unordered_map<bytes, std::deque<blocked_waiter>> _wait_queues;
 };
 
 } /* namespace redis */
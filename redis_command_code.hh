@@ -19,10 +19,14 @@ enum class command_code {
     decr,
     incrby,
     decrby,
+    incrbyfloat,
+    getset,
     command,
     exists,
     append,
     strlen,
+    setrange,
+    getrange,
     lpush,
     lpushx,
     lpop,
@@ -36,6 +40,9 @@ enum class command_code {
     rpop,
     lrem,
     ltrim,
+    blpop,
+    brpop,
+    blmove,
     hset,
     hdel,
     hget,
@@ -49,6 +56,7 @@ enum class command_code {
     hmget,
     hmset,
     hgetall,
+    hscan,
     sadd,
     scard,
     sismember,
@@ -63,6 +71,7 @@ enum class command_code {
     smove,
     srandmember,
     spop,
+    sscan,
     type,
     expire,
     pexpire,
@@ -90,6 +99,7 @@ enum class command_code {
     zinter,
     zdiff,
     zscan,
+    bzpopmin,
     zrangebylex,
     zlexcount,
     zremrangebylex,
@@ -100,6 +110,8 @@ enum class command_code {
     geopos,
     georadius,
     georadiusbymember,
+    geosearch,
+    geosearchstore,
     setbit,
     getbit,
     bitcount,
@@ -109,5 +121,10 @@ enum class command_code {
     pfadd,
     pfcount,
     pfmerge,
+    subscribe,
+    psubscribe,
+    unsubscribe,
+    punsubscribe,
+    publish,
 };
 }
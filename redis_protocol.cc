@@ -22,6 +22,7 @@
 #include <algorithm>
 #include "util/log.hh"
 #include "redis_command_code.hh"
+#include "pubsub.hh"
 namespace redis {
 using namespace seastar;
 static seastar::logger rlog("proto");
@@ -31,10 +32,26 @@ redis_protocol::redis_protocol()
 
 void redis_protocol::prepare_request()
 {
+    _request._command    = _parser._command;
     _request._args_count = _parser._args_count - 1;
     _request._args       = std::move(_parser._args_list);
 }
 
+// The commands which a subscribed connection runs, as redis does.
+static bool allowed_in_subscribed_mode(command_code command)
+{
+    switch (command) {
+    case command_code::subscribe:
+    case command_code::psubscribe:
+    case command_code::unsubscribe:
+    case command_code::punsubscribe:
+    case command_code::ping:
+        return true;
+    default:
+        return false;
+    }
+}
+
 future<> redis_protocol::handle(input_stream<char>& in, output_stream<char>& out)
 {
     _parser.init();
@@ -49,9 +66,19 @@ future<> redis_protocol::handle(input_stream<char>& in, output_stream<char>& out
             case protocol_state::ok:
             {
             prepare_request();
+            // the replies on a subscribed connection are written after the messages
+            // which are being delivered to it, see pubsub::reply().
+            if (local_pubsub().subscribed(out)) {
+                if (!allowed_in_subscribed_mode(_request._command)) {
+                    return local_pubsub().reply(out, "-ERR only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING are allowed in this context\r\n");
+                }
+                if (_request._command == command_code::ping) {
+                    return local_pubsub().reply(out, "*2\r\n$4\r\npong\r\n$0\r\n\r\n");
+                }
+            }
             }
             default:
-                return out.write("+OK\r\n");
+                return local_pubsub().reply(out, "+OK\r\n");
         };
     }).then_wrapped([this, &in, &out] (auto&& f) -> future<> {
         try {
@@ -91,10 +91,14 @@ incr = "incr"i ${_command = command_code::incr;};
 decr = "decr"i ${_command = command_code::decr;};
 incrby = "incrby"i ${_command = command_code::incrby;};
 decrby = "decrby"i ${_command = command_code::decrby;};
+incrbyfloat = "incrbyfloat"i ${_command = command_code::incrbyfloat;};
+getset = "getset"i ${_command = command_code::getset;};
 command_ = "command"i ${_command = command_code::command;};
 exists = "exists"i ${_command = command_code::exists;};
 append = "append"i ${_command = command_code::append;};
 strlen = "strlen"i ${_command = command_code::strlen;};
+setrange = "setrange"i ${_command = command_code::setrange;};
+getrange = "getrange"i ${_command = command_code::getrange;};
 lpush = "lpush"i ${_command = command_code::lpush;};
 lpushx = "lpushx"i ${_command = command_code::lpushx;};
 lpop = "lpop"i ${_command = command_code::lpop;};
@@ -108,6 +112,9 @@ rpushx = "rpushx"i ${_command = command_code::rpushx;};
 rpop = "rpop"i ${_command = command_code::rpop;};
 lrem = "lrem"i ${_command = command_code::lrem;};
 ltrim = "ltrim"i ${_command = command_code::ltrim;};
+blpop = "blpop"i ${_command = command_code::blpop;};
+brpop = "brpop"i ${_command = command_code::brpop;};
+blmove = "blmove"i ${_command = command_code::blmove;};
 hset = "hset"i ${_command = command_code::hset;};
 hmset = "hmset"i ${_command = command_code::hmset;};
 hdel = "hdel"i ${_command = command_code::hdel;};
@@ -121,6 +128,7 @@ hkeys = "hkeys"i ${_command = command_code::hkeys;};
 hvals = "hvals"i ${_command = command_code::hvals;};
 hmget = "hmget"i ${_command = command_code::hmget;};
 hgetall = "hgetall"i ${_command = command_code::hgetall;};
+hscan = "hscan"i ${_command = command_code::hscan;};
 sadd = "sadd"i ${_command = command_code::sadd;};
 scard = "scard"i ${_command = command_code::scard;};
 sismember = "sismember"i ${_command = command_code::sismember;};
@@ -135,6 +143,7 @@ sunion = "sunion"i ${_command = command_code::sunion;};
 sunionstore = "sunionstore"i ${_command = command_code::sunionstore;};
 smove = "smove"i ${_command = command_code::smove;};
 spop = "spop"i ${_command = command_code::spop;};
+sscan = "sscan"i ${_command = command_code::sscan;};
 type = "type"i ${_command = command_code::type; };
 expire = "expire"i ${_command = command_code::expire; };
 pexpire = "pexpire"i ${_command = command_code::pexpire; };
@@ -161,6 +170,7 @@ zunion = "zunion"i ${_command = command_code::zunion; };
 zinter = "zinter"i ${_command = command_code::zinter; };
 zdiff = "zunion"i ${_command = command_code::zdiff; };
 zscan = "zscan"i ${_command = command_code::zscan; };
+bzpopmin = "bzpopmin"i ${_command = command_code::bzpopmin; };
 zrangebylex = "zrangebylex"i ${_command = command_code::zrangebylex; };
 zrangebyscore = "zrangebyscore"i ${_command = command_code::zrangebyscore; };
 zlexcount = "zlexcount"i ${_command = command_code::zlexcount;};
@@ -172,6 +182,8 @@ geohash = "geohash"i ${_command = command_code::geohash; };
 geopos = "geopos"i ${_command = command_code::geopos; };
 georadius = "georadius"i ${_command = command_code::georadius; };
 georadiusbymember = "georadiusbymember"i ${_command = command_code::georadiusbymember; };
+geosearch = "geosearch"i ${_command = command_code::geosearch; };
+geosearchstore = "geosearchstore"i ${_command = command_code::geosearchstore; };
 setbit = "setbit"i ${_command = command_code::setbit; };
 getbit = "getbit"i ${_command = command_code::getbit; };
 bitcount = "bitcount"i ${_command = command_code::bitcount; };
@@ -181,17 +193,22 @@ bitpos = "bitpos"i ${_command = command_code::bitpos; };
 pfadd = "pfadd"i ${_command = command_code::pfadd; };
 pfcount = "pfcount"i ${_command = command_code::pfcount; };
 pfmerge = "pfmerge"i ${_command = command_code::pfmerge; };
+subscribe = "subscribe"i ${_command = command_code::subscribe; };
+psubscribe = "psubscribe"i ${_command = command_code::psubscribe; };
+unsubscribe = "unsubscribe"i ${_command = command_code::unsubscribe; };
+punsubscribe = "punsubscribe"i ${_command = command_code::punsubscribe; };
+publish = "publish"i ${_command = command_code::publish; };
 
-command = (setbit | set | getbit | get | del | mget | mset | echo | ping | incr | decr | incrby | decrby | command_ | exists | append |
+command = (setrange | setbit | set | getrange | getset | getbit | get | del | mget | mset | echo | ping | incrbyfloat | incrby | incr | decrby | decr | command_ | exists | append |
            strlen | lpushx | lpush | lpop | llen | lindex | linsert | lrange | lset | rpushx | rpush | rpop | lrem |
-           ltrim | hset | hgetall |hget | hdel | hlen | hexists | hstrlen | hincrby | hincrbyfloat | hkeys | hvals | hmget | hmset |
-           sadd | scard | sismember | smembers | srem | sdiffstore | sdiff | sinterstore | sinter| sunionstore | sunion | smove | srandmember | spop |
+           ltrim | blpop | brpop | blmove | hset | hgetall |hget | hdel | hlen | hexists | hstrlen | hincrby | hincrbyfloat | hkeys | hvals | hmget | hmset | hscan |
+           sadd | scard | sismember | smembers | srem | sdiffstore | sdiff | sinterstore | sinter| sunionstore | sunion | smove | srandmember | spop | sscan |
            type | expire | pexpire | persist | ttl | pttl | zadd | zcard | zcount | zincrby |
            zrangebyscore | zrank | zremrangebyrank | zremrangebyscore | zremrangebylex | zrem | zrevrangebyscore | zrevrange| zrevrank |
-           zscore | zunionstore  | zinterstore | zdiffstore | zunion | zinter | zdiff | zscan | zrangebylex | zlexcount |
-           zrange | select | geoadd | geodist | geohash | geopos | georadiusbymember | georadius |  bitcount |
+           zscore | zunionstore  | zinterstore | zdiffstore | zunion | zinter | zdiff | zscan | bzpopmin | zrangebylex | zlexcount |
+           zrange | select | geoadd | geodist | geohash | geopos | georadiusbymember | georadius | geosearchstore | geosearch |  bitcount |
            bitpos | bitop | bitfield |
-           pfadd | pfcount | pfmerge );
+           pfadd | pfcount | pfmerge | subscribe | psubscribe | unsubscribe | punsubscribe | publish );
 arg = '$' u32 crlf ${ _arg_size = _u32;};
 
 main := (args_count (arg command crlf) (arg @{fcall blob; } crlf)+) ${_state = protocol_state::ok;};
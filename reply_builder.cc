@@ -19,4 +19,77 @@
 *
 */
 #include "reply_builder.hh"
-namespace redis {}
+#include "structures/numeric_string.hh"
+namespace redis {
+
+namespace {
+// ":n\r\n" and "$len\r\nn\r\n" of the integers in [0, SHARED_INTEGERS), they are
+// immutable and never freed, so the messages refer to them without copying.
+struct shared_integers {
+    std::vector<sstring> _integers;
+    std::vector<sstring> _bulks;
+    shared_integers()
+    {
+        _integers.reserve(reply_builder::SHARED_INTEGERS);
+        _bulks.reserve(reply_builder::SHARED_INTEGERS);
+        for (int64_t n = 0; n < reply_builder::SHARED_INTEGERS; ++n) {
+            auto digits = to_sstring(n);
+            _integers.emplace_back(sstring(":") + digits + "\r\n");
+            _bulks.emplace_back(sstring("$") + to_sstring(digits.size()) + "\r\n" + digits + "\r\n");
+        }
+    }
+};
+
+const shared_integers& shared()
+{
+    static const shared_integers _shared;
+    return _shared;
+}
+}
+
+void reply_builder::append_integer(scattered_message<char>& m, int64_t n)
+{
+    if (n >= 0 && n < SHARED_INTEGERS) {
+        m.append_static(shared()._integers[n]);
+        return;
+    }
+    char buf[numeric_string::INT64_MAX_CHARS + 3];
+    size_t size = 0;
+    buf[size++] = ':';
+    size += numeric_string::from_int64(buf + size, n);
+    buf[size++] = '\r';
+    buf[size++] = '\n';
+    m.append(sstring(buf, size));
+}
+
+void reply_builder::append_bulk_integer(scattered_message<char>& m, int64_t n)
+{
+    if (n >= 0 && n < SHARED_INTEGERS) {
+        m.append_static(shared()._bulks[n]);
+        return;
+    }
+    char digits[numeric_string::INT64_MAX_CHARS];
+    auto length = numeric_string::from_int64(digits, n);
+    char buf[numeric_string::INT64_MAX_CHARS + 8];
+    size_t size = 0;
+    buf[size++] = '$';
+    size += numeric_string::from_int64(buf + size, length);
+    buf[size++] = '\r';
+    buf[size++] = '\n';
+    memcpy(buf + size, digits, length);
+    size += length;
+    buf[size++] = '\r';
+    buf[size++] = '\n';
+    m.append(sstring(buf, size));
+}
+
+sstring reply_builder::format_number(const cache_entry* e)
+{
+    if (e->type_of_integer()) {
+        char buf[numeric_string::INT64_MAX_CHARS];
+        return sstring(buf, numeric_string::from_int64(buf, e->value_integer()));
+    }
+    char buf[numeric_string::DOUBLE_MAX_CHARS];
+    return sstring(buf, numeric_string::from_double(buf, e->value_float()));
+}
+}
@@ -59,6 +59,31 @@ static const bytes msg_same_object_err = {"-ERR source and destination objects a
 static const bytes msg_out_of_range_err = {"-ERR index out of range\r\n"};
 static const bytes msg_not_integer_err = {"-ERR ERR hash value is not an integer\r\n" };
 static const bytes msg_not_float_err = {"-ERR ERR hash value is not an float\r\n" };
+static const bytes msg_invalid_hll_err = {"-INVALIDOBJ Corrupted HLL object detected\r\n" };
+static const bytes msg_bitop_not_err = {"-ERR BITOP NOT must be called with a single source key.\r\n" };
+static const bytes msg_bit_arg_err = {"-ERR The bit argument must be 1 or 0.\r\n" };
+static const bytes msg_bit_offset_err = {"-ERR bit offset is not an integer or out of range\r\n" };
+static const bytes msg_geo_from_err = {"-ERR exactly one of FROMMEMBER or FROMLONLAT can be specified\r\n" };
+static const bytes msg_geo_by_err = {"-ERR exactly one of BYRADIUS and BYBOX can be specified\r\n" };
+static const bytes msg_geo_any_err = {"-ERR the ANY argument requires COUNT argument\r\n" };
+static const bytes msg_geo_count_err = {"-ERR COUNT must be > 0\r\n" };
+static const bytes msg_geo_unit_err = {"-ERR unsupported unit provided. please use M, KM, FT, MI\r\n" };
+static const bytes msg_geo_lonlat_err = {"-ERR invalid longitude,latitude pair\r\n" };
+static const bytes msg_geo_member_err = {"-ERR could not decode requested zset member\r\n" };
+static const bytes msg_bit_value_err = {"-ERR bit is not an integer or out of range\r\n" };
+static const bytes msg_string_size_err = {"-ERR string exceeds maximum allowed size (512MB)\r\n" };
+static const bytes msg_offset_err = {"-ERR offset is out of range\r\n" };
+static const bytes msg_empty_bulk = {"$0\r\n\r\n"};
+static const bytes msg_value_not_integer_err = {"-ERR value is not an integer or out of range\r\n" };
+static const bytes msg_value_not_float_err = {"-ERR value is not a valid float\r\n" };
+static const bytes msg_incr_overflow_err = {"-ERR increment or decrement would overflow\r\n" };
+static const bytes msg_incr_nan_err = {"-ERR increment would produce NaN or Infinity\r\n" };
+static const bytes msg_invalid_cursor_err = {"-ERR invalid cursor\r\n" };
+static const bytes msg_value_not_positive_err = {"-ERR value is out of range, must be positive\r\n" };
+static const bytes msg_zset_numkeys_err = {"-ERR at least 1 input key is needed for ZUNIONSTORE/ZINTERSTORE\r\n" };
+static const bytes msg_zset_weight_err = {"-ERR weight value is not a float\r\n" };
+static const bytes msg_timeout_err = {"-ERR timeout is not a float or out of range\r\n" };
+static const bytes msg_timeout_negative_err = {"-ERR timeout is negative\r\n" };
 static const bytes msg_str_tag = {"+"};
 static const bytes msg_num_tag = {":"};
 static const bytes msg_sigle_tag = {"*"};
@@ -79,14 +104,27 @@ static const bytes msg_type_hash {"+hash\r\n"};
 
 class reply_builder final {
 public:
-static future<scattered_message_ptr> build(size_t size)
+// The replies of the integers in [0, SHARED_INTEGERS) are formatted once and shared
+// by all shards (as the shared integers of redis), the others are formatted straight
+// into a single buffer.
+static constexpr const int64_t SHARED_INTEGERS = 10000;
+static void append_integer(scattered_message<char>& m, int64_t n);
+static void append_bulk_integer(scattered_message<char>& m, int64_t n);
+
+// Formats the integer or float encoded string value.
+static sstring format_number(const cache_entry* e);
+
+static future<scattered_message_ptr> build_integer(int64_t n)
 {
     auto m = make_lw_shared<scattered_message<char>>();
-    m->append_static(msg_num_tag);
-    m->append(to_sstring(size));
-    m->append_static(msg_crlf);
+    append_integer(*m, n);
     return make_ready_future<scattered_message_ptr>(foreign_ptr<lw_shared_ptr<scattered_message<char>>>(m));
 }
+
+static future<scattered_message_ptr> build(size_t size)
+{
+    return build_integer(static_cast<int64_t>(size));
+}
 static future<> build_local(output_stream<char>& out, size_t size)
 {
     auto m = make_lw_shared<scattered_message<char>>();
@@ -120,6 +158,42 @@ inline static future<> build_local(output_stream<char>& out, const sstring& mess
    return out.write(message);
 }
 
+// Copies the bytes [offset, offset + length) of the string (or the roaring bitmap, or
+// the number), the fragmented string is copied fragment by fragment rather than being
+// linearized.
+static void copy_string_range(const cache_entry* e, size_t offset, size_t length, char* out)
+{
+    if (e->type_of_bitmap()) {
+        e->value_bitmap().copy_range(offset, length, reinterpret_cast<uint8_t*>(out));
+    }
+    else if (e->type_of_bytes()) {
+        e->value_bytes().copy_to(offset, length, out);
+    }
+    else {
+        auto number = format_number(e);
+        std::copy_n(number.begin() + offset, length, out);
+    }
+}
+
+// Appends the length and the bytes [offset, offset + length) of the string.
+static void append_string_range(scattered_message<char>& m, const cache_entry* e, size_t offset, size_t length)
+{
+    sstring data(sstring::initialized_later(), length);
+    copy_string_range(e, offset, length, data.begin());
+    m.append(to_sstring(length));
+    m.append_static(msg_crlf);
+    m.append(std::move(data));
+    m.append_static(msg_crlf);
+}
+
+static future<scattered_message_ptr> build_range(const cache_entry* e, size_t offset, size_t length)
+{
+    auto m = make_lw_shared<scattered_message<char>>();
+    m->append_static(msg_batch_tag);
+    append_string_range(*m, e, offset, length);
+    return make_ready_future<scattered_message_ptr>(foreign_ptr<lw_shared_ptr<scattered_message<char>>>(m));
+}
+
 template<bool Key, bool Value>
 static future<scattered_message_ptr> build(const cache_entry* e)
 {
@@ -134,26 +208,25 @@ static future<scattered_message_ptr> build(const cache_entry* e)
             m->append_static(msg_crlf);
         }
         if (Value) {
-            m->append_static(msg_batch_tag);
             if (e->type_of_integer()) {
-               auto&& n = to_sstring(e->value_integer());
-               m->append(to_sstring(n.size()));
-               m->append_static(msg_crlf);
-               m->append(n);
-               m->append_static(msg_crlf);
+               append_bulk_integer(*m, e->value_integer());
             }
             else if (e->type_of_float()) {
-               auto&& n = to_sstring(e->value_float());
+               auto&& n = format_number(e);
+               m->append_static(msg_batch_tag);
                m->append(to_sstring(n.size()));
                m->append_static(msg_crlf);
-               m->append(n);
+               m->append(std::move(n));
                m->append_static(msg_crlf);
             }
             else if (e->type_of_bytes()) {
-                m->append(to_sstring(e->value_bytes_size()));
-                m->append_static(msg_crlf);
-                m->append(sstring{e->value_bytes_data(), e->value_bytes_size()});
-                m->append_static(msg_crlf);
+                m->append_static(msg_batch_tag);
+                append_string_range(*m, e, 0, e->value_bytes_size());
+            }
+            else if (e->type_of_bitmap()) {
+                m->append_static(msg_batch_tag);
+                // the roaring bitmap is converted to the plain string only here.
+                append_string_range(*m, e, 0, e->value_bitmap().byte_size());
             }
             else {
                m->append_static(msg_type_err);
@@ -166,6 +239,60 @@ static future<scattered_message_ptr> build(const cache_entry* e)
     }
 }
 
+static void append_array_header(scattered_message<char>& m, size_t size)
+{
+    m.append_static(msg_sigle_tag);
+    m.append(to_sstring(size));
+    m.append_static(msg_crlf);
+}
+
+static void append_bulk(scattered_message<char>& m, sstring&& data)
+{
+    m.append_static(msg_batch_tag);
+    m.append(to_sstring(data.size()));
+    m.append_static(msg_crlf);
+    m.append(std::move(data));
+    m.append_static(msg_crlf);
+}
+
+static void append_member(scattered_message<char>& m, const dict_entry* e)
+{
+    sstring data(sstring::initialized_later(), e->key_size());
+    e->key().copy_to(0, e->key_size(), data.begin());
+    append_bulk(m, std::move(data));
+}
+
+// The members of a set, it is an empty array rather than nil if there is no member.
+static future<scattered_message_ptr> build_members(const std::vector<const dict_entry*>& entries)
+{
+    auto m = make_lw_shared<scattered_message<char>>();
+    append_array_header(*m, entries.size());
+    for (auto e : entries) {
+        append_member(*m, e);
+    }
+    return make_ready_future<scattered_message_ptr>(foreign_ptr<lw_shared_ptr<scattered_message<char>>>(m));
+}
+
+static future<scattered_message_ptr> build_member(const dict_entry* e)
+{
+    auto m = make_lw_shared<scattered_message<char>>();
+    append_member(*m, e);
+    return make_ready_future<scattered_message_ptr>(foreign_ptr<lw_shared_ptr<scattered_message<char>>>(m));
+}
+
+// The reply of SCAN: the next cursor, and the array of the items.
+static future<scattered_message_ptr> build_scan(size_t cursor, std::vector<sstring>& items)
+{
+    auto m = make_lw_shared<scattered_message<char>>();
+    append_array_header(*m, 2);
+    append_bulk(*m, to_sstring(cursor));
+    append_array_header(*m, items.size());
+    for (auto& item : items) {
+        append_bulk(*m, std::move(item));
+    }
+    return make_ready_future<scattered_message_ptr>(foreign_ptr<lw_shared_ptr<scattered_message<char>>>(m));
+}
+
 template<bool Key, bool Value>
 static future<scattered_message_ptr> build(const std::vector<const dict_entry*>& entries)
 {
@@ -448,9 +575,12 @@ static future<> build_local(output_stream<char>& out, std::vector<std::tuple<sst
     if (wh) temp++;
     if (wc) temp++;
     for (size_t i = 0; i < u.size(); ++i) {
-        m->append_static(msg_sigle_tag);
-        m->append(std::move(to_sstring(temp)));
-        m->append_static(msg_crlf);
+        // only the members are replied if no WITH* option was given.
+        if (temp > 1) {
+            m->append_static(msg_sigle_tag);
+            m->append(std::move(to_sstring(temp)));
+            m->append_static(msg_crlf);
+        }
 
         //key
         sstring& key = std::get<0>(u[i]);
@@ -470,6 +600,12 @@ static future<> build_local(output_stream<char>& out, std::vector<std::tuple<sst
             m->append(std::move(n2));
             m->append_static(msg_crlf);
         }
+        //hash
+        if (wh) {
+            m->append_static(msg_num_tag);
+            m->append(to_sstring(static_cast<uint64_t>(std::get<1>(u[i]))));
+            m->append_static(msg_crlf);
+        }
         //coord
         if (wc) {
             m->append_static(msg_sigle_tag);
@@ -488,19 +624,6 @@ static future<> build_local(output_stream<char>& out, std::vector<std::tuple<sst
             m->append(std::move(n2));
             m->append_static(msg_crlf);
         }
-        //hash
-        if (wh) {
-/*
-            double& score = std::get<1>(u[i]);
-            sstring hashstr;
-            geo::encode_to_geohash_string(score, hashstr);
-            m->append_static(msg_batch_tag);
-            m->append(to_sstring(hashstr.size()));
-            m->append_static(msg_crlf);
-            m->append(std::move(hashstr));
-            m->append_static(msg_crlf);
-*/
-        }
     }
     return out.write(std::move(*m));
 }
@@ -37,6 +37,7 @@ struct request_wrapper {
     uint32_t _args_count { 0 };
     command_code _command;
     std::vector<bytes> _args {};
+    std::vector<bytes> _tmp_keys {};
     request_wrapper () {}
 };
 }
@@ -8,6 +8,8 @@
 #include <boost/range/adaptor/sliced.hpp>
 
 #include "service.hh"
+#include "pubsub.hh"
+#include "redis.hh"
 #include "core/future-util.hh"
 #include "core/reactor.hh"
 #include "net/byteorder.hh"
@@ -164,9 +166,15 @@ future<> server::connection::process()
             throw request_exception("request error");
         }
     }).finally([this] {
-        return _pending_requests_gate.close().then([this] {
+        // the requests blocked on the lists are released first, or the gate never closes.
+        return local_redis_service().disconnect(_out).then([this] {
+            return _pending_requests_gate.close();
+        }).then([this] {
             return _ready_to_respond.finally([this] {
-                return _out.close();
+                // the messages being published to the connection are written first.
+                return local_pubsub().disconnect(_out).finally([this] {
+                    return _out.close();
+                });
             });
         });
     });
@@ -179,7 +187,8 @@ future<> server::connection::shutdown()
         _fd.shutdown_output();
     } catch (...) {
     }
-    return make_ready_future<>();
+    // the requests blocked on the lists never read the input, so they are released here.
+    return local_redis_service().disconnect(_out);
 }
 
 future<> server::connection::process_request() {
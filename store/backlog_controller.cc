@@ -0,0 +1,40 @@
+#include "store/backlog_controller.hh"
+#include "core/reactor.hh"
+#include <algorithm>
+#include <cassert>
+namespace store {
+
+constexpr std::chrono::milliseconds backlog_controller::default_update_interval;
+
+backlog_controller::backlog_controller(std::vector<control_point> points, std::function<double ()> current_backlog,
+    std::chrono::milliseconds interval)
+    : _control_points(std::move(points))
+    , _current_backlog(std::move(current_backlog))
+{
+    assert(!_control_points.empty());
+    std::sort(_control_points.begin(), _control_points.end(), [] (auto& l, auto& r) {
+        return l._input < r._input;
+    });
+    _shares = _control_points.front()._output;
+    _update_timer.set_callback([this] { update(); });
+    _update_timer.arm_periodic(std::chrono::duration_cast<steady_clock_type::duration>(interval));
+}
+
+void backlog_controller::update()
+{
+    _backlog = std::max(_current_backlog(), 0.0);
+    auto next = std::find_if(_control_points.begin(), _control_points.end(), [this] (auto& p) {
+        return p._input > _backlog;
+    });
+    if (next == _control_points.begin()) {
+        _shares = next->_output;
+    } else if (next == _control_points.end()) {
+        _shares = _control_points.back()._output;
+    } else {
+        auto& prev = *(next - 1);
+        auto ratio = (_backlog - prev._input) / (next->_input - prev._input);
+        _shares = prev._output + ratio * (next->_output - prev._output);
+    }
+}
+
+}
@@ -0,0 +1,46 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <vector>
+#include "core/timer.hh"
+#include "seastarx.hh"
+namespace store {
+
+// Adjusts the shares of a background process from its backlog. The backlog is
+// sampled periodically and mapped to the shares by the control points, linearly
+// between them, so the process gets more bandwidth while its backlog grows and
+// leaves it to the foreground requests while it is idle.
+class backlog_controller {
+public:
+    struct control_point {
+        double _input;
+        double _output;
+    };
+    static constexpr std::chrono::milliseconds default_update_interval { 250 };
+private:
+    // sorted by their inputs, the shares are clamped to the first and the last.
+    std::vector<control_point> _control_points;
+    std::function<double ()> _current_backlog;
+    timer<> _update_timer;
+    double _backlog = 0;
+    double _shares = 0;
+public:
+    backlog_controller(std::vector<control_point> points, std::function<double ()> current_backlog,
+        std::chrono::milliseconds interval = default_update_interval);
+    backlog_controller(const backlog_controller&) = delete;
+    backlog_controller& operator = (const backlog_controller&) = delete;
+
+    double backlog() const {
+        return _backlog;
+    }
+    double shares() const {
+        return _shares;
+    }
+    // Samples the backlog and updates the shares, it is called by the timer.
+    void update();
+    void stop() {
+        _update_timer.cancel();
+    }
+};
+
+}
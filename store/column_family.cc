@@ -1,87 +1,384 @@
 #include "column_family.hh"
 #include "store/reader.hh"
+#include "store/checked-file-impl.hh"
+#include "core/metrics.hh"
+#include "core/reactor.hh"
+#include "core/seastar.hh"
+#include "core/sleep.hh"
+#include "core/thread.hh"
+#include "core/print.hh"
+#include "utils/disk-error-handler.hh"
+#include "util/log.hh"
+#include <boost/algorithm/string/predicate.hpp>
+#include <algorithm>
+#include <chrono>
+#include <unordered_set>
 namespace store {
 
+using logger =  seastar::logger;
+static logger cf_log ("column_family");
+
+// The flushes share the disk with the reads by their own priority class, and run
+// in their own scheduling group so they do not take the whole CPU from the reads.
+static const io_priority_class& memtable_flush_priority()
+{
+    static thread_local auto pc = engine().register_one_priority_class("memtable_flush", 100);
+    return pc;
+}
+
+static seastar::thread_scheduling_group& memtable_flush_scheduling_group()
+{
+    static thread_local seastar::thread_scheduling_group scheduling_group(std::chrono::milliseconds(1), 0.5);
+    return scheduling_group;
+}
+
+// The compactions are throttled by their throughput as well, they are never urgent.
+static const io_priority_class& compaction_priority()
+{
+    static thread_local auto pc = engine().register_one_priority_class("compaction", 100);
+    return pc;
+}
+
+static seastar::thread_scheduling_group& compaction_scheduling_group()
+{
+    static thread_local seastar::thread_scheduling_group scheduling_group(std::chrono::milliseconds(1), 0.2);
+    return scheduling_group;
+}
+
+// The shares at which the flushes and the compactions write at their configured
+// throughput, the controllers scale the throughput by their shares.
+static constexpr double base_shares = 100;
+
+// The flush backlog is the dirty memory of the memtables, normalized by the memory
+// at which the writes wait for the flushes. The flushes are slow while the memtables
+// fill, and catch up before the writes stall.
+static std::vector<backlog_controller::control_point> flush_control_points()
+{
+    return { { 0.0, 10 }, { 0.25, base_shares }, { 0.5, 2 * base_shares }, { 1.0, 10 * base_shares } };
+}
+
+// The compaction backlog is the bytes to rewrite, normalized by the memtable size.
+// A backlog of a few memtables is compacted at the configured throughput, a larger
+// one faster so the reads do not touch ever more sstables.
+static std::vector<backlog_controller::control_point> compaction_control_points()
+{
+    return { { 0.0, base_shares / 2 }, { 1.5, base_shares }, { 30.0, 10 * base_shares } };
+}
+
 int column_family::in_range(lw_shared_ptr<sstable_meta> m, const bytes_view& key) const
 {
     // return 1, iff key > largest key of the sstable;
     // return -1, iff key < smallest key of the sstable
     // return 0, otherwise.
     assert(m);
-    if (key > m->_largest_key) return 1;
-    else if (key < m->_smallest_key) return -1;
+    if (tri_compare_keys(key, m->_largest_key) > 0) return 1;
+    else if (tri_compare_keys(key, m->_smallest_key) < 0) return -1;
     return 0;
 }
 
+bool column_family::may_contain(const lw_shared_ptr<sstable_meta>& m, bytes_view key) const
+{
+    // the filter is loaded when the sstable is opened by its first read.
+    if (!m->_sstable || !m->_sstable->has_filter()) {
+        return true;
+    }
+    ++_read_stats._bloom_filter_checks;
+    if (m->_sstable->may_contain(key)) {
+        return true;
+    }
+    ++_read_stats._bloom_filter_negatives;
+    return false;
+}
+
 std::vector<lw_shared_ptr<sstable_meta>> column_family::filter_file_meta_from_level_zero(bytes_view key) const
 {
-    return std::vector<lw_shared_ptr<sstable_meta>> {};
+    // the level 0 files overlap each other, the newest one (the highest sequence) first.
+    std::vector<lw_shared_ptr<sstable_meta>> result;
+    auto& sstable_metas = _manifest.level(0);
+    for (auto i = sstable_metas.rbegin(); i != sstable_metas.rend(); ++i) {
+        if (in_range(*i, key) == 0 && may_contain(*i, key)) {
+            result.push_back(*i);
+        }
+    }
+    std::stable_sort(result.begin(), result.end(), [] (const auto& l, const auto& r) {
+        return l->_sequence > r->_sequence;
+    });
+    return result;
 }
 
 std::vector<lw_shared_ptr<sstable_meta>> column_family::filter_file_meta(bytes_view key) const
 {
     std::vector<lw_shared_ptr<sstable_meta>> result;
-    for (size_t i = 0; i < MAX_LEVELS; ++i) {
-        auto& sstable_metas = _sstables[i];
-        auto files_number = sstable_metas.size();
-        if (i == 0) {
-            // iterate every files in the level 0.
-            for (size_t k = 0; k < files_number; ++k) {
-                if (in_range(sstable_metas[k], key) == 0) {
-                    result.push_back(sstable_metas[k]);
-                    break;
-                }
-            }
-        }
-        else {
-            // binary search to lookup the target files.
-            size_t begin = 0, end = sstable_metas.size();
-            for (; begin < end; ) {
-                auto m = (begin + end) >> 1;
-                auto c = in_range(sstable_metas[m], key);
-                if (c == 0) {
+    // the level 0 files are looked up by filter_file_meta_from_level_zero().
+    for (int i = 1; i < level_manifest::max_levels; ++i) {
+        auto& sstable_metas = _manifest.level(i);
+        // binary search to lookup the target files.
+        size_t begin = 0, end = sstable_metas.size();
+        for (; begin < end; ) {
+            auto m = (begin + end) >> 1;
+            auto c = in_range(sstable_metas[m], key);
+            if (c == 0) {
+                if (may_contain(sstable_metas[m], key)) {
                     result.push_back(sstable_metas[m]);
-                    break;
-                }
-                else if (c > 0) {
-                    begin = m + 1;
-                }
-                else {
-                    end = m - 1;
                 }
+                break;
+            }
+            else if (c > 0) {
+                begin = m + 1;
+            }
+            else {
+                end = m;
             }
         }
     }
     return std::move(result);
 }
 
-lw_shared_ptr<partition> column_family::merge_multi_targets(std::vector<lw_shared_ptr<partition>>&& ps) const
-{
-    return make_lw_shared<partition> (nullptr);
-}
-
 future<lw_shared_ptr<partition>> column_family::try_read_from_sstable(lw_shared_ptr<sstable> stable, bytes_view key) const
 {
     assert(stable);
     auto sstable_reader = make_sstable_reader(stable);
-    return sstable_reader->seek(key).then([this, sstable_reader = std::move(sstable_reader)] {
-        if (!sstable_reader->eof()) {
+    auto filtered = stable->has_filter();
+    return sstable_reader->seek(key).then([this, key, sstable_reader = std::move(sstable_reader), filtered] {
+        if (!sstable_reader->eof() && tri_compare_keys(sstable_reader->key(), key) == 0) {
              return make_ready_future<lw_shared_ptr<partition>> ( make_lw_shared<partition>(sstable_reader->current()) );
         }
+        // the filter of the sstable was checked before the read.
+        if (filtered) {
+            ++_read_stats._bloom_filter_false_positives;
+        }
         return make_ready_future<lw_shared_ptr<partition>>( nullptr );
     });
 }
 
 void column_family::maybe_flush()
 {
+    if (_active_memtable->occupancy().total_space() < _opt._memtable_size) {
+        return;
+    }
+    // the flush reports its own failures, and retries until it succeeds.
+    seal_active_memtable().handle_exception([] (auto) {});
+}
+
+future<> column_family::seal_active_memtable()
+{
+    if (_active_memtable->empty() || _stopping) {
+        return make_ready_future<>();
+    }
+    // the memtable holds the records up to its replay position, the records appended
+    // after it are inserted into the next memtable.
+    auto mt = std::move(_active_memtable);
+    mt->disable_write();
+    _immutable_memtables.push_back(mt);
+    _active_memtable = make_lw_shared<memtable>(_dirty_memory_manager);
+    return with_gate(_flush_gate, [this, mt] {
+        return with_semaphore(_flush_lock, 1, [this, mt] {
+            return this->flush_memtable(mt);
+        });
+    });
+}
+
+future<> column_family::flush()
+{
+    // the memtables are flushed in the order they were sealed, so the last one
+    // completes after all others.
+    return seal_active_memtable().then([this] {
+        return with_gate(_flush_gate, [this] {
+            return with_semaphore(_flush_lock, 1, [] {
+                return make_ready_future<>();
+            });
+        });
+    });
+}
+
+future<std::vector<lw_shared_ptr<sstable_meta>>> column_family::write_memtable(lw_shared_ptr<memtable> mt)
+{
+    sstable_writer_options opt;
+    opt._directory = _opt._directory;
+    opt._name = _opt._name;
+    opt._new_generation = [this] { return _manifest.new_generation(); };
+    opt._throughput_mb_per_sec = [this] { return flush_throughput(); };
+    opt._builder_opt = _opt._builder_opt;
+    opt._builder_opt._compression = compression_for_level(0);
+    opt._builder_opt._io_priority_class = &memtable_flush_priority();
+    opt._scheduling_group = &memtable_flush_scheduling_group();
+    return do_with(std::move(opt), sstable_writer_stats {}, [this, mt] (auto& opt, auto& stats) {
+        return write_sstables(make_flush_reader(mt), opt, stats).then([this, &stats] (auto outputs) {
+            _stats._flushed_partitions += stats._partitions;
+            _stats._flushed_compressed_blocks += stats._compressed_blocks;
+            _stats._flushed_uncompressed_blocks += stats._uncompressed_blocks;
+            return outputs;
+        });
+    });
+}
+
+future<> column_family::flush_memtable(lw_shared_ptr<memtable> mt)
+{
+    auto start = std::chrono::steady_clock::now();
+    return write_memtable(mt).then([this] (std::vector<lw_shared_ptr<sstable_meta>> outputs) {
+        version_edit edit;
+        for (auto& m : outputs) {
+            edit.add_file(0, m);
+        }
+        _manifest.apply(edit);
+        return _manifest.persist(_opt._directory, _opt._name).then([outputs = std::move(outputs)] {
+            return std::move(outputs);
+        });
+    }).then_wrapped([this, mt, start] (future<std::vector<lw_shared_ptr<sstable_meta>>> f) {
+        try {
+            auto outputs = f.get0();
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            ++_stats._flushes;
+            for (auto& m : outputs) {
+                _stats._flushed_bytes += m->_file_size;
+                cf_log.debug("flushed the memtable of {} to {}: {} partitions, {} bytes in {} ms",
+                    _opt._name, m->_file_name, mt->partition_count(), m->_file_size, elapsed.count());
+            }
+            _stats._flush_time_ms += elapsed.count();
+        } catch (...) {
+            ++_stats._failed_flushes;
+            mt->revert_flushed_memory();
+            if (_stopping) {
+                throw;
+            }
+            // the memtable is kept, so are the commit log segments which hold its
+            // records. Try again later.
+            cf_log.error("failed to flush the memtable of {}: {}, retrying", _opt._name, std::current_exception());
+            return sleep(std::chrono::seconds(1)).then([this, mt] {
+                return this->flush_memtable(mt);
+            });
+        }
+        _immutable_memtables.erase(std::find(_immutable_memtables.begin(), _immutable_memtables.end(), mt));
+        _memtable_flushed.broadcast();
+        if (_commit_log) {
+            _commit_log->discard_completed_segments(mt->replay_position());
+        }
+        maybe_compact();
+        return mt->clear_gently();
+    });
 }
 
+void column_family::maybe_compact()
+{
+    if (_compacting || _stopping) {
+        return;
+    }
+    auto desc = _compaction_strategy->pick_compaction(_manifest);
+    if (desc.empty()) {
+        return;
+    }
+    _compacting = true;
+    with_gate(_compaction_gate, [this, desc = std::move(desc)] () mutable {
+        return this->run_compaction(std::move(desc));
+    }).then_wrapped([this] (future<> f) {
+        _compacting = false;
+        try {
+            f.get();
+        } catch (...) {
+            // the inputs are kept, the compaction is picked again after the next flush.
+            ++_compaction_stats._failed_compactions;
+            cf_log.error("failed to compact the sstables of {}: {}", _opt._name, std::current_exception());
+            return;
+        }
+        // the outputs may push the next level past its target.
+        maybe_compact();
+    });
+}
+
+future<> column_family::run_compaction(compaction_descriptor desc)
+{
+    if (desc._trivial_move) {
+        // the moved sstable keeps the codec of its former level until it is rewritten.
+        auto& m = desc._inputs.front();
+        version_edit edit;
+        edit.delete_file(desc._level, m->_generation);
+        edit.add_file(desc._output_level, m);
+        _manifest.apply(edit);
+        ++_compaction_stats._trivial_moves;
+        return _manifest.persist(_opt._directory, _opt._name);
+    }
+    sstable_writer_options opt;
+    opt._directory = _opt._directory;
+    opt._name = _opt._name;
+    opt._new_generation = [this] { return _manifest.new_generation(); };
+    opt._max_sstable_size = desc._max_sstable_size;
+    opt._drop_tombstones = desc._drop_tombstones;
+    opt._throughput_mb_per_sec = [this] { return compaction_throughput(); };
+    opt._builder_opt = _opt._builder_opt;
+    opt._builder_opt._compression = compression_for_level(desc._output_level);
+    opt._builder_opt._io_priority_class = &compaction_priority();
+    opt._scheduling_group = &compaction_scheduling_group();
+    auto start = std::chrono::steady_clock::now();
+    return do_with(std::move(desc), std::move(opt), [this, start] (auto& desc, auto& opt) {
+        return compact_sstables(desc, _sstable_opt, opt, _compaction_stats._writer).then([this, &desc] (auto outputs) {
+            version_edit edit;
+            for (auto& d : desc._deleted) {
+                edit.delete_file(d.first, d.second);
+            }
+            // the level 0 outputs take the place of the inputs among the overlapping
+            // sstables, the newer ones still hide them.
+            uint64_t sequence = 0;
+            for (auto& m : desc._inputs) {
+                sequence = std::max(sequence, m->_sequence);
+            }
+            for (auto& m : outputs) {
+                if (desc._output_level == 0) {
+                    m->_sequence = sequence;
+                }
+                edit.add_file(desc._output_level, m);
+            }
+            _manifest.apply(edit);
+            // the inputs are removed once the manifest does not refer to them.
+            return _manifest.persist(_opt._directory, _opt._name);
+        }).then([this, &desc, start] {
+            uint64_t bytes_read = 0;
+            for (auto& m : desc._inputs) {
+                bytes_read += m->_file_size;
+            }
+            _compaction_stats._bytes_read += bytes_read;
+            ++_compaction_stats._compactions;
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            cf_log.debug("compacted {} sstables of {} from the level {} into the level {}: {} bytes in {} ms",
+                desc._inputs.size(), _opt._name, desc._level, desc._output_level, bytes_read, elapsed.count());
+            // the reads which opened the inputs still hold their files.
+            for (auto& m : desc._inputs) {
+                if (m->_sstable) {
+                    _block_cache.invalidate(m->_sstable->id());
+                }
+            }
+            return parallel_for_each(desc._inputs, [] (auto& m) {
+                return sstable_io_check(sstable_write_error_handler, remove_file, m->_file_name);
+            });
+        });
+    });
+}
+
+future<> column_family::throttle_write()
+{
+    if (_immutable_memtables.size() < _opt._flush_queue_size) {
+        return make_ready_future<>();
+    }
+    ++_stats._write_stalls;
+    auto start = std::chrono::steady_clock::now();
+    return _memtable_flushed.wait([this] {
+        return _immutable_memtables.size() < _opt._flush_queue_size;
+    }).then([this, start] {
+        _stats._write_stall_time_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    });
+}
 
 future<> column_family::write(const write_options& opt, redis::decorated_key&& key, partition&& p)
+{
+    return throttle_write().then([this, key = std::move(key), p = std::move(p)] () mutable {
+        apply(std::move(key), std::move(p));
+    });
+}
+
+void column_family::apply(redis::decorated_key&& key, partition&& p, uint64_t replay_position)
 {
     _active_memtable->insert(std::move(key), std::move(p));
+    _active_memtable->update_replay_position(replay_position);
     maybe_flush();
-    return make_ready_future<>();
 }
 
 future<lw_shared_ptr<partition>> column_family::read(const read_options& opt, const redis::decorated_key& key) const
@@ -89,102 +386,274 @@ future<lw_shared_ptr<partition>> column_family::read(const read_options& opt, co
     auto target = make_lw_shared<partition>(make_null_partition());
 
     // 1. read partition from the memtable;
-    auto memtable_reader = make_memtable_reader(_active_memtable);
-    memtable_reader->seek(key.key_view());
-    // if the target partition was not in the memtable, the memtable_reader's eof will return true.
-    if (memtable_reader->eof() == false) {
-        // we read the target partition from the memtable, good news, return it to caller.
-        return make_ready_future<lw_shared_ptr<partition>> ( make_lw_shared<partition>(memtable_reader->current()) ); 
+    // the removed partition is returned as well, it hides the partition in the older tables.
+    auto p = _active_memtable->get(key);
+    if (p) {
+        return make_ready_future<lw_shared_ptr<partition>> ( make_lw_shared<partition>(std::move(*p)) );
     }
 
-    // 2. read partition from the immemtables;
+    // 2. read partition from the immemtables, the newest one first;
     // looking up the target partition from the immemtables will not blocks the thread.
-    for (size_t i = 0; i < _immutable_memtables.size(); ++i) {
-        auto immemtable_reader = make_memtable_reader(_immutable_memtables[i]);
-        immemtable_reader->seek(key.key_view());
-        if (immemtable_reader->eof() == false) {
-            // we read the target partition from the memtable, good news, return it to caller.
-            return make_ready_future<lw_shared_ptr<partition>> ( make_lw_shared<partition>(immemtable_reader->current()) ); 
+    for (auto i = _immutable_memtables.rbegin(); i != _immutable_memtables.rend(); ++i) {
+        auto p = (*i)->get(key);
+        if (p) {
+            return make_ready_future<lw_shared_ptr<partition>> ( make_lw_shared<partition>(std::move(*p)) );
         }
     }
-    // 3. read partition from the level 0 files.
-    auto&& level_zero_sstables = filter_file_meta_from_level_zero(key.key_view());
-    if (!level_zero_sstables.empty()) {
-        // if we meet the same key, return the newer one, which local version is bigger.
-        // because the sstables in the level zero were overlaped each other.
-        return do_with( std::vector<lw_shared_ptr<partition>> {}, [this, target, keyv = key.key_view(), sstables = std::move(level_zero_sstables)] (auto& target_container) { 
-            return parallel_for_each(sstables.begin(), sstables.end(), [this, target, keyv, &target_container] (auto& sstable_meta) {
-                // we have opened the sstable last time, try to read target from the sstable.
-                if (sstable_meta->_sstable) {
-                    return this->try_read_from_sstable(sstable_meta->_sstable, keyv).then([&target_container] (auto p) {
-                        target_container.emplace_back(std::move(p));
-                    });
+    // 3. read partition from the level 0 files, the newest one first, then from the
+    // other levels. The first sstable which has the key holds its latest version, the
+    // removed partition is returned as well.
+    auto sstables = filter_file_meta_from_level_zero(key.key_view());
+    auto deeper = filter_file_meta(key.key_view());
+    sstables.insert(sstables.end(), deeper.begin(), deeper.end());
+    if (sstables.empty()) {
+        // oh, the key was not exists.
+        return make_ready_future<lw_shared_ptr<partition>> ( target );
+    }
+    struct lookup_partition_state {
+        std::vector<lw_shared_ptr<sstable_meta>> _sstables;
+        std::vector<lw_shared_ptr<sstable_meta>>::iterator _next;
+        lw_shared_ptr<partition> _p;
+        lookup_partition_state(std::vector<lw_shared_ptr<sstable_meta>>&& sstables)
+           : _sstables(std::move(sstables))
+           , _next(_sstables.begin())
+           , _p(nullptr)
+           {
+           }
+    };
+    return do_with(lookup_partition_state { std::move(sstables) }, [this, target, keyv = key.key_view()] (auto& state) {
+        return repeat([this, keyv, &state] {
+            if (state._next == state._sstables.end()) {
+                return make_ready_future<stop_iteration>(stop_iteration::yes);
+            }
+            auto sm = *(state._next++);
+            if (sm->_sstable) {
+                return this->try_read_from_sstable(sm->_sstable, keyv).then([&state] (auto p) {
+                    if (p) state._p = std::move(p);
+                    return make_ready_future<stop_iteration>(!p ? stop_iteration::no : stop_iteration::yes);
+                });
+            }
+            // open the target sstable, then try to read the partition.
+            return open_sstable(sm->_file_name, _sstable_opt).then([this, keyv, sm, &state] (auto nsstable) {
+                if (!sm->_sstable) {
+                    sm->_sstable = nsstable;
                 }
-                else {
-                    // open the target sstable, then try to read the partition.
-                    return open_sstable(sstable_meta->_file_name, _sstable_opt).then([this, keyv, sstable_meta, &target_container] (auto nsstable) {
-                        sstable_meta->_sstable = nsstable;
-                        return this->try_read_from_sstable(sstable_meta->_sstable, keyv).then([&target_container] (auto p) {
-                            target_container.emplace_back(std::move(p));
-                        });
-                    });
+                if (!this->may_contain(sm, keyv)) {
+                    return make_ready_future<stop_iteration>(stop_iteration::no);
                 }
-            }).then([this, target, keyv, &target_container] {
-                auto p =  this->merge_multi_targets(std::move(target_container));
-                return make_ready_future<lw_shared_ptr<partition>> (std::move(p));
+                return this->try_read_from_sstable(sm->_sstable, keyv).then([&state] (auto p) {
+                    if (p) state._p = std::move(p);
+                    return make_ready_future<stop_iteration>(!p ? stop_iteration::no : stop_iteration::yes);
+                });
             });
-        }).then([this, target, keyv = key.key_view()] (auto t) {
-            if (t->empty()) {
-     // 4. rpartition from other level files.
-                auto&& target_sstables = this->filter_file_meta(keyv);
-                if (!target_sstables.empty()) {
-                    struct lookup_partition_state {
-                        std::vector<lw_shared_ptr<sstable_meta>> _sstables;
-                        std::vector<lw_shared_ptr<sstable_meta>>::iterator _next;
-                        lw_shared_ptr<partition> _p;
-                        lookup_partition_state(std::vector<lw_shared_ptr<sstable_meta>>&& sstables)
-                           : _sstables(std::move(sstables))
-                           , _next(_sstables.begin())
-                           , _p(nullptr)
-                           {
-                           }
-                    };
-                    return do_with(lookup_partition_state { std::move(target_sstables) }, [this, keyv] (auto& state) {
-                        return repeat([this, keyv, &state] {
-                            if (state._next == state._sstables.end()) {
-                                return make_ready_future<stop_iteration>(stop_iteration::yes);
-                            }
-                            auto sm = *(state._next++);
-                            if (sm->_sstable) {
-                                return this->try_read_from_sstable(sm->_sstable, keyv).then([&state] (auto p) {
-                                    if (p) state._p = std::move(p);
-                                    return make_ready_future<stop_iteration>(!p ? stop_iteration::no : stop_iteration::yes);
-                                });
-                            }
-                            // open the target sstable, then try to read the partition.
-                            return open_sstable(sm->_file_name, _sstable_opt).then([this, keyv, sm, &state] (auto nsstable) {
-                                assert(!sm->_sstable);
-                                sm->_sstable = nsstable;
-                                return this->try_read_from_sstable(nsstable, keyv).then([&state] (auto p) {
-                                    if (p) state._p = std::move(p);
-                                    return make_ready_future<stop_iteration>(!p ? stop_iteration::no : stop_iteration::yes);
-                                });
-                            });
-                        }).then([this, &state] {
-                            return make_ready_future<lw_shared_ptr<partition>> ( std::move(state._p) );
-                        });
-                    });
-                }
-            }
-            return make_ready_future<lw_shared_ptr<partition>> ( t );
+        }).then([target, &state] {
+            return make_ready_future<lw_shared_ptr<partition>> ( state._p ? std::move(state._p) : target );
         });
-    }
-    // oh, the key was not exists.
-    assert(target->empty()); 
-    return make_ready_future<lw_shared_ptr<partition>> ( target );
+    });
+}
+
+column_family::column_family(dirty_memory_manager& dmm, column_family_options opt)
+    : _compaction_strategy(make_compaction_strategy(opt._compaction_strategy_opt))
+    , _dirty_memory_manager(dmm)
+    , _active_memtable(make_lw_shared<memtable>(dmm))
+    , _opt(std::move(opt))
+    , _block_cache(_opt._name, _opt._block_cache_size)
+    , _flush_controller(flush_control_points(), [this] { return flush_backlog(); })
+    , _compaction_controller(compaction_control_points(), [this] { return compaction_backlog(); })
+{
+    _sstable_opt._block_cache = &_block_cache;
+    setup_metrics();
 }
 
 column_family::~column_family()
 {
 }
+
+double column_family::flush_backlog() const
+{
+    auto limit = _opt._memtable_size * (_opt._flush_queue_size + 1);
+    return double(_dirty_memory_manager.dirty_memory()) / limit;
+}
+
+double column_family::compaction_backlog() const
+{
+    return _compaction_strategy->backlog(_manifest) / _opt._memtable_size;
+}
+
+compression_type column_family::compression_for_level(int level) const
+{
+    auto& codecs = _opt._level_compression;
+    if (codecs.empty()) {
+        return compression_type::none;
+    }
+    return codecs[std::min(size_t(level), codecs.size() - 1)];
+}
+
+double column_family::flush_throughput() const
+{
+    return _opt._flush_throughput_mb_per_sec * _flush_controller.shares() / base_shares;
+}
+
+double column_family::compaction_throughput() const
+{
+    return _opt._compaction_throughput_mb_per_sec * _compaction_controller.shares() / base_shares;
+}
+
+double column_family::bloom_filter_false_positive_ratio() const
+{
+    auto positives = _read_stats._bloom_filter_checks - _read_stats._bloom_filter_negatives;
+    if (!positives) {
+        return 0;
+    }
+    return double(_read_stats._bloom_filter_false_positives) / positives;
+}
+
+size_t column_family::bloom_filter_memory_size() const
+{
+    size_t size = 0;
+    for (int level = 0; level < level_manifest::max_levels; ++level) {
+        for (auto& m : _manifest.level(level)) {
+            if (m->_sstable) {
+                size += m->_sstable->filter_memory_size();
+            }
+        }
+    }
+    return size;
+}
+
+double column_family::write_amplification() const
+{
+    if (!_stats._flushed_bytes) {
+        return 0;
+    }
+    return double(_stats._flushed_bytes + _compaction_stats._writer._bytes) / _stats._flushed_bytes;
+}
+
+void column_family::setup_metrics()
+{
+    namespace sm = seastar::metrics;
+    auto cf = sm::label("cf");
+    auto strategy = sm::label("compaction_strategy");
+    _metrics.add_group("column_family", {
+        sm::make_derive("memtable_flushes", _stats._flushes,
+                        sm::description("Counts the memtables which were flushed to the level 0 sstables."), { cf(_opt._name) }),
+        sm::make_derive("memtable_flush_failures", _stats._failed_flushes,
+                        sm::description("Counts the memtable flushes which failed and were retried."), { cf(_opt._name) }),
+        sm::make_derive("memtable_flushed_partitions", _stats._flushed_partitions,
+                        sm::description("Counts the partitions which were written by the memtable flushes."), { cf(_opt._name) }),
+        sm::make_derive("memtable_flushed_bytes", _stats._flushed_bytes,
+                        sm::description("Counts the bytes of the sstables which were written by the memtable flushes."), { cf(_opt._name) }),
+        sm::make_derive("memtable_flush_time_ms", _stats._flush_time_ms,
+                        sm::description("Counts the milliseconds spent on the memtable flushes."), { cf(_opt._name) }),
+        sm::make_derive("memtable_flushed_compressed_blocks", _stats._flushed_compressed_blocks,
+                        sm::description("Counts the data blocks which were compressed by the memtable flushes."), { cf(_opt._name) }),
+        sm::make_derive("memtable_flushed_uncompressed_blocks", _stats._flushed_uncompressed_blocks,
+                        sm::description("Counts the data blocks which were stored uncompressed by the memtable flushes."), { cf(_opt._name) }),
+        sm::make_gauge("pending_memtable_flushes", [this] { return _immutable_memtables.size(); },
+                        sm::description("Holds the number of the sealed memtables which are waiting for the flush."), { cf(_opt._name) }),
+        sm::make_derive("write_stalls", _stats._write_stalls,
+                        sm::description("Counts the writes which waited for the memtable flushes."), { cf(_opt._name) }),
+        sm::make_derive("write_stall_time_us", _stats._write_stall_time_us,
+                        sm::description("Counts the microseconds the writes waited for the memtable flushes."), { cf(_opt._name) }),
+        sm::make_derive("compactions", _compaction_stats._compactions,
+                        sm::description("Counts the compactions which merged the sstables."), { cf(_opt._name) }),
+        sm::make_derive("compaction_trivial_moves", _compaction_stats._trivial_moves,
+                        sm::description("Counts the sstables which were moved to the next level without being rewritten."), { cf(_opt._name) }),
+        sm::make_derive("compaction_failures", _compaction_stats._failed_compactions,
+                        sm::description("Counts the compactions which failed."), { cf(_opt._name) }),
+        sm::make_derive("compaction_bytes_read", _compaction_stats._bytes_read,
+                        sm::description("Counts the bytes of the sstables which were merged by the compactions."), { cf(_opt._name) }),
+        sm::make_derive("compaction_bytes_written", _compaction_stats._writer._bytes,
+                        sm::description("Counts the bytes of the sstables which were written by the compactions."), { cf(_opt._name) }),
+        sm::make_derive("compaction_compressed_blocks", _compaction_stats._writer._compressed_blocks,
+                        sm::description("Counts the data blocks which were compressed by the compactions."), { cf(_opt._name) }),
+        sm::make_derive("compaction_uncompressed_blocks", _compaction_stats._writer._uncompressed_blocks,
+                        sm::description("Counts the data blocks which were stored uncompressed by the compactions."), { cf(_opt._name) }),
+        sm::make_derive("compaction_dropped_tombstones", _compaction_stats._writer._dropped_tombstones,
+                        sm::description("Counts the removed partitions which were dropped by the compactions."), { cf(_opt._name) }),
+        sm::make_derive("compaction_throttled_ms", _compaction_stats._writer._throttled_ms,
+                        sm::description("Counts the milliseconds the compactions slept to keep their throughput."), { cf(_opt._name) }),
+        sm::make_derive("bloom_filter_checks", _read_stats._bloom_filter_checks,
+                        sm::description("Counts the lookups which checked the bloom filter of an sstable."), { cf(_opt._name) }),
+        sm::make_derive("bloom_filter_negatives", _read_stats._bloom_filter_negatives,
+                        sm::description("Counts the lookups which skipped an sstable by its bloom filter."), { cf(_opt._name) }),
+        sm::make_derive("bloom_filter_false_positives", _read_stats._bloom_filter_false_positives,
+                        sm::description("Counts the lookups which passed the bloom filter of an sstable which did not hold the key."), { cf(_opt._name) }),
+        sm::make_gauge("bloom_filter_false_positive_ratio", [this] { return bloom_filter_false_positive_ratio(); },
+                        sm::description("Holds the ratio of the lookups which passed the bloom filters but found no key."), { cf(_opt._name) }),
+        sm::make_gauge("bloom_filter_memory_size", [this] { return bloom_filter_memory_size(); },
+                        sm::description("Holds the memory of the bloom filters of the opened sstables."), { cf(_opt._name) }),
+        sm::make_gauge("level0_sstables", [this] { return _manifest.level(0).size(); },
+                        sm::description("Holds the number of the level 0 sstables."), { cf(_opt._name) }),
+        sm::make_gauge("write_amplification", [this] { return write_amplification(); },
+                        sm::description("Holds the bytes written by the flushes and the compactions per byte flushed."),
+                        { cf(_opt._name), strategy(_compaction_strategy->name()) }),
+        sm::make_gauge("flush_backlog", [this] { return _flush_controller.backlog(); },
+                        sm::description("Holds the dirty memory of the memtables, normalized by the memory at which the writes wait for the flushes."), { cf(_opt._name) }),
+        sm::make_gauge("flush_shares", [this] { return _flush_controller.shares(); },
+                        sm::description("Holds the shares of the memtable flushes set by the flush backlog."), { cf(_opt._name) }),
+        sm::make_gauge("flush_throughput_mb_per_sec", [this] { return flush_throughput(); },
+                        sm::description("Holds the throughput of the memtable flushes, 0 is unthrottled."), { cf(_opt._name) }),
+        sm::make_gauge("compaction_backlog", [this] { return _compaction_controller.backlog(); },
+                        sm::description("Holds the bytes the compactions have to rewrite, normalized by the memtable size."),
+                        { cf(_opt._name), strategy(_compaction_strategy->name()) }),
+        sm::make_gauge("compaction_shares", [this] { return _compaction_controller.shares(); },
+                        sm::description("Holds the shares of the compactions set by the compaction backlog."), { cf(_opt._name) }),
+        sm::make_gauge("compaction_throughput_mb_per_sec", [this] { return compaction_throughput(); },
+                        sm::description("Holds the throughput of the compactions, 0 is unthrottled."), { cf(_opt._name) }),
+    });
+}
+
+future<> column_family::start()
+{
+    return sstable_io_check(sstable_write_error_handler, recursive_touch_directory, _opt._directory).then([this] {
+        return _manifest.load(_opt._directory, _opt._name);
+    }).then([this] {
+        return remove_orphan_sstables();
+    }).then([this] {
+        maybe_compact();
+    });
+}
+
+future<> column_family::remove_orphan_sstables()
+{
+    std::unordered_set<sstring> live;
+    for (int level = 0; level < level_manifest::max_levels; ++level) {
+        for (auto& m : _manifest.level(level)) {
+            live.insert(m->_file_name);
+        }
+    }
+    return open_checked_directory(general_disk_error_handler, _opt._directory).then([this, live = std::move(live)] (file dir) mutable {
+        auto prefix = _opt._name + "-";
+        auto orphans = make_lw_shared<std::vector<sstring>>();
+        auto listing = make_lw_shared<subscription<directory_entry>>(dir.list_directory([this, prefix, orphans, live = std::move(live)] (directory_entry de) {
+            auto name = _opt._directory + "/" + de.name;
+            auto is_sstable = de.name.size() > prefix.size() && de.name.compare(0, prefix.size(), prefix) == 0
+                && (boost::algorithm::ends_with(de.name, ".sst") || boost::algorithm::ends_with(de.name, ".sst.tmp"));
+            if (is_sstable && !live.count(name)) {
+                orphans->push_back(std::move(name));
+            }
+            return make_ready_future<>();
+        }));
+        return listing->done().finally([listing, dir] () mutable {
+            return dir.close();
+        }).then([orphans] {
+            return parallel_for_each(*orphans, [orphans] (const sstring& name) {
+                cf_log.info("removing the sstable {} which is not in the manifest", name);
+                return sstable_io_check(sstable_write_error_handler, remove_file, name);
+            });
+        });
+    });
+}
+
+future<> column_family::stop()
+{
+    _stopping = true;
+    _memtable_flushed.broken();
+    _flush_controller.stop();
+    _compaction_controller.stop();
+    return _flush_gate.close().then([this] {
+        return _compaction_gate.close();
+    });
+}
 }
@@ -1,23 +1,24 @@
 #pragma once
 #include <vector>
 #include "core/shared_ptr.hh"
+#include "core/condition-variable.hh"
+#include "core/gate.hh"
+#include "core/semaphore.hh"
+#include "core/metrics_registration.hh"
 #include "store/table.hh"
+#include "store/table_builder.hh"
+#include "store/table/block_cache.hh"
+#include "store/level_manifest.hh"
+#include "store/compaction.hh"
+#include "store/compaction_strategy.hh"
+#include "store/backlog_controller.hh"
 #include "store/memtable.hh"
+#include "store/commit_log.hh"
 #include "store/log_writer.hh"
 #include "partition.hh"
 #include "core/sharded.hh"
 namespace store {
 
-struct sstable_meta {
-    bytes _smallest_key {};
-    bytes _largest_key {};
-    bytes _file_name {};
-    lw_shared_ptr<sstable> _sstable = { nullptr };
-    sstable_meta()
-    {
-    }
-};
-
 class level_manifest_wrapper {
     unsigned int _source_shard;
     std::vector<std::vector<lw_shared_ptr<sstable_meta>>> _sstable_metas;
@@ -38,29 +39,145 @@ public:
     }
 };
 
+struct column_family_options {
+    sstring _name;
+    sstring _directory;
+    // the active memtable is sealed and flushed once it takes so much memory.
+    size_t _memtable_size = 64 * 1024 * 1024;
+    // the writes wait once so many sealed memtables are waiting for the flush.
+    size_t _flush_queue_size = 4;
+    // the rates of the bytes written by the compactions and the flushes at the base
+    // shares, the backlog controllers scale them. 0 is unthrottled.
+    uint32_t _compaction_throughput_mb_per_sec = 16;
+    uint32_t _flush_throughput_mb_per_sec = 32;
+    table_builder_options _builder_opt;
+    compaction_strategy_options _compaction_strategy_opt;
+    // the codecs of the data blocks by the level, the last one applies to the deeper
+    // levels. The level 0 is flushed often and compacted soon, it is not compressed.
+    std::vector<compression_type> _level_compression = { compression_type::none, compression_type::lz4 };
+    // the memory of the uncompressed data blocks which were read recently.
+    size_t _block_cache_size = 64 * 1024 * 1024;
+};
+
+struct flush_stats {
+    uint64_t _flushes = 0;
+    uint64_t _failed_flushes = 0;
+    uint64_t _flushed_partitions = 0;
+    uint64_t _flushed_bytes = 0;
+    uint64_t _flush_time_ms = 0;
+    uint64_t _flushed_compressed_blocks = 0;
+    uint64_t _flushed_uncompressed_blocks = 0;
+    // the writes which waited for the flush queue, and the time they waited.
+    uint64_t _write_stalls = 0;
+    uint64_t _write_stall_time_us = 0;
+};
+
+struct read_stats {
+    // the lookups which checked the bloom filters, the ones the filters rejected, and
+    // the ones which passed but found no key.
+    uint64_t _bloom_filter_checks = 0;
+    uint64_t _bloom_filter_negatives = 0;
+    uint64_t _bloom_filter_false_positives = 0;
+};
+
+struct compaction_stats {
+    uint64_t _compactions = 0;
+    uint64_t _trivial_moves = 0;
+    uint64_t _failed_compactions = 0;
+    uint64_t _bytes_read = 0;
+    sstable_writer_stats _writer;
+};
+
 class write_options;
 class read_options;
 class column_family final {
-    static constexpr int MAX_LEVELS = 9;
-    std::vector<std::vector<lw_shared_ptr<sstable_meta>>> _sstables;
+    level_manifest _manifest;
+    std::unique_ptr<compaction_strategy> _compaction_strategy;
+    dirty_memory_manager& _dirty_memory_manager;
     lw_shared_ptr<memtable> _active_memtable;
     std::vector<lw_shared_ptr<memtable>> _immutable_memtables;
-    bytes _sstable_dir_name;
-    bytes _column_family_name;
+    column_family_options _opt;
     sstable_options _sstable_opt;
+    block_cache _block_cache;
+    lw_shared_ptr<commit_log> _commit_log;
+    // the sealed memtables are flushed one by one, in the order they were sealed.
+    semaphore _flush_lock { 1 };
+    condition_variable _memtable_flushed;
+    gate _flush_gate;
+    // the compactions run one by one in the background.
+    gate _compaction_gate;
+    bool _compacting = false;
+    bool _stopping = false;
+    flush_stats _stats;
+    compaction_stats _compaction_stats;
+    mutable read_stats _read_stats;
+    // the flushes speed up as the dirty memory grows, and the compactions as their
+    // backlog grows.
+    backlog_controller _flush_controller;
+    backlog_controller _compaction_controller;
+    seastar::metrics::metric_groups _metrics;
 public:
-    column_family();
+    column_family(dirty_memory_manager& dmm, column_family_options opt);
     ~column_family();
+    // Loads the manifest, and removes the sstables which are not in it: they were
+    // left by the flushes and the compactions which did not complete.
+    future<> start();
+    // Waits for the flushes and the compactions in progress.
+    future<> stop();
     future<> write(const write_options& opt, redis::decorated_key&& key, partition&& p);
+    // Waits while the flush queue is full. The logged writes wait before they are
+    // appended to the commit log, so the memtable sealed while they wait does not
+    // cover their records.
+    future<> throttle_write();
+    // Inserts the partition into the active memtable without waiting, the replay
+    // position is the commit log record of the write, 0 if it was not logged.
+    void apply(redis::decorated_key&& key, partition&& p, uint64_t replay_position = 0);
     future<lw_shared_ptr<partition>> read(const read_options& opt, const redis::decorated_key& key) const;
     bool apply_new_sstables(foreign_ptr<level_manifest_wrapper> news);
+    // The flushed memtables release the commit log segments which hold their records.
+    void set_commit_log(lw_shared_ptr<commit_log> log) {
+        _commit_log = std::move(log);
+    }
+    // Seals the active memtable and flushes it to a level 0 sstable in the background,
+    // the sealed memtable is read until it is flushed. The future resolves when the
+    // memtable was flushed.
+    future<> seal_active_memtable();
+    // Seals the active memtable, the future resolves when all sealed memtables were
+    // flushed.
+    future<> flush();
+    const flush_stats& get_flush_stats() const {
+        return _stats;
+    }
+    const compaction_stats& get_compaction_stats() const {
+        return _compaction_stats;
+    }
+    // The bytes written by the flushes and the compactions per byte flushed, it
+    // compares the compaction strategies.
+    double write_amplification() const;
+    const read_stats& get_read_stats() const {
+        return _read_stats;
+    }
+    double bloom_filter_false_positive_ratio() const;
 private:
     future<lw_shared_ptr<partition>> try_read_from_sstable(lw_shared_ptr<sstable> stable, bytes_view key) const;
     void maybe_flush();
+    future<> flush_memtable(lw_shared_ptr<memtable> mt);
+    future<std::vector<lw_shared_ptr<sstable_meta>>> write_memtable(lw_shared_ptr<memtable> mt);
+    void maybe_compact();
+    future<> run_compaction(compaction_descriptor desc);
+    future<> remove_orphan_sstables();
+    size_t bloom_filter_memory_size() const;
+    double flush_backlog() const;
+    double compaction_backlog() const;
+    double flush_throughput() const;
+    double compaction_throughput() const;
+    compression_type compression_for_level(int level) const;
+    void setup_metrics();
     int in_range(lw_shared_ptr<sstable_meta> m, const bytes_view& key) const;
+    // Returns false if the bloom filter of the opened sstable rejects the key.
+    bool may_contain(const lw_shared_ptr<sstable_meta>& m, bytes_view key) const;
     std::vector<lw_shared_ptr<sstable_meta>> filter_file_meta(bytes_view key) const;
     std::vector<lw_shared_ptr<sstable_meta>> filter_file_meta_from_level_zero(bytes_view key) const;
-    lw_shared_ptr<partition> merge_multi_targets(std::vector<lw_shared_ptr<partition>>&& ps) const;
 };
 
 }
@@ -0,0 +1,110 @@
+#include "store/reader.hh"
+#include "store/table/format.hh"
+#include "core/future-util.hh"
+#include <assert.h>
+namespace store {
+
+// Merges the readers in the order of the keys. The current partition is the one of
+// the first reader, the newest one, among the readers which are at the smallest key;
+// next() moves all of them past the key, so the older partitions are skipped.
+class combined_reader final : public reader::impl {
+    std::vector<lw_shared_ptr<reader>> _readers;
+    // the reader of the current partition, or -1 at the end.
+    int _current = -1;
+    // seek_to_last() positions at the largest key, nothing follows it.
+    bool _at_last = false;
+private:
+    template <typename Func>
+    future<> for_each_reader(Func&& func) {
+        return parallel_for_each(_readers, std::forward<Func>(func));
+    }
+
+    // Selects the smallest key, or the largest one after seek_to_last().
+    void select(bool largest) {
+        _current = -1;
+        for (size_t i = 0; i < _readers.size(); ++i) {
+            if (_readers[i]->eof()) {
+                continue;
+            }
+            if (_current < 0) {
+                _current = i;
+                continue;
+            }
+            auto c = tri_compare_keys(_readers[i]->key(), _readers[_current]->key());
+            if (largest ? c > 0 : c < 0) {
+                _current = i;
+            }
+        }
+    }
+public:
+    explicit combined_reader(std::vector<lw_shared_ptr<reader>> readers)
+        : _readers(std::move(readers))
+    {
+    }
+
+    virtual future<> seek_to_first() override {
+        _at_last = false;
+        return for_each_reader([] (auto& r) {
+            return r->seek_to_first();
+        }).then([this] {
+            select(false);
+        });
+    }
+
+    virtual future<> seek_to_last() override {
+        _at_last = true;
+        return for_each_reader([] (auto& r) {
+            return r->seek_to_last();
+        }).then([this] {
+            select(true);
+        });
+    }
+
+    virtual future<> seek(bytes_view key) override {
+        _at_last = false;
+        return for_each_reader([key] (auto& r) {
+            return r->seek(key);
+        }).then([this] {
+            select(false);
+        });
+    }
+
+    virtual future<> next() override {
+        if (_current < 0) {
+            return make_ready_future<>();
+        }
+        if (_at_last) {
+            _current = -1;
+            return make_ready_future<>();
+        }
+        auto key = _readers[_current]->key();
+        return for_each_reader([key = std::move(key)] (auto& r) {
+            if (r->eof() || tri_compare_keys(r->key(), key) != 0) {
+                return make_ready_future<>();
+            }
+            return r->next();
+        }).then([this] {
+            select(false);
+        });
+    }
+
+    virtual bool eof() const override {
+        return _current < 0;
+    }
+
+    virtual const bytes& key() const override {
+        assert(_current >= 0);
+        return _readers[_current]->key();
+    }
+
+    virtual partition current() const override {
+        assert(_current >= 0);
+        return _readers[_current]->current();
+    }
+};
+
+lw_shared_ptr<reader> make_combined_reader(std::vector<lw_shared_ptr<reader>> readers) {
+    return make_lw_shared<reader>(std::make_unique<combined_reader>(std::move(readers)));
+}
+
+}
@@ -1,9 +1,398 @@
 #include "store/commit_log.hh"
+#include "store/checked-file-impl.hh"
+#include "core/align.hh"
+#include "core/byteorder.hh"
+#include "core/reactor.hh"
+#include "core/print.hh"
+#include "utils/crc.hh"
+#include "utils/disk-error-handler.hh"
+#include "util/log.hh"
 namespace store {
 
-future<> commit_log::append(lw_shared_ptr<partition> entry)
+using logger =  seastar::logger;
+static logger commit_log_log ("commit_log");
+
+constexpr const size_t commit_log::alignment;
+constexpr const uint32_t commit_log::segment_magic;
+constexpr const uint32_t commit_log::segment_version;
+constexpr const size_t commit_log::record_header_size;
+constexpr const size_t commit_log::group_header_size;
+
+template <typename T>
+static inline char* put(char* p, T value)
+{
+    value = cpu_to_le(value);
+    std::copy_n(reinterpret_cast<const char*>(&value), sizeof(value), p);
+    return p + sizeof(value);
+}
+
+commit_log::commit_log(options opt)
+    : _opt(std::move(opt))
+{
+    _timer.set_callback([this] { cycle_in_background(); });
+}
+
+commit_log::~commit_log()
+{
+}
+
+commit_log::sync_mode commit_log::parse_sync_mode(const sstring& mode)
+{
+    return mode == "batch" ? sync_mode::batch : sync_mode::periodic;
+}
+
+sstring commit_log::segment_name(uint64_t file_id) const
+{
+    return sprint("%s/commitlog-%d-%d.log", _opt._directory, engine().cpu_id(), file_id);
+}
+
+future<> commit_log::start(adopted_segments adopted)
+{
+    // the ids of the files and the generations are increased from the start time,
+    // so the segments of the previous runs are never overwritten.
+    auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    _next_file_id = std::max<uint64_t>(now, adopted._max_file_id + 1);
+    _next_generation = std::max<uint64_t>(now, adopted._max_generation + 1);
+    return commit_io_check(recursive_touch_directory, _opt._directory).then([this, adopted = std::move(adopted)] () mutable {
+        return adopt(std::move(adopted));
+    }).then([this] {
+        return with_semaphore(_write_lock, 1, [this] {
+            return next_segment();
+        });
+    }).then([this] {
+        if (_opt._mode == sync_mode::periodic) {
+            _timer.arm_periodic(std::chrono::duration_cast<steady_clock_type::duration>(_opt._sync_period));
+        }
+    });
+}
+
+future<> commit_log::adopt(adopted_segments adopted)
+{
+    return do_with(std::move(adopted), [this] (auto& adopted) {
+        // the replayed segments hold no records of this run, the flushes of this run
+        // never complete them.
+        return do_for_each(adopted._replayed, [this] (const sstring& name) {
+            return open_checked_file_dma(commit_error_handler, name, open_flags::rw).then([this, name] (file f) {
+                _replayed.push_back(make_lw_shared<segment>(segment { name, std::move(f) }));
+            });
+        }).then([this, &adopted] {
+            return do_for_each(adopted._free, [this] (const sstring& name) {
+                return open_checked_file_dma(commit_error_handler, name, open_flags::rw).then([this, name] (file f) {
+                    _reserve.push_back(make_lw_shared<segment>(segment { name, std::move(f) }));
+                    _reserve_ready.signal();
+                });
+            });
+        });
+    });
+}
+
+future<> commit_log::stop()
+{
+    _timer.cancel();
+    return cycle().then([this] {
+        return _gate.close();
+    }).then([this] {
+        std::vector<lw_shared_ptr<segment>> segments;
+        if (_segment) {
+            segments.push_back(std::move(_segment));
+        }
+        std::move(_closed.begin(), _closed.end(), std::back_inserter(segments));
+        std::move(_replayed.begin(), _replayed.end(), std::back_inserter(segments));
+        std::move(_reserve.begin(), _reserve.end(), std::back_inserter(segments));
+        _closed.clear();
+        _replayed.clear();
+        _reserve.clear();
+        return parallel_for_each(segments, [] (auto s) {
+            return s->_file.close().finally([s] {});
+        });
+    });
+}
+
+size_t commit_log::disk_usage() const
+{
+    auto segments = _closed.size() + _replayed.size() + _reserve.size() + _allocating + (_segment ? 1 : 0);
+    return segments * _opt._segment_size;
+}
+
+lw_shared_ptr<commit_log::group> commit_log::make_group(size_t size) const
 {
+    auto g = make_lw_shared<group>();
+    auto capacity = align_up(std::max(group_header_size + size, _opt._buffer_size), alignment);
+    g->_buffer = temporary_buffer<char>::aligned(alignment, capacity);
+    return g;
+}
+
+future<> commit_log::append(const redis::decorated_key& key, const partition& p)
+{
+    auto value = p.serialize();
+    auto k = key.key_view();
+    uint32_t payload = sizeof(uint8_t) + sizeof(uint32_t) + k.size() + value.size();
+    size_t size = record_header_size + payload;
+    if (_current && _current->_used + size > _current->_buffer.size()) {
+        // the full group is written at once, instead of waiting for the timer.
+        _sealed.push_back(std::move(_current));
+        cycle_in_background();
+    }
+    if (!_current) {
+        _current = make_group(size);
+        if (_opt._mode == sync_mode::batch && !_timer.armed()) {
+            _timer.arm(std::chrono::duration_cast<steady_clock_type::duration>(_opt._batch_window));
+        }
+    }
+    auto g = _current;
+    auto record = g->_buffer.get_write() + g->_used;
+    auto data = put<uint8_t>(record + record_header_size, static_cast<uint8_t>(p.type()));
+    data = put<uint32_t>(data, k.size());
+    data = std::copy_n(k.data(), k.size(), data);
+    std::copy_n(value.data(), value.size(), data);
+    utils::crc32 crc;
+    crc.process(reinterpret_cast<const uint8_t*>(record + record_header_size), payload);
+    put<uint32_t>(put<uint32_t>(record, crc.get()), payload);
+    g->_used += size;
+    g->_last_position = ++_position;
+    _pending_bytes += size;
+
+    if (_opt._mode == sync_mode::batch || _pending_bytes > _opt._max_pending_bytes) {
+        return g->_durable.get_shared_future();
+    }
     return make_ready_future<>();
 }
 
+future<> commit_log::sync()
+{
+    return cycle();
+}
+
+void commit_log::cycle_in_background()
+{
+    cycle().handle_exception([] (auto ep) {
+        commit_log_log.error("failed to write the commit log: {}", ep);
+    });
+}
+
+future<> commit_log::cycle()
+{
+    return futurize_apply([this] {
+        return with_gate(_gate, [this] {
+            return with_semaphore(_write_lock, 1, [this] {
+                // the records which were appended while the previous write was in
+                // flight are written together, and synced by one flush.
+                auto groups = std::move(_sealed);
+                _sealed.clear();
+                if (_current && _current->_used > group_header_size) {
+                    groups.push_back(std::move(_current));
+                }
+                _current = {};
+                if (groups.empty()) {
+                    return make_ready_future<>();
+                }
+                return write(std::move(groups));
+            });
+        });
+    });
+}
+
+future<> commit_log::write(std::vector<lw_shared_ptr<group>> groups)
+{
+    return do_with(std::move(groups), [this] (auto& groups) {
+        return do_for_each(groups, [this] (auto& g) {
+            return this->write_group(g);
+        }).then([this] {
+            return _segment->_file.flush();
+        }).then_wrapped([this, &groups] (future<> f) {
+            std::exception_ptr ep;
+            try {
+                f.get();
+            } catch (...) {
+                ep = std::current_exception();
+            }
+            for (auto& g : groups) {
+                _pending_bytes -= g->_used - group_header_size;
+                if (ep) {
+                    g->_durable.set_exception(ep);
+                } else {
+                    g->_durable.set_value();
+                }
+            }
+            return ep ? make_exception_future<>(ep) : make_ready_future<>();
+        });
+    });
+}
+
+future<> commit_log::write_group(lw_shared_ptr<group> g)
+{
+    auto size = align_up(g->_used, alignment);
+    std::fill(g->_buffer.get_write() + g->_used, g->_buffer.get_write() + size, 0);
+    auto f = make_ready_future<>();
+    if (!_segment || (_segment->_size > alignment && _segment->_size + size > _opt._segment_size)) {
+        f = next_segment();
+    }
+    return f.then([this, g, size] {
+        auto s = _segment;
+        // the group header binds the group to the generation of the segment.
+        uint32_t records_size = g->_used - group_header_size;
+        utils::crc32 crc;
+        crc.process(s->_generation);
+        crc.process(records_size);
+        put<uint32_t>(put<uint32_t>(put<uint64_t>(g->_buffer.get_write(), s->_generation), records_size), crc.get());
+        auto pos = s->_size;
+        s->_size += size;
+        s->_last_position = std::max(s->_last_position, g->_last_position);
+        return s->_file.dma_write(pos, g->_buffer.get(), size).then([s, g, size] (size_t written) {
+            if (written != size) {
+                throw std::runtime_error(sprint("short write to the commit log %s", s->_name));
+            }
+        });
+    });
+}
+
+future<> commit_log::write_header(lw_shared_ptr<segment> s)
+{
+    auto header = temporary_buffer<char>::aligned(alignment, alignment);
+    std::fill(header.get_write(), header.get_write() + alignment, 0);
+    // a recycled segment waits in the reserve with a zero generation, so it is never replayed.
+    if (s->_generation) {
+        put<uint64_t>(put<uint32_t>(put<uint32_t>(header.get_write(), segment_magic), segment_version), s->_generation);
+    }
+    auto p = header.get();
+    return s->_file.dma_write(0, p, alignment).then([s, header = std::move(header)] (size_t written) {
+        if (written != alignment) {
+            throw std::runtime_error(sprint("short write to the commit log %s", s->_name));
+        }
+    });
+}
+
+future<> commit_log::next_segment()
+{
+    auto f = make_ready_future<>();
+    if (_segment) {
+        auto old = std::move(_segment);
+        _closed.push_back(old);
+        f = old->_file.flush();
+    }
+    return f.then([this] {
+        replenish();
+        return _reserve_ready.wait();
+    }).then([this] {
+        auto s = _reserve.front();
+        _reserve.pop_front();
+        s->_generation = _next_generation++;
+        s->_size = alignment;
+        s->_last_position = 0;
+        // the header is overwritten in place, the file was preallocated already.
+        return write_header(s).then([this, s] {
+            _segment = s;
+            replenish();
+        });
+    });
+}
+
+// Keeps the reserve filled, the segments are preallocated in the background.
+void commit_log::replenish()
+{
+    while (_reserve.size() + _allocating < _opt._reserve_segments) {
+        ++_allocating;
+        auto file_id = _next_file_id++;
+        with_gate(_gate, [this, file_id] {
+            return allocate_segment(file_id);
+        }).then_wrapped([this] (future<> f) {
+            --_allocating;
+            try {
+                f.get();
+            } catch (...) {
+                commit_log_log.error("failed to preallocate the commit log segment: {}", std::current_exception());
+                _reserve_ready.broken(std::current_exception());
+            }
+        });
+    }
+    maybe_request_flush();
+}
+
+future<> commit_log::allocate_segment(uint64_t file_id)
+{
+    auto name = segment_name(file_id);
+    return open_checked_file_dma(commit_error_handler, name, open_flags::rw | open_flags::create | open_flags::exclusive).then([this, name] (file f) {
+        auto s = make_lw_shared<segment>(segment { name, std::move(f) });
+        return s->_file.allocate(0, _opt._segment_size).then([this, s] {
+            // the zeros are written once, so the writes of the groups never convert
+            // the unwritten extents.
+            static constexpr size_t chunk_size = 1024 * 1024;
+            auto zeros = temporary_buffer<char>::aligned(alignment, chunk_size);
+            std::fill(zeros.get_write(), zeros.get_write() + chunk_size, 0);
+            return do_with(std::move(zeros), uint64_t(0), [this, s] (auto& zeros, auto& pos) {
+                return do_until([this, &pos] { return pos >= _opt._segment_size; }, [s, &zeros, &pos] {
+                    return s->_file.dma_write(pos, zeros.get(), zeros.size()).then([&pos] (size_t written) {
+                        if (!written) {
+                            throw std::runtime_error("failed to zero-fill the commit log segment");
+                        }
+                        pos += written;
+                    });
+                });
+            });
+        }).then([s] {
+            return s->_file.flush();
+        }).then([this, s] {
+            _reserve.push_back(s);
+            _reserve_ready.signal();
+        });
+    });
+}
+
+void commit_log::discard_completed_segments(uint64_t position)
+{
+    while (!_closed.empty() && _closed.front()->_last_position <= position) {
+        auto s = _closed.front();
+        _closed.pop_front();
+        recycle_in_background(s);
+    }
+}
+
+void commit_log::release_replayed_segments()
+{
+    for (auto& s : _replayed) {
+        recycle_in_background(s);
+    }
+    _replayed.clear();
+}
+
+void commit_log::recycle_in_background(lw_shared_ptr<segment> s)
+{
+    ++_allocating;
+    with_gate(_gate, [this, s] {
+        return recycle(s);
+    }).then_wrapped([this] (future<> f) {
+        --_allocating;
+        try {
+            f.get();
+        } catch (...) {
+            commit_log_log.error("failed to recycle the commit log segment: {}", std::current_exception());
+        }
+    });
+}
+
+future<> commit_log::recycle(lw_shared_ptr<segment> s)
+{
+    s->_generation = 0;
+    if (_opt._total_space && disk_usage() > _opt._total_space) {
+        // too many segments were created while the memtables were flushed.
+        return s->_file.close().then([s] {
+            return commit_io_check(remove_file, s->_name);
+        });
+    }
+    return write_header(s).then([s] {
+        return s->_file.flush();
+    }).then([this, s] {
+        _reserve.push_back(s);
+        _reserve_ready.signal();
+    });
+}
+
+void commit_log::maybe_request_flush()
+{
+    if (_opt._total_space && disk_usage() > _opt._total_space && _flush_requested < _position && _flush_handler) {
+        _flush_requested = _position;
+        _flush_handler(_position);
+    }
+}
+
 }
@@ -1,21 +1,165 @@
 #pragma once
-#include "store/log_writer.hh"
 #include "partition.hh"
+#include "keys.hh"
 #include "core/future.hh"
+#include "core/shared_future.hh"
 #include "core/shared_ptr.hh"
+#include "core/file.hh"
+#include "core/gate.hh"
+#include "core/semaphore.hh"
+#include "core/timer.hh"
+#include "core/temporary_buffer.hh"
 #include "utils/bytes.hh"
+#include "seastarx.hh"
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <vector>
 namespace store {
+
+// The per-shard commit log. The records of the concurrent writers are copied into
+// the buffer of the current group; a group is written as one aligned DMA write, and
+// the groups which were written together are synced by one flush.
+//
+// The segment files are preallocated and zero-filled in the background, so the write
+// path never creates or extends a file. A segment whose records were all flushed to
+// the sstables is recycled: its header is invalidated, and a new generation header is
+// written when it is used again.
+//
+// A segment starts with a header block, and every group starts at an aligned offset:
+//   header : [magic u32][version u32][generation u64], padded to the alignment.
+//   group  : [generation u64][size u32][crc32 u32][records]
+//   record : [crc32 u32][size u32][type u8][key size u32][key][value]
+// The group is valid only if its generation is the one of the segment, so the stale
+// groups of a recycled segment are never replayed. The size of a group counts its
+// records, the size of a record counts the bytes after the size field, and the crc
+// covers them.
 class commit_log {
-    bytes _file_name;
-    lw_shared_ptr<log::writer> _writer;
 public:
-    commit_log() = default;
-    commit_log(bytes fn) : _file_name (std::move(fn)), _writer(make_lw_shared<log::writer>(_file_name)) {}
-    ~commit_log() = default;
-    commit_log(commit_log&&) = default;
+    enum class sync_mode {
+        // the appends resolve once they are buffered, the groups are synced every
+        // sync period or whenever a buffer is full.
+        periodic,
+        // the appends resolve when their groups are durable, a group is written
+        // after the batch window since its first record.
+        batch,
+    };
+    struct options {
+        sstring _directory;
+        size_t _segment_size = 64 * 1024 * 1024;
+        sync_mode _mode = sync_mode::periodic;
+        std::chrono::milliseconds _sync_period { 10000 };
+        std::chrono::milliseconds _batch_window { 0 };
+        size_t _buffer_size = 128 * 1024;
+        // the periodic appends wait for the sync once so many bytes are not durable.
+        size_t _max_pending_bytes = 8 * 1024 * 1024;
+        // the memtables are flushed once the segments take more space, 0 is unlimited.
+        size_t _total_space = 0;
+        // the number of the preallocated segments which are kept ready.
+        size_t _reserve_segments = 2;
+    };
+    // Called with the position of the last appended record, when the segments take
+    // more space than the total space. The owner flushes the memtables which hold
+    // the records up to the position, then discards the completed segments.
+    using flush_handler = std::function<void (uint64_t position)>;
+    // The segments which were found at the start. The replayed segments are kept
+    // until the memtables which hold their records are flushed on all shards, see
+    // release_replayed_segments(), the free ones are put into the reserve.
+    struct adopted_segments {
+        std::vector<sstring> _replayed;
+        std::vector<sstring> _free;
+        uint64_t _max_generation = 0;
+        uint64_t _max_file_id = 0;
+    };
+    static constexpr const size_t alignment = 4096;
+    static constexpr const uint32_t segment_magic = 0x50434c47;
+    static constexpr const uint32_t segment_version = 1;
+    static constexpr const size_t record_header_size = 2 * sizeof(uint32_t);
+    static constexpr const size_t group_header_size = sizeof(uint64_t) + 2 * sizeof(uint32_t);
+private:
+    struct segment {
+        sstring _name;
+        file _file;
+        uint64_t _generation = 0;
+        uint64_t _size = 0;
+        // the position of the last record in the segment.
+        uint64_t _last_position = 0;
+    };
+    struct group {
+        temporary_buffer<char> _buffer;
+        size_t _used = group_header_size;
+        uint64_t _last_position = 0;
+        shared_promise<> _durable;
+    };
+    options _opt;
+    lw_shared_ptr<segment> _segment;
+    // the segments which were written, but not flushed to the sstables yet.
+    std::deque<lw_shared_ptr<segment>> _closed;
+    // the segments which were replayed at the start. Their records were sent to the
+    // memtables of all shards, which do not know their positions in this log.
+    std::vector<lw_shared_ptr<segment>> _replayed;
+    // the preallocated or recycled segments.
+    std::deque<lw_shared_ptr<segment>> _reserve;
+    semaphore _reserve_ready { 0 };
+    size_t _allocating = 0;
+    uint64_t _next_file_id = 0;
+    uint64_t _next_generation = 0;
+    // the number of the records which were appended.
+    uint64_t _position = 0;
+    uint64_t _flush_requested = 0;
+    flush_handler _flush_handler;
+    lw_shared_ptr<group> _current;
+    // the full groups which are waiting for the write lock.
+    std::vector<lw_shared_ptr<group>> _sealed;
+    size_t _pending_bytes = 0;
+    semaphore _write_lock { 1 };
+    timer<> _timer;
+    gate _gate;
+public:
+    explicit commit_log(options opt);
+    ~commit_log();
     commit_log(const commit_log&) = delete;
     commit_log& operator = (const commit_log&) = delete;
-    commit_log& operator = (commit_log&&) = default;
-    future<> append(partition&& entry);
+
+    future<> start(adopted_segments adopted);
+    // Writes and syncs the buffered records, then closes the segment.
+    future<> stop();
+
+    future<> append(const redis::decorated_key& key, const partition& p);
+    // Writes and syncs all records which were appended before.
+    future<> sync();
+
+    // Returns the position of the last appended record.
+    uint64_t position() const {
+        return _position;
+    }
+    void set_flush_handler(flush_handler handler) {
+        _flush_handler = std::move(handler);
+    }
+    // Recycles the segments whose records are at or before the position, they were
+    // flushed to the sstables.
+    void discard_completed_segments(uint64_t position);
+    // Recycles the replayed segments, once the memtables which hold the replayed
+    // records were flushed on all shards.
+    void release_replayed_segments();
+    // Returns the disk space of all segment files.
+    size_t disk_usage() const;
+
+    static sync_mode parse_sync_mode(const sstring& mode);
+private:
+    lw_shared_ptr<group> make_group(size_t size) const;
+    future<> cycle();
+    future<> write(std::vector<lw_shared_ptr<group>> groups);
+    future<> write_group(lw_shared_ptr<group> g);
+    future<> next_segment();
+    void replenish();
+    future<> allocate_segment(uint64_t file_id);
+    future<> adopt(adopted_segments adopted);
+    future<> recycle(lw_shared_ptr<segment> s);
+    void recycle_in_background(lw_shared_ptr<segment> s);
+    future<> write_header(lw_shared_ptr<segment> s);
+    void maybe_request_flush();
+    sstring segment_name(uint64_t file_id) const;
+    void cycle_in_background();
 };
 }
@@ -0,0 +1,229 @@
+#include "store/commit_log_replayer.hh"
+#include "store/checked-file-impl.hh"
+#include "core/align.hh"
+#include "core/byteorder.hh"
+#include "core/fstream.hh"
+#include "core/reactor.hh"
+#include "core/print.hh"
+#include "utils/crc.hh"
+#include "utils/disk-error-handler.hh"
+#include "util/log.hh"
+#include <algorithm>
+#include <chrono>
+namespace store {
+
+using logger =  seastar::logger;
+static logger replay_log ("commit_log_replay");
+
+template <typename T>
+static inline T get(const char*& p)
+{
+    T value;
+    std::copy_n(p, sizeof(value), reinterpret_cast<char*>(&value));
+    p += sizeof(value);
+    return le_to_cpu(value);
+}
+
+commit_log_replayer::commit_log_replayer(sstring directory, apply_func apply, options opt)
+    : _directory(std::move(directory))
+    , _apply(std::move(apply))
+    , _opt(std::move(opt))
+{
+}
+
+// The segments are named commitlog-<shard>-<file id>.log. The segments of the shards
+// which do not exist any more are replayed by the shard shard % smp::count.
+static bool parse_segment_name(const sstring& name, unsigned& shard, uint64_t& file_id)
+{
+    static const sstring prefix = "commitlog-";
+    static const sstring suffix = ".log";
+    if (name.size() <= prefix.size() + suffix.size()
+        || name.compare(0, prefix.size(), prefix) != 0
+        || name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+        return false;
+    }
+    try {
+        auto id = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        auto dash = id.find('-');
+        if (dash == sstring::npos) {
+            return false;
+        }
+        shard = std::stoul(std::string(id.begin(), id.begin() + dash));
+        file_id = std::stoull(std::string(id.begin() + dash + 1, id.end()));
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+future<std::vector<commit_log_replayer::segment_info>> commit_log_replayer::list_segments()
+{
+    return commit_io_check(recursive_touch_directory, _directory).then([this] {
+        return open_checked_directory(commit_error_handler, _directory);
+    }).then([this] (file dir) {
+        auto names = make_lw_shared<std::vector<sstring>>();
+        auto listing = make_lw_shared<subscription<directory_entry>>(dir.list_directory([this, names] (directory_entry de) {
+            unsigned shard;
+            uint64_t file_id;
+            if (parse_segment_name(de.name, shard, file_id) && shard % smp::count == engine().cpu_id()) {
+                names->push_back(_directory + "/" + de.name);
+                _adopted._max_file_id = std::max(_adopted._max_file_id, file_id);
+            }
+            return make_ready_future<>();
+        }));
+        return listing->done().finally([listing, dir] () mutable {
+            return dir.close();
+        }).then([names] {
+            return std::move(*names);
+        });
+    }).then([this] (std::vector<sstring> names) {
+        // the generations are read from the headers, the segments which have no valid
+        // header are the preallocated or recycled ones.
+        return do_with(std::move(names), std::vector<segment_info> {}, [this] (auto& names, auto& segments) {
+            return do_for_each(names, [this, &segments] (const sstring& name) {
+                return open_checked_file_dma(commit_error_handler, name, open_flags::ro).then([this, &segments, name] (file f) {
+                    return f.dma_read_exactly<char>(0, commit_log::alignment).then([this, &segments, name] (temporary_buffer<char> header) {
+                        const char* p = header.get();
+                        if (header.size() == commit_log::alignment
+                            && get<uint32_t>(p) == commit_log::segment_magic
+                            && get<uint32_t>(p) == commit_log::segment_version) {
+                            auto generation = get<uint64_t>(p);
+                            if (generation) {
+                                segments.push_back(segment_info { name, generation });
+                                return;
+                            }
+                        }
+                        _adopted._free.push_back(name);
+                    }).finally([f] () mutable {
+                        return f.close();
+                    });
+                });
+            }).then([&segments] {
+                std::sort(segments.begin(), segments.end(), [] (auto& l, auto& r) {
+                    return l._generation < r._generation;
+                });
+                return std::move(segments);
+            });
+        });
+    });
+}
+
+future<> commit_log_replayer::replay()
+{
+    auto start = std::chrono::steady_clock::now();
+    return list_segments().then([this] (std::vector<segment_info> segments) {
+        if (!segments.empty()) {
+            replay_log.info("replaying {} commit log segments", segments.size());
+        }
+        return do_with(std::move(segments), [this] (auto& segments) {
+            return do_for_each(segments, [this] (const segment_info& s) {
+                return this->replay_segment(s).then([this, &s] {
+                    _adopted._replayed.push_back(s._name);
+                    _adopted._max_generation = std::max(_adopted._max_generation, s._generation);
+                });
+            });
+        });
+    }).then([this, start] {
+        if (_stats._segments) {
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+            replay_log.info("replayed {} segments, {} records, {} bytes in {} ms, {} corrupted",
+                _stats._segments, _stats._records, _stats._bytes, elapsed.count(), _stats._corrupted);
+        }
+    });
+}
+
+future<> commit_log_replayer::replay_segment(const segment_info& s)
+{
+    return open_checked_file_dma(commit_error_handler, s._name, open_flags::ro).then([this, s] (file f) {
+        file_input_stream_options opt;
+        opt.buffer_size = _opt._buffer_size;
+        opt.read_ahead = _opt._read_ahead;
+        auto in = make_file_input_stream(f, commit_log::alignment, std::move(opt));
+        return do_with(std::move(in), std::vector<commit_log_record> {}, uint64_t(0), [this, s] (auto& in, auto& batch, auto& records) {
+            return repeat([this, s, &in, &batch, &records] {
+                return in.read_exactly(commit_log::group_header_size).then([this, s, &in, &batch, &records] (temporary_buffer<char> header) {
+                    if (header.size() < commit_log::group_header_size) {
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    const char* p = header.get();
+                    auto generation = get<uint64_t>(p);
+                    auto size = get<uint32_t>(p);
+                    auto crc = get<uint32_t>(p);
+                    utils::crc32 expected;
+                    expected.process(generation);
+                    expected.process(size);
+                    if (generation != s._generation || crc != expected.get()) {
+                        // the end of the segment: the rest was never written, or was
+                        // written by an older generation.
+                        if (generation == s._generation) {
+                            ++_stats._corrupted;
+                        }
+                        return make_ready_future<stop_iteration>(stop_iteration::yes);
+                    }
+                    auto padded = align_up(commit_log::group_header_size + size, commit_log::alignment) - commit_log::group_header_size;
+                    return in.read_exactly(padded).then([this, s, size, &batch, &records] (temporary_buffer<char> data) {
+                        if (data.size() < size) {
+                            ++_stats._corrupted;
+                            return make_ready_future<stop_iteration>(stop_iteration::yes);
+                        }
+                        const char* p = data.get();
+                        const char* end = p + size;
+                        while (p < end) {
+                            if (size_t(end - p) < commit_log::record_header_size) {
+                                ++_stats._corrupted;
+                                return make_ready_future<stop_iteration>(stop_iteration::yes);
+                            }
+                            auto crc = get<uint32_t>(p);
+                            auto payload = get<uint32_t>(p);
+                            if (payload < sizeof(uint8_t) + sizeof(uint32_t) || size_t(end - p) < payload) {
+                                ++_stats._corrupted;
+                                return make_ready_future<stop_iteration>(stop_iteration::yes);
+                            }
+                            utils::crc32 expected;
+                            expected.process(reinterpret_cast<const uint8_t*>(p), payload);
+                            if (expected.get() != crc) {
+                                ++_stats._corrupted;
+                                return make_ready_future<stop_iteration>(stop_iteration::yes);
+                            }
+                            const char* next = p + payload;
+                            auto type = static_cast<partition_type>(get<uint8_t>(p));
+                            auto key_size = get<uint32_t>(p);
+                            if (key_size > size_t(next - p)) {
+                                ++_stats._corrupted;
+                                return make_ready_future<stop_iteration>(stop_iteration::yes);
+                            }
+                            bytes key { p, key_size };
+                            p += key_size;
+                            batch.emplace_back(commit_log_record { type, std::move(key), bytes { p, size_t(next - p) } });
+                            p = next;
+                            ++records;
+                        }
+                        _stats._bytes += size;
+                        if (batch.size() < _opt._batch_size) {
+                            return make_ready_future<stop_iteration>(stop_iteration::no);
+                        }
+                        return _apply(std::move(batch)).then([&batch] {
+                            batch.clear();
+                            return stop_iteration::no;
+                        });
+                    });
+                });
+            }).then([this, &batch] {
+                if (batch.empty()) {
+                    return make_ready_future<>();
+                }
+                return _apply(std::move(batch));
+            }).then([this, s, &records] {
+                ++_stats._segments;
+                _stats._records += records;
+                replay_log.debug("replayed the segment {}: {} records", s._name, records);
+            }).finally([&in] {
+                return in.close();
+            });
+        }).finally([f] () mutable {
+            return f.close();
+        });
+    });
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include "store/commit_log.hh"
+#include "partition.hh"
+#include "core/future.hh"
+#include "core/sstring.hh"
+#include "utils/bytes.hh"
+#include "seastarx.hh"
+#include <functional>
+#include <vector>
+namespace store {
+
+// A record which was replayed from the commit log.
+struct commit_log_record {
+    partition_type _type;
+    bytes _key;
+    bytes _value;
+};
+
+// Replays the segments of the current shard at the start, every shard replays its
+// own segments concurrently. The segments are read in the order of their generations
+// with the large read-ahead buffers, and the records are applied in batches. A group
+// which fails the checks ends the segment: it is the torn tail of the last write, or
+// the stale group of a recycled segment.
+class commit_log_replayer {
+public:
+    struct options {
+        size_t _buffer_size = 1024 * 1024;
+        unsigned _read_ahead = 4;
+        size_t _batch_size = 1024;
+    };
+    struct stats {
+        uint64_t _segments = 0;
+        uint64_t _records = 0;
+        uint64_t _bytes = 0;
+        // the groups and the records which failed the checks.
+        uint64_t _corrupted = 0;
+    };
+    // Applies a batch of records, the records are in the order they were appended.
+    using apply_func = std::function<future<> (std::vector<commit_log_record>)>;
+private:
+    struct segment_info {
+        sstring _name;
+        uint64_t _generation;
+    };
+    sstring _directory;
+    apply_func _apply;
+    options _opt;
+    stats _stats;
+    commit_log::adopted_segments _adopted;
+public:
+    commit_log_replayer(sstring directory, apply_func apply, options opt);
+    commit_log_replayer(sstring directory, apply_func apply)
+        : commit_log_replayer(std::move(directory), std::move(apply), options {})
+    {
+    }
+
+    future<> replay();
+
+    const stats& get_stats() const {
+        return _stats;
+    }
+    // Returns the segments which were found, they are handed over to the commit log.
+    const commit_log::adopted_segments& adopted() const {
+        return _adopted;
+    }
+private:
+    future<std::vector<segment_info>> list_segments();
+    future<> replay_segment(const segment_info& s);
+};
+}
@@ -0,0 +1,128 @@
+#include "store/compaction.hh"
+#include "store/checked-file-impl.hh"
+#include "core/future-util.hh"
+#include "core/reactor.hh"
+#include "core/seastar.hh"
+#include "core/sleep.hh"
+#include "utils/disk-error-handler.hh"
+#include <chrono>
+#include <memory>
+namespace store {
+
+future<std::vector<lw_shared_ptr<sstable_meta>>> write_sstables(lw_shared_ptr<reader> r,
+    const sstable_writer_options& opt, sstable_writer_stats& stats)
+{
+    seastar::thread_attributes attr;
+    attr.scheduling_group = opt._scheduling_group;
+    return seastar::async(std::move(attr), [r, &opt, &stats] {
+        std::vector<lw_shared_ptr<sstable_meta>> outputs;
+        std::unique_ptr<table_builder> builder;
+        lw_shared_ptr<sstable_meta> meta;
+        sstring tmp;
+        uint64_t completed = 0;
+
+        auto open_output = [&] {
+            meta = make_lw_shared<sstable_meta>();
+            meta->_generation = opt._new_generation();
+            meta->_file_name = level_manifest::sstable_file_name(opt._directory, opt._name, meta->_generation);
+            tmp = meta->_file_name + ".tmp";
+            auto flags = open_flags::wo | open_flags::create | open_flags::truncate;
+            auto f = open_checked_file_dma(sstable_write_error_handler, tmp, flags).get0();
+            builder = std::make_unique<table_builder>(std::move(f), opt._builder_opt);
+        };
+        auto seal_output = [&] {
+            builder->finish().get();
+            // the sstable is visible only once it was written completely.
+            sstable_io_check(sstable_write_error_handler, rename_file, tmp, meta->_file_name).get();
+            meta->_file_size = builder->file_size();
+            completed += meta->_file_size;
+            stats._compressed_blocks += builder->compressed_blocks();
+            stats._uncompressed_blocks += builder->uncompressed_blocks();
+            outputs.push_back(std::move(meta));
+            builder.reset();
+        };
+        // sleeps while the bytes were written faster than the throughput. The bytes
+        // are measured from the last sleep, the throughput may change in between.
+        auto throttle_start = std::chrono::steady_clock::now();
+        uint64_t throttle_written = 0;
+        auto throttle = [&] {
+            double rate = opt._throughput_mb_per_sec ? opt._throughput_mb_per_sec() : 0;
+            auto written = completed + (builder ? builder->file_size() : 0);
+            if (rate <= 0) {
+                throttle_start = std::chrono::steady_clock::now();
+                throttle_written = written;
+                return;
+            }
+            auto expected = std::chrono::microseconds(uint64_t((written - throttle_written) * 1000000 / (rate * 1024 * 1024)));
+            auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - throttle_start);
+            if (expected - elapsed >= std::chrono::milliseconds(1)) {
+                auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(expected - elapsed);
+                stats._throttled_ms += delay.count();
+                sleep(delay).get();
+            } else if (expected >= elapsed) {
+                return;
+            }
+            // the next bytes are measured from now, the time the writer fell behind the
+            // throughput is not made up.
+            throttle_start = std::chrono::steady_clock::now();
+            throttle_written = written;
+        };
+        try {
+            for (r->seek_to_first().get(); !r->eof(); r->next().get()) {
+                auto p = r->current();
+                if (opt._drop_tombstones && p.type() == partition_type::unknown) {
+                    ++stats._dropped_tombstones;
+                    continue;
+                }
+                if (!builder) {
+                    open_output();
+                    meta->_smallest_key = r->key();
+                }
+                builder->add(r->key(), encode_partition(p)).get();
+                meta->_largest_key = r->key();
+                ++stats._partitions;
+                if (builder->file_size() >= opt._max_sstable_size) {
+                    seal_output();
+                }
+                throttle();
+            }
+            if (builder) {
+                seal_output();
+            }
+            sstable_io_check(sstable_write_error_handler, sync_directory, opt._directory).get();
+        } catch (...) {
+            if (builder) {
+                builder->abandon().handle_exception([] (auto) {}).get();
+                remove_file(tmp).handle_exception([] (auto) {}).get();
+            }
+            for (auto& m : outputs) {
+                remove_file(m->_file_name).handle_exception([] (auto) {}).get();
+            }
+            throw;
+        }
+        stats._bytes += completed;
+        return outputs;
+    });
+}
+
+future<std::vector<lw_shared_ptr<sstable_meta>>> compact_sstables(const compaction_descriptor& desc,
+    const sstable_options& sstable_opt, const sstable_writer_options& opt, sstable_writer_stats& stats)
+{
+    return parallel_for_each(desc._inputs, [&sstable_opt] (const lw_shared_ptr<sstable_meta>& m) {
+        if (m->_sstable) {
+            return make_ready_future<>();
+        }
+        return open_sstable(m->_file_name, sstable_opt).then([m] (lw_shared_ptr<sstable> s) {
+            m->_sstable = std::move(s);
+        });
+    }).then([&desc, &opt, &stats] {
+        std::vector<lw_shared_ptr<reader>> readers;
+        for (auto& m : desc._inputs) {
+            // the inputs are removed once they are merged, their blocks are not cached.
+            readers.push_back(make_sstable_reader(m->_sstable, *opt._builder_opt._io_priority_class, false));
+        }
+        return write_sstables(make_combined_reader(std::move(readers)), opt, stats);
+    });
+}
+
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <functional>
+#include <limits>
+#include <vector>
+#include "core/future.hh"
+#include "core/shared_ptr.hh"
+#include "core/sstring.hh"
+#include "core/thread.hh"
+#include "store/level_manifest.hh"
+#include "store/reader.hh"
+#include "store/table.hh"
+#include "store/table_builder.hh"
+#include "seastarx.hh"
+namespace store {
+
+struct sstable_writer_options {
+    sstring _directory;
+    sstring _name;
+    // returns the generation of the next output.
+    std::function<uint64_t ()> _new_generation;
+    // the output is split once it grows past the size.
+    uint64_t _max_sstable_size = std::numeric_limits<uint64_t>::max();
+    // drops the removed partitions, no older sstable holds their keys.
+    bool _drop_tombstones = false;
+    // the rate of the written bytes, it is read again as the writing goes on, so the
+    // rate follows the controller. Unthrottled if it is not set or returns 0.
+    std::function<double ()> _throughput_mb_per_sec;
+    table_builder_options _builder_opt;
+    seastar::thread_scheduling_group* _scheduling_group = nullptr;
+};
+
+struct sstable_writer_stats {
+    uint64_t _partitions = 0;
+    uint64_t _dropped_tombstones = 0;
+    uint64_t _bytes = 0;
+    uint64_t _compressed_blocks = 0;
+    uint64_t _uncompressed_blocks = 0;
+    // the time the writer slept to keep the throughput.
+    uint64_t _throttled_ms = 0;
+};
+
+// Writes the partitions of the reader into the new sstables. Every sstable is
+// written into a temporary file which is renamed once it is complete; the outputs
+// are removed if the writing fails.
+future<std::vector<lw_shared_ptr<sstable_meta>>> write_sstables(lw_shared_ptr<reader> r,
+    const sstable_writer_options& opt, sstable_writer_stats& stats);
+
+// Merges the inputs of the compaction, the newest partition of every key wins.
+// The inputs are opened if they were not opened yet.
+future<std::vector<lw_shared_ptr<sstable_meta>>> compact_sstables(const compaction_descriptor& desc,
+    const sstable_options& sstable_opt, const sstable_writer_options& opt, sstable_writer_stats& stats);
+
+}
@@ -0,0 +1,250 @@
+#include "store/compaction_strategy.hh"
+#include "store/table/format.hh"
+#include "core/print.hh"
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+namespace store {
+
+compaction_strategy_type compaction_strategy_options::parse_type(const sstring& name)
+{
+    if (name == "SizeTieredCompactionStrategy" || name == "size_tiered") {
+        return compaction_strategy_type::size_tiered;
+    }
+    return compaction_strategy_type::leveled;
+}
+
+template <typename T>
+static T parse_option(const sstring& key, const sstring& value)
+{
+    try {
+        return boost::lexical_cast<T>(value);
+    } catch (boost::bad_lexical_cast&) {
+        throw std::invalid_argument(sprint("the compaction option %s is malformed: %s", key, value));
+    }
+}
+
+void compaction_strategy_options::set_options(const std::unordered_map<sstring, sstring>& options)
+{
+    for (auto& o : options) {
+        auto& key = o.first;
+        if (key == "min_threshold") {
+            _min_threshold = parse_option<size_t>(key, o.second);
+        } else if (key == "max_threshold") {
+            _max_threshold = parse_option<size_t>(key, o.second);
+        } else if (key == "bucket_low") {
+            _bucket_low = parse_option<double>(key, o.second);
+        } else if (key == "bucket_high") {
+            _bucket_high = parse_option<double>(key, o.second);
+        } else if (key == "min_sstable_size") {
+            _min_sstable_size = parse_option<uint64_t>(key, o.second);
+        } else if (key == "sstable_size_in_mb") {
+            _max_sstable_size = parse_option<uint64_t>(key, o.second) * 1024 * 1024;
+        } else if (key == "level0_compaction_trigger") {
+            _level0_compaction_trigger = parse_option<size_t>(key, o.second);
+        } else {
+            throw std::invalid_argument(sprint("the compaction option %s is unknown", key));
+        }
+    }
+    if (_min_threshold < 2 || _max_threshold < _min_threshold) {
+        throw std::invalid_argument(sprint("the compaction thresholds %d and %d are invalid", _min_threshold, _max_threshold));
+    }
+    if (_bucket_low <= 0 || _bucket_high <= _bucket_low) {
+        throw std::invalid_argument(sprint("the compaction bucket ratios %f and %f are invalid", _bucket_low, _bucket_high));
+    }
+}
+
+leveled_compaction_strategy::leveled_compaction_strategy(compaction_strategy_options opt)
+    : _opt(std::move(opt))
+    , _compact_pointers(level_manifest::max_levels)
+{
+}
+
+uint64_t leveled_compaction_strategy::max_bytes_for_level(int level) const
+{
+    uint64_t result = _opt._max_bytes_for_level_base;
+    while (level > 1) {
+        result *= _opt._level_size_multiplier;
+        --level;
+    }
+    return result;
+}
+
+compaction_descriptor leveled_compaction_strategy::pick_compaction(const level_manifest& manifest)
+{
+    compaction_descriptor desc;
+    // the last level is never compacted into a deeper one.
+    int best = -1;
+    double best_score = 1;
+    for (int level = 0; level < level_manifest::max_levels - 1; ++level) {
+        double score = level == 0
+            ? double(manifest.level(0).size()) / _opt._level0_compaction_trigger
+            : double(manifest.level_size(level)) / max_bytes_for_level(level);
+        if (score >= best_score) {
+            best_score = score;
+            best = level;
+        }
+    }
+    if (best < 0) {
+        return desc;
+    }
+    std::vector<lw_shared_ptr<sstable_meta>> inputs;
+    if (best == 0) {
+        // the level 0 sstables overlap each other, all of them are merged.
+        inputs.assign(manifest.level(0).rbegin(), manifest.level(0).rend());
+    } else {
+        // the sstables of the level are compacted round robin.
+        auto& files = manifest.level(best);
+        auto& pointer = _compact_pointers[best];
+        auto i = std::find_if(files.begin(), files.end(), [&pointer] (auto& m) {
+            return tri_compare_keys(m->_largest_key, pointer) > 0;
+        });
+        inputs.push_back(i == files.end() ? files.front() : *i);
+    }
+    auto smallest = inputs.front()->_smallest_key;
+    auto largest = inputs.front()->_largest_key;
+    for (auto& m : inputs) {
+        if (tri_compare_keys(m->_smallest_key, smallest) < 0) {
+            smallest = m->_smallest_key;
+        }
+        if (tri_compare_keys(m->_largest_key, largest) > 0) {
+            largest = m->_largest_key;
+        }
+    }
+    _compact_pointers[best] = largest;
+
+    desc._level = best;
+    desc._output_level = best + 1;
+    desc._max_sstable_size = _opt._max_sstable_size;
+    for (auto& m : inputs) {
+        desc._deleted.emplace_back(best, m->_generation);
+    }
+    auto next = manifest.overlapping(best + 1, smallest, largest);
+    desc._trivial_move = inputs.size() == 1 && next.empty();
+    for (auto& m : next) {
+        desc._deleted.emplace_back(best + 1, m->_generation);
+        if (tri_compare_keys(m->_smallest_key, smallest) < 0) {
+            smallest = m->_smallest_key;
+        }
+        if (tri_compare_keys(m->_largest_key, largest) > 0) {
+            largest = m->_largest_key;
+        }
+    }
+    inputs.insert(inputs.end(), next.begin(), next.end());
+    desc._inputs = std::move(inputs);
+    desc._drop_tombstones = true;
+    for (int level = best + 2; level < level_manifest::max_levels; ++level) {
+        if (!manifest.overlapping(level, smallest, largest).empty()) {
+            desc._drop_tombstones = false;
+            break;
+        }
+    }
+    return desc;
+}
+
+double leveled_compaction_strategy::backlog(const level_manifest& manifest) const
+{
+    int deepest = 1;
+    for (int level = 1; level < level_manifest::max_levels; ++level) {
+        if (!manifest.level(level).empty()) {
+            deepest = level;
+        }
+    }
+    // the level 0 bytes are rewritten by every level down to the deepest one, the
+    // bytes past the target of another level by every level below it.
+    double result = double(manifest.level_size(0)) * deepest;
+    for (int level = 1; level < level_manifest::max_levels - 1; ++level) {
+        auto size = manifest.level_size(level);
+        auto target = max_bytes_for_level(level);
+        if (size > target) {
+            result += double(size - target) * std::max(1, deepest - level);
+        }
+    }
+    return result;
+}
+
+size_tiered_compaction_strategy::size_tiered_compaction_strategy(compaction_strategy_options opt)
+    : _opt(std::move(opt))
+{
+}
+
+bool size_tiered_compaction_strategy::similar(uint64_t size, uint64_t average) const
+{
+    if (size < _opt._min_sstable_size && average < _opt._min_sstable_size) {
+        return true;
+    }
+    return size >= average * _opt._bucket_low && size <= average * _opt._bucket_high;
+}
+
+compaction_descriptor size_tiered_compaction_strategy::pick_compaction(const level_manifest& manifest)
+{
+    compaction_descriptor desc;
+    // the level 0 from the oldest sstable, the tier is the longest run of the
+    // similarly sized sstables, and the smallest one of the runs of the same length.
+    auto& files = manifest.level(0);
+    size_t best_begin = 0, best_count = 0;
+    uint64_t best_size = 0;
+    for (size_t i = 0; i < files.size(); ++i) {
+        uint64_t total = files[i]->_file_size;
+        size_t j = i + 1;
+        for (; j < files.size() && j - i < _opt._max_threshold; ++j) {
+            if (!similar(files[j]->_file_size, total / (j - i))) {
+                break;
+            }
+            total += files[j]->_file_size;
+        }
+        auto count = j - i;
+        if (count >= _opt._min_threshold && (count > best_count || (count == best_count && total < best_size))) {
+            best_begin = i;
+            best_count = count;
+            best_size = total;
+        }
+    }
+    if (!best_count) {
+        return desc;
+    }
+    desc._level = 0;
+    desc._output_level = 0;
+    for (size_t i = best_begin + best_count; i > best_begin; --i) {
+        auto& m = files[i - 1];
+        desc._inputs.push_back(m);
+        desc._deleted.emplace_back(0, m->_generation);
+    }
+    // the removed partitions may hide the older ones of the same keys.
+    desc._drop_tombstones = best_begin == 0;
+    for (int level = 1; level < level_manifest::max_levels; ++level) {
+        if (!manifest.level(level).empty()) {
+            desc._drop_tombstones = false;
+            break;
+        }
+    }
+    return desc;
+}
+
+double size_tiered_compaction_strategy::backlog(const level_manifest& manifest) const
+{
+    // every sstable is merged into the larger tiers until a single one is left, once
+    // per min_threshold times its size.
+    auto total = manifest.level_size(0);
+    double result = 0;
+    for (auto& m : manifest.level(0)) {
+        if (m->_file_size) {
+            result += m->_file_size * std::log(double(total) / m->_file_size) / std::log(double(_opt._min_threshold));
+        }
+    }
+    return result;
+}
+
+std::unique_ptr<compaction_strategy> make_compaction_strategy(const compaction_strategy_options& opt)
+{
+    switch (opt._type) {
+    case compaction_strategy_type::size_tiered:
+        return std::make_unique<size_tiered_compaction_strategy>(opt);
+    case compaction_strategy_type::leveled:
+    default:
+        return std::make_unique<leveled_compaction_strategy>(opt);
+    }
+}
+
+}
@@ -0,0 +1,94 @@
+#pragma once
+#include <limits>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "core/sstring.hh"
+#include "store/level_manifest.hh"
+#include "utils/bytes.hh"
+#include "seastarx.hh"
+namespace store {
+
+enum class compaction_strategy_type {
+    leveled,
+    size_tiered,
+};
+
+struct compaction_strategy_options {
+    compaction_strategy_type _type = compaction_strategy_type::leveled;
+
+    // leveled: the level 0 is compacted once it has so many sstables.
+    size_t _level0_compaction_trigger = 4;
+    // leveled: the target size of the level 1, every next level holds the multiplier
+    // times the bytes of the previous one.
+    uint64_t _max_bytes_for_level_base = 10 * 1024 * 1024;
+    unsigned _level_size_multiplier = 10;
+    // leveled: the outputs of the compactions are split at the size.
+    uint64_t _max_sstable_size = 2 * 1024 * 1024;
+
+    // size tiered: the number of the similarly sized sstables which are merged.
+    size_t _min_threshold = 4;
+    size_t _max_threshold = 32;
+    // size tiered: an sstable joins the tier if its size is within the ratios of the
+    // average size of the tier.
+    double _bucket_low = 0.5;
+    double _bucket_high = 1.5;
+    // size tiered: the sstables smaller than the size are in the same tier.
+    uint64_t _min_sstable_size = 50 * 1024 * 1024;
+
+    // Parses the strategy class of the config, the leveled strategy is the default.
+    static compaction_strategy_type parse_type(const sstring& name);
+    // Sets the options of the config, such as min_threshold and bucket_low. Throws
+    // std::invalid_argument if an option is unknown or its value is malformed.
+    void set_options(const std::unordered_map<sstring, sstring>& options);
+};
+
+// Picks the sstables of the column family which are merged by the next compaction.
+class compaction_strategy {
+public:
+    virtual ~compaction_strategy() {}
+    virtual const char* name() const = 0;
+    // Returns an empty descriptor if no sstables need the compaction.
+    virtual compaction_descriptor pick_compaction(const level_manifest& manifest) = 0;
+    // Returns the bytes the compactions still have to rewrite, every byte weighted by
+    // the times it is rewritten.
+    virtual double backlog(const level_manifest& manifest) const = 0;
+};
+
+// The level 0 sstables are merged into the level 1, and every level is merged into
+// the next one once its size exceeds the target. Every partition is rewritten once
+// per level, so the reads touch few sstables for the cost of the write
+// amplification.
+class leveled_compaction_strategy final : public compaction_strategy {
+    compaction_strategy_options _opt;
+    // the largest key which was compacted in every level, the next compaction of the
+    // level starts after it.
+    std::vector<bytes> _compact_pointers;
+public:
+    explicit leveled_compaction_strategy(compaction_strategy_options opt);
+    const char* name() const override { return "LeveledCompactionStrategy"; }
+    compaction_descriptor pick_compaction(const level_manifest& manifest) override;
+    double backlog(const level_manifest& manifest) const override;
+    uint64_t max_bytes_for_level(int level) const;
+};
+
+// The sstables are kept in the level 0, and the runs of the similarly sized sstables
+// are merged into a single larger one. Every partition is rewritten once per tier,
+// which is far less than once per level for the write heavy column families.
+//
+// The merged sstables are adjacent in their sequences, so the output takes their
+// place among the overlapping level 0 sstables and the newest partitions still win.
+class size_tiered_compaction_strategy final : public compaction_strategy {
+    compaction_strategy_options _opt;
+public:
+    explicit size_tiered_compaction_strategy(compaction_strategy_options opt);
+    const char* name() const override { return "SizeTieredCompactionStrategy"; }
+    compaction_descriptor pick_compaction(const level_manifest& manifest) override;
+    double backlog(const level_manifest& manifest) const override;
+private:
+    bool similar(uint64_t size, uint64_t average) const;
+};
+
+std::unique_ptr<compaction_strategy> make_compaction_strategy(const compaction_strategy_options& opt);
+
+}
@@ -93,13 +93,10 @@ serialized_size(const T& object) {
     return size;
 }
 
-future<file> make_file(const io_error_handler& error_handler, sstring name, open_flags flags) {
-    return open_checked_file_dma(error_handler, name, flags).handle_exception([name] (auto ep) {
-        return make_exception_future<file>(ep);
-    });
-}
+// defined in file_reader.cc.
+extern future<file> make_file(const io_error_handler& error_handler, sstring name, open_flags flags);
 
-future<file> make_file(const io_error_handler& error_handler, sstring name, open_flags flags, file_open_options options) {
+inline future<file> make_file(const io_error_handler& error_handler, sstring name, open_flags flags, file_open_options options) {
     return open_checked_file_dma(error_handler, name, flags, options).handle_exception([name] (auto ep) {
         return make_exception_future<file>(ep);
     });
@@ -0,0 +1,177 @@
+#include "store/level_manifest.hh"
+#include "store/table/format.hh"
+#include "store/util/coding.hh"
+#include "store/checked-file-impl.hh"
+#include "core/fstream.hh"
+#include "core/reactor.hh"
+#include "core/seastar.hh"
+#include "core/print.hh"
+#include "utils/crc.hh"
+#include "utils/disk-error-handler.hh"
+#include "exceptions/exceptions.hh"
+#include <algorithm>
+namespace store {
+
+constexpr const int level_manifest::max_levels;
+constexpr const uint32_t level_manifest::manifest_magic;
+
+// the manifest file: [magic u32][crc32 u32][size u32][version edit]
+static constexpr const size_t manifest_header_size = 3 * sizeof(uint32_t);
+
+level_manifest::level_manifest()
+    : _levels(max_levels)
+{
+}
+
+sstring level_manifest::manifest_file_name(const sstring& directory, const sstring& name)
+{
+    return sprint("%s/%s-MANIFEST", directory, name);
+}
+
+sstring level_manifest::sstable_file_name(const sstring& directory, const sstring& name, uint64_t generation)
+{
+    return sprint("%s/%s-%d.sst", directory, name, generation);
+}
+
+void level_manifest::apply(const version_edit& edit)
+{
+    for (auto& d : edit.deleted_files()) {
+        auto& files = _levels[d.first];
+        files.erase(std::remove_if(files.begin(), files.end(), [&d] (auto& m) {
+            return m->_generation == d.second;
+        }), files.end());
+    }
+    for (auto& f : edit.new_files()) {
+        auto& files = _levels[f.first];
+        if (!f.second->_sequence) {
+            f.second->_sequence = f.second->_generation;
+        }
+        files.push_back(f.second);
+        _next_generation = std::max(_next_generation, f.second->_generation + 1);
+    }
+    if (edit.has_next_generation()) {
+        _next_generation = std::max(_next_generation, edit.next_generation());
+    }
+    std::sort(_levels[0].begin(), _levels[0].end(), [] (auto& l, auto& r) {
+        return l->_sequence < r->_sequence;
+    });
+    for (int level = 1; level < max_levels; ++level) {
+        std::sort(_levels[level].begin(), _levels[level].end(), [] (auto& l, auto& r) {
+            return tri_compare_keys(l->_smallest_key, r->_smallest_key) < 0;
+        });
+    }
+}
+
+version_edit level_manifest::snapshot() const
+{
+    version_edit edit;
+    edit.set_next_generation(_next_generation);
+    for (int level = 0; level < max_levels; ++level) {
+        for (auto& m : _levels[level]) {
+            edit.add_file(level, m);
+        }
+    }
+    return edit;
+}
+
+uint64_t level_manifest::level_size(int level) const
+{
+    uint64_t size = 0;
+    for (auto& m : _levels[level]) {
+        size += m->_file_size;
+    }
+    return size;
+}
+
+std::vector<lw_shared_ptr<sstable_meta>> level_manifest::overlapping(int level, bytes_view smallest, bytes_view largest) const
+{
+    std::vector<lw_shared_ptr<sstable_meta>> result;
+    for (auto& m : _levels[level]) {
+        if (tri_compare_keys(m->_largest_key, smallest) < 0 || tri_compare_keys(m->_smallest_key, largest) > 0) {
+            continue;
+        }
+        result.push_back(m);
+    }
+    return result;
+}
+
+future<> level_manifest::persist(const sstring& directory, const sstring& name)
+{
+    return with_semaphore(_persist_lock, 1, [this, directory, name] {
+        bytes edit;
+        snapshot().encode_to(edit);
+        utils::crc32 crc;
+        crc.process(reinterpret_cast<const uint8_t*>(edit.data()), edit.size());
+        bytes data;
+        put_fixed32(data, manifest_magic);
+        put_fixed32(data, crc.get());
+        put_fixed32(data, edit.size());
+        data.append(edit.data(), edit.size());
+
+        auto file_name = manifest_file_name(directory, name);
+        auto tmp = file_name + ".tmp";
+        auto flags = open_flags::wo | open_flags::create | open_flags::truncate;
+        return open_checked_file_dma(sstable_write_error_handler, tmp, flags).then([data = std::move(data)] (file f) mutable {
+            return do_with(make_file_output_stream(std::move(f)), std::move(data), [] (auto& out, auto& data) {
+                return out.write(data).then([&out] {
+                    return out.flush();
+                }).finally([&out] {
+                    return out.close();
+                });
+            });
+        }).then([tmp, file_name] {
+            // the rename replaces the manifest atomically.
+            return sstable_io_check(sstable_write_error_handler, rename_file, tmp, file_name);
+        }).then([directory] {
+            return sstable_io_check(sstable_write_error_handler, sync_directory, directory);
+        });
+    });
+}
+
+future<> level_manifest::load(const sstring& directory, const sstring& name)
+{
+    auto file_name = manifest_file_name(directory, name);
+    auto tmp = file_name + ".tmp";
+    return file_exists(tmp).then([tmp] (bool exists) {
+        // the temporary manifest was never renamed, the crash happened before.
+        return exists ? remove_file(tmp) : make_ready_future<>();
+    }).then([file_name] {
+        return file_exists(file_name);
+    }).then([this, directory, name, file_name] (bool exists) {
+        if (!exists) {
+            return make_ready_future<>();
+        }
+        return open_checked_file_dma(general_disk_error_handler, file_name, open_flags::ro).then([] (file f) {
+            return f.size().then([f] (uint64_t size) mutable {
+                return f.dma_read_exactly<char>(0, size);
+            }).finally([f] () mutable {
+                return f.close();
+            });
+        }).then([this, directory, name, file_name] (temporary_buffer<char> buf) {
+            if (buf.size() < manifest_header_size || decode_fixed32(buf.get()) != manifest_magic) {
+                throw redis::io_exception(sprint("%s: the manifest header is malformed", file_name));
+            }
+            auto crc = decode_fixed32(buf.get() + sizeof(uint32_t));
+            auto size = decode_fixed32(buf.get() + 2 * sizeof(uint32_t));
+            if (buf.size() - manifest_header_size != size) {
+                throw redis::io_exception(sprint("%s: the manifest is truncated", file_name));
+            }
+            utils::crc32 expected;
+            expected.process(reinterpret_cast<const uint8_t*>(buf.get() + manifest_header_size), size);
+            version_edit edit;
+            if (expected.get() != crc
+                || !edit.decode_from(bytes_view { reinterpret_cast<const int8_t*>(buf.get() + manifest_header_size), size })) {
+                throw redis::io_exception(sprint("%s: the manifest is corrupted", file_name));
+            }
+            for (auto& f : edit.new_files()) {
+                if (f.first < 0 || f.first >= max_levels) {
+                    throw redis::io_exception(sprint("%s: the level %d is out of range", file_name, f.first));
+                }
+                f.second->_file_name = sstable_file_name(directory, name, f.second->_generation);
+            }
+            apply(edit);
+        });
+    });
+}
+
+}
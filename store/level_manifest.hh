@@ -0,0 +1,83 @@
+#pragma once
+#include <limits>
+#include <vector>
+#include "core/future.hh"
+#include "core/semaphore.hh"
+#include "core/shared_ptr.hh"
+#include "core/sstring.hh"
+#include "store/version_edit.hh"
+#include "utils/bytes.hh"
+#include "seastarx.hh"
+namespace store {
+
+// The sstables which are merged by a compaction, and the level of the outputs.
+struct compaction_descriptor {
+    int _level = -1;
+    int _output_level = 0;
+    // the inputs from the newest one, the partitions of the newer sstables hide the
+    // older ones of the same keys.
+    std::vector<lw_shared_ptr<sstable_meta>> _inputs;
+    std::vector<version_edit::deleted_file> _deleted;
+    // the single input overlaps nothing in the output level, it is moved there
+    // without being rewritten.
+    bool _trivial_move = false;
+    // no older sstable holds the keys of the inputs, so the removed partitions are
+    // dropped.
+    bool _drop_tombstones = false;
+    // the outputs are split once they grow past the size.
+    uint64_t _max_sstable_size = std::numeric_limits<uint64_t>::max();
+
+    bool empty() const { return _inputs.empty(); }
+};
+
+// The levels of the sstables of a column family. The level 0 sstables are the
+// flushed memtables, they overlap each other and are ordered by their sequences.
+// The sstables of every other level do not overlap, they are ordered by their keys.
+// The compaction strategy picks the sstables to merge.
+//
+// The manifest file holds the edit which recreates all levels. It is replaced by
+// writing the temporary file, syncing it, and renaming it over the manifest, so a
+// crash leaves either the old or the new manifest.
+class level_manifest {
+public:
+    static constexpr const int max_levels = 7;
+    static constexpr const uint32_t manifest_magic = 0x50444d46;
+private:
+    std::vector<std::vector<lw_shared_ptr<sstable_meta>>> _levels;
+    uint64_t _next_generation = 1;
+    semaphore _persist_lock { 1 };
+public:
+    level_manifest();
+    level_manifest(const level_manifest&) = delete;
+    level_manifest& operator = (const level_manifest&) = delete;
+
+    const std::vector<lw_shared_ptr<sstable_meta>>& level(int level) const {
+        return _levels[level];
+    }
+    uint64_t new_generation() {
+        return _next_generation++;
+    }
+    uint64_t next_generation() const {
+        return _next_generation;
+    }
+
+    void apply(const version_edit& edit);
+    // Returns the edit which recreates all levels.
+    version_edit snapshot() const;
+
+    uint64_t level_size(int level) const;
+    // Returns the sstables of the level whose keys overlap the range.
+    std::vector<lw_shared_ptr<sstable_meta>> overlapping(int level, bytes_view smallest, bytes_view largest) const;
+
+    // Writes the manifest, the concurrent calls write it one by one, and the last
+    // one holds the latest edits.
+    future<> persist(const sstring& directory, const sstring& name);
+    // Reads the manifest, a temporary manifest left by a crash is removed. Throws
+    // redis::io_exception if the manifest is corrupted.
+    future<> load(const sstring& directory, const sstring& name);
+
+    static sstring manifest_file_name(const sstring& directory, const sstring& name);
+    static sstring sstable_file_name(const sstring& directory, const sstring& name, uint64_t generation);
+};
+
+}
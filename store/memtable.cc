@@ -1,10 +1,8 @@
 #include "store/memtable.hh"
-#include "stdx.hh"
+#include "store/reader.hh"
+#include "core/thread.hh"
 
 namespace store {
-memtable::memtable()
-{
-}
 
 memtable::memtable(dirty_memory_manager& dmm)
     : logalloc::region(dmm.region_group())
@@ -12,8 +10,6 @@ memtable::memtable(dirty_memory_manager& dmm)
 {
 }
 
-static thread_local dirty_memory_manager mgr_for_tests;
-
 memtable::~memtable() {
     revert_flushed_memory();
     clear();
@@ -23,10 +19,16 @@ uint64_t memtable::dirty_size() const {
     return occupancy().total_space();
 }
 
+size_t memtable::entry_memory_usage(const memtable_entry& e) const {
+    return allocator().object_memory_size_in_allocator(&e)
+        + e._key.external_memory_usage()
+        + e._value.external_memory_usage();
+}
+
 void memtable::clear() noexcept {
     auto dirty_before = dirty_size();
     with_allocator(allocator(), [this] {
-        partitions.clear_and_dispose(current_deleter<memtable_entry>());
+        _partitions.clear_and_dispose(current_deleter<memtable_entry>());
     });
     remove_flushed_memory(dirty_before - dirty_size());
 }
@@ -38,7 +40,7 @@ future<> memtable::clear_gently() noexcept {
         attr.scheduling_group = &scheduling_group;
         auto t = std::make_unique<seastar::thread>(attr, [this] {
             auto& alloc = allocator();
-            auto p = std::move(partitions);
+            auto p = std::move(_partitions);
             while (!p.empty()) {
                 auto batch_size = std::min<size_t>(p.size(), 32);
                 auto dirty_before = dirty_size();
@@ -60,146 +62,208 @@ future<> memtable::clear_gently() noexcept {
     });
 }
 
-
-partition&
-memtable::find_or_create_partition(const redis::decorated_key& key) {
-    assert(!reclaiming_enabled());
-    assert(write_enabled());
-    // call lower_bound so we have a hint for the insert, just in case.
-    auto i = partitions.lower_bound(key, memtable_entry::compare(_schema));
-    if (i == partitions.end() || !key.equal(*_schema, i->key())) {
-        memtable_entry* entry = current_allocator().construct<memtable_entry>(redis::decorated_key { key });
-        i = partitions.insert(i, *entry);
-        return entry->partition();
-    } else {
-        upgrade_entry(*i);
+bool memtable::insert(redis::decorated_key&& key, partition&& data) {
+    if (!_write_enabled) {
+        return false;
     }
-    return i->partition();
+    auto type = data.type();
+    auto value = data.serialize();
+    return with_linearized_managed_bytes([this, &key, type, &value] {
+        auto k = key.key_view();
+        return _allocating_section(*this, [this, k, type, &value] {
+            return with_allocator(allocator(), [this, k, type, &value] {
+                auto i = _partitions.lower_bound(k, memtable_entry::compare());
+                if (i != _partitions.end() && memtable_entry::tri_compare(i->key(), k) == 0) {
+                    // the new value is allocated before the old one is released.
+                    i->_value = managed_bytes(bytes_view { value });
+                    i->_type = type;
+                } else {
+                    auto entry = current_allocator().construct<memtable_entry>(k, type, bytes_view { value });
+                    _partitions.insert(i, *entry);
+                }
+                return true;
+            });
+        });
+    });
+}
+
+static partition to_partition(const memtable_entry& e) {
+    bytes key { e.key().data(), e.key().size() };
+    bytes_view v = e.value();
+    return make_serialized_partition(e.type(), key, bytes { v.data(), v.size() });
+}
+
+optional<partition> memtable::get(const redis::decorated_key& key) {
+    return with_linearized_managed_bytes([this, &key] {
+        return _read_section(*this, [this, &key] () -> optional<partition> {
+            auto i = _partitions.find(key.key_view(), memtable_entry::compare());
+            if (i == _partitions.end()) {
+                return {};
+            }
+            return to_partition(*i);
+        });
+    });
 }
 
+bool memtable::remove(const redis::decorated_key& key) {
+    auto k = key.key_view();
+    return insert(redis::decorated_key { key }, make_removable_partition(bytes { k.data(), k.size() }));
+}
 
 void memtable::add_flushed_memory(uint64_t delta) {
     _flushed_memory += delta;
-    _dirty_mgr.account_potentially_cleaned_up_memory(this, delta);
+    _dirty_mgr.account_potentially_cleaned_up_memory(delta);
 }
 
 void memtable::remove_flushed_memory(uint64_t delta) {
     delta = std::min(_flushed_memory, delta);
     _flushed_memory -= delta;
-    _dirty_mgr.revert_potentially_cleaned_up_memory(this, delta);
-}
-
-void memtable::on_detach_from_region_group() noexcept {
-    revert_flushed_memory();
+    _dirty_mgr.revert_potentially_cleaned_up_memory(delta);
 }
 
 void memtable::revert_flushed_memory() noexcept {
-    _dirty_mgr.revert_potentially_cleaned_up_memory(this, _flushed_memory);
+    _dirty_mgr.revert_potentially_cleaned_up_memory(_flushed_memory);
     _flushed_memory = 0;
 }
 
-class flush_memory_accounter {
-    memtable& _mt;
-public:
-    void update_bytes_read(uint64_t delta) {
-        _mt.add_flushed_memory(delta);
-    }
-    explicit flush_memory_accounter(memtable& mt)
-        : _mt(mt)
-	{}
-    ~flush_memory_accounter() {
-        assert(_mt._flushed_memory <= _mt.occupancy().used_space());
-
-        // Flushed the current memtable. There is still some work to do, like finish sealing the
-        // SSTable and updating the cache, but we can already allow the next one to start.
-        //
-        // By erasing this memtable from the flush_manager we'll destroy the semaphore_units
-        // associated with this flush and will allow another one to start. We'll signal the
-        // condition variable to let them know we might be ready early.
-        _mt._dirty_mgr.remove_from_flush_manager(&_mt);
-    }
-    void account_component(memtable_entry& e) {
-        auto delta = _mt.allocator().object_memory_size_in_allocator(&e)
-                     + e.external_memory_usage_without_rows();
-        update_bytes_read(delta);
-    }
-    void account_component(partition_snapshot& snp) {
-        update_bytes_read(_mt.allocator().object_memory_size_in_allocator(&*snp.version()));
-    }
-};
-
+bool memtable::is_flushed() const {
+    return !_write_enabled && _flushed_memory >= occupancy().used_space();
+}
 
 logalloc::occupancy_stats memtable::occupancy() const {
     return logalloc::region::occupancy();
 }
 
 size_t memtable::partition_count() const {
-    return partitions.size();
+    return _partitions.size();
 }
 
 memtable_entry::memtable_entry(memtable_entry&& o) noexcept
     : _link()
-    , _schema(std::move(o._schema))
     , _key(std::move(o._key))
-    , _pe(std::move(o._pe))
+    , _value(std::move(o._value))
+    , _type(o._type)
 {
     using container_type = memtable::partitions_type;
     container_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
     container_type::node_algorithms::init(o._link.this_ptr());
 }
 
-class memtable_reader : public reader::impl {
-   lw_shared_ptr<memtable> _memtable;
-   memtable::partitions_type::const_iterator _begin;
-   memtable::partitions_type::const_iterator _end;
-   memtable::partitions_type::const_iterator _current;
-   bool _eof = false;
+// The entries are moved by the LSA compaction, which invalidates the iterators. The
+// reader remembers the key of the current entry, and looks it up again whenever the
+// reclaim counter of the region was changed. The entries are never erased until the
+// memtable is destroyed, so the key is always found.
+class memtable_reader final : public reader::impl {
+    lw_shared_ptr<memtable> _memtable;
+    mutable memtable::partitions_type::const_iterator _current;
+    mutable uint64_t _reclaim_counter = 0;
+    bytes _current_key;
+    bool _eof = true;
+    // the flush reader accounts the entries which were written to the sstable.
+    bool _flush;
+private:
+    logalloc::region& region() const {
+        return *_memtable;
+    }
+
+    void set_current(memtable::partitions_type::const_iterator i) {
+        _current = i;
+        _eof = (i == _memtable->_partitions.cend());
+        if (!_eof) {
+            auto k = i->key();
+            _current_key = bytes { k.data(), k.size() };
+        }
+        _reclaim_counter = region().reclaim_counter();
+    }
+
+    void refresh() const {
+        if (!_eof && _reclaim_counter != region().reclaim_counter()) {
+            _current = _memtable->_partitions.find(bytes_view { _current_key }, memtable_entry::compare());
+            assert(_current != _memtable->_partitions.cend());
+            _reclaim_counter = region().reclaim_counter();
+        }
+    }
+
+    template <typename Func>
+    decltype(auto) with_entries(Func&& func) const {
+        return with_linearized_managed_bytes([this, &func] {
+            return _memtable->_read_section(region(), std::forward<Func>(func));
+        });
+    }
 public:
-   memtable_reader(lw_shared_ptr<memtable> mtable)
-      : _memtable(mtable)
-      , _begin (mtable->_partitions.cbegin())
-      , _end (mtable->_partitions.cend())
-      , _current(mtable->_partitions.cbegin())
-      , _eof(_begin == _end)
-   {
-   }
-   ~memtable_reader() {}
-
-   future<> seek_to_first() {
-       _current = _begin;
-       return make_ready_future<>();
-   }
-
-   future<> seek_to_last() {
-       _current = --_end;
-       return make_ready_future<>();
-   }
-
-   future<> seek(bytes_view key) {
-       // disable seek operation
-       return make_exception_future<>();
-   }
-
-   future<> next() {
-       _current++;
-       if (_current == _end) {
-           _eof = true;
-       }
-       return make_ready_future<>();
-   }
-
-   bool eof() const {
-       return _eof;
-   }
-
-   partition current() const {
-       return _current->partition();
-   }
+    memtable_reader(lw_shared_ptr<memtable> mtable, bool flush)
+        : _memtable(std::move(mtable))
+        , _flush(flush)
+    {
+        with_entries([this] {
+            set_current(_memtable->_partitions.cbegin());
+        });
+    }
+
+    virtual ~memtable_reader() {}
+
+    virtual future<> seek_to_first() override {
+        with_entries([this] {
+            set_current(_memtable->_partitions.cbegin());
+        });
+        return make_ready_future<>();
+    }
+
+    virtual future<> seek_to_last() override {
+        with_entries([this] {
+            auto& partitions = _memtable->_partitions;
+            set_current(partitions.empty() ? partitions.cend() : std::prev(partitions.cend()));
+        });
+        return make_ready_future<>();
+    }
+
+    // Positions at the first partition whose key is not less than the key.
+    virtual future<> seek(bytes_view key) override {
+        with_entries([this, key] {
+            set_current(_memtable->_partitions.lower_bound(key, memtable_entry::compare()));
+        });
+        return make_ready_future<>();
+    }
+
+    virtual future<> next() override {
+        if (_eof) {
+            return make_ready_future<>();
+        }
+        with_entries([this] {
+            refresh();
+            if (_flush) {
+                _memtable->add_flushed_memory(_memtable->entry_memory_usage(*_current));
+            }
+            set_current(std::next(_current));
+        });
+        return make_ready_future<>();
+    }
+
+    virtual bool eof() const override {
+        return _eof;
+    }
+
+    virtual const bytes& key() const override {
+        assert(!_eof);
+        return _current_key;
+    }
+
+    virtual partition current() const override {
+        assert(!_eof);
+        return with_entries([this] {
+            refresh();
+            return to_partition(*_current);
+        });
+    }
 };
 
-lw_shared_ptr<memtable_reader> make_memtable_reader(lw_shared_ptr<memtable> mtable) {
-    assert(mtable->enable_write() == false);
-    return make_lw_shared<memtable_reader> (mtable);
+lw_shared_ptr<reader> make_memtable_reader(lw_shared_ptr<memtable> mtable) {
+    return make_lw_shared<reader>(std::make_unique<memtable_reader>(std::move(mtable), false));
+}
+
+lw_shared_ptr<reader> make_flush_reader(lw_shared_ptr<memtable> mtable) {
+    assert(mtable->write_enabled() == false);
+    return make_lw_shared<reader>(std::make_unique<memtable_reader>(std::move(mtable), true));
 }
 
 }
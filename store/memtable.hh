@@ -1,12 +1,14 @@
-/** 
+/**
  *  Copy from memtable.{cc, hh} from https://github.com/scylladb/scylla
- * 
+ *
  *  Modified by Peng Jian.
  *
  **/
 #pragma once
+#include <algorithm>
 #include <map>
 #include <memory>
+#include <boost/intrusive/set.hpp>
 #include "utils/logalloc.hh"
 #include "utils/managed_bytes.hh"
 #include "partition.hh"
@@ -20,43 +22,91 @@ using optional = std::experimental::optional<T>;
 namespace bi = boost::intrusive;
 class partition;
 namespace store {
+
+// The memory of all memtables of a shard. The memory of a memtable which was
+// written to the sstable already is potentially cleaned up: it is released as soon
+// as the memtable is destroyed, so it is not counted as the dirty memory.
+class dirty_memory_manager {
+    logalloc::region_group _region_group;
+    uint64_t _potentially_cleaned_up = 0;
+public:
+    dirty_memory_manager() = default;
+    dirty_memory_manager(const dirty_memory_manager&) = delete;
+
+    logalloc::region_group& region_group() {
+        return _region_group;
+    }
+
+    // Returns the memory of all memtables, including the flushed parts.
+    size_t real_dirty_memory() const {
+        return _region_group.memory_used();
+    }
+
+    // Returns the memory which is not flushed yet.
+    size_t dirty_memory() const {
+        return real_dirty_memory() - _potentially_cleaned_up;
+    }
+
+    void account_potentially_cleaned_up_memory(uint64_t delta) {
+        _potentially_cleaned_up += delta;
+    }
+
+    void revert_potentially_cleaned_up_memory(uint64_t delta) {
+        _potentially_cleaned_up -= delta;
+    }
+};
+
+// A partition in the memtable, the key and the serialized partition are allocated
+// in the region of the memtable.
 class memtable_entry {
     bi::set_member_hook<> _link;
-    redis::decorated_key _key;
-    partition _partition;
+    managed_bytes _key;
+    managed_bytes _value;
+    partition_type _type;
 public:
     friend class memtable;
 
-    memtable_entry(redis::decorated_key key, partition&& data)
-        : _key(std::move(key))
-        , _partition(std::move(data))
+    memtable_entry(bytes_view key, partition_type type, bytes_view value)
+        : _key(key)
+        , _value(value)
+        , _type(type)
     {
     }
 
     memtable_entry(memtable_entry&& o) noexcept;
 
-    const redis::decorated_key& key() const { return _key; }
-    redis::decorated_key& key() { return _key; }
+    bytes_view key() const { return _key; }
+    partition_type type() const { return _type; }
+    const managed_bytes& value() const { return _value; }
+
+    // The keys are ordered by their bytes, as the keys of the sstables.
+    static int tri_compare(bytes_view l, bytes_view r) {
+        auto n = memcmp(l.data(), r.data(), std::min(l.size(), r.size()));
+        if (n) {
+            return n;
+        }
+        return l.size() < r.size() ? -1 : (l.size() > r.size() ? 1 : 0);
+    }
 
     struct compare {
-        bool operator()(const redis::decorated_key& l, const memtable_entry& r) const {
-            return l == r.key();
+        bool operator()(bytes_view l, const memtable_entry& r) const {
+            return tri_compare(l, r.key()) < 0;
         }
 
         bool operator()(const memtable_entry& l, const memtable_entry& r) const {
-
-            return l.key() == r.key();
+            return tri_compare(l.key(), r.key()) < 0;
         }
 
-        bool operator()(const memtable_entry& l, const redis::decorated_key& r) const {
-            return l.key() == r;
+        bool operator()(const memtable_entry& l, bytes_view r) const {
+            return tri_compare(l.key(), r) < 0;
         }
     };
 };
 
-class dirty_memory_manager;
-
-
+// The memtable keeps the partitions ordered by their keys in its own region, the
+// region belongs to the region group of the dirty_memory_manager. Once the memtable
+// is sealed by disable_write(), it is an immutable snapshot: the flush iterates it
+// while the reads still look up the partitions in it.
 class memtable final : public enable_lw_shared_from_this<memtable>, private logalloc::region {
 public:
     using partitions_type = bi::set<memtable_entry,
@@ -68,17 +118,16 @@ private:
     logalloc::allocating_section _allocating_section;
     partitions_type _partitions;
     uint64_t _flushed_memory = 0;
+    // the commit log position of the last record inserted into the memtable.
+    uint64_t _replay_position = 0;
     bool _write_enabled = true;
 private:
-    partition& find_or_create_partition(const redis::decorated_key& key);
-    void upgrade_entry(memtable_entry&);
     void add_flushed_memory(uint64_t);
     void remove_flushed_memory(uint64_t);
     void clear() noexcept;
-    uint64_t dirty_size() const;
+    size_t entry_memory_usage(const memtable_entry& e) const;
 public:
     explicit memtable(dirty_memory_manager&);
-    explicit memtable();
     ~memtable();
     future<> clear_gently() noexcept;
 
@@ -93,18 +142,26 @@ public:
     logalloc::region_group* region_group() {
         return group();
     }
-    bool insert(redis::decorated_key&& key, partition&& data) { return false; /* mock now; */ }
-    optional<partition> get(redis::decorated_key key);
-    bool remote(redis::decorated_key key);
+
+    // Inserts the partition, or replaces the partition which has the same key.
+    // Returns false if the memtable was sealed.
+    bool insert(redis::decorated_key&& key, partition&& data);
+    // Returns the partition of the key. A removed partition is returned as the
+    // removable partition, so the caller does not look up the older tables.
+    optional<partition> get(const redis::decorated_key& key);
+    // Removes the partition by inserting the removable partition of the key.
+    bool remove(const redis::decorated_key& key);
     void disable_write() { _write_enabled = false; }
     bool write_enabled() const { return _write_enabled; }
+    void update_replay_position(uint64_t position) { _replay_position = std::max(_replay_position, position); }
+    uint64_t replay_position() const { return _replay_position; }
 public:
     size_t partition_count() const;
     logalloc::occupancy_stats occupancy() const;
+    uint64_t dirty_size() const;
 
     bool empty() const { return _partitions.empty(); }
     bool is_flushed() const;
-    void on_detach_from_region_group() noexcept;
     void revert_flushed_memory() noexcept;
     friend class memtable_reader;
 };
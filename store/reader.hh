@@ -1,22 +1,30 @@
 #pragma once
 #include "core/future.hh"
 #include "core/shared_ptr.hh"
+#include "core/reactor.hh"
 #include "utils/bytes.hh"
+#include "partition.hh"
+#include <memory>
+#include <vector>
 namespace store {
 
 // A reader object allows to iterate on sstable, a set of sstables etc.    
 class reader {
+public:
     class impl {
     public:
         impl () {}
-        virtual ~impl () = 0;
+        virtual ~impl () {}
         virtual future<> seek_to_first() = 0;
         virtual future<> seek_to_last() = 0;
         virtual future<> seek(bytes_view key) = 0;
         virtual future<> next() = 0;
+        // The key of the current partition, the reader is not at the end.
+        virtual const bytes& key() const = 0;
         virtual partition current() const = 0;
         virtual bool eof() const = 0;
     };
+private:
     std::unique_ptr<impl> _impl { nullptr };
 public:
     reader (std::unique_ptr<impl> i) : _impl(std::move(i)) {}
@@ -25,6 +33,7 @@ public:
     future<> seek_to_last() { return _impl->seek_to_last(); } 
     future<> seek(bytes_view key) { return _impl->seek(key); } 
     future<> next() { return _impl->next(); } 
+    const bytes& key() const { return _impl->key(); }
     partition current() const { return _impl->current(); }
     bool eof() const { return _impl->eof(); }
 };
@@ -32,7 +41,17 @@ public:
 class sstable;
 class memtable;
 
-extern lw_shared_ptr<reader> make_sstable_reader(lw_shared_ptr<sstable> sstable);
-extern lw_shared_ptr<reader> make_combined_sstables_reader(std::vector<lw_shared_ptr<sstable>> sstables);
+// The scans which read every block once, such as the compactions, do not
+// populate the block cache.
+extern lw_shared_ptr<reader> make_sstable_reader(lw_shared_ptr<sstable> sstable,
+    const io_priority_class& pc = default_priority_class(), bool populate_cache = true);
+// Merges the readers in the order of the keys. The readers are ordered from the
+// newest one, the partition of the newest reader hides the older ones of its key.
+extern lw_shared_ptr<reader> make_combined_reader(std::vector<lw_shared_ptr<reader>> readers);
+extern lw_shared_ptr<reader> make_combined_sstables_reader(std::vector<lw_shared_ptr<sstable>> sstables,
+    const io_priority_class& pc = default_priority_class());
 extern lw_shared_ptr<reader> make_memtable_reader(lw_shared_ptr<memtable> mtable);
+// The reader of the sealed memtable which is being flushed, the entries it passed
+// are accounted as the flushed memory.
+extern lw_shared_ptr<reader> make_flush_reader(lw_shared_ptr<memtable> mtable);
 }
@@ -1,48 +1,80 @@
 #pragma once
 #include "core/future.hh"
 #include "core/shared_ptr.hh"
+#include "core/file.hh"
+#include "core/reactor.hh"
+#include "core/temporary_buffer.hh"
 #include "utils/bytes.hh"
-#include "utils/managed_bytes.hh"
-#include "store/file_reader.hh"
-#include "lru_cache.hh"
+#include "store/table/format.hh"
+#include "store/table/block_cache.hh"
+#include "utils/bloom_filter.hh"
+#include "seastarx.hh"
 #include <memory>
+#include <vector>
 namespace store {
 
-class sstable_cache;
 struct sstable_options {
     size_t _sstable_buffer_size = 4096;
+    // the data blocks are cached uncompressed, they are not cached if it is null.
+    block_cache* _block_cache = nullptr;
 };
+
 // A Table is a sorted map from strings to strings.  Tables are
-// immutable and persistent.  A Table may be safely accessed from
-// multiple threads without external synchronization.
+// immutable and persistent.
+//
+// The index block and the bloom filter are loaded when the sstable is opened, the
+// data blocks are read on demand, their trailers are verified, and they are
+// uncompressed by the codec recorded in the trailers.
 class sstable {
-    struct rep;
 public:
-    explicit sstable(std::unique_ptr<rep> rep);
-    explicit sstable() = default;
-    sstable(sstable&&) = default;
-    sstable& operator = (sstable&&) = default;
-    ~sstable();
-    uint64_t approximate_offset_of(const bytes_view& key) const;
+    struct index_entry {
+        // the last key of the data block.
+        bytes _last_key;
+        block_handle _handle;
+    };
 private:
-    std::unique_ptr<rep> rep_;
-
-    // No copying allowed
+    // identifies the blocks of the sstable in the block cache.
+    uint64_t _id;
+    sstring _file_name;
+    file _file;
+    uint64_t _file_size;
+    std::vector<index_entry> _index;
+    // the sstables written without the filter have none.
+    std::unique_ptr<utils::filter::bloom_filter> _filter;
+    sstable_options _options;
+public:
+    sstable(sstring file_name, file f, uint64_t file_size, std::vector<index_entry> index,
+        std::unique_ptr<utils::filter::bloom_filter> filter, sstable_options opt);
+    ~sstable();
     sstable(const sstable&) = delete;
     void operator=(const sstable&) = delete;
-};
 
-future<lw_shared_ptr<sstable>> open_sstable(bytes fname, const sstable_options& options);
+    future<> close();
 
-class sstable_cache : public redis::base_cache<managed_bytes, lw_shared_ptr<sstable>> {
-public:
-    sstable_cache()
-        : redis::base_cache<managed_bytes, lw_shared_ptr<sstable>> (redis::global_cache_tracker<managed_bytes, lw_shared_ptr<sstable>>())
-    {
+    uint64_t id() const { return _id; }
+    const sstring& file_name() const { return _file_name; }
+    uint64_t file_size() const { return _file_size; }
+    size_t block_count() const { return _index.size(); }
+
+    bool has_filter() const { return bool(_filter); }
+    // Returns false if the sstable does not hold the key, no block is read.
+    bool may_contain(bytes_view key) const {
+        return !_filter || _filter->is_present(key);
     }
-    sstable_cache(sstable_cache&&) = delete;
-    sstable_cache(const sstable_cache&) = delete;
-    sstable_cache& operator = (const sstable_cache&) = delete;
-    sstable_cache& operator = (sstable_cache&&) = delete;
+    size_t filter_memory_size() const {
+        return _filter ? _filter->memory_size() : 0;
+    }
+
+    // Returns the first data block which may hold the key, or block_count().
+    size_t find_block(bytes_view key) const;
+    // Reads the uncompressed data block from the cache or the disk, and verifies its
+    // trailer.
+    future<temporary_buffer<char>> read_block(size_t i, const io_priority_class& pc = default_priority_class(),
+        bool populate_cache = true) const;
+
+    uint64_t approximate_offset_of(const bytes_view& key) const;
 };
+
+// Throws redis::io_exception if the sstable is malformed.
+future<lw_shared_ptr<sstable>> open_sstable(sstring fname, const sstable_options& options);
 }
@@ -1,42 +1,88 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 //
 // Decodes the blocks generated by block_builder.cc.
 //
-// Modified by Pedis 
+// Modified by Pedis
 
 #include "store/table/block.hh"
-#include "utils/managed_bytes.hh"
-#include <vector>
-#include <algorithm>
-//#include "store/table/format.hh"
-//#include "store/util/coding.hh"
+#include "store/table/format.hh"
+#include "store/util/coding.hh"
+#include "exceptions/exceptions.hh"
+#include "core/print.hh"
+#include <assert.h>
 
 namespace store {
 
-inline uint32_t block::num_restarts() const {
-  // mock
-  return 0;
-  //assert(_size >= sizeof(uint32_t));
-  //return DecodeFixed32(data_ + size_ - sizeof(uint32_t));
+uint32_t block::num_restarts() const
+{
+    return decode_fixed32(_data.get() + _data.size() - sizeof(uint32_t));
 }
 
-block::block(managed_bytes cache_key, temporary_buffer<char> buffer)
-    : _cache_key(std::move(cache_key))
-    , _data(std::move(managed_bytes { bytes_view {buffer.get(), buffer.size()} }))
-    , _size(static_cast<uint32_t>(_data.size()))
+block::block(temporary_buffer<char> data)
+    : _data(std::move(data))
 {
-  if (_size < sizeof(uint32_t)) {
-    _size = 0;  // Error marker
-  } else {
-    size_t max_restarts_allowed = (_size - sizeof(uint32_t)) / sizeof(uint32_t);
+    if (_data.size() < sizeof(uint32_t)) {
+        throw redis::io_exception(sprint("the block of %d bytes is too small", _data.size()));
+    }
+    size_t max_restarts_allowed = (_data.size() - sizeof(uint32_t)) / sizeof(uint32_t);
     if (num_restarts() > max_restarts_allowed) {
-      // The size is too small for NumRestarts()
-      _size = 0;
-    } else {
-      _restart_offset = _size - (1 + num_restarts()) * sizeof(uint32_t);
+        throw redis::io_exception(sprint("the block has %d restarts, at most %d are allowed", num_restarts(), max_restarts_allowed));
+    }
+    _restart_offset = _data.size() - (1 + num_restarts()) * sizeof(uint32_t);
+}
+
+void block::parse_entry(uint32_t offset)
+{
+    if (offset >= _restart_offset) {
+        _valid = false;
+        _key = {};
+        _value = {};
+        _next = _restart_offset;
+        return;
     }
-  }
+    const char* p = _data.get() + offset;
+    const char* limit = _data.get() + _restart_offset;
+    uint32_t shared = 0, non_shared = 0, value_length = 0;
+    p = get_varint32_ptr(p, limit, shared);
+    p = p ? get_varint32_ptr(p, limit, non_shared) : nullptr;
+    p = p ? get_varint32_ptr(p, limit, value_length) : nullptr;
+    if (p == nullptr || shared > _key.size() || size_t(limit - p) < size_t(non_shared) + value_length) {
+        throw redis::io_exception(sprint("the block entry at %d is malformed", offset));
+    }
+    _key.resize(shared);
+    _key.append(reinterpret_cast<const int8_t*>(p), non_shared);
+    p += non_shared;
+    _value = bytes_view { reinterpret_cast<const int8_t*>(p), value_length };
+    _next = (p + value_length) - _data.get();
+    _valid = true;
+}
+
+void block::seek_to_first()
+{
+    _key = {};
+    parse_entry(0);
+}
+
+void block::seek(bytes_view key)
+{
+    for (seek_to_first(); _valid && tri_compare_keys(_key, key) < 0; next()) {
+    }
+}
+
+void block::seek_to_last()
+{
+    seek_to_first();
+    while (_valid && _next < _restart_offset) {
+        next();
+    }
+}
+
+void block::next()
+{
+    assert(_valid);
+    parse_entry(_next);
 }
 
 }
@@ -0,0 +1,85 @@
+#include "store/table/block_cache.hh"
+#include "core/metrics.hh"
+namespace store {
+
+block_cache::block_cache(sstring name, size_t capacity)
+    : _capacity(capacity)
+{
+    namespace sm = seastar::metrics;
+    auto cf = sm::label("cf");
+    _metrics.add_group("block_cache", {
+        sm::make_derive("hits", _stats._hits,
+                        sm::description("Counts the data blocks which were read from the cache."), { cf(name) }),
+        sm::make_derive("misses", _stats._misses,
+                        sm::description("Counts the data blocks which were read from the disk."), { cf(name) }),
+        sm::make_derive("insertions", _stats._insertions,
+                        sm::description("Counts the data blocks which were added to the cache."), { cf(name) }),
+        sm::make_derive("evictions", _stats._evictions,
+                        sm::description("Counts the data blocks which were evicted from the cache."), { cf(name) }),
+        sm::make_gauge("bytes", [this] { return _size; },
+                        sm::description("Holds the bytes of the uncompressed blocks in the cache."), { cf(name) }),
+    });
+}
+
+std::experimental::optional<temporary_buffer<char>> block_cache::get(uint64_t sstable_id, uint64_t offset)
+{
+    auto blocks = _index.find(sstable_id);
+    if (blocks == _index.end()) {
+        ++_stats._misses;
+        return {};
+    }
+    auto i = blocks->second.find(offset);
+    if (i == blocks->second.end()) {
+        ++_stats._misses;
+        return {};
+    }
+    ++_stats._hits;
+    _lru.splice(_lru.begin(), _lru, i->second);
+    return i->second->_data.share();
+}
+
+void block_cache::put(uint64_t sstable_id, uint64_t offset, temporary_buffer<char>& data)
+{
+    if (!_capacity || data.size() > _capacity) {
+        return;
+    }
+    auto& blocks = _index[sstable_id];
+    if (blocks.count(offset)) {
+        return;
+    }
+    _lru.push_front(entry { key_type { sstable_id, offset }, data.share() });
+    blocks.emplace(offset, _lru.begin());
+    _size += data.size();
+    ++_stats._insertions;
+    while (_size > _capacity) {
+        evict(std::prev(_lru.end()));
+    }
+}
+
+void block_cache::invalidate(uint64_t sstable_id)
+{
+    auto blocks = _index.find(sstable_id);
+    if (blocks == _index.end()) {
+        return;
+    }
+    for (auto& b : blocks->second) {
+        _size -= b.second->_data.size();
+        _lru.erase(b.second);
+        ++_stats._evictions;
+    }
+    _index.erase(blocks);
+}
+
+void block_cache::evict(lru_type::iterator i)
+{
+    _size -= i->_data.size();
+    auto blocks = _index.find(i->_key.first);
+    blocks->second.erase(i->_key.second);
+    if (blocks->second.empty()) {
+        _index.erase(blocks);
+    }
+    _lru.erase(i);
+    ++_stats._evictions;
+}
+
+}
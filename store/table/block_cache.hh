@@ -0,0 +1,59 @@
+#pragma once
+#include <list>
+#include <unordered_map>
+#include <utility>
+#include <experimental/optional>
+#include "core/temporary_buffer.hh"
+#include "core/metrics_registration.hh"
+#include "core/sstring.hh"
+#include "seastarx.hh"
+namespace store {
+
+struct block_cache_stats {
+    uint64_t _hits = 0;
+    uint64_t _misses = 0;
+    uint64_t _insertions = 0;
+    uint64_t _evictions = 0;
+};
+
+// Keeps the uncompressed data blocks which were read recently, so the hot reads
+// pay neither the disk nor the codec. The blocks are keyed by the id of their
+// sstable and their offsets, and evicted in the LRU order once the cache holds more
+// than its capacity. The readers share the cached buffers.
+class block_cache {
+    using key_type = std::pair<uint64_t, uint64_t>;
+    struct entry {
+        key_type _key;
+        temporary_buffer<char> _data;
+    };
+    using lru_type = std::list<entry>;
+    size_t _capacity;
+    size_t _size = 0;
+    // the most recently used block first.
+    lru_type _lru;
+    // the blocks by the sstables, then by the offsets, so the blocks of a removed
+    // sstable are found without scanning the cache.
+    std::unordered_map<uint64_t, std::unordered_map<uint64_t, lru_type::iterator>> _index;
+    block_cache_stats _stats;
+    seastar::metrics::metric_groups _metrics;
+public:
+    block_cache(sstring name, size_t capacity);
+    block_cache(const block_cache&) = delete;
+    block_cache& operator = (const block_cache&) = delete;
+
+    std::experimental::optional<temporary_buffer<char>> get(uint64_t sstable_id, uint64_t offset);
+    void put(uint64_t sstable_id, uint64_t offset, temporary_buffer<char>& data);
+    // Removes the blocks of the sstable which was removed.
+    void invalidate(uint64_t sstable_id);
+
+    size_t size() const {
+        return _size;
+    }
+    const block_cache_stats& get_stats() const {
+        return _stats;
+    }
+private:
+    void evict(lru_type::iterator i);
+};
+
+}
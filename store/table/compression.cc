@@ -0,0 +1,134 @@
+#include "store/table/compression.hh"
+#include "store/util/coding.hh"
+#include "exceptions/exceptions.hh"
+#include "core/print.hh"
+#include <boost/algorithm/string.hpp>
+#include <lz4.h>
+#include <snappy.h>
+#include <zlib.h>
+#include <memory>
+#include <stdexcept>
+namespace store {
+
+// the uncompressed size prefix is at most 5 bytes.
+static constexpr const size_t max_size_prefix = 5;
+
+bool compress_block(compression_type type, bytes_view raw, bytes& out)
+{
+    size_t bound = 0;
+    switch (type) {
+    case compression_type::lz4:
+        bound = LZ4_compressBound(raw.size());
+        break;
+    case compression_type::snappy:
+        bound = snappy::MaxCompressedLength(raw.size());
+        break;
+    case compression_type::deflate:
+        bound = compressBound(raw.size());
+        break;
+    case compression_type::none:
+    default:
+        return false;
+    }
+    auto buf = std::make_unique<char[]>(max_size_prefix + bound);
+    auto data = encode_varint32(buf.get(), raw.size());
+    auto input = reinterpret_cast<const char*>(raw.data());
+    size_t n = 0;
+    switch (type) {
+    case compression_type::lz4: {
+        auto r = LZ4_compress_default(input, data, raw.size(), bound);
+        if (r <= 0) {
+            return false;
+        }
+        n = r;
+        break;
+    }
+    case compression_type::snappy:
+        snappy::RawCompress(input, raw.size(), data, &n);
+        break;
+    case compression_type::deflate: {
+        uLongf len = bound;
+        if (compress2(reinterpret_cast<Bytef*>(data), &len, reinterpret_cast<const Bytef*>(input), raw.size(), Z_DEFAULT_COMPRESSION) != Z_OK) {
+            return false;
+        }
+        n = len;
+        break;
+    }
+    default:
+        return false;
+    }
+    auto size = (data - buf.get()) + n;
+    // less than 12.5% saved is not worth the decompression of every read.
+    if (size >= raw.size() - raw.size() / 8) {
+        return false;
+    }
+    out = bytes { reinterpret_cast<const int8_t*>(buf.get()), size };
+    return true;
+}
+
+temporary_buffer<char> uncompress_block(compression_type type, temporary_buffer<char> stored)
+{
+    if (type == compression_type::none) {
+        return stored;
+    }
+    uint32_t raw_size = 0;
+    auto data = get_varint32_ptr(stored.get(), stored.get() + stored.size(), raw_size);
+    if (!data) {
+        throw redis::io_exception("the compressed block has no size");
+    }
+    size_t size = stored.get() + stored.size() - data;
+    temporary_buffer<char> raw(raw_size);
+    bool ok = false;
+    switch (type) {
+    case compression_type::lz4:
+        ok = LZ4_decompress_safe(data, raw.get_write(), size, raw_size) == int(raw_size);
+        break;
+    case compression_type::snappy: {
+        size_t n = 0;
+        ok = snappy::GetUncompressedLength(data, size, &n) && n == raw_size
+            && snappy::RawUncompress(data, size, raw.get_write());
+        break;
+    }
+    case compression_type::deflate: {
+        uLongf len = raw_size;
+        ok = uncompress(reinterpret_cast<Bytef*>(raw.get_write()), &len, reinterpret_cast<const Bytef*>(data), size) == Z_OK
+            && len == raw_size;
+        break;
+    }
+    default:
+        throw redis::io_exception(sprint("the block has the unknown compression %d", static_cast<int>(type)));
+    }
+    if (!ok) {
+        throw redis::io_exception(sprint("the block of the compression %d is malformed", static_cast<int>(type)));
+    }
+    return raw;
+}
+
+compression_type parse_compression_type(const sstring& name)
+{
+    auto n = boost::algorithm::to_lower_copy(std::string(name.c_str()));
+    if (n.empty() || n == "none") {
+        return compression_type::none;
+    } else if (n == "lz4" || n == "lz4compressor") {
+        return compression_type::lz4;
+    } else if (n == "snappy" || n == "snappycompressor") {
+        return compression_type::snappy;
+    } else if (n == "deflate" || n == "deflatecompressor") {
+        return compression_type::deflate;
+    }
+    throw std::invalid_argument(sprint("the compression %s is unknown", name));
+}
+
+std::vector<compression_type> parse_level_compression(const sstring& names)
+{
+    std::vector<std::string> parts;
+    boost::algorithm::split(parts, std::string(names.c_str()), boost::algorithm::is_any_of(","));
+    std::vector<compression_type> result;
+    for (auto& p : parts) {
+        boost::algorithm::trim(p);
+        result.push_back(parse_compression_type(sstring(p)));
+    }
+    return result;
+}
+
+}
@@ -0,0 +1,26 @@
+#pragma once
+#include <vector>
+#include "core/sstring.hh"
+#include "core/temporary_buffer.hh"
+#include "store/table/format.hh"
+#include "utils/bytes.hh"
+#include "seastarx.hh"
+namespace store {
+
+// Compresses the block: [uncompressed size varint32][compressed data]. Returns
+// false if the block compresses poorly, so it is stored uncompressed.
+bool compress_block(compression_type type, bytes_view raw, bytes& out);
+
+// Returns the uncompressed block. Throws redis::io_exception if the compressed data
+// is malformed.
+temporary_buffer<char> uncompress_block(compression_type type, temporary_buffer<char> stored);
+
+// Parses the codec names: none, lz4, snappy and deflate, or the compressor classes
+// such as LZ4Compressor. Throws std::invalid_argument if the name is unknown.
+compression_type parse_compression_type(const sstring& name);
+
+// Parses the codecs of the levels separated by the commas, such as "none,lz4", the
+// last one applies to the deeper levels.
+std::vector<compression_type> parse_level_compression(const sstring& names);
+
+}
@@ -0,0 +1,49 @@
+#include "store/table/filter_block.hh"
+#include "store/util/coding.hh"
+#include "utils/bloom_calculations.hh"
+#include "utils/large_bitset.hh"
+#include "core/align.hh"
+#include <algorithm>
+namespace store {
+
+bytes filter_block_builder::finish()
+{
+    int64_t n = _hashes.size();
+    int buckets = std::min(_bits_per_key, std::max(1, utils::bloom_calculations::max_buckets_per_element(n)));
+    auto spec = utils::bloom_calculations::compute_bloom_spec(buckets);
+    auto nr_bits = align_up<int64_t>(n * spec.buckets_per_element + utils::bloom_calculations::EXCESS, 64);
+    utils::filter::murmur3_bloom_filter filter { spec.K, large_bitset(nr_bits) };
+    for (auto& h : _hashes) {
+        filter.add(h);
+    }
+    std::vector<uint64_t> words(nr_bits / 64);
+    filter.bits().save(words.begin());
+
+    bytes result;
+    put_varint32(result, spec.K);
+    put_varint64(result, nr_bits);
+    for (auto w : words) {
+        put_fixed64(result, w);
+    }
+    _hashes.clear();
+    return result;
+}
+
+std::unique_ptr<utils::filter::bloom_filter> decode_filter_block(bytes_view data)
+{
+    uint32_t hash_count = 0;
+    uint64_t nr_bits = 0;
+    if (!get_varint32(data, hash_count) || !get_varint64(data, nr_bits)
+        || hash_count == 0 || nr_bits == 0 || nr_bits % 64 || data.size() != nr_bits / 8) {
+        return nullptr;
+    }
+    std::vector<uint64_t> words(nr_bits / 64);
+    for (size_t i = 0; i < words.size(); ++i) {
+        words[i] = decode_fixed64(reinterpret_cast<const char*>(data.data()) + i * sizeof(uint64_t));
+    }
+    large_bitset bits(nr_bits);
+    bits.load(words.begin(), words.end());
+    return std::make_unique<utils::filter::murmur3_bloom_filter>(hash_count, std::move(bits));
+}
+
+}
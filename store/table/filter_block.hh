@@ -0,0 +1,33 @@
+#pragma once
+#include <memory>
+#include <vector>
+#include "utils/bloom_filter.hh"
+#include "utils/bytes.hh"
+#include "seastarx.hh"
+namespace store {
+
+// The name of the bloom filter in the metaindex block.
+static constexpr const char* bloom_filter_block_name = "filter.murmur3";
+
+// Collects the hashes of the keys of the sstable, the filter is sized by the number
+// of the keys once the sstable is finished.
+class filter_block_builder {
+    int _bits_per_key;
+    std::vector<utils::hashed_key> _hashes;
+public:
+    explicit filter_block_builder(int bits_per_key) : _bits_per_key(bits_per_key) {}
+
+    void add(bytes_view key) {
+        _hashes.push_back(utils::make_hashed_key(key));
+    }
+    bool empty() const {
+        return _hashes.empty();
+    }
+    // The filter block: [hash count varint32][bits varint64][the bitmap as fixed64].
+    bytes finish();
+};
+
+// Returns nullptr if the filter block is malformed.
+std::unique_ptr<utils::filter::bloom_filter> decode_filter_block(bytes_view data);
+
+}
@@ -0,0 +1,67 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+//  Modified by Peng Jian.
+//
+#include "store/table/format.hh"
+#include "store/util/coding.hh"
+#include <algorithm>
+namespace store {
+
+constexpr const size_t block_handle::max_encoded_length;
+constexpr const uint64_t footer::table_magic_number;
+constexpr const size_t footer::encoded_length;
+
+void block_handle::encode_to(bytes& dst) const
+{
+    put_varint64(dst, _offset);
+    put_varint64(dst, _size);
+}
+
+bool block_handle::decode_from(bytes_view& input)
+{
+    return get_varint64(input, _offset) && get_varint64(input, _size);
+}
+
+void footer::encode_to(bytes& dst) const
+{
+    auto original_size = dst.size();
+    _metaindex_handle.encode_to(dst);
+    _index_handle.encode_to(dst);
+    dst.resize(original_size + 2 * block_handle::max_encoded_length);
+    put_fixed64(dst, table_magic_number);
+}
+
+bool footer::decode_from(bytes_view input)
+{
+    if (input.size() < encoded_length) {
+        return false;
+    }
+    uint64_t magic = decode_fixed64(reinterpret_cast<const char*>(input.data()) + encoded_length - sizeof(uint64_t));
+    if (magic != table_magic_number) {
+        return false;
+    }
+    return _metaindex_handle.decode_from(input) && _index_handle.decode_from(input);
+}
+
+bytes encode_partition(const partition& p)
+{
+    auto data = p.serialize();
+    bytes value { bytes::initialized_later(), data.size() + 1 };
+    value[0] = static_cast<int8_t>(p.type());
+    std::copy(data.begin(), data.end(), value.begin() + 1);
+    return value;
+}
+
+partition decode_partition(bytes_view key, bytes_view value)
+{
+    if (value.empty()) {
+        return make_null_partition();
+    }
+    auto type = static_cast<partition_type>(static_cast<uint8_t>(value[0]));
+    value.remove_prefix(1);
+    return make_serialized_partition(type, bytes { key.begin(), key.end() }, bytes { value.begin(), value.end() });
+}
+
+}
@@ -0,0 +1,86 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+//  Modified by Peng Jian.
+//
+#pragma once
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+#include "utils/bytes.hh"
+#include "partition.hh"
+namespace store {
+
+// The position of a block in the sstable file.
+class block_handle {
+    uint64_t _offset = 0;
+    uint64_t _size = 0;
+public:
+    // the maximum encoding length of a handle, two varint64.
+    static constexpr const size_t max_encoded_length = 10 + 10;
+
+    block_handle() = default;
+    block_handle(uint64_t offset, uint64_t size) : _offset(offset), _size(size) {}
+
+    // The offset of the block in the file.
+    uint64_t offset() const { return _offset; }
+    void set_offset(uint64_t offset) { _offset = offset; }
+
+    // The size of the stored block, the trailer is not counted.
+    uint64_t size() const { return _size; }
+    void set_size(uint64_t size) { _size = size; }
+
+    void encode_to(bytes& dst) const;
+    bool decode_from(bytes_view& input);
+};
+
+// The compression of a block is recorded in its trailer.
+enum class compression_type : uint8_t {
+    none = 0,
+    lz4 = 1,
+    snappy = 2,
+    deflate = 3,
+};
+
+// Every block is followed by the trailer: [compression type u8][crc32 u32], the crc
+// covers the stored block and the compression type.
+static constexpr const size_t block_trailer_size = sizeof(uint8_t) + sizeof(uint32_t);
+
+// The footer is stored at the tail of every sstable:
+//   [metaindex handle][index handle], padded to 2 * max_encoded_length, [magic u64]
+class footer {
+    block_handle _metaindex_handle;
+    block_handle _index_handle;
+public:
+    static constexpr const uint64_t table_magic_number = 0x7065646973737462ull;
+    static constexpr const size_t encoded_length = 2 * block_handle::max_encoded_length + sizeof(uint64_t);
+
+    footer() = default;
+
+    // The block of the meta blocks, such as the filter.
+    const block_handle& metaindex_handle() const { return _metaindex_handle; }
+    void set_metaindex_handle(const block_handle& h) { _metaindex_handle = h; }
+
+    const block_handle& index_handle() const { return _index_handle; }
+    void set_index_handle(const block_handle& h) { _index_handle = h; }
+
+    void encode_to(bytes& dst) const;
+    bool decode_from(bytes_view input);
+};
+
+// The keys of the sstables are ordered by their bytes, as the keys of the memtable.
+inline int tri_compare_keys(bytes_view l, bytes_view r)
+{
+    auto n = memcmp(l.data(), r.data(), std::min(l.size(), r.size()));
+    if (n) {
+        return n;
+    }
+    return l.size() < r.size() ? -1 : (l.size() > r.size() ? 1 : 0);
+}
+
+// The value of a partition in the sstable: [type u8][serialized partition].
+bytes encode_partition(const partition& p);
+partition decode_partition(bytes_view key, bytes_view value);
+
+}
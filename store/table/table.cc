@@ -1,451 +1,306 @@
 #include "store/table.hh"
-#include "store/filter_policy.hh"
-#include "store/options.hh"
 #include "store/table/block.hh"
-#include "store/table/filter_block.hh"
 #include "store/table/format.hh"
+#include "store/table/filter_block.hh"
+#include "store/table/compression.hh"
 #include "store/util/coding.hh"
 #include "store/reader.hh"
+#include "store/checked-file-impl.hh"
+#include "utils/crc.hh"
+#include "utils/disk-error-handler.hh"
+#include "exceptions/exceptions.hh"
+#include "core/print.hh"
+#include <algorithm>
 
 namespace store {
 
-static thread_local sstable_cache _table_cache;
-static inline sstable_cache& get_table_cache() {
-    return _table_cache;
-}
-static thread_local block_cache _block_cache;
-static inline block_cache& get_block_cache() {
-    return _block_cache;
+// Verifies the trailer of the block, and returns the uncompressed block.
+static temporary_buffer<char> verify_block(const sstring& name, const block_handle& handle, temporary_buffer<char> data)
+{
+    if (data.size() != handle.size() + block_trailer_size) {
+        throw redis::io_exception(sprint("%s: the block at %d is truncated", name, handle.offset()));
+    }
+    auto type = static_cast<uint8_t>(data[handle.size()]);
+    utils::crc32 crc;
+    crc.process(reinterpret_cast<const uint8_t*>(data.get()), handle.size());
+    crc.process(type);
+    if (crc.get() != decode_fixed32(data.get() + handle.size() + 1)) {
+        throw redis::io_exception(sprint("%s: the block at %d fails the crc check", name, handle.offset()));
+    }
+    if (type > static_cast<uint8_t>(compression_type::deflate)) {
+        throw redis::io_exception(sprint("%s: the block at %d has the unknown compression %d", name, handle.offset(), type));
+    }
+    data.trim(handle.size());
+    try {
+        return uncompress_block(static_cast<compression_type>(type), std::move(data));
+    } catch (redis::io_exception& e) {
+        throw redis::io_exception(sprint("%s: the block at %d: %s", name, handle.offset(), e.what()));
+    }
 }
 
-future<temporary_buffer<char>> read_block(lw_shared_ptr<file_random_access_reader> r, block_handle index);
-lw_shared_ptr<reader> make_block_reader(lw_shared_ptr<table> ptable, block_handle index);
-
-struct sstable::rep {
-  ~rep() {
-  }
-
-  rep(lw_shared_ptr<file_reader> freader,
-      block_handle metaindex,
-      lw_shared_ptr<block> index_block,
-      sstable_options opt)
-      : _file_reader (freader)
-      , _filter (nullptr)
-      , _fileter_data()
-      , _file_name ()
-      , _metaindex_handle ()
-      , _index_block (index_block)
-      , _options(opt)
-  {
-  }
+static uint64_t new_sstable_id()
+{
+    static thread_local uint64_t next_id = 0;
+    return next_id++;
+}
 
-  lw_shared_ptr<file_reader> _file_reader;
-  lw_shared_ptr<filter_block_reader> _filter = nullptr;
-  managed_bytes _fileter_data;
-  bytes _file_name;
-  block_handle _metaindex_handle;  // Handle to metaindex_block: saved from footer
-  lw_shared_ptr<block> _index_block = nullptr;
-  sstable_options _options;
-  future<> read_meta(const footer& footer);
-  future<> read_filter(const slice& filter_handle_value);
-};
+sstable::sstable(sstring file_name, file f, uint64_t file_size, std::vector<index_entry> index,
+    std::unique_ptr<utils::filter::bloom_filter> filter, sstable_options opt)
+    : _id(new_sstable_id())
+    , _file_name(std::move(file_name))
+    , _file(std::move(f))
+    , _file_size(file_size)
+    , _index(std::move(index))
+    , _filter(std::move(filter))
+    , _options(std::move(opt))
+{
+}
 
-future<temporary_buffer<char>> read_block(lw_shared_ptr<file_random_access_reader> r, block_handle index) {
-    r->seek(index.offset());
-    return r->read_exactly(index.size()).then([r] (auto&& buffer) {
-        return std::move(buffer);
-    }).hanlde_exception([index] (auto e) {
-        // log it and throw it.
-        throw io_exception();
-    });;
+sstable::~sstable()
+{
 }
 
-sstable::sstable(std::unique_ptr<sstable::rep> r) : rep_(std::move(r)) {}
+future<> sstable::close()
+{
+    return _file.close();
+}
 
-future<lw_shared_ptr<sstable>> open_sstable(bytes fname, const sstable_options& opts) {
-    return open_file_dma(fname, open_flags::ro).then([this, &opts] (file file_) mutable {
-        // mock, we will get the table cache from the thread local instance?
-        auto cached_table = get_table_cache().find(fname);
-        if (cached_table) {
-            return make_ready_future<table> (cached_table);
-        }
-        return file_.size().then([this, file_ = std::move(file_), &opts] (uint64_t size) {
-            if (size < footer::kEncodedLength) {
-                return make_exception_future<>(lw_shared_ptr<table>({}));
-            }
-            auto f = make_checked_file(opts._read_error_handler, file_);
-            auto r = make_lw_shared<file_random_access_reader>(std::move(f), size, opts.sstable_buffer_size);
-            reader->seek(size - Footer::kEncodedLength);
-            return r->read_exactly(Footer::kEncodedLength).then([this, r, &opts] (auto buffer) mutable {
-                if (buffer.size() != footer::kEncodedLength) {
-                    return make_exception_future<>(lw_shared_ptr<table>({}));
-                }
-                // read footer
-                footer footer_;
-                if (!footer_.decode_from(buffer.get(), buffer.size())) {
-                    return make_exception_future<>(lw_shared_ptr<table>({}));
-                }
-                // read index block, and do not parse the index block now.
-                auto fut = read_block(r, footer_.index_handle());
-                return fut.then([this, r = std::move(r), _footer = std::move(_footer), &opts] (auto&& data) {
-                    auto block_handle_key = convert_to_handle_key(footer_.index_handle());
-                    auto index_block = cache->find_and_create(std::move(block_handle_key), std::move(data));
-                    auto rep_ = std::make_unique<table::rep>(r, footer_.metaindex_handle(), index_block, opts);
-                    auto table_instance = make_lw_shared<table>(rep_);
-                    // read meta block
-                    return rep_->read_meta(footer_.metaindex_handle()).then([this, table_instance] {
-                        get_table_cache().insert(table_instance);
-                        return make_ready_future<lw_shared_ptr<sstable>> ({table_instance});
-                    });
-                });
-             });
-        }).handle_exception([this, fname] (std::exception_ptr) {
-            throw redis::io_exception();
-        });
+size_t sstable::find_block(bytes_view key) const
+{
+    auto i = std::lower_bound(_index.begin(), _index.end(), key, [] (const index_entry& e, bytes_view key) {
+        return tri_compare_keys(e._last_key, key) < 0;
     });
+    return i - _index.begin();
 }
 
-future<> table::read_meta(lw_shared_ptr<file_random_access_reader> reader, block_handle metaindex_handle) {
-    if (rep_->options.filter_policy == nullptr) {
-      // Do not need any metadata
-      return make_ready_future<>();
+future<temporary_buffer<char>> sstable::read_block(size_t i, const io_priority_class& pc, bool populate_cache) const
+{
+    assert(i < _index.size());
+    auto& handle = _index[i]._handle;
+    auto cache = _options._block_cache;
+    if (cache) {
+        auto cached = cache->get(_id, handle.offset());
+        if (cached) {
+            return make_ready_future<temporary_buffer<char>>(std::move(*cached));
+        }
     }
-
-    return read_block(reader, metaindex_handle).then([this] (auto&& key, auto&& data) {
-        auto meta = make_lw_shared<block>(std::move(key), std::move(data));
-        auto meta_block_reader = make_block_reader(meta, bytes_comparator());
-        bytes key { "filter." + rep_->_options.filter_policy->name() };
-        meta_block_reader->seek(key);
-        auto data = meta_block_reader->current().data();
-        block_handle filter_handle;
-        if (filter_handle.decode_from(data)) {
-            return read_block(reader, filter_handle).then([this] (auto&& data) mutable {
-                // we do not put filter block into cache.
-                rep_->_filter = make_lw_shared<filter_block_reader> (rep_->_options._filter_policy, std::move(data));
-                return make_ready_future<>();
-            });
+    return _file.dma_read_exactly<char>(handle.offset(), handle.size() + block_trailer_size, pc).then([this, handle, cache, populate_cache] (temporary_buffer<char> data) {
+        // the block is cached uncompressed, the following reads skip the codec.
+        auto block = verify_block(_file_name, handle, std::move(data));
+        if (cache && populate_cache) {
+            cache->put(_id, handle.offset(), block);
         }
-        return make_ready_future<>();
+        return block;
     });
 }
 
-table::~table() {
+uint64_t sstable::approximate_offset_of(const bytes_view& key) const
+{
+    auto i = find_block(key);
+    if (i < _index.size()) {
+        return _index[i]._handle.offset();
+    }
+    // the key is past the last key, the offset of the metaindex block is close to
+    // the end of the data.
+    return _index.empty() ? 0 : _index.back()._handle.offset() + _index.back()._handle.size();
 }
 
-class block_reader : public reader::impl {
-    lw_shared_ptr<block> _block;
-    sstable_options _optons;
-    uint32_t _restarts_offset = 0;
-    uint32_t _num_restarts = 0;
-    uint32_t _restart_index = 0;
-    uint32_t _current_offset = 0;
-    partition _current;
-    bytes_view _data_view;
-    bytes_view _value_view;
-    bool _eof = false;
-public:
-    block_reader(lw_shared_ptr<block> b, sstable_options opt)
-        , _block(b)
-        , _options(opt)
-        , _data_view ({b->data(), b->size()})
-        , _value_view ()
-        , _restarts_offset (0)
-        , _num_restarts (b->num_restarts())
-        , _restart_index(0)
-        , _current_offset(0)
-        , _eof(false)
-    {
-    }
-    future<> seek_to_first() {
-        seek_to_restart_point(0);
-        parse_next_key();
-        return make_ready_future<>();
-    }
+// The blocks which are loaded when the sstable is opened.
+struct sstable_meta_blocks {
+    std::vector<sstable::index_entry> _index;
+    std::unique_ptr<utils::filter::bloom_filter> _filter;
+};
 
-    future<> seek_to_last() {
-        seek_to_restart_point(num_restarts_ - 1);
-        while (parse_next_key() && next_entry_offset() < restarts_) { }
-        return make_ready_future<>();
-    }
+static future<temporary_buffer<char>> read_meta_block(const sstring& fname, file f, block_handle handle)
+{
+    return f.dma_read_exactly<char>(handle.offset(), handle.size() + block_trailer_size).then([fname, handle] (temporary_buffer<char> data) {
+        return verify_block(fname, handle, std::move(data));
+    });
+}
 
-    future<> seek(bytes key) {
-        // binary search the target restart point.
-        uint32_t left = 0;
-        uint32_t right = num_restarts_ - 1;
-        while (left < right) {
-            uint32_t mid = (left + right + 1) / 2;
-            uint32_t region_offset = get_restart_point(mid);
-            uint32_t shared, non_shared, value_length;
-            const char* key_ptr = decode_entry(data_ + region_offset, data_ + restarts_, &shared, &non_shared, &value_length);
-            if (key_ptr == nullptr || (shared != 0)) {
-                _eof = true;
-                return make_ready_future<>();
-            }
-            auto mid_key = bytes_view { key_ptr, non_shared };
-            if (compare(mid_key, target) < 0) {
-                left = mid;
-            } else {
-                right = mid - 1;
-            }
-        }
-        seek_to_restart_point(left);
-        // leaner search the target key
-        while (true) {
-            if (!parse_next_key()) {
-                return make_ready_future<>();
-            }
-            if (compare(_curent_key(), key) >= 0) {
-                return make_ready_future<>();
-            }
+static std::vector<sstable::index_entry> decode_index(const sstring& fname, temporary_buffer<char> data)
+{
+    // the index block is decoded once, the lookups search it by the binary search.
+    block index_block { std::move(data) };
+    std::vector<sstable::index_entry> index;
+    for (index_block.seek_to_first(); index_block.valid(); index_block.next()) {
+        auto value = index_block.value();
+        block_handle h;
+        if (!h.decode_from(value)) {
+            throw redis::io_exception(sprint("%s: the index entry is malformed", fname));
         }
+        index.push_back(sstable::index_entry { index_block.key(), h });
     }
+    return index;
+}
 
-    future<> next() {
-        parse_next_key();
-        return make_ready_future<>();
-    }
-    partition current() const {
-        return _current;
-    }
-    bool eof() const {
-        return _current_offset >= restarts_ || _eof;
-    }
-private:
-    inline uint32_t next_entry_offset() const {
-        return static_cast<uint32_t>((_value_view.data() + _value_view.size()) - _data_view.data());
-    }
-
-    uint32_t get_restart_point(uint32_t index) {
-        assert (index < _num_restarts);
-        return decode_fixed32(data_ + restarts_ + index * sizeof(uint32_t));
-    }
-
-    void seek_to_restart_point(uint32_t index) {
-        _current.key().clear();
-        restart_index_ = index;
-        uint32_t offset = get_restart_point(index);
-        _value_view = bytes_view { _data_view.data() + offset, 0 };
-    }
-
-    bool parse_next_key() {
-        _current_offset = next_entry_offset();
-        const char* p = _data_view.data() + _current_offset;
-        const char* limit = data_ + restarts_offset;
-        if (p >= limit) {
-            current_ = restarts_offset;
-            restart_index_ = num_restarts_;
-            return false;
+// Reads the filter named by the metaindex block, the sstable has no filter if the
+// metaindex block names none.
+static future<std::unique_ptr<utils::filter::bloom_filter>> read_filter(const sstring& fname, file f, block_handle metaindex_handle)
+{
+    return read_meta_block(fname, f, metaindex_handle).then([fname, f] (temporary_buffer<char> data) {
+        block metaindex_block { std::move(data) };
+        auto name = bytes { reinterpret_cast<const int8_t*>(bloom_filter_block_name), strlen(bloom_filter_block_name) };
+        metaindex_block.seek(name);
+        if (!metaindex_block.valid() || metaindex_block.key() != name) {
+            return make_ready_future<std::unique_ptr<utils::filter::bloom_filter>>(nullptr);
         }
-
-        uint32_t shared, non_shared, value_length;
-        p = decode_entry(p, limit, &shared, &non_shared, &value_length);
-        if (p == nullptr || key_.size() < shared) {
-            return false;
-        } else {
-            _current.key().resize(shared);
-            _current.key().append(p, non_shared);
-            _value_view = { p + non_shared, value_length };
-            while (restart_index_ + 1 < num_restarts_ && get_restart_point(restart_index_ + 1) < _current_offset) {
-                ++restart_index_;
-            }
-            return true;
+        auto value = metaindex_block.value();
+        block_handle h;
+        if (!h.decode_from(value)) {
+            throw redis::io_exception(sprint("%s: the metaindex entry is malformed", fname));
         }
-    }
-};
-
-lw_shared_ptr<reader> make_block_reader(lw_shared_ptr<block> b, sstables_options opt) {
-    return make_lw_shared<reader>(std::make_unique<block_reader>(b, std::move(opt)));
+        return read_meta_block(fname, f, h).then([fname] (temporary_buffer<char> data) {
+            auto filter = decode_filter_block(bytes_view { reinterpret_cast<const int8_t*>(data.get()), data.size() });
+            if (!filter) {
+                throw redis::io_exception(sprint("%s: the filter block is malformed", fname));
+            }
+            return filter;
+        });
+    });
 }
 
-class sstable_reader : public reader::impl {
-   lw_shared_ptr<table> _table;
-   lw_shared_ptr<block_reader> _index_block_reader;
-   lw_shared_ptr<block_reader> _data_block_reader;
-   lw_shared_ptr<file_random_access_reader> _reader;
-   bool _initialized = false;
-public:
-   sstable_reader(lw_shared_ptr<table> ptable) : _table(ptable) {}
-   future<> seek_to_first() {
-       return _index_block_reader->seek_to_first().then([this] {
-            _initialized = true;
-            block_handle data_handle;
-            data_handle.decode_from(_index_block_reader->current().data());
-            auto handle_key = convert_to_handle_key(data_handle);
-            auto b  = _table->cache()->find(handle_key);
-            if (b != nullptr) {
-                _data_block_reader = make_block_reader(b, _table->options());
-                return _data_block_reader.seek_to_first();
-            }
-            return read_block(_reader, data_handle).then([this, key = std::move(handle_key)] (auto&& data) {
-                // cache the block. the block in the cache will be evicted by LRU or the file was deleted.
-                auto b = _table->cache()->create(std::move(key), std::move(data));
-                 _data_block_reader = make_block_reader(b, _table->options());
-                return _data_block_reader->seek_to_first();
+static future<sstable_meta_blocks> read_meta_blocks(const sstring& fname, file f, uint64_t size)
+{
+    if (size < footer::encoded_length) {
+        throw redis::io_exception(sprint("%s: the file of %d bytes has no footer", fname, size));
+    }
+    return f.dma_read_exactly<char>(size - footer::encoded_length, footer::encoded_length).then([fname, f] (temporary_buffer<char> buf) mutable {
+        footer footer_;
+        if (!footer_.decode_from(bytes_view { reinterpret_cast<const int8_t*>(buf.get()), buf.size() })) {
+            throw redis::io_exception(sprint("%s: the footer is malformed", fname));
+        }
+        return read_meta_block(fname, f, footer_.index_handle()).then([fname, f, footer_] (temporary_buffer<char> data) {
+            auto index = decode_index(fname, std::move(data));
+            return read_filter(fname, f, footer_.metaindex_handle()).then([index = std::move(index)] (auto filter) mutable {
+                return sstable_meta_blocks { std::move(index), std::move(filter) };
             });
-       });
-   }
-   future<> seek_to_last() {
-       return _index_block_reader->seek_to_last().then([this] {
-            _initialized = true;
-            block_handle data_handle;
-            data_handle.decode_from(_index_block_reader->current().data());
-            auto handle_key = convert_to_handle_key(data_handle);
-            auto b  = _table->cache()->find(handle_key);
-            if (b != nullptr) {
-                _data_block_reader = make_block_reader(b, _table->options());
-                return _data_block_reader.seek_to_last();
-            }
-            return read_block(_reader, data_handle).then([this, key = std::move(handle_key)] (auto&& data) {
-                auto b = _table->cache()->create(std::move(key), std::move(data));
-                 _data_block_reader = make_block_reader(b, _table->options());
-                return _data_block_reader->seek_to_last();
+        });
+    });
+}
+
+future<lw_shared_ptr<sstable>> open_sstable(sstring fname, const sstable_options& opts)
+{
+    return open_checked_file_dma(general_disk_error_handler, fname, open_flags::ro).then([fname, opts] (file f) {
+        return f.size().then([fname, f] (uint64_t size) {
+            return read_meta_blocks(fname, f, size).then([size] (sstable_meta_blocks blocks) {
+                return std::make_pair(size, std::move(blocks));
             });
-       });
-   }
-   future<> seek(bytes_view key) {
-       return _index_block_reader->seek(key).then([this, key] {
-            _initialized = true;
-            block_handle data_handle;
-            data_handle.decode_from(_index_block_reader->current().data());
-            auto handle_key = convert_to_handle_key(data_handle);
-            auto b  = _table->cache()->find(handle_key);
-            if (b != nullptr) {
-                _data_block_reader = make_block_reader(b, _table->options());
-                return _data_block_reader.seek(key);
-            }
-            return read_block(_reader, data_handle).then([this, key = std::move(handle_key)] (auto&& data) {
-                auto b = _table->cache()->create(std::move(key), std::move(data));
-                _data_block_reader = make_block_reader(b, _table->options());
-                return _data_block_reader->seek(ikey);
+        }).then([fname, f, opts] (std::pair<uint64_t, sstable_meta_blocks> r) mutable {
+            return make_lw_shared<sstable>(fname, std::move(f), r.first, std::move(r.second._index),
+                std::move(r.second._filter), opts);
+        }).handle_exception([f] (auto ep) mutable {
+            return f.close().then_wrapped([ep] (auto&&) {
+                return make_exception_future<lw_shared_ptr<sstable>>(ep);
             });
-       });
-   }
-   future<> next() {
-       assert(_initialized);
-       return _data_block_reader->next().then([this] mutable {
-           if (_data_block_reader->current().empty()) {
-               return _index_block_reader->next().then([this] mutable {
-                   block_handle data_handle;
-                   data_handle.decode_from(_index_block_reader->current().data());
-                   auto handle_key = convert_to_handle_key(data_handle);
-                   auto b  = _table->cache()->find(handle_key);
-                   if (b != nullptr) {
-                       _data_block_reader = make_block_reader(b, _table->options());
-                       return _data_block_reader->seek_to_first();
-                   }
-                   return read_block(_reader, data_handle).then([this, key = std::move(handle_key)] (auto&& data) {
-                       auto b = _table->cache()->create(std::move(key), std::move(data));
-                       _data_block_reader = make_block_reader(b, _table->options());
-                       return _data_block_reader->seek_to_first();
-                   });
-               });
-           }
-           return make_ready_future<>();
-       });
-   }
-   partition current() {
-       return _data_block_reader->current();
-   }
-   bool eof() {
-       return _index_block_reader->eof() && _data_block_reader->eof();
-   }
-};
-
-lw_shared_ptr<reader> make_sstable_reader(lw_shared_ptr<sstable> table) {
-    return make_lw_shared<reader>(std::make_unique<sstable_reader>(table));
+        });
+    });
 }
 
-class combined_sstables_reader : public reader::impl {
-    std::vector<lw_shared_ptr<table>> _sstables;
-    std::vector<lw_shared_ptr<reader> _readers;
-    lw_shared_ptr<reader> _current = nullptr;
-    bool _eof = false;
-
-public:
-    combined_sstables_reader(std::vector<lw_shared_ptr<table>> sstables)
-        : _sstables(std::move(sstables))
-        , _readers(sstables.size())
-        , _current(nullptr)
-        , _eof(false)
-    {
-        for (size_t i = 0; i < sstables.size(); ++i) {
-            _readers[i] = make_sstable_reader(sstables[i]);
+// Iterates the partitions of the sstable in the order of their keys, one data block
+// is kept in memory at a time.
+class sstable_reader final : public reader::impl {
+    lw_shared_ptr<sstable> _sstable;
+    const io_priority_class& _pc;
+    bool _populate_cache;
+    size_t _block_index = 0;
+    block _block;
+    bool _eof = true;
+private:
+    future<> load_block(size_t i) {
+        _block_index = i;
+        if (i >= _sstable->block_count()) {
+            _eof = true;
+            return make_ready_future<>();
         }
+        return _sstable->read_block(i, _pc, _populate_cache).then([this] (temporary_buffer<char> data) {
+            _block = block { std::move(data) };
+            _eof = false;
+        });
     }
 
-    ~combined_sstables_reader()
-    {
-    }
-
-    future<> seek_to_first() {
-        return parallel_for_each(_sstables, [this] (auto sstable) mutable {
-            sstable->seek_to_first();
-        }).then(this] mutable {
-            return find_smallest_one();
+    // Moves to the following blocks until an entry is found.
+    future<> skip_exhausted_blocks() {
+        return do_until([this] { return _eof || _block.valid(); }, [this] {
+            return this->load_block(_block_index + 1).then([this] {
+                if (!_eof) {
+                    _block.seek_to_first();
+                }
+            });
         });
     }
+public:
+    sstable_reader(lw_shared_ptr<sstable> sst, const io_priority_class& pc, bool populate_cache)
+        : _sstable(std::move(sst))
+        , _pc(pc)
+        , _populate_cache(populate_cache)
+    {
+    }
 
-    future<> seek_to_last() {
-        return parallel_for_each(_sstables, [this] (auto sstable) mutable {
-            sstable->seek_to_last();
-        }).then(this] mutable {
-            return find_smallest_one();
+    virtual future<> seek_to_first() override {
+        return load_block(0).then([this] {
+            if (!_eof) {
+                _block.seek_to_first();
+            }
+            return this->skip_exhausted_blocks();
         });
     }
 
-    future<> seek(bytes_view key) {
-        return parallel_for_each(_sstables, [this, key] (auto sstable) mutable {
-            sstable->seek(key);
-        }).then(this] mutable {
-            return find_smallest_one();
+    virtual future<> seek_to_last() override {
+        if (_sstable->block_count() == 0) {
+            _eof = true;
+            return make_ready_future<>();
+        }
+        return load_block(_sstable->block_count() - 1).then([this] {
+            _block.seek_to_last();
+            _eof = !_block.valid();
         });
     }
 
-    future<> next() {
-        return parallel_for_each(_sstables, [this] (auto sstable) mutable {
-            if (sstable == _current) {
-                sstable->next();
+    // Positions at the first partition whose key is not less than the key.
+    virtual future<> seek(bytes_view key) override {
+        return load_block(_sstable->find_block(key)).then([this, key = bytes { key.begin(), key.end() }] {
+            if (!_eof) {
+                _block.seek(key);
             }
-        }).then([this] mutable {
-            return find_smallest_one();
+            return this->skip_exhausted_blocks();
         });
     }
 
-    bool eof() const {
+    virtual future<> next() override {
         if (_eof) {
-            return _eof;
+            return make_ready_future<>();
         }
-        bool all_eof = false;
-        for (auto& sstable : _sstables) {
-            all_eof &= sstable->eof();
-        }
-        return all_eof;
+        _block.next();
+        return skip_exhausted_blocks();
     }
 
-    partition current() const {
-        return _current->current();
+    virtual bool eof() const override {
+        return _eof;
     }
-private:
-    future<> find_smallest_one() {
-       auto less_comparator = [] (const lw_shared_ptr<table> a, const lw_shared_ptr<table> b) {
-           return a->current().key() < b->current().key();
-       };
-       lw_shared_ptr<table> smallest = _sstables[0];
-       for (size_t i = 1; i < _sstables.size(); ++i) {
-           if (less_comparator(_sstables[i], smallest)) {
-               smallest = _sstables[i];
-           }
-       }
-       _current = smallest;
-       if (_current == nullptr) {
-           _eof = true;
-       }
-       return make_ready_future<>();
+
+    virtual const bytes& key() const override {
+        assert(!_eof);
+        return _block.key();
+    }
+
+    virtual partition current() const override {
+        assert(!_eof);
+        return decode_partition(_block.key(), _block.value());
     }
 };
 
-lw_shared_ptr<reader> make_combined_sstables_reader(std::vector<lw_shared_ptr<table>> sstables) {
-    return make_lw_shared<reader>(std::make_unique<combined_sstables_reader>(std::move(stables)));
+lw_shared_ptr<reader> make_sstable_reader(lw_shared_ptr<sstable> sstable, const io_priority_class& pc, bool populate_cache) {
+    return make_lw_shared<reader>(std::make_unique<sstable_reader>(std::move(sstable), pc, populate_cache));
+}
+
+lw_shared_ptr<reader> make_combined_sstables_reader(std::vector<lw_shared_ptr<sstable>> sstables, const io_priority_class& pc) {
+    std::vector<lw_shared_ptr<reader>> readers;
+    readers.reserve(sstables.size());
+    for (auto& s : sstables) {
+        readers.push_back(make_sstable_reader(std::move(s), pc));
+    }
+    return make_combined_reader(std::move(readers));
 }
 
 }
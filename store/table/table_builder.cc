@@ -0,0 +1,166 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+//  Modified by Peng Jian.
+//
+#include "store/table_builder.hh"
+#include "store/util/coding.hh"
+#include "store/table/compression.hh"
+#include "utils/crc.hh"
+#include <assert.h>
+
+namespace store {
+
+static block_options make_block_options(uint32_t restart_interval)
+{
+    block_options opt;
+    opt._block_restart_interval = restart_interval;
+    return opt;
+}
+
+static file_output_stream_options make_stream_options(const table_builder_options& opt)
+{
+    file_output_stream_options fopt;
+    fopt.buffer_size = opt._buffer_size;
+    fopt.io_priority_class = *opt._io_priority_class;
+    return fopt;
+}
+
+table_builder::table_builder(file f, table_builder_options opt)
+    : _opt(std::move(opt))
+    , _block_opt(make_block_options(_opt._block_restart_interval))
+    , _writer(std::move(f), make_stream_options(_opt))
+    , _data_block(_block_opt)
+    // the index block is searched by the binary search, every entry is a restart point.
+    , _index_block(make_block_options(1))
+    , _metaindex_block(make_block_options(1))
+{
+    if (_opt._bloom_filter_bits_per_key > 0) {
+        _filter_block = std::make_unique<filter_block_builder>(_opt._bloom_filter_bits_per_key);
+    }
+}
+
+table_builder::~table_builder()
+{
+    assert(_closed);
+}
+
+future<> table_builder::add(bytes_view key, bytes_view value)
+{
+    assert(!_closed);
+    assert(_entries == 0 || _block_opt._comparator.compare(key, _last_key) > 0);
+    _last_key = bytes { key.begin(), key.end() };
+    _data_block.add(_last_key, bytes { value.begin(), value.end() });
+    if (_filter_block) {
+        _filter_block->add(key);
+    }
+    ++_entries;
+    if (_data_block.current_size_estimate() < _opt._block_size) {
+        return make_ready_future<>();
+    }
+    return flush();
+}
+
+future<> table_builder::flush()
+{
+    assert(!_closed);
+    if (_data_block.empty()) {
+        return make_ready_future<>();
+    }
+    return do_with(block_handle {}, [this] (auto& handle) {
+        return this->write_block(_data_block, handle, _opt._compression).then([this, &handle] {
+            // the last key of the block separates it from the following blocks.
+            bytes encoded;
+            handle.encode_to(encoded);
+            _index_block.add(_last_key, encoded);
+        });
+    });
+}
+
+future<> table_builder::write_block(block_builder& block, block_handle& handle, compression_type type)
+{
+    const bytes& contents = block.finish();
+    if (type != compression_type::none) {
+        bytes compressed;
+        if (compress_block(type, contents, compressed)) {
+            ++_compressed_blocks;
+            return do_with(std::move(compressed), [this, &block, &handle, type] (auto& compressed) {
+                return this->write_raw_block(compressed, type, handle).then([&block] {
+                    block.reset();
+                });
+            });
+        }
+        ++_uncompressed_blocks;
+    }
+    return write_raw_block(contents, compression_type::none, handle).then([&block] {
+        block.reset();
+    });
+}
+
+future<> table_builder::write_raw_block(const bytes& contents, compression_type type, block_handle& handle)
+{
+    handle.set_offset(_offset);
+    handle.set_size(contents.size());
+    utils::crc32 crc;
+    crc.process(reinterpret_cast<const uint8_t*>(contents.data()), contents.size());
+    crc.process(static_cast<uint8_t>(type));
+    bytes trailer { bytes::initialized_later(), block_trailer_size };
+    trailer[0] = static_cast<int8_t>(type);
+    encode_fixed32(reinterpret_cast<char*>(trailer.begin() + 1), crc.get());
+    _offset += contents.size() + block_trailer_size;
+    return _writer.write(contents).then([this, trailer = std::move(trailer)] {
+        return _writer.write(trailer);
+    });
+}
+
+future<> table_builder::write_filter_block()
+{
+    if (!_filter_block || _filter_block->empty()) {
+        return make_ready_future<>();
+    }
+    return do_with(_filter_block->finish(), block_handle {}, [this] (auto& contents, auto& handle) {
+        return this->write_raw_block(contents, compression_type::none, handle).then([this, &handle] {
+            bytes encoded;
+            handle.encode_to(encoded);
+            auto name = bytes { reinterpret_cast<const int8_t*>(bloom_filter_block_name), strlen(bloom_filter_block_name) };
+            _metaindex_block.add(name, encoded);
+        });
+    });
+}
+
+future<> table_builder::finish()
+{
+    return flush().then([this] {
+        return this->write_filter_block();
+    }).then([this] {
+        return do_with(footer {}, block_handle {}, block_handle {}, [this] (auto& f, auto& metaindex_handle, auto& index_handle) {
+            return this->write_block(_metaindex_block, metaindex_handle).then([this, &index_handle] {
+                return this->write_block(_index_block, index_handle);
+            }).then([this, &f, &metaindex_handle, &index_handle] {
+                f.set_metaindex_handle(metaindex_handle);
+                f.set_index_handle(index_handle);
+                bytes encoded;
+                f.encode_to(encoded);
+                _offset += encoded.size();
+                return _writer.write(encoded);
+            });
+        });
+    }).then([this] {
+        return _writer.flush();
+    }).finally([this] {
+        _closed = true;
+        return _writer.close();
+    });
+}
+
+future<> table_builder::abandon()
+{
+    if (_closed) {
+        return make_ready_future<>();
+    }
+    _closed = true;
+    return _writer.close();
+}
+
+}  // namespace store
@@ -5,86 +5,94 @@
 // table_builder provides the interface used to build a Table
 // (an immutable and sorted map from keys to values).
 //
-// Multiple threads can invoke const methods on a table_builder without
-// external synchronization, but if any of the threads may call a
-// non-const method, all threads accessing the same table_builder must use
-// external synchronization.
-
+//  Modified by Peng Jian.
+//
 #pragma once
 #include <stdint.h>
-#include "store/options.hh"
-#include "store/status.hh"
+#include "store/table/block_builder.hh"
+#include "store/table/format.hh"
+#include "store/table/filter_block.hh"
+#include "store/file_writer.hh"
 #include "core/future.hh"
 #include "core/file.hh"
+#include "core/reactor.hh"
 #include "seastarx.hh"
 
 namespace store {
 
-class block_builder;
-class block_handle;
+struct table_builder_options {
+    // the approximate size of the uncompressed data block.
+    size_t _block_size = 4096;
+    uint32_t _block_restart_interval = 16;
+    size_t _buffer_size = 128 * 1024;
+    // the codec of the data blocks, the blocks which compress poorly are stored
+    // uncompressed.
+    compression_type _compression = compression_type::none;
+    // the bits of the bloom filter per key, 0 writes no filter.
+    int _bloom_filter_bits_per_key = 10;
+    const io_priority_class* _io_priority_class = &default_priority_class();
+};
 
+// Writes the sorted partitions into the sstable file:
+//   [data block 1][trailer] ... [data block N][trailer]
+//   [filter block][trailer]
+//   [metaindex block][trailer]
+//   [index block][trailer]
+//   [footer]
+// The index block maps the last key of every data block to its handle, the
+// metaindex block maps the name of the filter to its handle.
 class table_builder {
- public:
-  // Create a builder that will store the contents of the table it is
-  // building in *file.  Does not close the file.  It is up to the
-  // caller to close the file after calling Finish().
-  table_builder(const options& options, file& file);
-
-  // REQUIRES: Either Finish() or Abandon() has been called.
-  ~table_builder();
-
-  // Change the options used by this builder.  Note: only some of the
-  // option fields can be changed after construction.  If a field is
-  // not allowed to change dynamically and its value in the structure
-  // passed to the constructor is different from its value in the
-  // structure passed to this method, this method will return an error
-  // without changing any fields.
-  status change_options(const options& options);
-
-  // Add key,value to the table being constructed.
-  // REQUIRES: key is after any previously added key according to comparator.
-  // REQUIRES: Finish(), Abandon() have not been called
-  future<> add(const bytes_view key, const bytes_view value);
-
-  // Advanced operation: flush any buffered key/value pairs to file.
-  // Can be used to ensure that two adjacent entries never live in
-  // the same data block.  Most clients should not need to use this method.
-  // REQUIRES: Finish(), Abandon() have not been called
-  void flush();
-
-  // Return non-ok iff some error has been detected.
-  status get_status() const;
-
-  // Finish building the table.  Stops using the file passed to the
-  // constructor after this function returns.
-  // REQUIRES: Finish(), Abandon() have not been called
-  future<> finish();
-
-  // Indicate that the contents of this builder should be abandoned.  Stops
-  // using the file passed to the constructor after this function returns.
-  // If the caller is not going to call Finish(), it must call Abandon()
-  // before destroying this builder.
-  // REQUIRES: Finish(), Abandon() have not been called
-  void abandon();
-
-  // Number of calls to Add() so far.
-  uint64_t num_entries() const;
-
-  // Size of the file generated so far.  If invoked after a successful
-  // Finish() call, returns the size of the final generated file.
-  uint64_t file_size() const;
-
- private:
-  bool ok() const { return status().ok(); }
-  void write_block(block_builder* block, block_handle* handle);
-  void write_raw_block(bytes_view data, compression_type, block_handle* handle);
-
-  struct rep;
-  rep* rep_;
-
-  // No copying allowed
-  table_builder(const table_builder&) = delete;
-  void operator=(const table_builder&) = delete;
+    table_builder_options _opt;
+    block_options _block_opt;
+    file_writer _writer;
+    block_builder _data_block;
+    block_builder _index_block;
+    // maps the names of the meta blocks to their handles.
+    block_builder _metaindex_block;
+    std::unique_ptr<filter_block_builder> _filter_block;
+    bytes _last_key;
+    uint64_t _offset = 0;
+    uint64_t _entries = 0;
+    uint64_t _compressed_blocks = 0;
+    uint64_t _uncompressed_blocks = 0;
+    bool _closed = false;
+public:
+    // The builder writes the file through its own output stream, and closes it
+    // when the table is finished or abandoned.
+    table_builder(file f, table_builder_options opt);
+    ~table_builder();
+
+    table_builder(const table_builder&) = delete;
+    void operator=(const table_builder&) = delete;
+
+    // Add key,value to the table being constructed.
+    // REQUIRES: key is after any previously added key.
+    future<> add(bytes_view key, bytes_view value);
+
+    // Writes the buffered data block, so that the following entries start a new one.
+    future<> flush();
+
+    // Writes the index and the footer, then flushes and closes the file.
+    future<> finish();
+
+    // Closes the file without finishing the table, the caller removes it. Does
+    // nothing if the file was closed by a failed finish().
+    future<> abandon();
+
+    // Number of calls to add() so far.
+    uint64_t num_entries() const { return _entries; }
+
+    // Size of the file generated so far.
+    uint64_t file_size() const { return _offset; }
+
+    // The data blocks which were stored compressed, and the ones which compressed
+    // poorly and were stored uncompressed.
+    uint64_t compressed_blocks() const { return _compressed_blocks; }
+    uint64_t uncompressed_blocks() const { return _uncompressed_blocks; }
+private:
+    future<> write_block(block_builder& block, block_handle& handle, compression_type type = compression_type::none);
+    future<> write_raw_block(const bytes& contents, compression_type type, block_handle& handle);
+    future<> write_filter_block();
 };
 
-}  // namespace store 
+}  // namespace store
@@ -18,13 +18,13 @@ void encode_fixed64(char* buf, uint64_t value) {
 void put_fixed32(bytes& dst, uint32_t value) {
   char buf[sizeof(value)];
   encode_fixed32(buf, value);
-  dst->append(buf, sizeof(buf));
+  dst.append(reinterpret_cast<const int8_t*>(buf), sizeof(buf));
 }
 
 void put_fixed64(bytes& dst, uint64_t value) {
   char buf[sizeof(value)];
   encode_fixed64(buf, value);
-  dst->append(buf, sizeof(buf));
+  dst.append(reinterpret_cast<const int8_t*>(buf), sizeof(buf));
 }
 
 char* encode_varint32(char* dst, uint32_t v) {
@@ -58,7 +58,7 @@ char* encode_varint32(char* dst, uint32_t v) {
 void put_varint32(bytes& dst, uint32_t v) {
   char buf[5];
   char* ptr = encode_varint32(buf, v);
-  dst->append(buf, ptr - buf);
+  dst.append(reinterpret_cast<const int8_t*>(buf), ptr - buf);
 }
 
 char* encode_varint64(char* dst, uint64_t v) {
@@ -75,12 +75,12 @@ char* encode_varint64(char* dst, uint64_t v) {
 void put_varint64(bytes& dst, uint64_t v) {
   char buf[10];
   char* ptr = encode_varint64(buf, v);
-  dst->append(buf, ptr - buf);
+  dst.append(reinterpret_cast<const int8_t*>(buf), ptr - buf);
 }
 
 void put_length_prefixed_slice(bytes& dst, const bytes_view& value) {
   put_varint32(dst, value.size());
-  dst->append(value.data(), value.size());
+  dst.append(value.data(), value.size());
 }
 
 int varint_length(uint64_t v) {
@@ -112,13 +112,13 @@ const char* get_varint32_ptr_fallback(const char* p,
 }
 
 bool get_varint32(bytes_view& input, uint32_t& value) {
-  const char* p = input.data();
+  const char* p = reinterpret_cast<const char*>(input.data());
   const char* limit = p + input.size();
   const char* q = get_varint32_ptr(p, limit, value);
   if (q == nullptr) {
     return false;
   } else {
-    input = bytes_view { q, limit - q };
+    input = bytes_view { reinterpret_cast<const int8_t*>(q), size_t(limit - q) };
     return true;
   }
 }
@@ -141,13 +141,13 @@ const char* get_varint64_ptr(const char* p, const char* limit, uint64_t& value)
 }
 
 bool get_varint64(bytes_view& input, uint64_t& value) {
-  const char* p = input.data();
+  const char* p = reinterpret_cast<const char*>(input.data());
   const char* limit = p + input.size();
   const char* q = get_varint64_ptr(p, limit, value);
   if (q == nullptr) {
     return false;
   } else {
-    input = bytes_view { q, limit - q };
+    input = bytes_view { reinterpret_cast<const int8_t*>(q), size_t(limit - q) };
     return true;
   }
 }
@@ -157,7 +157,7 @@ const char* get_length_prefixed_slice(const char* p, const char* limit, bytes_vi
   p = get_varint32_ptr(p, limit, len);
   if (p == nullptr) return nullptr;
   if (p + len > limit) return nullptr;
-  result = bytes_view {p, len };
+  result = bytes_view { reinterpret_cast<const int8_t*>(p), len };
   return p + len;
 }
 
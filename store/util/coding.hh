@@ -58,7 +58,7 @@ extern char* encode_varint64(char* dst, uint64_t value);
 // Lower-level versions of Get... that read directly from a character buffer
 // without any bounds checking.
 
-inline uint32_t eecode_fixed32(const char* ptr) {
+inline uint32_t decode_fixed32(const char* ptr) {
     // Load the raw bytes
     uint32_t result;
     memcpy(&result, ptr, sizeof(result));  // gcc optimizes this to a plain load
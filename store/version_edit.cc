@@ -1,266 +1,110 @@
 // Copyright (c) 2011 The LevelDB Authors. All rights reserved.
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
-
-#include "store/version_edit.h"
-
-#include "store/version_set.h"
-#include "store/util/coding.h"
+//
+//  Modified by Peng Jian.
+//
+#include "store/version_edit.hh"
+#include "store/util/coding.hh"
 
 namespace store {
 
 // Tag numbers for serialized version_edit.  These numbers are written to
 // disk and should not be changed.
-enum Tag {
-  kComparator           = 1,
-  kLogNumber            = 2,
-  kNextFileNumber       = 3,
-  kLastSequence         = 4,
-  kCompactPointer       = 5,
-  kDeletedFile          = 6,
-  kNewFile              = 7,
-  // 8 was used for large value refs
-  kPrevLogNumber        = 9
+enum tag : uint32_t {
+    next_generation = 1,
+    deleted_file    = 2,
+    new_file        = 3,
 };
 
-void version_edit::clear() {
-  comparator_.clear();
-  log_number_ = 0;
-  prev_log_number_ = 0;
-  last_sequence_ = 0;
-  next_file_number_ = 0;
-  has_comparator_ = false;
-  has_log_number_ = false;
-  has_prev_log_number_ = false;
-  has_next_file_number_ = false;
-  has_last_sequence_ = false;
-  deleted_files_.clear();
-  new_files_.clear();
+void version_edit::clear()
+{
+    _new_files.clear();
+    _deleted_files.clear();
+    _next_generation = 0;
+    _has_next_generation = false;
 }
 
-void version_edit::encode_to(std::string* dst) const {
-  if (has_comparator_) {
-    PutVarint32(dst, kComparator);
-    PutLengthPrefixedSlice(dst, comparator_);
-  }
-  if (has_log_number_) {
-    PutVarint32(dst, kLogNumber);
-    PutVarint64(dst, log_number_);
-  }
-  if (has_prev_log_number_) {
-    PutVarint32(dst, kPrevLogNumber);
-    PutVarint64(dst, prev_log_number_);
-  }
-  if (has_next_file_number_) {
-    PutVarint32(dst, kNextFileNumber);
-    PutVarint64(dst, next_file_number_);
-  }
-  if (has_last_sequence_) {
-    PutVarint32(dst, kLastSequence);
-    PutVarint64(dst, last_sequence_);
-  }
-
-  for (size_t i = 0; i < compact_pointers_.size(); i++) {
-    PutVarint32(dst, kCompactPointer);
-    PutVarint32(dst, compact_pointers_[i].first);  // level
-    PutLengthPrefixedSlice(dst, compact_pointers_[i].second.Encode());
-  }
-
-  for (deleted_file_set::const_iterator iter = deleted_files_.begin();
-       iter != deleted_files_.end();
-       ++iter) {
-    PutVarint32(dst, kDeletedFile);
-    PutVarint32(dst, iter->first);   // level
-    PutVarint64(dst, iter->second);  // file number
-  }
-
-  for (size_t i = 0; i < new_files_.size(); i++) {
-    const file_meta_data& f = new_files_[i].second;
-    PutVarint32(dst, kNewFile);
-    PutVarint32(dst, new_files_[i].first);  // level
-    PutVarint64(dst, f.number);
-    PutVarint64(dst, f.file_size);
-    PutLengthPrefixedSlice(dst, f.smallest.Encode());
-    PutLengthPrefixedSlice(dst, f.largest.Encode());
-  }
+static void put_bytes(bytes& dst, const bytes& value)
+{
+    put_varint32(dst, value.size());
+    dst.append(value.data(), value.size());
 }
 
-static bool get_internal_key(slice* input, internal_key* dst) {
-  slice str;
-  if (GetLengthPrefixedSlice(input, &str)) {
-    dst->decode_from(str);
+static bool get_bytes(bytes_view& input, bytes& value)
+{
+    uint32_t size = 0;
+    if (!get_varint32(input, size) || input.size() < size) {
+        return false;
+    }
+    value = bytes { input.data(), size };
+    input.remove_prefix(size);
     return true;
-  } else {
-    return false;
-  }
 }
 
-static bool GetLevel(slice* input, int* level) {
-  uint32_t v;
-  if (GetVarint32(input, &v) &&
-      v < config::kNumLevels) {
-    *level = v;
-    return true;
-  } else {
-    return false;
-  }
+void version_edit::encode_to(bytes& dst) const
+{
+    if (_has_next_generation) {
+        put_varint32(dst, tag::next_generation);
+        put_varint64(dst, _next_generation);
+    }
+    for (auto& d : _deleted_files) {
+        put_varint32(dst, tag::deleted_file);
+        put_varint32(dst, d.first);
+        put_varint64(dst, d.second);
+    }
+    for (auto& f : _new_files) {
+        put_varint32(dst, tag::new_file);
+        put_varint32(dst, f.first);
+        put_varint64(dst, f.second->_generation);
+        put_varint64(dst, f.second->_sequence);
+        put_varint64(dst, f.second->_file_size);
+        put_bytes(dst, f.second->_smallest_key);
+        put_bytes(dst, f.second->_largest_key);
+    }
 }
 
-status version_edit::decode_from(const slice& src) {
-  clear();
-  slice input = src;
-  const char* msg = NULL;
-  uint32_t tag;
-
-  // Temporary storage for parsing
-  int level;
-  uint64_t number;
-  file_meta_data f;
-  slice str;
-  internal_key key;
-
-  while (msg == NULL && GetVarint32(&input, &tag)) {
-    switch (tag) {
-      case kComparator:
-        if (GetLengthPrefixedSlice(&input, &str)) {
-          comparator_ = str.to_string();
-          has_comparator_ = true;
-        } else {
-          msg = "comparator name";
+bool version_edit::decode_from(bytes_view src)
+{
+    clear();
+    while (!src.empty()) {
+        uint32_t t = 0, level = 0;
+        if (!get_varint32(src, t)) {
+            return false;
         }
-        break;
-
-      case kLogNumber:
-        if (GetVarint64(&input, &log_number_)) {
-          has_log_number_ = true;
-        } else {
-          msg = "log number";
+        switch (t) {
+        case tag::next_generation:
+            if (!get_varint64(src, _next_generation)) {
+                return false;
+            }
+            _has_next_generation = true;
+            break;
+        case tag::deleted_file: {
+            uint64_t generation = 0;
+            if (!get_varint32(src, level) || !get_varint64(src, generation)) {
+                return false;
+            }
+            _deleted_files.emplace_back(level, generation);
+            break;
         }
-        break;
-
-      case kPrevLogNumber:
-        if (GetVarint64(&input, &prev_log_number_)) {
-          has_prev_log_number_ = true;
-        } else {
-          msg = "previous log number";
+        case tag::new_file: {
+            auto meta = make_lw_shared<sstable_meta>();
+            if (!get_varint32(src, level)
+                || !get_varint64(src, meta->_generation)
+                || !get_varint64(src, meta->_sequence)
+                || !get_varint64(src, meta->_file_size)
+                || !get_bytes(src, meta->_smallest_key)
+                || !get_bytes(src, meta->_largest_key)) {
+                return false;
+            }
+            _new_files.emplace_back(level, std::move(meta));
+            break;
         }
-        break;
-
-      case kNextFileNumber:
-        if (GetVarint64(&input, &next_file_number_)) {
-          has_next_file_number_ = true;
-        } else {
-          msg = "next file number";
+        default:
+            return false;
         }
-        break;
-
-      case kLastSequence:
-        if (GetVarint64(&input, &last_sequence_)) {
-          has_last_sequence_ = true;
-        } else {
-          msg = "last sequence number";
-        }
-        break;
-
-      case kCompactPointer:
-        if (GetLevel(&input, &level) &&
-            GetInternalKey(&input, &key)) {
-          compact_pointers_.push_back(std::make_pair(level, key));
-        } else {
-          msg = "compaction pointer";
-        }
-        break;
-
-      case kDeletedFile:
-        if (GetLevel(&input, &level) &&
-            GetVarint64(&input, &number)) {
-          deleted_files_.insert(std::make_pair(level, number));
-        } else {
-          msg = "deleted file";
-        }
-        break;
-
-      case kNewFile:
-        if (GetLevel(&input, &level) &&
-            GetVarint64(&input, &f.number) &&
-            GetVarint64(&input, &f.file_size) &&
-            GetInternalKey(&input, &f.smallest) &&
-            GetInternalKey(&input, &f.largest)) {
-          new_files_.push_back(std::make_pair(level, f));
-        } else {
-          msg = "new-file entry";
-        }
-        break;
-
-      default:
-        msg = "unknown tag";
-        break;
     }
-  }
-
-  if (msg == NULL && !input.empty()) {
-    msg = "invalid tag";
-  }
-
-  status result;
-  if (msg != NULL) {
-    result = status::corruption("version_edit", msg);
-  }
-  return result;
-}
-
-std::string version_edit::debug_string() const {
-  std::string r;
-  r.append("version_edit {");
-  if (has_comparator_) {
-    r.append("\n  Comparator: ");
-    r.append(comparator_);
-  }
-  if (has_log_number_) {
-    r.append("\n  LogNumber: ");
-    append_number_to(&r, log_number_);
-  }
-  if (has_prev_log_number_) {
-    r.append("\n  PrevLogNumber: ");
-    append_number_to(&r, prev_log_number_);
-  }
-  if (has_next_file_number_) {
-    r.append("\n  NextFile: ");
-    append_number_to(&r, next_file_number_);
-  }
-  if (has_last_sequence_) {
-    r.append("\n  LastSeq: ");
-    append_number_to(&r, last_sequence_);
-  }
-  for (size_t i = 0; i < compact_pointers_.size(); i++) {
-    r.append("\n  CompactPointer: ");
-    append_number_to(&r, compact_pointers_[i].first);
-    r.append(" ");
-    r.append(compact_pointers_[i].second.DebugString());
-  }
-  for (DeletedFileSet::const_iterator iter = deleted_files_.begin();
-       iter != deleted_files_.end();
-       ++iter) {
-    r.append("\n  DeleteFile: ");
-    append_number_to(&r, iter->first);
-    r.append(" ");
-    append_number_to(&r, iter->second);
-  }
-  for (size_t i = 0; i < new_files_.size(); i++) {
-    const file_meta_data& f = new_files_[i].second;
-    r.append("\n  AddFile: ");
-    append_number_to(&r, new_files_[i].first);
-    r.append(" ");
-    append_number_to(&r, f.number);
-    r.append(" ");
-    append_number_to(&r, f.file_size);
-    r.append(" ");
-    r.append(f.smallest.DebugString());
-    r.append(" .. ");
-    r.append(f.largest.DebugString());
-  }
-  r.append("\n}\n");
-  return r;
+    return true;
 }
 
-}  // namespace store 
+}  // namespace store
@@ -0,0 +1,312 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#include "bits_kernels.hh"
+#include <cstring>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+namespace redis {
+namespace bits_kernels {
+
+static inline uint64_t load_u64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void store_u64(uint8_t* p, uint64_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+static size_t popcount_words(const uint8_t* data, size_t size)
+{
+    size_t count = 0, i = 0;
+    for (; i + 32 <= size; i += 32) {
+        count += __builtin_popcountll(load_u64(data + i));
+        count += __builtin_popcountll(load_u64(data + i + 8));
+        count += __builtin_popcountll(load_u64(data + i + 16));
+        count += __builtin_popcountll(load_u64(data + i + 24));
+    }
+    for (; i + 8 <= size; i += 8) {
+        count += __builtin_popcountll(load_u64(data + i));
+    }
+    for (; i < size; ++i) {
+        count += __builtin_popcount(data[i]);
+    }
+    return count;
+}
+
+template <typename Op>
+static inline void bitwise_words(uint8_t* dest, const uint8_t* src, size_t size, Op&& op)
+{
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        store_u64(dest + i, op(load_u64(dest + i), load_u64(src + i)));
+    }
+    for (; i < size; ++i) {
+        dest[i] = static_cast<uint8_t>(op(dest[i], src[i]));
+    }
+}
+
+static void and_words(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    bitwise_words(dest, src, size, [] (uint64_t a, uint64_t b) { return a & b; });
+}
+
+static void or_words(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    bitwise_words(dest, src, size, [] (uint64_t a, uint64_t b) { return a | b; });
+}
+
+static void xor_words(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    bitwise_words(dest, src, size, [] (uint64_t a, uint64_t b) { return a ^ b; });
+}
+
+static void not_words(uint8_t* dest, size_t size)
+{
+    bitwise_words(dest, dest, size, [] (uint64_t a, uint64_t) { return ~a; });
+}
+
+static size_t find_words(const uint8_t* data, size_t size, uint8_t skip)
+{
+    const uint64_t pattern = skip ? ~uint64_t(0) : 0;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        if (load_u64(data + i) != pattern) {
+            break;
+        }
+    }
+    for (; i < size; ++i) {
+        if (data[i] != skip) {
+            return i;
+        }
+    }
+    return size;
+}
+
+#if defined(__x86_64__)
+// The nibbles are counted by a lookup table (VPSHUFB), the 8 bits counters are summed up by VPSADBW.
+__attribute__((target("avx2")))
+static inline __m256i popcount256(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    auto lo = _mm256_and_si256(v, low_mask);
+    auto hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    auto count = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(count, _mm256_setzero_si256());
+}
+
+// carry save adder.
+__attribute__((target("avx2")))
+static inline void csa(__m256i& h, __m256i& l, __m256i a, __m256i b, __m256i c)
+{
+    auto u = _mm256_xor_si256(a, b);
+    h = _mm256_or_si256(_mm256_and_si256(a, b), _mm256_and_si256(u, c));
+    l = _mm256_xor_si256(u, c);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i load256(const uint8_t* p)
+{
+    return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+}
+
+// Harley-Seal: 16 vectors are reduced by the carry save adders, so only one of them
+// needs the full population count.
+__attribute__((target("avx2")))
+static size_t popcount_avx2(const uint8_t* data, size_t size)
+{
+    __m256i total = _mm256_setzero_si256();
+    __m256i ones = _mm256_setzero_si256(), twos = _mm256_setzero_si256();
+    __m256i fours = _mm256_setzero_si256(), eights = _mm256_setzero_si256();
+    __m256i sixteens, twos_a, twos_b, fours_a, fours_b, eights_a, eights_b;
+    size_t i = 0;
+    for (; i + 16 * 32 <= size; i += 16 * 32) {
+        const uint8_t* p = data + i;
+        csa(twos_a, ones, ones, load256(p + 0 * 32), load256(p + 1 * 32));
+        csa(twos_b, ones, ones, load256(p + 2 * 32), load256(p + 3 * 32));
+        csa(fours_a, twos, twos, twos_a, twos_b);
+        csa(twos_a, ones, ones, load256(p + 4 * 32), load256(p + 5 * 32));
+        csa(twos_b, ones, ones, load256(p + 6 * 32), load256(p + 7 * 32));
+        csa(fours_b, twos, twos, twos_a, twos_b);
+        csa(eights_a, fours, fours, fours_a, fours_b);
+        csa(twos_a, ones, ones, load256(p + 8 * 32), load256(p + 9 * 32));
+        csa(twos_b, ones, ones, load256(p + 10 * 32), load256(p + 11 * 32));
+        csa(fours_a, twos, twos, twos_a, twos_b);
+        csa(twos_a, ones, ones, load256(p + 12 * 32), load256(p + 13 * 32));
+        csa(twos_b, ones, ones, load256(p + 14 * 32), load256(p + 15 * 32));
+        csa(fours_b, twos, twos, twos_a, twos_b);
+        csa(eights_b, fours, fours, fours_a, fours_b);
+        csa(sixteens, eights, eights, eights_a, eights_b);
+        total = _mm256_add_epi64(total, popcount256(sixteens));
+    }
+    total = _mm256_slli_epi64(total, 4);
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(eights), 3));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(fours), 2));
+    total = _mm256_add_epi64(total, _mm256_slli_epi64(popcount256(twos), 1));
+    total = _mm256_add_epi64(total, popcount256(ones));
+    for (; i + 32 <= size; i += 32) {
+        total = _mm256_add_epi64(total, popcount256(load256(data + i)));
+    }
+    uint64_t lanes[4];
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), total);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + popcount_words(data + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void and_avx2(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_and_si256(load256(dest + i), load256(src + i)));
+    }
+    and_words(dest + i, src + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void or_avx2(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_or_si256(load256(dest + i), load256(src + i)));
+    }
+    or_words(dest + i, src + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void xor_avx2(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_xor_si256(load256(dest + i), load256(src + i)));
+    }
+    xor_words(dest + i, src + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static void not_avx2(uint8_t* dest, size_t size)
+{
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_xor_si256(load256(dest + i), ones));
+    }
+    not_words(dest + i, size - i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_avx2(const uint8_t* data, size_t size, uint8_t skip)
+{
+    const __m256i pattern = _mm256_set1_epi8(static_cast<char>(skip));
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32) {
+        auto equal = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(load256(data + i), pattern)));
+        if (equal != 0xffffffff) {
+            return i + __builtin_ctz(~equal);
+        }
+    }
+    return i + find_words(data + i, size - i, skip);
+}
+#endif
+
+struct kernel_set {
+    const char* name;
+    size_t (*popcount)(const uint8_t*, size_t);
+    void (*bitwise_and)(uint8_t*, const uint8_t*, size_t);
+    void (*bitwise_or)(uint8_t*, const uint8_t*, size_t);
+    void (*bitwise_xor)(uint8_t*, const uint8_t*, size_t);
+    void (*bitwise_not)(uint8_t*, size_t);
+    size_t (*find_first_not_of)(const uint8_t*, size_t, uint8_t);
+};
+
+// Returns the implementations supported by the CPU, the fastest one first.
+static std::vector<kernel_set> supported_kernels()
+{
+    std::vector<kernel_set> result;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        result.push_back(kernel_set { "avx2", popcount_avx2, and_avx2, or_avx2, xor_avx2, not_avx2, find_avx2 });
+    }
+#endif
+    result.push_back(kernel_set { "words", popcount_words, and_words, or_words, xor_words, not_words, find_words });
+    return result;
+}
+
+static kernel_set& kernels()
+{
+    static kernel_set _kernels = supported_kernels().front();
+    return _kernels;
+}
+
+bool select(const char* name)
+{
+    for (auto& k : supported_kernels()) {
+        if (strcmp(k.name, name) == 0) {
+            kernels() = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t popcount(const uint8_t* data, size_t size)
+{
+    return kernels().popcount(data, size);
+}
+
+void bitwise_and(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    kernels().bitwise_and(dest, src, size);
+}
+
+void bitwise_or(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    kernels().bitwise_or(dest, src, size);
+}
+
+void bitwise_xor(uint8_t* dest, const uint8_t* src, size_t size)
+{
+    kernels().bitwise_xor(dest, src, size);
+}
+
+void bitwise_not(uint8_t* dest, size_t size)
+{
+    kernels().bitwise_not(dest, size);
+}
+
+size_t find_first_not_of(const uint8_t* data, size_t size, uint8_t skip)
+{
+    return kernels().find_first_not_of(data, size, skip);
+}
+
+const char* implementation()
+{
+    return kernels().name;
+}
+}
+}
@@ -0,0 +1,48 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+namespace redis {
+// The kernels on the bitmaps. Like the hll_kernels, the AVX2 implementation is
+// selected at runtime, the fallback works on 64 bits words (POPCNT is a part of
+// -march=nehalem).
+namespace bits_kernels {
+// Returns the number of the set bits.
+size_t popcount(const uint8_t* data, size_t size);
+
+void bitwise_and(uint8_t* dest, const uint8_t* src, size_t size);
+void bitwise_or(uint8_t* dest, const uint8_t* src, size_t size);
+void bitwise_xor(uint8_t* dest, const uint8_t* src, size_t size);
+void bitwise_not(uint8_t* dest, size_t size);
+
+// Returns the index of the first byte which is not equal to skip, or size if
+// all bytes are equal to skip.
+size_t find_first_not_of(const uint8_t* data, size_t size, uint8_t skip);
+
+const char* implementation();
+
+// Switches to the implementation by its name ("avx2" or "words"), so the tests
+// compare the AVX2 kernels with the fallback. Returns false if the CPU does not
+// support it.
+bool select(const char* name);
+}
+}
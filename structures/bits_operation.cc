@@ -19,6 +19,8 @@
 *
 */
 #include "bits_operation.hh"
+#include "bits_kernels.hh"
+#include <cstring>
 #include "core/stream.hh"
 #include "core/memory.hh"
 #include "core/sstring.hh"
@@ -27,18 +29,15 @@
 namespace redis {
 // 512M bytes
 static const size_t MAX_BYTE_COUNT = 1024 * 1024 * 512 - 1;
-static const size_t RESIZE_STEP    = 16;
 
 bool bits_operation::set(managed_bytes& o, size_t offset, bool value)
 {
     auto index = offset >> 3;
+    // the commands reject the offsets beyond 2^32 bits, like redis.
+    assert(index <= MAX_BYTE_COUNT);
     if (index >= o.size()) {
-        size_t append_size = RESIZE_STEP;
-        while (append_size < index) append_size+= RESIZE_STEP;
-        if (append_size < 64) {
-            append_size = 64;
-        }
-        //o.extend(append_size, 0);
+        // the value grows to the byte of the offset, the new bytes are zeros.
+        o.write(index, bytes_view { "\0", 1 });
     }
     uint8_t byte_val = uint8_t(o[index]);
     auto bit = 7 - (offset & 0x7);
@@ -62,72 +61,86 @@ bool bits_operation::get(const managed_bytes& o, size_t offset)
     return bit_val > 0;
 }
 
-size_t bits_operation::count(const managed_bytes& o, long start, long end)
+bool bits_operation::normalize_range(long& start, long& end, size_t size)
 {
-    if (start < 0) start = static_cast<size_t>(start) + o.size();
-    if (end < 0) end = static_cast<size_t>(end) + o.size();
+    long strlen = static_cast<long>(size);
+    if (start < 0) start = strlen + start;
+    if (end < 0) end = strlen + end;
     if (start < 0) start = 0;
     if (end < 0) end = 0;
-    if (end >= static_cast<long>(o.size())) end = static_cast<long>(o.size()) - 1;
-    size_t bits_count = 0, count = static_cast<size_t>(end - start) + 1;
-    size_t p = start /*, p4 = 0 */;
-    static const unsigned char bits_in_byte[256] = {
-        0,1,1,2,1,2,2,3,1,2,2,3,2,3,3,4,1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,
-        1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-        1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-        2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-        1,2,2,3,2,3,3,4,2,3,3,4,3,4,4,5,2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,
-        2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-        2,3,3,4,3,4,4,5,3,4,4,5,4,5,5,6,3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,
-        3,4,4,5,4,5,5,6,4,5,5,6,5,6,6,7,4,5,5,6,5,6,6,7,5,6,6,7,6,7,7,8
-    };
+    if (end >= strlen) end = strlen - 1;
+    return start <= end;
+}
 
-    while((unsigned long)(uint8_t(o[p])) & 3 && count) {
-        uint8_t v = uint8_t(o[p++]);
-        bits_count += static_cast<size_t>(bits_in_byte[static_cast<unsigned int>(v)]);
-        count--;
+size_t bits_operation::count(const managed_bytes& o, long start, long end)
+{
+    if (!normalize_range(start, end, o.size())) {
+        return 0;
     }
-/*
-    p4 = p;
-    uint32_t d1 = 0, d2 = 0, d3 = 0, d4 = 0, d5 = 0, d6 = 0, d7 = 0;
-    while(count>=28) {
-        d1 = uint8_t(o[p4++]);
-        d2 = uint8_t(o[p4++]);
-        d3 = uint8_t(o[p4++]);
-        d4 = uint8_t(o[p4++]);
-        d5 = uint8_t(o[p4++]);
-        d6 = uint8_t(o[p4++]);
-        d7 = uint8_t(o[p4++]);
-        count -= 28;
+    return count_range(o, static_cast<size_t>(start), static_cast<size_t>(end - start) + 1);
+}
 
-        d1 = d1 - ((d1 >> 1) & 0x55555555);
-        d1 = (d1 & 0x33333333) + ((d1 >> 2) & 0x33333333);
-        d2 = d2 - ((d2 >> 1) & 0x55555555);
-        d2 = (d2 & 0x33333333) + ((d2 >> 2) & 0x33333333);
-        d3 = d3 - ((d3 >> 1) & 0x55555555);
-        d3 = (d3 & 0x33333333) + ((d3 >> 2) & 0x33333333);
-        d4 = d4 - ((d4 >> 1) & 0x55555555);
-        d4 = (d4 & 0x33333333) + ((d4 >> 2) & 0x33333333);
-        d5 = d5 - ((d5 >> 1) & 0x55555555);
-        d5 = (d5 & 0x33333333) + ((d5 >> 2) & 0x33333333);
-        d6 = d6 - ((d6 >> 1) & 0x55555555);
-        d6 = (d6 & 0x33333333) + ((d6 >> 2) & 0x33333333);
-        d7 = d7 - ((d7 >> 1) & 0x55555555);
-        d7 = (d7 & 0x33333333) + ((d7 >> 2) & 0x33333333);
-        bits_count += ((((d1 + (d1 >> 4)) & 0x0F0F0F0F) +
-                    ((d2 + (d2 >> 4)) & 0x0F0F0F0F) +
-                    ((d3 + (d3 >> 4)) & 0x0F0F0F0F) +
-                    ((d4 + (d4 >> 4)) & 0x0F0F0F0F) +
-                    ((d5 + (d5 >> 4)) & 0x0F0F0F0F) +
-                    ((d6 + (d6 >> 4)) & 0x0F0F0F0F) +
-                    ((d7 + (d7 >> 4)) & 0x0F0F0F0F))* 0x01010101) >> 24;
+size_t bits_operation::count_range(const managed_bytes& o, size_t offset, size_t length)
+{
+    size_t bits_count = 0;
+    o.for_each_fragment(offset, length, [&bits_count] (const bytes_view::value_type* data, size_t size) {
+        bits_count += bits_kernels::popcount(reinterpret_cast<const uint8_t*>(data), size);
+        return true;
+    });
+    return bits_count;
+}
+
+long bits_operation::find_byte(const managed_bytes& o, bool bit, size_t offset, size_t length)
+{
+    // looking for 1 skips the 0x00 bytes, looking for 0 skips the 0xff bytes.
+    const uint8_t skip = bit ? 0x00 : 0xff;
+    long result = -1;
+    size_t position = offset;
+    o.for_each_fragment(offset, length, [&result, &position, skip] (const bytes_view::value_type* data, size_t size) {
+        auto index = bits_kernels::find_first_not_of(reinterpret_cast<const uint8_t*>(data), size, skip);
+        if (index < size) {
+            result = static_cast<long>(position + index);
+            return false;
+        }
+        position += size;
+        return true;
+    });
+    return result;
+}
+
+int bits_operation::first_bit_in_byte(uint8_t byte, bool bit)
+{
+    if (!bit) {
+        byte = ~byte;
     }
-    p = p4;
-*/
-    while(count--) {
-        uint8_t v = uint8_t(o[p++]);
-        bits_count += static_cast<size_t>(bits_in_byte[static_cast<unsigned int>(v)]);
+    return byte ? __builtin_clz(static_cast<unsigned int>(byte)) - 24 : -1;
+}
+
+void bits_operation::copy_range(const managed_bytes& o, size_t offset, size_t length, uint8_t* out)
+{
+    o.for_each_fragment(offset, length, [&out] (const bytes_view::value_type* data, size_t size) {
+        memcpy(out, data, size);
+        out += size;
+        return true;
+    });
+}
+
+void bits_operation::write_range(managed_bytes& o, size_t offset, const uint8_t* in, size_t length)
+{
+    o.for_each_fragment(offset, length, [&in] (bytes_view::value_type* data, size_t size) {
+        memcpy(data, in, size);
+        in += size;
+        return true;
+    });
+}
+
+void bits_operation::apply(bitop_type op, uint8_t* dest, const uint8_t* src, size_t length)
+{
+    switch (op) {
+        case bitop_type::AND: bits_kernels::bitwise_and(dest, src, length); break;
+        case bitop_type::OR: bits_kernels::bitwise_or(dest, src, length); break;
+        case bitop_type::XOR: bits_kernels::bitwise_xor(dest, src, length); break;
+        case bitop_type::NOT: bits_kernels::bitwise_not(dest, length); break;
     }
-    return bits_count;
 }
 }
@@ -22,10 +22,40 @@
 #include "utils/managed_bytes.hh"
 namespace redis {
 static constexpr const size_t BITMAP_MAX_OFFSET  = (1 << 31);
+// The long running bitmap commands (BITCOUNT, BITPOS, BITOP) process a chunk
+// of this size between two preemption points.
+static constexpr const size_t BITMAP_CHUNK_BYTES = 1 << 20;
+enum class bitop_type {
+    AND,
+    OR,
+    XOR,
+    NOT,
+};
+// The ranges are visited fragment by fragment, so the large bitmaps are never linearized.
 struct bits_operation
 {
     static bool set(managed_bytes& o, size_t offset, bool value);
     static bool get(const managed_bytes& o, size_t offset);
     static size_t count(const managed_bytes& o, long start, long end);
+
+    // Normalizes the range [start, end] of redis (the negative index counts from
+    // the end), returns false if the range is empty.
+    static bool normalize_range(long& start, long& end, size_t size);
+
+    // Counts the set bits in the bytes [offset, offset + length).
+    static size_t count_range(const managed_bytes& o, size_t offset, size_t length);
+
+    // Returns the index of the first byte in [offset, offset + length) which has
+    // a bit equals to the bit, or -1 if not found.
+    static long find_byte(const managed_bytes& o, bool bit, size_t offset, size_t length);
+
+    // Returns the position (from the most significant bit) of the first bit equals to bit.
+    static int first_bit_in_byte(uint8_t byte, bool bit);
+
+    static void copy_range(const managed_bytes& o, size_t offset, size_t length, uint8_t* out);
+    static void write_range(managed_bytes& o, size_t offset, const uint8_t* in, size_t length);
+
+    // dest = dest op src, src is ignored by the NOT.
+    static void apply(bitop_type op, uint8_t* dest, const uint8_t* src, size_t length);
 };
 }
@@ -19,4 +19,81 @@
 *
 */
 #include "dict_lsa.hh"
-namespace redis {}
+namespace redis {
+
+member_slot::member_slot(dict_entry* e) noexcept
+    : _entry(e)
+{
+    _entry->_slot = this;
+}
+
+member_slot::member_slot(member_slot&& o) noexcept
+    : _entry(o._entry)
+{
+    if (_entry) {
+        _entry->_slot = this;
+    }
+    o._entry = nullptr;
+}
+
+member_slot& member_slot::operator = (member_slot&& o) noexcept
+{
+    if (this != &o) {
+        _entry = o._entry;
+        if (_entry) {
+            _entry->_slot = this;
+        }
+        o._entry = nullptr;
+    }
+    return *this;
+}
+
+dict_entry::dict_entry(dict_entry&& o) noexcept
+    : _link()
+    , _slot(o._slot)
+    , _key(std::move(o._key))
+    , _key_hash(std::move(o._key_hash))
+    , _type(std::move(o._type))
+{
+    dict_lsa::dict_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
+    dict_lsa::dict_type::node_algorithms::init(o._link.this_ptr());
+    if (_slot) {
+        _slot->_entry = this;
+    }
+    o._slot = nullptr;
+    switch (_type) {
+        case entry_type::BYTES:
+             new (&_u._data) managed_bytes(std::move(o._u._data));
+             break;
+        case entry_type::FLOAT:
+             _u._float = o._u._float;
+             break;
+        case entry_type::INTEGER:
+             _u._integer = o._u._integer;
+             break;
+    }
+}
+
+void dict_lsa::append_slot(dict_entry* e)
+{
+    if (_slots.empty() || _slots.back().size() == SLOT_CHUNK_SIZE) {
+        _slots.emplace_back();
+    }
+    _slots.back().emplace_back(e);
+}
+
+// The slot of the last entry is moved to the removed one.
+void dict_lsa::remove_slot(dict_entry* e) noexcept
+{
+    auto& chunk = _slots.back();
+    auto& last = chunk.back();
+    if (&last != e->_slot) {
+        *(e->_slot) = std::move(last);
+    }
+    chunk.pop_back();
+    if (chunk.empty()) {
+        _slots.pop_back();
+    }
+    e->_slot = nullptr;
+}
+}
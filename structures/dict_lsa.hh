@@ -23,6 +23,8 @@
 #include "utils/allocation_strategy.hh"
 #include "utils/managed_ref.hh"
 #include "utils/managed_bytes.hh"
+#include "structures/scan.hh"
+#include "utils/managed_vector.hh"
 #include "utils/bytes.hh"
 #include "utils/allocation_strategy.hh"
 #include "utils/logalloc.hh"
@@ -32,11 +34,24 @@ namespace stdx = std::experimental;
 namespace redis {
 
 class dict_lsa;
+struct dict_entry;
+// The slot of an entry in the dense array of the dict, which makes the random
+// selection O(1). The slot and the entry refer to each other, so both of them
+// can be moved by the LSA.
+struct member_slot
+{
+    dict_entry* _entry;
+    explicit member_slot(dict_entry* e) noexcept;
+    member_slot(member_slot&& o) noexcept;
+    member_slot& operator = (member_slot&& o) noexcept;
+};
+
 struct dict_entry
 {
     friend class dict_lsa;
     using hook_type = boost::intrusive::set_member_hook<>;
     hook_type _link;
+    member_slot* _slot = nullptr;
     managed_bytes _key;
     size_t _key_hash;
     union storage {
@@ -56,24 +71,25 @@ struct dict_entry
 
     dict_entry(const sstring& key, const sstring& val) noexcept
         : _link()
-        , _key(std::move(*(current_allocator().construct<managed_bytes>(bytes_view {key.data(), key.size()}))))
+        , _key(bytes_view {key.data(), key.size()})
         , _key_hash(std::hash<managed_bytes>()(_key))
         , _type(entry_type::BYTES)
     {
-        _u._data = std::move(*(current_allocator().construct<managed_bytes>(bytes_view {val.data(), val.size()})));
+        new (&_u._data) managed_bytes(bytes_view {val.data(), val.size()});
     }
 
     dict_entry(const sstring& key) noexcept
         : _link()
-        , _key(std::move(*(current_allocator().construct<managed_bytes>(bytes_view {key.data(), key.size()}))))
+        , _key(bytes_view {key.data(), key.size()})
         , _key_hash(std::hash<managed_bytes>()(_key))
         , _type(entry_type::BYTES)
     {
+        new (&_u._data) managed_bytes();
     }
 
     dict_entry(const sstring& key, double data) noexcept
         : _link()
-        , _key(std::move(*(current_allocator().construct<managed_bytes>(bytes_view {key.data(), key.size()}))))
+        , _key(bytes_view {key.data(), key.size()})
         , _key_hash(std::hash<managed_bytes>()(_key))
         , _type(entry_type::FLOAT)
     {
@@ -82,29 +98,19 @@ struct dict_entry
 
     dict_entry(const sstring& key, int64_t data) noexcept
         : _link()
-        , _key(std::move(*(current_allocator().construct<managed_bytes>(bytes_view {key.data(), key.size()}))))
+        , _key(bytes_view {key.data(), key.size()})
         , _key_hash(std::hash<managed_bytes>()(_key))
         , _type(entry_type::INTEGER)
     {
         _u._integer = data;
     }
 
-    dict_entry(dict_entry&& o) noexcept
-        : _link(std::move(o._link))
-        , _key(std::move(o._key))
-        , _key_hash(std::move(o._key_hash))
-        , _type(std::move(o._type))
+    dict_entry(dict_entry&& o) noexcept;
+
+    ~dict_entry()
     {
-        switch (_type) {
-            case entry_type::BYTES:
-                 _u._data = std::move(o._u._data);
-                 break;
-            case entry_type::FLOAT:
-                 _u._float = o._u._float;
-                 break;
-            case entry_type::INTEGER:
-                 _u._integer = o._u._integer;
-                 break;
+        if (_type == entry_type::BYTES) {
+            _u._data.~managed_bytes();
         }
     }
 
@@ -118,14 +124,30 @@ struct dict_entry
             }
             return r < 0;
         }
+        // the entries are ordered by the hash first, see structures/scan.hh.
         inline bool operator () (const dict_entry& l, const dict_entry& r) const noexcept {
+            if (l._key_hash != r._key_hash) {
+                return l._key_hash < r._key_hash;
+            }
             return compare_impl(l.key_data(), l.key_size(), r.key_data(), r.key_size());
         }
-        inline bool operator () (const sstring& k, const dict_entry& e) const noexcept {
-            return compare_impl(k.data(), k.size(), e.key_data(), e.key_size());
+        inline bool operator () (const hashed_key& k, const dict_entry& e) const noexcept {
+            if (k.hash != e._key_hash) {
+                return k.hash < e._key_hash;
+            }
+            return compare_impl(k.key.data(), k.key.size(), e.key_data(), e.key_size());
+        }
+        inline bool operator () (const dict_entry& e, const hashed_key& k) const noexcept {
+            if (e._key_hash != k.hash) {
+                return e._key_hash < k.hash;
+            }
+            return compare_impl(e.key_data(), e.key_size(), k.key.data(), k.key.size());
+        }
+        inline bool operator () (const hash_position& p, const dict_entry& e) const noexcept {
+            return p.hash < e._key_hash;
         }
-        inline bool operator () (const dict_entry& e, const sstring& k) const noexcept {
-            return compare_impl(e.key_data(), e.key_size(), k.data(), k.size());
+        inline bool operator () (const dict_entry& e, const hash_position& p) const noexcept {
+            return e._key_hash < p.hash;
         }
     };
 
@@ -183,18 +205,26 @@ struct dict_entry
 class database;
 class dict_lsa final {
     friend class database;
+    friend struct dict_entry;
     using dict_type = boost::intrusive::set<dict_entry,
         boost::intrusive::member_hook<dict_entry, dict_entry::hook_type, &dict_entry::_link>,
         boost::intrusive::compare<dict_entry::compare>>;
     using iterator = typename dict_type::iterator;
     using const_iterator = typename dict_type::const_iterator;
+    // the dense array of the slots is split to the chunks, so it never needs a large
+    // contiguous allocation, and the growth only moves the slots of the last chunk.
+    static constexpr const size_t SLOT_CHUNK_SIZE = 1024;
+    using slot_chunk = managed_vector<member_slot>;
     dict_type _dict;
+    managed_vector<slot_chunk> _slots;
+    void append_slot(dict_entry* e);
+    void remove_slot(dict_entry* e) noexcept;
 public:
     dict_lsa () noexcept : _dict()
     {
     }
 
-    dict_lsa (dict_lsa&& o) noexcept : _dict(std::move(o._dict))
+    dict_lsa (dict_lsa&& o) noexcept : _dict(std::move(o._dict)), _slots(std::move(o._slots))
     {
     }
 
@@ -205,6 +235,7 @@ public:
 
     void flush_all()
     {
+        _slots.clear();
         _dict.erase_and_dispose(_dict.begin(), _dict.end(), current_deleter<dict_entry>());
     }
 
@@ -212,12 +243,20 @@ public:
     {
         assert(e != nullptr);
         auto r = _dict.insert(*e);
+        if (r.second) {
+            try {
+                append_slot(e);
+            } catch (...) {
+                _dict.erase(r.first);
+                throw;
+            }
+        }
         return r.second;
     }
 
     template <typename Func>
     inline std::result_of_t<Func(const dict_entry* e)> with_entry_run(const sstring& k, Func&& func) const {
-        auto it = _dict.find(k, dict_entry::compare());
+        auto it = _dict.find(hashed_key(k), dict_entry::compare());
         if (it != _dict.end()) {
             const auto& e = *it;
             return func(&e);
@@ -229,7 +268,7 @@ public:
 
     template <typename Func>
     inline std::result_of_t<Func(dict_entry* e)> with_entry_run(const sstring& k, Func&& func) {
-        auto it = _dict.find(k, dict_entry::compare());
+        auto it = _dict.find(hashed_key(k), dict_entry::compare());
         if (it != _dict.end()) {
             auto& e = *it;
             return func(&e);
@@ -242,6 +281,7 @@ public:
     inline bool erase(const_iterator i)
     {
         if (i != _dict.cend()) {
+            remove_slot(const_cast<dict_entry*>(&*i));
             _dict.erase_and_dispose(i, current_deleter<dict_entry>());
             return true;
         }
@@ -250,14 +290,20 @@ public:
 
     inline bool erase(const sstring& key)
     {
-        auto it = _dict.find(key, dict_entry::compare());
+        auto it = _dict.find(hashed_key(key), dict_entry::compare());
         if (it != _dict.end()) {
+            remove_slot(&*it);
             _dict.erase_and_dispose(it, current_deleter<dict_entry>());
             return true;
         }
         return false;
     }
 
+    inline bool erase(const dict_entry* e)
+    {
+        return erase(_dict.iterator_to(*e));
+    }
+
     inline bool empty() const {
         return _dict.empty();
     }
@@ -272,7 +318,7 @@ public:
 
     inline bool exists(const sstring& key) const
     {
-        return _dict.find(key, dict_entry::compare()) != _dict.end();
+        return _dict.find(hashed_key(key), dict_entry::compare()) != _dict.end();
     }
 
     inline const dict_entry* begin() const
@@ -284,20 +330,43 @@ public:
         return nullptr;
     }
 
-    inline const_iterator at(size_t index) const
+    // Returns the entry at the index of the dense array in O(1), the order of the
+    // array is arbitrary, it is used to select the random entries.
+    inline const dict_entry* slot_at(size_t index) const
+    {
+        assert(index < size());
+        return _slots[index / SLOT_CHUNK_SIZE][index % SLOT_CHUNK_SIZE]._entry;
+    }
+
+    // Visits up to count entries from the cursor in the order of the hashes, but never
+    // stops between the entries with the same hash. Returns the cursor of the next call,
+    // or 0 if all entries are visited.
+    template <typename Func>
+    size_t scan(size_t cursor, size_t count, Func&& func) const
     {
-        assert(index >= 0 && index < size());
-        for (auto i = _dict.cbegin(); i != _dict.cend(); ++i, index--) {
-            if (index == 0) {
-                return i;
+        assert(count > 0);
+        auto it = _dict.lower_bound(hash_position { cursor }, dict_entry::compare());
+        for (size_t visited = 0; it != _dict.end(); ++it, ++visited) {
+            if (visited >= count && it->_key_hash != std::prev(it)->_key_hash) {
+                return it->_key_hash;
             }
+            func(*it);
+        }
+        return 0;
+    }
+
+    // Visits the entries whose hashes are in [first, last], in the order of the hashes.
+    template <typename Func>
+    void scan_range(size_t first, size_t last, Func&& func) const
+    {
+        for (auto it = _dict.lower_bound(hash_position { first }, dict_entry::compare()); it != _dict.end() && it->_key_hash <= last; ++it) {
+            func(*it);
         }
-        return _dict.cend();
     }
 
     void fetch(const std::vector<sstring>& keys, std::vector<const dict_entry*>& entries) const {
         for (const auto& key : keys) {
-            auto it = _dict.find(key, dict_entry::compare());
+            auto it = _dict.find(hashed_key(key), dict_entry::compare());
             if (it != _dict.end()) {
                 const auto& e = *it;
                 entries.push_back(&e);
@@ -19,6 +19,9 @@
 *
 */
 #include "geo.hh"
+#include "geo_kernels.hh"
+#include <algorithm>
+#include <cmath>
 #include "util/log.hh"
 using logger =  seastar::logger;
 static logger geo_log ("db");
@@ -442,31 +445,66 @@ static void geohash_neighbors(const geo_hash& hash, geo_hash_neighbors& neighbor
     geohash_move_y(neighbors._south_west, -1);
 }
 
-static int fetch_points_in_box(geo_hash& h, double longitude, double latitude, double radius, geo::fetch_point& f, geo::points_type& points)
+// The bounding box of the rectangle, the longitude delta is computed at the latitude
+// which is the farther from the equator, as redis does.
+static void geohash_bounding_box_of_rectangle(double longitude, double latitude, double width, double height, double* bounds)
 {
-    uint64_t min = 0, max = 0;
-    auto align_hash = [] (const geo_hash& h) -> uint64_t {
-        uint64_t hash = h._hash;
-        hash <<= (52 - h._step * 2);
-        return hash;
-    };
-    min = align_hash(h);
-    h._hash++;
-    max = align_hash(h);
-    return f(min, max, longitude, latitude, radius, points);
+    double latitude_delta = rad_deg(height / 2 / EARTH_RADIUS_IN_METERS);
+    double longitude_delta_top = rad_deg(width / 2 / EARTH_RADIUS_IN_METERS / std::cos(deg_rad(latitude + latitude_delta)));
+    double longitude_delta_bottom = rad_deg(width / 2 / EARTH_RADIUS_IN_METERS / std::cos(deg_rad(latitude - latitude_delta)));
+    double longitude_delta = latitude < 0 ? longitude_delta_bottom : longitude_delta_top;
+    bounds[0] = longitude - longitude_delta;
+    bounds[1] = latitude - latitude_delta;
+    bounds[2] = longitude + longitude_delta;
+    bounds[3] = latitude + latitude_delta;
 }
 
-bool geo::fetch_points_from_location(double longitude, double latitude, double radius, fetch_point&& f, points_type& points)
+static void geohash_shape_bounding_box(const geo_shape& shape, double* bounds)
 {
-    geo_radius output;
+    if (shape._box) {
+        geohash_bounding_box_of_rectangle(shape._longitude, shape._latitude, shape._width, shape._height, bounds);
+    }
+    else {
+        geohash_bounding_box(shape._longitude, shape._latitude, shape._radius, bounds);
+    }
+}
 
-    double bounds[4];
-    if (geohash_bounding_box(longitude, latitude, radius, bounds) == false) {
-        return false;
+// A lower bound of the distances from the point to the points in the area: the distance
+// to the nearer parallel of the area, and the distance to the great circle of the nearer
+// meridian of the area.
+static double distance_lower_bound(double longitude, double latitude, const geo_hash_area& area)
+{
+    double bound = 0;
+    if (latitude < area._latitude_range._min) {
+        bound = EARTH_RADIUS_IN_METERS * deg_rad(area._latitude_range._min - latitude);
+    }
+    else if (latitude > area._latitude_range._max) {
+        bound = EARTH_RADIUS_IN_METERS * deg_rad(latitude - area._latitude_range._max);
+    }
+    double longitude_delta = 0;
+    if (longitude < area._longitude_range._min) {
+        longitude_delta = area._longitude_range._min - longitude;
     }
+    else if (longitude > area._longitude_range._max) {
+        longitude_delta = longitude - area._longitude_range._max;
+    }
+    if (longitude_delta > 0 && longitude_delta < 90) {
+        auto meridian = EARTH_RADIUS_IN_METERS * std::asin(std::sin(deg_rad(longitude_delta)) * std::cos(deg_rad(latitude)));
+        bound = std::max(bound, meridian);
+    }
+    return bound;
+}
+
+bool geo::search_ranges(const geo_shape& shape, std::vector<geo_search_range>& ranges)
+{
+    geo_radius output;
+    double longitude = shape._longitude, latitude = shape._latitude;
+    double bounds[4];
+    geohash_shape_bounding_box(shape, bounds);
     double min_lon = bounds[0], max_lon = bounds[2], min_lat = bounds[1], max_lat = bounds[3];
 
     // 1. step
+    double radius = shape._box ? std::sqrt((shape._width / 2) * (shape._width / 2) + (shape._height / 2) * (shape._height / 2)) : shape._radius;
     output._hash._step = geohash_estimate_steps_by_radius(radius, latitude);
 
     // 2. hash
@@ -478,7 +516,6 @@ bool geo::fetch_points_from_location(double longitude, double latitude, double r
     // 3. neighbors
     geohash_neighbors(output._hash, output._neighbors);
 
-
     // 4. area
     if (geohash_decode_internal(longitude_range, latitude_range, output._hash, output._area) == false) {
         return false;
@@ -493,21 +530,23 @@ bool geo::fetch_points_from_location(double longitude, double latitude, double r
         geohash_decode_internal(longitude_range, latitude_range, output._neighbors._east, east);
         geohash_decode_internal(longitude_range, latitude_range, output._neighbors._west, west);
 
-        if (dist_internal(longitude, latitude, longitude, north._latitude_range._max) < radius) {
+        double north_south = shape._box ? shape._height / 2 : radius;
+        double east_west = shape._box ? shape._width / 2 : radius;
+        if (dist_internal(longitude, latitude, longitude, north._latitude_range._max) < north_south) {
             decrease_step = true;
         }
-        if (dist_internal(longitude, latitude, longitude, south._latitude_range._min) < radius) {
+        if (dist_internal(longitude, latitude, longitude, south._latitude_range._min) < north_south) {
             decrease_step = true;
         }
-        if (dist_internal(longitude, latitude, east._longitude_range._max, latitude) < radius) {
+        if (dist_internal(longitude, latitude, east._longitude_range._max, latitude) < east_west) {
             decrease_step = true;
         }
-        if (dist_internal(longitude, latitude, west._longitude_range._min, latitude) < radius) {
+        if (dist_internal(longitude, latitude, west._longitude_range._min, latitude) < east_west) {
             decrease_step = true;
         }
     }
 
-    if (decrease_step) {
+    if (decrease_step && output._hash._step > 1) {
         output._hash._step--;
         if (geohash_encode_internal(longitude_range, latitude_range, longitude, latitude, output._hash._step, output._hash._hash) == false) {
             return false;
@@ -546,20 +585,120 @@ bool geo::fetch_points_from_location(double longitude, double latitude, double r
         output._neighbors._south_east,
         output._neighbors._south_west
     };
-    size_t count = 0;
-    int last_processed = 0;
+    auto align_hash = [] (const geo_hash& h) -> uint64_t {
+        return h._hash << (52 - h._step * 2);
+    };
+    ranges.clear();
     for (int i = 0; i < 9; ++i) {
         auto& h = gh[i];
         if (h._hash == 0 && h._step == 0) {
             continue;
         }
-        if (last_processed && gh[i]._hash == gh[last_processed]._hash && gh[i]._step == gh[last_processed]._step) {
+        geo_hash_area area;
+        // the box of the hash 0 can't be decoded, it has no lower bound.
+        double min_dist = 0;
+        if (geohash_decode_internal(longitude_range, latitude_range, h, area)) {
+            min_dist = distance_lower_bound(longitude, latitude, area);
+        }
+        geo_hash next = h;
+        next._hash++;
+        ranges.emplace_back(geo_search_range { static_cast<double>(align_hash(h)), static_cast<double>(align_hash(next)), min_dist });
+    }
+    // the boxes are visited in the order of the scores, and the same box is visited once.
+    std::sort(ranges.begin(), ranges.end(), [] (const geo_search_range& l, const geo_search_range& r) {
+        return l._min < r._min;
+    });
+    ranges.erase(std::unique(ranges.begin(), ranges.end(), [] (const geo_search_range& l, const geo_search_range& r) {
+        return l._min == r._min;
+    }), ranges.end());
+    return true;
+}
+
+geo_filter::geo_filter(const geo_shape& shape)
+    : _shape(shape)
+    , _cos_latitude(std::cos(deg_rad(shape._latitude)))
+    , _threshold(0)
+{
+    geohash_shape_bounding_box(shape, _bounds);
+    // the bounds of the prefilter are widened, so that no point which passes the exact test
+    // is rejected by the rounding errors. The longitude is not filtered if the box crosses the
+    // antimeridian or a pole.
+    static constexpr const double margin = 1e-6;
+    _bounds[0] -= margin;
+    _bounds[1] -= margin;
+    _bounds[2] += margin;
+    _bounds[3] += margin;
+    if (shape._box) {
+        double latitude = std::max(std::fabs(_bounds[1]), std::fabs(_bounds[3]));
+        double c = std::cos(deg_rad(std::min(latitude, 90.0)));
+        double s = std::sin(shape._width / 4 / EARTH_RADIUS_IN_METERS);
+        if (c > 0 && s < c) {
+            // the exact test of the box is the haversine along the parallel of the point.
+            double delta = rad_deg(2 * std::asin(s / c)) + margin;
+            _bounds[0] = std::min(_bounds[0], shape._longitude - delta);
+            _bounds[2] = std::max(_bounds[2], shape._longitude + delta);
+        }
+        else {
+            _bounds[0] = GEO_LONG_MIN * 2;
+            _bounds[2] = GEO_LONG_MAX * 2;
+        }
+    }
+    else {
+        // the exact distance decides the points on the circle, the threshold only saves the asin.
+        double u = std::sin(std::min(shape._radius / EARTH_RADIUS_IN_METERS, M_PI) / 2);
+        _threshold = u * u * (1 + 1e-9);
+    }
+    if (!(_bounds[0] >= GEO_LONG_MIN && _bounds[2] <= GEO_LONG_MAX)) {
+        _bounds[0] = GEO_LONG_MIN * 2;
+        _bounds[2] = GEO_LONG_MAX * 2;
+    }
+}
+
+size_t geo_filter::filter(const double* scores, size_t count, uint32_t* indexes, double* dists) const
+{
+    uint32_t cells[2][BATCH_SIZE];
+    double longitudes[BATCH_SIZE], latitudes[BATCH_SIZE];
+    uint32_t candidates[BATCH_SIZE];
+    geo_kernels::deinterleave(scores, count, cells[0], cells[1]);
+    // the centers of the cells, as decode_from_geohash does.
+    static constexpr const double cell = 1.0 / (1ull << GEO_HASH_STEP_MAX);
+    for (size_t i = 0; i < count; ++i) {
+        longitudes[i] = ((GEO_LONG_MIN + cells[0][i] * cell * GEO_LONG_SCALE) + (GEO_LONG_MIN + (cells[0][i] + 1.0) * cell * GEO_LONG_SCALE)) / 2.0;
+        latitudes[i] = ((GEO_LAT_MIN + cells[1][i] * cell * GEO_LAT_SCALE) + (GEO_LAT_MIN + (cells[1][i] + 1.0) * cell * GEO_LAT_SCALE)) / 2.0;
+    }
+    auto n = geo_kernels::select_in_bounds(longitudes, latitudes, count, _bounds, candidates);
+    double lat1r = deg_rad(_shape._latitude), lon1r = deg_rad(_shape._longitude);
+    size_t matched = 0;
+    for (size_t j = 0; j < n; ++j) {
+        auto i = candidates[j];
+        double lat2r = deg_rad(latitudes[i]), lon2r = deg_rad(longitudes[i]);
+        double u = std::sin((lat2r - lat1r) / 2);
+        double v = std::sin((lon2r - lon1r) / 2);
+        double cos_latitude = std::cos(lat2r);
+        if (_shape._box) {
+            // the distances along the meridian and the parallel of the point, as redis does.
+            if (EARTH_RADIUS_IN_METERS * std::fabs(lat2r - lat1r) > _shape._height / 2) {
+                continue;
+            }
+            double w = std::min(1.0, cos_latitude * std::fabs(v));
+            if (2.0 * EARTH_RADIUS_IN_METERS * std::asin(w) > _shape._width / 2) {
+                continue;
+            }
+        }
+        // the asin is computed only for the matched points.
+        double a = u * u + _cos_latitude * cos_latitude * v * v;
+        if (!_shape._box && a > _threshold) {
+            continue;
+        }
+        double dist = 2.0 * EARTH_RADIUS_IN_METERS * std::asin(std::sqrt(std::min(1.0, a)));
+        if (!_shape._box && dist > _shape._radius) {
             continue;
         }
-        count += fetch_points_in_box(gh[i], longitude, latitude, radius, f, points);
-        last_processed = i;
+        indexes[matched] = i;
+        dists[matched] = dist;
+        matched++;
     }
-    return true;
+    return matched;
 }
 
 bool geo::to_meters(double& n, int flags)
@@ -570,10 +709,10 @@ bool geo::to_meters(double& n, int flags)
         n *= 1000;
     }
     else if (flags & GEO_UNIT_MI) {
-        n *= 0.3048;
+        n *= 1609.34;
     }
     else if (flags & GEO_UNIT_FT) {
-        n *= 1609.34;
+        n *= 0.3048;
     }
     else {
         return false;
@@ -589,10 +728,10 @@ bool geo::from_meters(double& n, int flags)
         n /= 1000;
     }
     else if (flags & GEO_UNIT_MI) {
-        n /= 0.3048;
+        n /= 1609.34;
     }
     else if (flags & GEO_UNIT_FT) {
-        n /= 1609.34;
+        n /= 0.3048;
     }
     else {
         return false;
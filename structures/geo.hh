@@ -19,6 +19,8 @@
 *
 */
 #pragma once
+#include <vector>
+#include <tuple>
 #include "utils/bytes.hh"
 namespace redis {
 static constexpr const int GEODIST_UNIT_M  = (1 << 0);
@@ -39,6 +41,44 @@ static constexpr const int GEO_UNIT_M      = (1 << 9);
 static constexpr const int GEO_UNIT_KM     = (1 << 10);
 static constexpr const int GEO_UNIT_MI     = (1 << 11);
 static constexpr const int GEO_UNIT_FT     = (1 << 12);
+static constexpr const int GEOSEARCH_ANY        = (1 << 13);
+static constexpr const int GEOSEARCH_STORE       = (1 << 14);
+
+// The shape of GEOSEARCH, the sizes are in meters.
+struct geo_shape {
+    bool _box = false;
+    double _longitude = 0;
+    double _latitude = 0;
+    double _radius = 0;
+    double _width = 0;
+    double _height = 0;
+};
+
+// The scores [min, max) of a geohash box which covers a part of the shape, and the
+// lower bound of the distances from the center of the shape to the points in the box.
+struct geo_search_range {
+    double _min;
+    double _max;
+    double _min_dist;
+};
+
+// Tests the points against the shape in batches: the geohash scores are decoded, the
+// points out of the bounding box of the shape are rejected by the vectorized kernel,
+// and only the others get the exact (haversine) test.
+class geo_filter {
+    geo_shape _shape;
+    double _bounds[4];
+    double _cos_latitude;
+    // the haversine term of the radius.
+    double _threshold;
+public:
+    static constexpr const size_t BATCH_SIZE = 256;
+    explicit geo_filter(const geo_shape& shape);
+    // Writes the indexes and the distances (in meters) of the matched points, returns
+    // the number of them. The count must not be greater than the BATCH_SIZE.
+    size_t filter(const double* scores, size_t count, uint32_t* indexes, double* dists) const;
+};
+
 class geo {
 public:
     static bool encode_to_geohash(const double& longitude, const double& latitude, double& geohash);
@@ -50,8 +90,9 @@ public:
 
     //[key, dist, score, longitude, latitude]
     using points_type = std::vector<std::tuple<bytes, double, double, double, double>>;
-    using fetch_point = std::function<size_t (uint64_t, uint64_t, const double, const double, const double, points_type& points)>;
-    static bool fetch_points_from_location(double longitude, double latitude, double radius, fetch_point&& f, points_type& points);
+    // Returns the ranges of the geohash boxes (the box of the center and its neighbors)
+    // which cover the shape, sorted by the scores.
+    static bool search_ranges(const geo_shape& shape, std::vector<geo_search_range>& ranges);
     static bool to_meters(double& n, int flags);
     static bool from_meters(double& n, int flags);
 };
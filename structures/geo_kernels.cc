@@ -0,0 +1,136 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#include "geo_kernels.hh"
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+namespace redis {
+namespace geo_kernels {
+
+static inline uint32_t squash(uint64_t x)
+{
+    x &= 0x5555555555555555ULL;
+    x = (x | (x >> 1)) & 0x3333333333333333ULL;
+    x = (x | (x >> 2)) & 0x0F0F0F0F0F0F0F0FULL;
+    x = (x | (x >> 4)) & 0x00FF00FF00FF00FFULL;
+    x = (x | (x >> 8)) & 0x0000FFFF0000FFFFULL;
+    x = (x | (x >> 16)) & 0x00000000FFFFFFFFULL;
+    return static_cast<uint32_t>(x);
+}
+
+static void deinterleave_scalar(const double* scores, size_t count, uint32_t* longitudes, uint32_t* latitudes)
+{
+    for (size_t i = 0; i < count; ++i) {
+        auto hash = static_cast<uint64_t>(scores[i]);
+        latitudes[i] = squash(hash);
+        longitudes[i] = squash(hash >> 1);
+    }
+}
+
+static size_t select_scalar(const double* longitudes, const double* latitudes, size_t count, const double* bounds, uint32_t* indexes)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < count; ++i) {
+        indexes[n] = static_cast<uint32_t>(i);
+        n += (longitudes[i] >= bounds[0]) & (longitudes[i] <= bounds[2]) & (latitudes[i] >= bounds[1]) & (latitudes[i] <= bounds[3]);
+    }
+    return n;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("bmi2")))
+static void deinterleave_bmi2(const double* scores, size_t count, uint32_t* longitudes, uint32_t* latitudes)
+{
+    for (size_t i = 0; i < count; ++i) {
+        auto hash = static_cast<uint64_t>(scores[i]);
+        latitudes[i] = static_cast<uint32_t>(_pext_u64(hash, 0x5555555555555555ULL));
+        longitudes[i] = static_cast<uint32_t>(_pext_u64(hash, 0xaaaaaaaaaaaaaaaaULL));
+    }
+}
+
+// 4 points are tested at a time, the mask of the matched lanes is expanded to the indexes.
+__attribute__((target("avx2")))
+static size_t select_avx2(const double* longitudes, const double* latitudes, size_t count, const double* bounds, uint32_t* indexes)
+{
+    const __m256d min_longitude = _mm256_set1_pd(bounds[0]);
+    const __m256d min_latitude = _mm256_set1_pd(bounds[1]);
+    const __m256d max_longitude = _mm256_set1_pd(bounds[2]);
+    const __m256d max_latitude = _mm256_set1_pd(bounds[3]);
+    size_t n = 0, i = 0;
+    for (; i + 4 <= count; i += 4) {
+        auto longitude = _mm256_loadu_pd(longitudes + i);
+        auto latitude = _mm256_loadu_pd(latitudes + i);
+        auto in = _mm256_and_pd(_mm256_cmp_pd(longitude, min_longitude, _CMP_GE_OQ), _mm256_cmp_pd(longitude, max_longitude, _CMP_LE_OQ));
+        in = _mm256_and_pd(in, _mm256_cmp_pd(latitude, min_latitude, _CMP_GE_OQ));
+        in = _mm256_and_pd(in, _mm256_cmp_pd(latitude, max_latitude, _CMP_LE_OQ));
+        auto mask = static_cast<unsigned>(_mm256_movemask_pd(in));
+        while (mask) {
+            indexes[n++] = static_cast<uint32_t>(i + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    auto rest = select_scalar(longitudes + i, latitudes + i, count - i, bounds, indexes + n);
+    for (size_t j = 0; j < rest; ++j) {
+        indexes[n + j] += static_cast<uint32_t>(i);
+    }
+    return n + rest;
+}
+#endif
+
+struct kernel_set {
+    const char* name;
+    void (*deinterleave)(const double*, size_t, uint32_t*, uint32_t*);
+    size_t (*select_in_bounds)(const double*, const double*, size_t, const double*, uint32_t*);
+};
+
+static kernel_set select_kernels()
+{
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2")) {
+        return kernel_set { "avx2", deinterleave_bmi2, select_avx2 };
+    }
+#endif
+    return kernel_set { "scalar", deinterleave_scalar, select_scalar };
+}
+
+static const kernel_set& kernels()
+{
+    static const kernel_set _kernels = select_kernels();
+    return _kernels;
+}
+
+void deinterleave(const double* scores, size_t count, uint32_t* longitudes, uint32_t* latitudes)
+{
+    kernels().deinterleave(scores, count, longitudes, latitudes);
+}
+
+size_t select_in_bounds(const double* longitudes, const double* latitudes, size_t count, const double* bounds, uint32_t* indexes)
+{
+    return kernels().select_in_bounds(longitudes, latitudes, count, bounds, indexes);
+}
+
+const char* implementation()
+{
+    return kernels().name;
+}
+}
+}
@@ -0,0 +1,37 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+namespace redis {
+// The kernels on the batches of the geo points. The AVX2 (and BMI2) implementation
+// is selected at runtime, like the hll_kernels.
+namespace geo_kernels {
+// Splits the 52 bits geohash scores to the cells of the longitude and the latitude.
+void deinterleave(const double* scores, size_t count, uint32_t* longitudes, uint32_t* latitudes);
+
+// Writes the indexes of the points in the bounds [min_longitude, min_latitude,
+// max_longitude, max_latitude], returns the number of them.
+size_t select_in_bounds(const double* longitudes, const double* latitudes, size_t count, const double* bounds, uint32_t* indexes);
+
+const char* implementation();
+}
+}
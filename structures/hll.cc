@@ -19,14 +19,29 @@
 *
 */
 #include "hll.hh"
+#include "hll_kernels.hh"
 #include <cmath>
+#include <cstring>
+#include <vector>
 namespace redis {
 
 static constexpr const int HLL_P = 14;
+static constexpr const int HLL_Q = 64 - HLL_P;
 static constexpr const int HLL_BITS = 6;
-static constexpr const int HLL_CARD_CACHE_SIZE = 8;
+static constexpr const int HLL_HDR_SIZE = 16;
+static constexpr const int HLL_CARD_CACHE_OFFSET = 8;
 static constexpr const int HLL_BUCKET_COUNT = (1 << HLL_P);
-static constexpr const int HLL_BYTES_SIZE = HLL_CARD_CACHE_SIZE + (HLL_BUCKET_COUNT * HLL_BITS + 7) / 8;
+static constexpr const int HLL_REGISTERS_SIZE = (HLL_BUCKET_COUNT * HLL_BITS + 7) / 8;
+static constexpr const int HLL_BYTES_SIZE = HLL_HDR_SIZE + HLL_REGISTERS_SIZE;
+static constexpr const uint8_t HLL_DENSE = 0;
+static constexpr const uint8_t HLL_SPARSE = 1;
+
+static constexpr const uint8_t HLL_SPARSE_XZERO_BIT = 0x40;
+static constexpr const uint8_t HLL_SPARSE_VAL_BIT = 0x80;
+static constexpr const int HLL_SPARSE_VAL_MAX_VALUE = 32;
+static constexpr const int HLL_SPARSE_VAL_MAX_LEN = 4;
+static constexpr const int HLL_SPARSE_ZERO_MAX_LEN = 64;
+static constexpr const int HLL_SPARSE_XZERO_MAX_LEN = 16384;
 
 static constexpr const int HLL_BUCKET_COUNT_MAX = (1 << HLL_BITS) - 1;
 static constexpr const int HLL_BUCKET_COUNT_MASK = HLL_BUCKET_COUNT - 1; 
@@ -43,16 +58,84 @@ static constexpr const double PE[64] = {
     1.0 / (1ULL << 57), 1.0 / (1ULL << 58), 1.0 / (1ULL << 59), 1.0 / (1ULL << 60), 1.0 / (1ULL << 61), 1.0 / (1ULL << 62), 1.0 / (1ULL << 63) 
 };
 
-static inline void hll_invalidate_cache(uint8_t* cache, size_t size)
+static thread_local size_t _sparse_max_bytes = hll::DEFAULT_SPARSE_MAX_BYTES;
+
+void hll::configure(size_t sparse_max_bytes)
+{
+    _sparse_max_bytes = sparse_max_bytes;
+}
+
+// MurmurHash64A, the same hash function (and seed) as redis, so the registers are
+// compatible with the HLL values created by redis.
+static uint64_t murmur_hash_64a(const void* key, int len, uint64_t seed)
 {
-    if (size > 7) {
-        cache[7] |= (1 << 7);
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+    const uint8_t* data = (const uint8_t*) key;
+    const uint8_t* end = data + (len - (len & 7));
+
+    while (data != end) {
+        uint64_t k = 0;
+        memcpy(&k, data, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+        data += 8;
     }
+
+    switch (len & 7) {
+    case 7: h ^= (uint64_t)data[6] << 48;
+    case 6: h ^= (uint64_t)data[5] << 40;
+    case 5: h ^= (uint64_t)data[4] << 32;
+    case 4: h ^= (uint64_t)data[3] << 24;
+    case 3: h ^= (uint64_t)data[2] << 16;
+    case 2: h ^= (uint64_t)data[1] << 8;
+    case 1: h ^= (uint64_t)data[0];
+            h *= m;
+    };
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+static inline uint8_t hll_pattern_len(bytes_view element, long& index)
+{
+    uint8_t count = 1;
+    auto hash = murmur_hash_64a(element.data(), element.size(), 0xadc83b19ULL);
+    index = hash & HLL_BUCKET_COUNT_MASK;
+    // the sentinel bit above the HLL_Q bits of the pattern bounds the count to
+    // HLL_Q + 1, the same as redis.
+    hash >>= HLL_P;
+    hash |= ((uint64_t) 1 << HLL_Q);
+    uint64_t bit = 1;
+    while ((hash & bit) == 0) {
+        ++count;
+        bit <<= 1;
+    }
+    return count;
+}
+
+static inline void hll_invalidate_cache(uint8_t* p)
+{
+    p[HLL_CARD_CACHE_OFFSET + 7] |= (1 << 7);
+}
+
+static inline bool hll_is_valid_cache(const uint8_t* p)
+{
+    return (p[HLL_CARD_CACHE_OFFSET + 7] & (1 << 7)) == 0;
 }
 
-static inline bool hll_is_valid_cache(const uint8_t* cache, size_t size)
+static inline void hll_init_header(uint8_t* p, uint8_t encoding)
 {
-    return size > 7 && (cache[7] & (1 << 7)) == 0;
+    memcpy(p, "HYLL", 4);
+    p[4] = encoding;
+    p[5] = p[6] = p[7] = 0;
+    memset(p + HLL_CARD_CACHE_OFFSET, 0, 8);
 }
 
 static inline void hll_get_counter_on_bucket(uint8_t& counter, const uint8_t* p, long index)
@@ -62,7 +145,8 @@ static inline void hll_get_counter_on_bucket(uint8_t& counter, const uint8_t* p,
     unsigned long _fb = index * HLL_BITS & 7;
     unsigned long _fb8 = 8 - _fb;
     unsigned long b0 = _p[_byte];
-    unsigned long b1 = _p[_byte+1];
+    // the last register does not cross the byte boundary.
+    unsigned long b1 = _fb > 2 ? _p[_byte+1] : 0;
     counter = ((b0 >> _fb) | (b1 << _fb8)) & HLL_BUCKET_COUNT_MAX;
 }
 
@@ -75,81 +159,333 @@ static inline void hll_set_counter_on_bucket(uint8_t* p, long index, uint8_t cou
     unsigned long _v = counter;
     _p[_byte] &= ~(HLL_BUCKET_COUNT_MAX << _fb);
     _p[_byte] |= _v << _fb;
-    _p[_byte+1] &= ~(HLL_BUCKET_COUNT_MAX >> _fb8);
-    _p[_byte+1] |= _v >> _fb8;
+    if (_fb > 2) {
+        _p[_byte+1] &= ~(HLL_BUCKET_COUNT_MAX >> _fb8);
+        _p[_byte+1] |= _v >> _fb8;
+    }
 }
 
-bool hll_add(managed_bytes& data, const sstring& element)
+// sparse opcodes:
+// ZERO  : 00xxxxxx, 1 - 64 registers set to 0.
+// XZERO : 01xxxxxx yyyyyyyy, 1 - 16384 registers set to 0.
+// VAL   : 1vvvvvxx, 1 - 4 registers set to the value 1 - 32.
+static inline bool sparse_is_zero(const uint8_t* p) { return (*p & 0xc0) == 0; }
+static inline bool sparse_is_xzero(const uint8_t* p) { return (*p & 0xc0) == HLL_SPARSE_XZERO_BIT; }
+static inline bool sparse_is_val(const uint8_t* p) { return (*p & HLL_SPARSE_VAL_BIT) != 0; }
+static inline int sparse_zero_len(const uint8_t* p) { return (*p & 0x3f) + 1; }
+static inline int sparse_xzero_len(const uint8_t* p) { return (((*p & 0x3f) << 8) | *(p + 1)) + 1; }
+static inline int sparse_val_value(const uint8_t* p) { return ((*p >> 2) & 0x1f) + 1; }
+static inline int sparse_val_len(const uint8_t* p) { return (*p & 0x3) + 1; }
+
+static inline uint8_t sparse_make_val(int value, int len)
 {
-    uint8_t oldcount = 0, count = 1;
-    uint8_t* p = (uint8_t*)(data.data()) + HLL_CARD_CACHE_SIZE;
-    auto hash = (uint64_t)(std::hash<sstring>()(element));
-    //auto hash = murmur_hash_64a((uint8_t*)element.data(), element.size(), 0xadc83b19ULL);
-    auto index = hash & HLL_BUCKET_COUNT_MASK;
-    hash |= ((uint64_t) 1 << 63);
-    uint64_t bit = HLL_BUCKET_COUNT;
-    while ((hash & bit) == 0) {
-        ++count;
-        bit <<= 1;
+    return static_cast<uint8_t>((((value - 1) << 2) | (len - 1)) | HLL_SPARSE_VAL_BIT);
+}
+
+static inline void sparse_emit_val(std::vector<uint8_t>& out, int value, int len)
+{
+    out.push_back(sparse_make_val(value, len));
+}
+
+static inline void sparse_emit_zero(std::vector<uint8_t>& out, int len)
+{
+    while (len > 0) {
+        if (len <= HLL_SPARSE_ZERO_MAX_LEN) {
+            out.push_back(static_cast<uint8_t>(len - 1));
+            len = 0;
+        }
+        else {
+            int n = std::min(len, HLL_SPARSE_XZERO_MAX_LEN);
+            out.push_back(static_cast<uint8_t>(((n - 1) >> 8) | HLL_SPARSE_XZERO_BIT));
+            out.push_back(static_cast<uint8_t>((n - 1) & 0xff));
+            len -= n;
+        }
     }
+}
+
+// Visits the runs of the sparse representation, func(first_register, run_length, value).
+// Returns false if the representation is corrupted.
+template <typename Func>
+static bool sparse_for_each_run(const uint8_t* data, size_t size, Func&& func)
+{
+    const uint8_t* p = data + HLL_HDR_SIZE;
+    const uint8_t* end = data + size;
+    long index = 0;
+    while (p < end) {
+        int len = 0, value = 0;
+        if (sparse_is_zero(p)) {
+            len = sparse_zero_len(p);
+            p++;
+        }
+        else if (sparse_is_xzero(p)) {
+            if (p + 1 >= end) {
+                return false;
+            }
+            len = sparse_xzero_len(p);
+            p += 2;
+        }
+        else {
+            len = sparse_val_len(p);
+            value = sparse_val_value(p);
+            p++;
+        }
+        if (index + len > HLL_BUCKET_COUNT) {
+            return false;
+        }
+        func(index, len, value);
+        index += len;
+    }
+    return index == HLL_BUCKET_COUNT;
+}
+
+bool hll::is_valid(const uint8_t* data, size_t size)
+{
+    if (size < HLL_HDR_SIZE || memcmp(data, "HYLL", 4) != 0) {
+        return false;
+    }
+    if (data[4] == HLL_DENSE) {
+        return size == HLL_BYTES_SIZE;
+    }
+    return data[4] == HLL_SPARSE;
+}
+
+bool hll::is_sparse(const uint8_t* data, size_t size)
+{
+    return size >= HLL_HDR_SIZE && data[4] == HLL_SPARSE;
+}
+
+bytes hll::empty()
+{
+    std::vector<uint8_t> out(HLL_HDR_SIZE);
+    hll_init_header(out.data(), HLL_SPARSE);
+    sparse_emit_zero(out, HLL_BUCKET_COUNT);
+    return bytes { reinterpret_cast<const char*>(out.data()), out.size() };
+}
+
+// Unpacks the registers of the HLL (any encoding), one byte per register.
+static bool hll_to_registers(const uint8_t* data, size_t size, uint8_t* registers)
+{
+    if (data[4] == HLL_SPARSE) {
+        return sparse_for_each_run(data, size, [registers] (long index, int len, int value) {
+            memset(registers + index, value, len);
+        });
+    }
+    hll_kernels::unpack(data + HLL_HDR_SIZE, HLL_REGISTERS_SIZE, registers);
+    return true;
+}
+
+static void hll_from_registers(const uint8_t* registers, std::vector<uint8_t>& out)
+{
+    out.assign(HLL_BYTES_SIZE, 0);
+    hll_init_header(out.data(), HLL_DENSE);
+    hll_kernels::pack(registers, HLL_BUCKET_COUNT, out.data() + HLL_HDR_SIZE);
+    hll_invalidate_cache(out.data());
+}
+
+static bool hll_sparse_to_dense(std::vector<uint8_t>& data)
+{
+    std::vector<uint8_t> registers(HLL_BUCKET_COUNT, 0);
+    if (!hll_to_registers(data.data(), data.size(), registers.data())) {
+        return false;
+    }
+    hll_from_registers(registers.data(), data);
+    return true;
+}
+
+static bool hll_dense_set(uint8_t* p, long index, uint8_t count)
+{
+    uint8_t oldcount = 0;
     hll_get_counter_on_bucket(oldcount, p, index);
     if (count > oldcount) {
         hll_set_counter_on_bucket(p, index, count);
-        hll_invalidate_cache((uint8_t*)(data.data()), HLL_CARD_CACHE_SIZE);
         return true;
     }
     return false;
 }
 
-size_t hll::append(managed_bytes& data, const std::vector<sstring>& elements)
+// Merges the adjacent VAL opcodes with the same value.
+static void hll_sparse_merge_vals(std::vector<uint8_t>& data)
+{
+    size_t pos = HLL_HDR_SIZE;
+    while (pos < data.size()) {
+        const uint8_t* p = &data[pos];
+        if (sparse_is_xzero(p)) {
+            pos += 2;
+            continue;
+        }
+        if (sparse_is_val(p) && pos + 1 < data.size() && sparse_is_val(p + 1)) {
+            auto value = sparse_val_value(p);
+            auto len = sparse_val_len(p) + sparse_val_len(p + 1);
+            if (value == sparse_val_value(p + 1) && len <= HLL_SPARSE_VAL_MAX_LEN) {
+                data[pos] = sparse_make_val(value, len);
+                data.erase(data.begin() + pos + 1);
+                continue;
+            }
+        }
+        pos++;
+    }
+}
+
+enum class sparse_set_result {
+    unchanged,
+    updated,
+    promote,
+};
+
+// Sets the register in the sparse representation, the opcode which covers the
+// register is replaced by up to 3 opcodes.
+static sparse_set_result hll_sparse_set(std::vector<uint8_t>& data, long index, uint8_t count, size_t sparse_max_bytes)
+{
+    if (count > HLL_SPARSE_VAL_MAX_VALUE) {
+        return sparse_set_result::promote;
+    }
+    size_t pos = HLL_HDR_SIZE, oplen = 1;
+    long first = 0, span = 0;
+    while (pos < data.size()) {
+        const uint8_t* p = &data[pos];
+        if (sparse_is_zero(p)) {
+            span = sparse_zero_len(p);
+            oplen = 1;
+        }
+        else if (sparse_is_xzero(p)) {
+            span = sparse_xzero_len(p);
+            oplen = 2;
+        }
+        else {
+            span = sparse_val_len(p);
+            oplen = 1;
+        }
+        if (index <= first + span - 1) {
+            break;
+        }
+        first += span;
+        pos += oplen;
+    }
+    if (pos >= data.size()) {
+        // corrupted, rebuild it as the dense one.
+        return sparse_set_result::promote;
+    }
+    const uint8_t* p = &data[pos];
+    bool is_val = sparse_is_val(p);
+    int current = is_val ? sparse_val_value(p) : 0;
+    if (is_val) {
+        if (current >= count) {
+            return sparse_set_result::unchanged;
+        }
+        if (span == 1) {
+            data[pos] = sparse_make_val(count, 1);
+            hll_sparse_merge_vals(data);
+            return sparse_set_result::updated;
+        }
+    }
+    std::vector<uint8_t> seq;
+    long last = first + span - 1;
+    if (is_val) {
+        if (index > first) sparse_emit_val(seq, current, index - first);
+        sparse_emit_val(seq, count, 1);
+        if (last > index) sparse_emit_val(seq, current, last - index);
+    }
+    else {
+        if (index > first) sparse_emit_zero(seq, index - first);
+        sparse_emit_val(seq, count, 1);
+        if (last > index) sparse_emit_zero(seq, last - index);
+    }
+    if (data.size() - oplen + seq.size() > sparse_max_bytes) {
+        return sparse_set_result::promote;
+    }
+    data.erase(data.begin() + pos, data.begin() + pos + oplen);
+    data.insert(data.begin() + pos, seq.begin(), seq.end());
+    hll_sparse_merge_vals(data);
+    return sparse_set_result::updated;
+}
+
+size_t hll::append(managed_bytes& data, const std::vector<bytes>& elements)
 {
+    uint8_t* p = (uint8_t*)(data.data());
+    if (!is_valid(p, data.size())) {
+        return 0;
+    }
     size_t result = 0;
+    if (p[4] == HLL_DENSE) {
+        for (size_t i = 0; i < elements.size(); ++i) {
+            long index = 0;
+            auto count = hll_pattern_len(bytes_view { elements[i] }, index);
+            if (hll_dense_set(p + HLL_HDR_SIZE, index, count)) {
+                ++result;
+            }
+        }
+        if (result > 0) {
+            hll_invalidate_cache(p);
+        }
+        return result > 0;
+    }
+    // the sparse representation is updated out of the LSA, and stored back once.
+    std::vector<uint8_t> buffer(p, p + data.size());
+    bool dense = false;
     for (size_t i = 0; i < elements.size(); ++i) {
-        if (hll_add(data, elements[i])) {
+        long index = 0;
+        auto count = hll_pattern_len(bytes_view { elements[i] }, index);
+        if (!dense) {
+            auto r = hll_sparse_set(buffer, index, count, _sparse_max_bytes);
+            if (r == sparse_set_result::updated) {
+                ++result;
+                continue;
+            }
+            if (r == sparse_set_result::unchanged) {
+                continue;
+            }
+            if (!hll_sparse_to_dense(buffer)) {
+                return 0;
+            }
+            dense = true;
+        }
+        if (hll_dense_set(buffer.data() + HLL_HDR_SIZE, index, count)) {
             ++result;
         }
     }
+    if (result > 0 || dense) {
+        hll_invalidate_cache(buffer.data());
+        data = managed_bytes(bytes_view { reinterpret_cast<const char*>(buffer.data()), buffer.size() });
+    }
     return result > 0;
 }
 
 
-static double hll_bucket_counter_sum(const uint8_t* data, size_t size, int& ez)
+// The dense registers are unpacked block by block, to keep the buffer on the stack small.
+static constexpr const size_t HLL_UNPACK_BLOCK_REGISTERS = 1024;
+static constexpr const size_t HLL_UNPACK_BLOCK_BYTES = HLL_UNPACK_BLOCK_REGISTERS * HLL_BITS / 8;
+
+static double hll_dense_counter_sum(const uint8_t* p, int& ez)
 {
-    ez = 0;
+    uint8_t block[HLL_UNPACK_BLOCK_REGISTERS];
     double E = 0;
-
-    const uint8_t *r = data;
-    unsigned long r0, r1, r2, r3, r4, r5, r6, r7, r8, r9, r10, r11, r12, r13, r14, r15;
-    for (int j = 0; j < 1024; j++) {
-        r0 = r[0] & 63; if (r0 == 0) ez++;
-        r1 = (r[0] >> 6 | r[1] << 2) & 63; if (r1 == 0) ez++;
-        r2 = (r[1] >> 4 | r[2] << 4) & 63; if (r2 == 0) ez++;
-        r3 = (r[2] >> 2) & 63; if (r3 == 0) ez++;
-        r4 = r[3] & 63; if (r4 == 0) ez++;
-        r5 = (r[3] >> 6 | r[4] << 2) & 63; if (r5 == 0) ez++;
-        r6 = (r[4] >> 4 | r[5] << 4) & 63; if (r6 == 0) ez++;
-        r7 = (r[5] >> 2) & 63; if (r7 == 0) ez++;
-        r8 = r[6] & 63; if (r8 == 0) ez++;
-        r9 = (r[6] >> 6 | r[7] << 2) & 63; if (r9 == 0) ez++;
-        r10 = (r[7] >> 4 | r[8] << 4) & 63; if (r10 == 0) ez++;
-        r11 = (r[8] >> 2) & 63; if (r11 == 0) ez++;
-        r12 = r[9] & 63; if (r12 == 0) ez++;
-        r13 = (r[9] >> 6 | r[10] << 2) & 63; if (r13 == 0) ez++;
-        r14 = (r[10] >> 4 | r[11] << 4) & 63; if (r14 == 0) ez++;
-        r15 = (r[11] >> 2) & 63; if (r15 == 0) ez++;
-
-        E += (PE[r0] + PE[r1]) + (PE[r2] + PE[r3]) + (PE[r4] + PE[r5]) +
-            (PE[r6] + PE[r7]) + (PE[r8] + PE[r9]) + (PE[r10] + PE[r11]) +
-            (PE[r12] + PE[r13]) + (PE[r14] + PE[r15]);
-        r += 12;
+    ez = 0;
+    for (size_t i = 0; i < HLL_REGISTERS_SIZE; i += HLL_UNPACK_BLOCK_BYTES) {
+        int block_ez = 0;
+        hll_kernels::unpack(p + i, HLL_UNPACK_BLOCK_BYTES, block);
+        E += hll_kernels::harmonic_sum(block, HLL_UNPACK_BLOCK_REGISTERS, block_ez);
+        ez += block_ez;
     }
     return E;
 }
 
-static size_t hll_read_card_from_cache(const managed_bytes& data)
+static double hll_sparse_counter_sum(const uint8_t* data, size_t size, int& ez)
+{
+    ez = 0;
+    double E = 0;
+    sparse_for_each_run(data, size, [&E, &ez] (long, int len, int value) {
+        if (value == 0) {
+            ez += len;
+        }
+        E += PE[value] * len;
+    });
+    return E;
+}
+
+static size_t hll_read_card_from_cache(const uint8_t* data)
 {
     uint64_t card = 0;
-    const uint8_t* p = (uint8_t*)(data.data());
+    const uint8_t* p = data + HLL_CARD_CACHE_OFFSET;
     card = (uint64_t)p[0];
     card |= (uint64_t)p[1] << 8;
     card |= (uint64_t)p[2] << 16;
@@ -161,9 +497,9 @@ static size_t hll_read_card_from_cache(const managed_bytes& data)
     return (size_t) card;
 }
 
-static void hll_write_card_to_cache(uint64_t card, managed_bytes& data)
+static void hll_write_card_to_cache(uint64_t card, uint8_t* data)
 {
-    uint8_t* p = (uint8_t*)(data.data());
+    uint8_t* p = data + HLL_CARD_CACHE_OFFSET;
     p[0] =  card & 0xff;
     p[1] = (card >> 8) & 0xff;
     p[2] = (card >> 16) & 0xff;
@@ -174,12 +510,8 @@ static void hll_write_card_to_cache(uint64_t card, managed_bytes& data)
     p[7] = (card >> 56) & 0xff;
 }
 
-
-static uint64_t compute_card(const uint8_t* data, size_t size)
+static uint64_t estimate_card(double S, int ez)
 {
-    int ez = 0;
-    auto S = hll_bucket_counter_sum(data, size, ez);
-
     S = (1/ S )* ALPHA_BUCKET_COUNT_POWER_2;
 
     if (S < HLL_BUCKET_COUNT * 2.5 && ez != 0) {
@@ -195,61 +527,112 @@ static uint64_t compute_card(const uint8_t* data, size_t size)
     return S;
 }
 
+static uint64_t compute_card(const uint8_t* data, size_t size)
+{
+    int ez = 0;
+    double S = 0;
+    if (data[4] == HLL_SPARSE) {
+        S = hll_sparse_counter_sum(data, size, ez);
+    }
+    else {
+        S = hll_dense_counter_sum(data + HLL_HDR_SIZE, ez);
+    }
+    return estimate_card(S, ez);
+}
+
 size_t hll::count(managed_bytes& data)
 {
-    uint64_t card = 0;
+    uint8_t* p = (uint8_t*)(data.data());
+    if (!is_valid(p, data.size())) {
+        return 0;
+    }
     // read the card from cache.
-    if (hll_is_valid_cache((uint8_t*)(data.data()), HLL_CARD_CACHE_SIZE)) {
-        return hll_read_card_from_cache(data);
+    if (hll_is_valid_cache(p)) {
+        return hll_read_card_from_cache(p);
     }
     // compute the value of card.
-    auto S = compute_card((uint8_t*)(data.data()) + HLL_CARD_CACHE_SIZE, data.size() - HLL_CARD_CACHE_SIZE);
-    card = (uint64_t) S;
-    hll_write_card_to_cache(card, data);
+    auto card = compute_card(p, data.size());
+    hll_write_card_to_cache(card, p);
     return (size_t) card;
 }
 
 size_t hll::count(const uint8_t* merged_sources, size_t size)
 {
-    auto S = compute_card(merged_sources + HLL_CARD_CACHE_SIZE, size - HLL_CARD_CACHE_SIZE);
-    return (size_t) S;
+    if (!is_valid(merged_sources, size)) {
+        return 0;
+    }
+    return (size_t) compute_card(merged_sources, size);
+}
+
+bool hll::merge_to_registers(const uint8_t* data, size_t size, uint8_t* registers)
+{
+    if (!is_valid(data, size)) {
+        return false;
+    }
+    if (data[4] == HLL_SPARSE) {
+        // only the VAL opcodes could raise the registers.
+        return sparse_for_each_run(data, size, [registers] (long index, int len, int value) {
+            for (long i = index; i < index + len; ++i) {
+                if (value > registers[i]) {
+                    registers[i] = value;
+                }
+            }
+        });
+    }
+    uint8_t block[HLL_UNPACK_BLOCK_REGISTERS];
+    const uint8_t* p = data + HLL_HDR_SIZE;
+    for (size_t i = 0; i < HLL_REGISTERS_SIZE; i += HLL_UNPACK_BLOCK_BYTES, registers += HLL_UNPACK_BLOCK_REGISTERS) {
+        hll_kernels::unpack(p + i, HLL_UNPACK_BLOCK_BYTES, block);
+        hll_kernels::max_merge(registers, block, HLL_UNPACK_BLOCK_REGISTERS);
+    }
+    return true;
+}
+
+void hll::merge_registers(uint8_t* dest, const uint8_t* src)
+{
+    hll_kernels::max_merge(dest, src, REGISTERS_COUNT);
+}
+
+size_t hll::count_registers(const uint8_t* registers)
+{
+    int ez = 0;
+    auto S = hll_kernels::harmonic_sum(registers, REGISTERS_COUNT, ez);
+    return (size_t) estimate_card(S, ez);
+}
+
+bool hll::store_registers(managed_bytes& data, const uint8_t* registers)
+{
+    std::vector<uint8_t> merged(registers, registers + REGISTERS_COUNT);
+    if (!merge_to_registers((const uint8_t*)(data.data()), data.size(), merged.data())) {
+        return false;
+    }
+    std::vector<uint8_t> dense;
+    hll_from_registers(merged.data(), dense);
+    data = managed_bytes(bytes_view { reinterpret_cast<const char*>(dense.data()), dense.size() });
+    return true;
 }
 
 size_t hll::merge(managed_bytes& data, const uint8_t* merged_sources, size_t size)
 {
-    if (size != HLL_BYTES_SIZE) {
+    std::vector<uint8_t> registers(HLL_BUCKET_COUNT, 0);
+    if (!merge_to_registers(merged_sources, size, registers.data())) {
         return 0;
     }
-    uint8_t* p = (uint8_t*)(data.data()) + HLL_CARD_CACHE_SIZE;
-    const uint8_t* s = merged_sources + HLL_CARD_CACHE_SIZE;
-    uint8_t counter = 0, counter_s = 0;
-    for (size_t i = 0; i < HLL_BUCKET_COUNT; ++i) {
-        hll_get_counter_on_bucket(counter_s, s, i);
-        hll_get_counter_on_bucket(counter, p, i);
-        if (counter_s > counter) {
-            hll_set_counter_on_bucket(p, i, counter_s);
-        }
-    }
-    hll_invalidate_cache((uint8_t*)data.data(), HLL_CARD_CACHE_SIZE);
-    return 1;
+    return store_registers(data, registers.data());
 }
 
 size_t hll::merge(uint8_t* data, size_t size, const sstring& merged_sources)
 {
-    if (merged_sources.size() != HLL_BYTES_SIZE) {
+    if (size != HLL_BYTES_SIZE || data[4] != HLL_DENSE) {
         return 0;
     }
-    uint8_t* p = data + HLL_CARD_CACHE_SIZE;
-    const uint8_t* s = (uint8_t*)(merged_sources.data()) + HLL_CARD_CACHE_SIZE;
-    uint8_t counter = 0, counter_s = 0;
-    for (size_t i = 0; i < HLL_BUCKET_COUNT; ++i) {
-        hll_get_counter_on_bucket(counter_s, s, i);
-        hll_get_counter_on_bucket(counter, p, i);
-        if (counter_s > counter) {
-            hll_set_counter_on_bucket(p, i, counter_s);
-        }
+    std::vector<uint8_t> registers(HLL_BUCKET_COUNT, 0);
+    hll_kernels::unpack(data + HLL_HDR_SIZE, HLL_REGISTERS_SIZE, registers.data());
+    if (!merge_to_registers(reinterpret_cast<const uint8_t*>(merged_sources.data()), merged_sources.size(), registers.data())) {
+        return 0;
     }
-    hll_invalidate_cache(data, HLL_CARD_CACHE_SIZE);
+    hll_kernels::pack(registers.data(), HLL_BUCKET_COUNT, data + HLL_HDR_SIZE);
+    hll_invalidate_cache(data);
     return 1;
 }
 }
@@ -14,21 +14,46 @@
 * KIND, either express or implied.  See the License for the
 * specific language governing permissions and limitations
 * under the License.
-* 
+*
 *  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
 *
 */
 #pragma once
+#include <vector>
 #include "core/sstring.hh"
+#include "utils/bytes.hh"
 #include "utils/managed_bytes.hh"
 namespace redis {
+// The layout of the HLL values is compatible with redis:
+// [HYLL][encoding][3 bytes unused][8 bytes cached cardinality][registers]
+// the registers are encoded in the dense (16384 * 6 bits) or the sparse
+// (ZERO/XZERO/VAL opcodes) representation. The sparse one is promoted to
+// the dense one when its size exceeds the sparse_max_bytes.
 class hll {
 public:
-    static size_t append(managed_bytes& data, const std::vector<sstring>& elements);
+    static constexpr const size_t DEFAULT_SPARSE_MAX_BYTES = 3000;
+    static void configure(size_t sparse_max_bytes);
+    // Returns an empty HLL in the sparse encoding.
+    static bytes empty();
+    static bool is_valid(const uint8_t* data, size_t size);
+    static bool is_sparse(const uint8_t* data, size_t size);
+    static size_t append(managed_bytes& data, const std::vector<bytes>& elements);
     static size_t count(managed_bytes& data);
     static size_t count(const uint8_t* merged_sources, size_t size);
-    static size_t merge(managed_bytes& data, const uint8_t* merged_sources, size_t size); 
-    static size_t merge(uint8_t* dest, size_t size, const sstring& merged_sources); 
+    // merges the merged_sources (any encoding) to the data, the data is promoted to the dense encoding.
+    static size_t merge(managed_bytes& data, const uint8_t* merged_sources, size_t size);
+    // the dest must be a HLL in the dense encoding.
+    static size_t merge(uint8_t* dest, size_t size, const sstring& merged_sources);
+
+    // The unpacked registers (one byte per register) are used to merge several HLL values,
+    // e.g. the multi-key PFCOUNT and PFMERGE.
+    static constexpr const size_t REGISTERS_COUNT = 16384;
+    // Merges the registers of the HLL value (any encoding) to the unpacked registers.
+    static bool merge_to_registers(const uint8_t* data, size_t size, uint8_t* registers);
+    static void merge_registers(uint8_t* dest, const uint8_t* src);
+    static size_t count_registers(const uint8_t* registers);
+    // Merges the unpacked registers to the data, the data is promoted to the dense encoding.
+    static bool store_registers(managed_bytes& data, const uint8_t* registers);
 };
 
 }
@@ -0,0 +1,314 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#include "hll_kernels.hh"
+#include <cstring>
+#include <vector>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+namespace redis {
+namespace hll_kernels {
+
+static constexpr const double PE[64] = {
+    1.0 / (1ULL << 0), 1.0 / (1ULL << 1), 1.0 / (1ULL << 2), 1.0 / (1ULL << 3), 1.0 / (1ULL << 4), 1.0 / (1ULL << 5), 1.0 / (1ULL << 6), 1.0 / (1ULL << 7),
+    1.0 / (1ULL << 8), 1.0 / (1ULL << 9), 1.0 / (1ULL << 10), 1.0 / (1ULL << 11), 1.0 / (1ULL << 12), 1.0 / (1ULL << 13), 1.0 / (1ULL << 14), 1.0 / (1ULL << 15),
+    1.0 / (1ULL << 16), 1.0 / (1ULL << 17), 1.0 / (1ULL << 18), 1.0 / (1ULL << 19), 1.0 / (1ULL << 20), 1.0 / (1ULL << 21), 1.0 / (1ULL << 22), 1.0 / (1ULL << 23),
+    1.0 / (1ULL << 24), 1.0 / (1ULL << 25), 1.0 / (1ULL << 26), 1.0 / (1ULL << 27), 1.0 / (1ULL << 28), 1.0 / (1ULL << 29), 1.0 / (1ULL << 30), 1.0 / (1ULL << 31),
+    1.0 / (1ULL << 32), 1.0 / (1ULL << 33), 1.0 / (1ULL << 34), 1.0 / (1ULL << 35), 1.0 / (1ULL << 36), 1.0 / (1ULL << 37), 1.0 / (1ULL << 38), 1.0 / (1ULL << 39),
+    1.0 / (1ULL << 40), 1.0 / (1ULL << 41), 1.0 / (1ULL << 42), 1.0 / (1ULL << 43), 1.0 / (1ULL << 44), 1.0 / (1ULL << 45), 1.0 / (1ULL << 46), 1.0 / (1ULL << 47),
+    1.0 / (1ULL << 48), 1.0 / (1ULL << 49), 1.0 / (1ULL << 50), 1.0 / (1ULL << 51), 1.0 / (1ULL << 52), 1.0 / (1ULL << 53), 1.0 / (1ULL << 54), 1.0 / (1ULL << 55),
+    1.0 / (1ULL << 56), 1.0 / (1ULL << 57), 1.0 / (1ULL << 58), 1.0 / (1ULL << 59), 1.0 / (1ULL << 60), 1.0 / (1ULL << 61), 1.0 / (1ULL << 62), 1.0 / (1ULL << 63),
+};
+
+// Every 3 bytes hold 4 registers, the first register is in the lowest bits.
+static inline void unpack_3_bytes(const uint8_t* p, uint8_t* r)
+{
+    uint32_t v = p[0] | (p[1] << 8) | (p[2] << 16);
+    r[0] = v & 63;
+    r[1] = (v >> 6) & 63;
+    r[2] = (v >> 12) & 63;
+    r[3] = (v >> 18) & 63;
+}
+
+static inline void pack_4_registers(const uint8_t* r, uint8_t* p)
+{
+    uint32_t v = (r[0] & 63) | ((r[1] & 63) << 6) | ((r[2] & 63) << 12) | ((r[3] & 63) << 18);
+    p[0] = v & 0xff;
+    p[1] = (v >> 8) & 0xff;
+    p[2] = (v >> 16) & 0xff;
+}
+
+static void unpack_scalar(const uint8_t* packed, size_t size, uint8_t* registers)
+{
+    for (size_t i = 0; i < size; i += 3, registers += 4) {
+        unpack_3_bytes(packed + i, registers);
+    }
+}
+
+static void pack_scalar(const uint8_t* registers, size_t count, uint8_t* packed)
+{
+    for (size_t i = 0; i < count; i += 4, packed += 3) {
+        pack_4_registers(registers + i, packed);
+    }
+}
+
+static void max_merge_scalar(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    for (size_t i = 0; i < count; ++i) {
+        if (src[i] > dest[i]) {
+            dest[i] = src[i];
+        }
+    }
+}
+
+static double harmonic_sum_scalar(const uint8_t* registers, size_t count, int& ez)
+{
+    double E = 0;
+    ez = 0;
+    for (size_t i = 0; i < count; ++i) {
+        auto r = registers[i] & 63;
+        if (r == 0) {
+            ez++;
+        }
+        E += PE[r];
+    }
+    return E;
+}
+
+#if defined(__x86_64__)
+// The SIMD unpack loads 16 bytes for every 12 bytes, so the loops stop 4 bytes before
+// the end of the input, and the tails are handled by the scalar code.
+__attribute__((target("sse4.1")))
+static void unpack_sse(const uint8_t* packed, size_t size, uint8_t* registers)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m128i m0 = _mm_set1_epi32(0x3f);
+    const __m128i m1 = _mm_set1_epi32(0x3f00);
+    const __m128i m2 = _mm_set1_epi32(0x3f0000);
+    const __m128i m3 = _mm_set1_epi32(0x3f000000);
+    size_t i = 0;
+    for (; i + 16 <= size; i += 12, registers += 16) {
+        auto x = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + i)), shuffle);
+        auto r = _mm_or_si128(_mm_or_si128(_mm_and_si128(x, m0), _mm_and_si128(_mm_slli_epi32(x, 2), m1)),
+                              _mm_or_si128(_mm_and_si128(_mm_slli_epi32(x, 4), m2), _mm_and_si128(_mm_slli_epi32(x, 6), m3)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(registers), r);
+    }
+    unpack_scalar(packed + i, size - i, registers);
+}
+
+__attribute__((target("sse4.1")))
+static void pack_sse(const uint8_t* registers, size_t count, uint8_t* packed)
+{
+    const __m128i shuffle = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+    const __m128i mask = _mm_set1_epi8(0x3f);
+    const __m128i m0 = _mm_set1_epi32(0x3f);
+    const __m128i m1 = _mm_set1_epi32(0xfc0);
+    const __m128i m2 = _mm_set1_epi32(0x3f000);
+    const __m128i m3 = _mm_set1_epi32(0xfc0000);
+    // the store writes 16 bytes for every 12 bytes.
+    size_t i = 0, out = 0;
+    for (; i + 16 <= count && out + 16 <= count / 4 * 3; i += 16, out += 12) {
+        auto x = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(registers + i)), mask);
+        auto v = _mm_or_si128(_mm_or_si128(_mm_and_si128(x, m0), _mm_and_si128(_mm_srli_epi32(x, 2), m1)),
+                              _mm_or_si128(_mm_and_si128(_mm_srli_epi32(x, 4), m2), _mm_and_si128(_mm_srli_epi32(x, 6), m3)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(packed + out), _mm_shuffle_epi8(v, shuffle));
+    }
+    pack_scalar(registers + i, count - i, packed + out);
+}
+
+__attribute__((target("sse4.1")))
+static void max_merge_sse(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dest + i));
+        auto s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dest + i), _mm_max_epu8(d, s));
+    }
+    max_merge_scalar(dest + i, src + i, count - i);
+}
+
+// 2^-r is built directly as the IEEE 754 double with the exponent (1023 - r).
+__attribute__((target("sse4.1")))
+static double harmonic_sum_sse(const uint8_t* registers, size_t count, int& ez)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i mask = _mm_set1_epi8(0x3f);
+    const __m128i bias = _mm_set1_epi64x(1023);
+    __m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+    int zeros = 0;
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto x = _mm_and_si128(_mm_loadu_si128(reinterpret_cast<const __m128i*>(registers + i)), mask);
+        zeros += __builtin_popcount(_mm_movemask_epi8(_mm_cmpeq_epi8(x, zero)));
+        for (int j = 0; j < 8; j += 2) {
+            auto r0 = _mm_cvtepu8_epi64(x);
+            auto r1 = _mm_cvtepu8_epi64(_mm_srli_si128(x, 2));
+            acc0 = _mm_add_pd(acc0, _mm_castsi128_pd(_mm_slli_epi64(_mm_sub_epi64(bias, r0), 52)));
+            acc1 = _mm_add_pd(acc1, _mm_castsi128_pd(_mm_slli_epi64(_mm_sub_epi64(bias, r1), 52)));
+            x = _mm_srli_si128(x, 4);
+        }
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    int tail_zeros = 0;
+    auto E = lanes[0] + lanes[1] + harmonic_sum_scalar(registers + i, count - i, tail_zeros);
+    ez = zeros + tail_zeros;
+    return E;
+}
+
+__attribute__((target("avx2")))
+static void unpack_avx2(const uint8_t* packed, size_t size, uint8_t* registers)
+{
+    const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                             0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256i m0 = _mm256_set1_epi32(0x3f);
+    const __m256i m1 = _mm256_set1_epi32(0x3f00);
+    const __m256i m2 = _mm256_set1_epi32(0x3f0000);
+    const __m256i m3 = _mm256_set1_epi32(0x3f000000);
+    size_t i = 0;
+    // every 128 bits lane unpacks 12 bytes, the high lane is loaded from the offset 12.
+    for (; i + 28 <= size; i += 24, registers += 32) {
+        auto lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + i));
+        auto hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(packed + i + 12));
+        auto x = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), shuffle);
+        auto r = _mm256_or_si256(_mm256_or_si256(_mm256_and_si256(x, m0), _mm256_and_si256(_mm256_slli_epi32(x, 2), m1)),
+                                 _mm256_or_si256(_mm256_and_si256(_mm256_slli_epi32(x, 4), m2), _mm256_and_si256(_mm256_slli_epi32(x, 6), m3)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(registers), r);
+    }
+    unpack_sse(packed + i, size - i, registers);
+}
+
+__attribute__((target("avx2")))
+static void max_merge_avx2(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        auto d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + i));
+        auto s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), _mm256_max_epu8(d, s));
+    }
+    max_merge_scalar(dest + i, src + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static double harmonic_sum_avx2(const uint8_t* registers, size_t count, int& ez)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i mask = _mm256_set1_epi8(0x3f);
+    const __m256i bias = _mm256_set1_epi64x(1023);
+    __m256d acc0 = _mm256_setzero_pd(), acc1 = _mm256_setzero_pd();
+    int zeros = 0;
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        auto x = _mm256_and_si256(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(registers + i)), mask);
+        zeros += __builtin_popcount(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, zero))));
+        auto lo = _mm256_castsi256_si128(x);
+        auto hi = _mm256_extracti128_si256(x, 1);
+        for (int j = 0; j < 2; ++j) {
+            auto r0 = _mm256_cvtepu8_epi64(lo);
+            auto r1 = _mm256_cvtepu8_epi64(_mm_srli_si128(lo, 4));
+            auto r2 = _mm256_cvtepu8_epi64(_mm_srli_si128(lo, 8));
+            auto r3 = _mm256_cvtepu8_epi64(_mm_srli_si128(lo, 12));
+            acc0 = _mm256_add_pd(acc0, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r0), 52)));
+            acc1 = _mm256_add_pd(acc1, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r1), 52)));
+            acc0 = _mm256_add_pd(acc0, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r2), 52)));
+            acc1 = _mm256_add_pd(acc1, _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, r3), 52)));
+            lo = hi;
+        }
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, _mm256_add_pd(acc0, acc1));
+    int tail_zeros = 0;
+    auto E = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + harmonic_sum_scalar(registers + i, count - i, tail_zeros);
+    ez = zeros + tail_zeros;
+    return E;
+}
+#endif
+
+struct kernel_set {
+    const char* name;
+    void (*unpack)(const uint8_t*, size_t, uint8_t*);
+    void (*pack)(const uint8_t*, size_t, uint8_t*);
+    void (*max_merge)(uint8_t*, const uint8_t*, size_t);
+    double (*harmonic_sum)(const uint8_t*, size_t, int&);
+};
+
+// Returns the implementations supported by the CPU, the fastest one first.
+static std::vector<kernel_set> supported_kernels()
+{
+    std::vector<kernel_set> result;
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        result.push_back(kernel_set { "avx2", unpack_avx2, pack_sse, max_merge_avx2, harmonic_sum_avx2 });
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        result.push_back(kernel_set { "sse4.1", unpack_sse, pack_sse, max_merge_sse, harmonic_sum_sse });
+    }
+#endif
+    result.push_back(kernel_set { "scalar", unpack_scalar, pack_scalar, max_merge_scalar, harmonic_sum_scalar });
+    return result;
+}
+
+static kernel_set& kernels()
+{
+    static kernel_set _kernels = supported_kernels().front();
+    return _kernels;
+}
+
+bool select(const char* name)
+{
+    for (auto& k : supported_kernels()) {
+        if (strcmp(k.name, name) == 0) {
+            kernels() = k;
+            return true;
+        }
+    }
+    return false;
+}
+
+void unpack(const uint8_t* packed, size_t size, uint8_t* registers)
+{
+    kernels().unpack(packed, size, registers);
+}
+
+void pack(const uint8_t* registers, size_t count, uint8_t* packed)
+{
+    kernels().pack(registers, count, packed);
+}
+
+void max_merge(uint8_t* dest, const uint8_t* src, size_t count)
+{
+    kernels().max_merge(dest, src, count);
+}
+
+double harmonic_sum(const uint8_t* registers, size_t count, int& ez)
+{
+    return kernels().harmonic_sum(registers, count, ez);
+}
+
+const char* implementation()
+{
+    return kernels().name;
+}
+}
+}
@@ -0,0 +1,51 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+namespace redis {
+// The kernels on the HLL registers. The implementation (AVX2, SSE4.1 or the scalar
+// one) is selected once at runtime by the features of the CPU, because the binary
+// is built for -march=nehalem.
+namespace hll_kernels {
+// Unpacks the 6 bits registers to one byte per register, the size (in bytes) must be
+// a multiple of 3.
+void unpack(const uint8_t* packed, size_t size, uint8_t* registers);
+
+// Packs the registers (one byte per register) to the 6 bits registers, the count
+// must be a multiple of 4.
+void pack(const uint8_t* registers, size_t count, uint8_t* packed);
+
+// dest[i] = max(dest[i], src[i]).
+void max_merge(uint8_t* dest, const uint8_t* src, size_t count);
+
+// Returns the sum of 2^-register, the number of zero registers is stored in ez.
+double harmonic_sum(const uint8_t* registers, size_t count, int& ez);
+
+// Returns the name of the selected implementation.
+const char* implementation();
+
+// Switches to the implementation by its name ("avx2", "sse4.1" or "scalar"), so the
+// tests compare the SIMD kernels with the scalar ones. Returns false if the CPU does
+// not support it.
+bool select(const char* name);
+}
+}
@@ -1,2 +1,594 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
 #include "list_lsa.hh"
-namespace redis {}
+#include <memory>
+#include <algorithm>
+#include <lz4.h>
+namespace redis {
+
+static constexpr const size_t ELEMENT_HEADER_SIZE = 4;
+static constexpr const size_t ELEMENT_OVERHEAD = 2 * ELEMENT_HEADER_SIZE;
+static thread_local list_lsa::options _list_options;
+
+void list_lsa::configure(size_t max_chunk_bytes, size_t max_chunk_elements, size_t compress_depth)
+{
+    if (max_chunk_bytes > 0) {
+        _list_options._max_chunk_bytes = max_chunk_bytes;
+    }
+    _list_options._max_chunk_elements = max_chunk_elements;
+    _list_options._compress_depth = compress_depth;
+}
+
+const list_lsa::options& list_lsa::get_options()
+{
+    return _list_options;
+}
+
+static inline void write_element_size(char* p, uint32_t size)
+{
+    p[0] = static_cast<char>(size & 0xff);
+    p[1] = static_cast<char>((size >> 8) & 0xff);
+    p[2] = static_cast<char>((size >> 16) & 0xff);
+    p[3] = static_cast<char>((size >> 24) & 0xff);
+}
+
+static inline uint32_t read_element_size(const char* p)
+{
+    const uint8_t* u = reinterpret_cast<const uint8_t*>(p);
+    return static_cast<uint32_t>(u[0]) | (static_cast<uint32_t>(u[1]) << 8) | (static_cast<uint32_t>(u[2]) << 16) | (static_cast<uint32_t>(u[3]) << 24);
+}
+
+static bytes pack_elements(const std::vector<bytes_view>& elements, size_t begin, size_t end)
+{
+    size_t total = 0;
+    for (size_t i = begin; i < end; ++i) {
+        total += ELEMENT_OVERHEAD + elements[i].size();
+    }
+    bytes packed(bytes::initialized_later(), total);
+    char* p = packed.begin();
+    for (size_t i = begin; i < end; ++i) {
+        const auto& e = elements[i];
+        write_element_size(p, e.size());
+        p += ELEMENT_HEADER_SIZE;
+        memcpy(p, e.data(), e.size());
+        p += e.size();
+        write_element_size(p, e.size());
+        p += ELEMENT_HEADER_SIZE;
+    }
+    return packed;
+}
+
+// Writes the encoded element at the offset of the blob, the blob is extended if the
+// element goes beyond its end.
+static void write_element(managed_bytes& data, size_t offset, bytes_view e)
+{
+    char size[ELEMENT_HEADER_SIZE];
+    write_element_size(size, e.size());
+    data.write(offset, bytes_view { size, ELEMENT_HEADER_SIZE });
+    data.write(offset + ELEMENT_HEADER_SIZE, e);
+    data.write(offset + ELEMENT_HEADER_SIZE + e.size(), bytes_view { size, ELEMENT_HEADER_SIZE });
+}
+
+static uint32_t read_element_size(const managed_bytes& data, size_t offset)
+{
+    char size[ELEMENT_HEADER_SIZE];
+    data.copy_to(offset, ELEMENT_HEADER_SIZE, size);
+    return read_element_size(size);
+}
+
+// The decoded payload of a chunk. If the payload was compressed or fragmented, or the
+// caller will allocate in the region (which may move the chunk), the payload is copied
+// out of the LSA, otherwise the views point to the chunk directly.
+class chunk_contents {
+    std::unique_ptr<char[]> _buffer;
+    bytes_view _raw;
+public:
+    chunk_contents(const managed_bytes& data, bool compressed, uint32_t head, uint32_t raw_size, bool owned)
+    {
+        if (compressed) {
+            _buffer.reset(new char[raw_size]);
+            with_linearized_managed_bytes([this, &data, raw_size] {
+                auto n = LZ4_decompress_safe(data.data(), _buffer.get(), data.size(), raw_size);
+                assert(n == static_cast<int>(raw_size));
+            });
+            _raw = bytes_view { _buffer.get(), raw_size };
+        }
+        else if (owned || data.is_fragmented()) {
+            _buffer.reset(new char[raw_size]);
+            data.copy_to(head, raw_size, _buffer.get());
+            _raw = bytes_view { _buffer.get(), raw_size };
+        }
+        else {
+            _raw = bytes_view { data.data() + head, raw_size };
+        }
+    }
+
+    bytes_view raw() const
+    {
+        return _raw;
+    }
+
+    // Visits the elements until the func returns true.
+    template <typename Func>
+    bool for_each(Func&& func) const
+    {
+        const char* p = _raw.data();
+        const char* end = p + _raw.size();
+        while (p < end) {
+            auto size = read_element_size(p);
+            p += ELEMENT_HEADER_SIZE;
+            if (func(bytes_view { p, size })) {
+                return true;
+            }
+            p += size + ELEMENT_HEADER_SIZE;
+        }
+        return false;
+    }
+
+    std::vector<bytes_view> elements() const
+    {
+        std::vector<bytes_view> result;
+        for_each([&result] (bytes_view e) {
+            result.push_back(e);
+            return false;
+        });
+        return result;
+    }
+};
+
+list_lsa::chunk::chunk(chunk&& o) noexcept
+    : _link()
+    , _data(std::move(o._data))
+    , _count(o._count)
+    , _head(o._head)
+    , _raw_size(o._raw_size)
+    , _compressed(o._compressed)
+{
+    using container_type = list_lsa::chunk_list_type;
+    container_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
+    container_type::node_algorithms::init(o._link.this_ptr());
+}
+
+bool list_lsa::fits(const chunk& c, size_t extra_bytes) const
+{
+    auto max_elements = _list_options._max_chunk_elements;
+    return (max_elements == 0 || c._count < max_elements)
+        && c._raw_size + ELEMENT_OVERHEAD + extra_bytes <= _list_options._max_chunk_bytes;
+}
+
+void list_lsa::relocate(chunk& c, size_t room)
+{
+    bytes live(bytes::initialized_later(), c._raw_size);
+    c._data.copy_to(c._head, c._raw_size, live.begin());
+    managed_bytes data(managed_bytes::initialized_later(), room);
+    data.append(bytes_view { live });
+    c._data = std::move(data);
+    c._head = room;
+}
+
+void list_lsa::push_chunk_front(chunk& c, bytes_view data)
+{
+    assert(!c._compressed);
+    size_t size = ELEMENT_OVERHEAD + data.size();
+    if (c._head < size) {
+        // reserve the room proportional to the elements, so a sequence of pushes
+        // copies the chunk for amortized O(1) times.
+        auto room = std::max(size, std::min<size_t>(c._raw_size, _list_options._max_chunk_bytes - c._raw_size));
+        relocate(c, room);
+    }
+    c._head -= size;
+    write_element(c._data, c._head, data);
+    c._raw_size += size;
+    ++c._count;
+}
+
+void list_lsa::push_chunk_back(chunk& c, bytes_view data)
+{
+    assert(!c._compressed);
+    // the blob grows with a doubled capacity, and overwrites the bytes left by the pops.
+    write_element(c._data, c._head + c._raw_size, data);
+    c._raw_size += ELEMENT_OVERHEAD + data.size();
+    ++c._count;
+}
+
+void list_lsa::pop_chunk_front(chunk& c)
+{
+    assert(!c._compressed);
+    size_t size = ELEMENT_OVERHEAD + read_element_size(c._data, c._head);
+    c._head += size;
+    c._raw_size -= size;
+    --c._count;
+    // the blob is shrunk once the popped bytes exceed the elements.
+    if (c._data.size() > 2 * c._raw_size + ELEMENT_OVERHEAD) {
+        relocate(c, 0);
+    }
+}
+
+void list_lsa::pop_chunk_back(chunk& c)
+{
+    assert(!c._compressed);
+    size_t size = ELEMENT_OVERHEAD + read_element_size(c._data, c._head + c._raw_size - ELEMENT_HEADER_SIZE);
+    c._raw_size -= size;
+    --c._count;
+    if (c._data.size() > 2 * c._raw_size + ELEMENT_OVERHEAD) {
+        relocate(c, 0);
+    }
+}
+
+bool list_lsa::interior(size_t position) const
+{
+    auto depth = _list_options._compress_depth;
+    return depth > 0 && position >= depth && position + depth < _chunks.size();
+}
+
+void list_lsa::maybe_compress(chunk& c, bool interior_chunk)
+{
+    if (interior_chunk == c._compressed) {
+        return;
+    }
+    if (interior_chunk) {
+        chunk_contents raw { c._data, false, c._head, c._raw_size, true };
+        std::vector<char> out(LZ4_compressBound(c._raw_size));
+        auto n = LZ4_compress_default(raw.raw().data(), out.data(), c._raw_size, out.size());
+        // skip the chunks which compress poorly.
+        if (n <= 0 || static_cast<size_t>(n) + c._raw_size / 8 >= c._raw_size) {
+            return;
+        }
+        c._data = managed_bytes(bytes_view { out.data(), static_cast<size_t>(n) });
+        c._head = 0;
+        c._compressed = true;
+    }
+    else {
+        chunk_contents raw { c._data, true, 0, c._raw_size, true };
+        c._data = managed_bytes(raw.raw());
+        c._compressed = false;
+    }
+}
+
+void list_lsa::rebalance_compression()
+{
+    auto depth = _list_options._compress_depth;
+    if (depth == 0) {
+        return;
+    }
+    // only the chunks near to both ends could change their state.
+    size_t position = 0;
+    for (auto it = _chunks.begin(); it != _chunks.end() && position <= depth; ++it, ++position) {
+        maybe_compress(*it, interior(position));
+    }
+    position = _chunks.size();
+    for (auto it = _chunks.rbegin(); it != _chunks.rend() && _chunks.size() - position <= depth; ++it) {
+        --position;
+        maybe_compress(*it, interior(position));
+    }
+}
+
+list_lsa::chunk* list_lsa::make_chunk(const std::vector<bytes_view>& elements)
+{
+    auto packed = pack_elements(elements, 0, elements.size());
+    return current_allocator().construct<chunk>(bytes_view { packed }, elements.size());
+}
+
+void list_lsa::store(chunk& c, const std::vector<bytes_view>& elements, size_t position)
+{
+    // split the elements by the limits of the chunk, the first part is stored in c,
+    // and the others are stored in the new chunks after c.
+    std::vector<bytes> parts;
+    std::vector<uint32_t> counts;
+    size_t begin = 0, bytes_in_part = 0;
+    for (size_t i = 0; i < elements.size(); ++i) {
+        auto size = ELEMENT_OVERHEAD + elements[i].size();
+        auto max_elements = _list_options._max_chunk_elements;
+        if (i > begin && ((max_elements > 0 && i - begin >= max_elements) || bytes_in_part + size > _list_options._max_chunk_bytes)) {
+            parts.emplace_back(pack_elements(elements, begin, i));
+            counts.push_back(i - begin);
+            begin = i;
+            bytes_in_part = 0;
+        }
+        bytes_in_part += size;
+    }
+    parts.emplace_back(pack_elements(elements, begin, elements.size()));
+    counts.push_back(elements.size() - begin);
+
+    c._data = managed_bytes(bytes_view { parts[0] });
+    c._count = counts[0];
+    c._head = 0;
+    c._raw_size = parts[0].size();
+    c._compressed = false;
+    auto next = std::next(chunk_list_type::s_iterator_to(c));
+    for (size_t i = 1; i < parts.size(); ++i) {
+        auto nc = current_allocator().construct<chunk>(bytes_view { parts[i] }, counts[i]);
+        _chunks.insert(next, *nc);
+    }
+    if (parts.size() > 1) {
+        rebalance_compression();
+    }
+    else {
+        maybe_compress(c, interior(position));
+    }
+}
+
+void list_lsa::erase_chunk(iterator it)
+{
+    _chunks.erase_and_dispose(it, current_deleter<chunk>());
+}
+
+list_lsa::const_iterator list_lsa::locate(size_t index, size_t& offset, size_t& position) const
+{
+    assert(index < _size);
+    if (index < _size / 2) {
+        position = 0;
+        for (auto it = _chunks.begin(); it != _chunks.end(); ++it, ++position) {
+            if (index < it->_count) {
+                offset = index;
+                return it;
+            }
+            index -= it->_count;
+        }
+    }
+    else {
+        size_t rindex = _size - 1 - index;
+        position = _chunks.size();
+        for (auto it = _chunks.rbegin(); it != _chunks.rend(); ++it) {
+            --position;
+            if (rindex < it->_count) {
+                offset = it->_count - 1 - rindex;
+                return chunk_list_type::s_iterator_to(*it);
+            }
+            rindex -= it->_count;
+        }
+    }
+    assert(false);
+    return _chunks.end();
+}
+
+list_lsa::iterator list_lsa::locate(size_t index, size_t& offset, size_t& position)
+{
+    auto it = const_cast<const list_lsa*>(this)->locate(index, offset, position);
+    return _chunks.iterator_to(const_cast<chunk&>(*it));
+}
+
+void list_lsa::insert_head(bytes_view data)
+{
+    if (!_chunks.empty() && fits(_chunks.front(), data.size())) {
+        push_chunk_front(_chunks.front(), data);
+    }
+    else {
+        _chunks.push_front(*make_chunk({ data }));
+        rebalance_compression();
+    }
+    ++_size;
+}
+
+void list_lsa::insert_tail(bytes_view data)
+{
+    if (!_chunks.empty() && fits(_chunks.back(), data.size())) {
+        push_chunk_back(_chunks.back(), data);
+    }
+    else {
+        _chunks.push_back(*make_chunk({ data }));
+        rebalance_compression();
+    }
+    ++_size;
+}
+
+void list_lsa::insert_at(size_t index, bytes_view data)
+{
+    assert(index <= _size);
+    if (index == 0) {
+        return insert_head(data);
+    }
+    if (index == _size) {
+        return insert_tail(data);
+    }
+    size_t offset = 0, position = 0;
+    auto it = locate(index, offset, position);
+    chunk_contents contents { it->_data, it->_compressed, it->_head, it->_raw_size, true };
+    auto elements = contents.elements();
+    elements.insert(elements.begin() + offset, data);
+    store(*it, elements, position);
+    ++_size;
+}
+
+void list_lsa::set(size_t index, bytes_view data)
+{
+    size_t offset = 0, position = 0;
+    auto it = locate(index, offset, position);
+    chunk_contents contents { it->_data, it->_compressed, it->_head, it->_raw_size, true };
+    auto elements = contents.elements();
+    elements[offset] = data;
+    store(*it, elements, position);
+}
+
+bytes list_lsa::at(size_t index) const
+{
+    size_t offset = 0, position = 0;
+    auto it = locate(index, offset, position);
+    chunk_contents contents { it->_data, it->_compressed, it->_head, it->_raw_size, false };
+    bytes result;
+    contents.for_each([&result, &offset] (bytes_view e) {
+        if (offset-- == 0) {
+            result = bytes { e.data(), e.size() };
+            return true;
+        }
+        return false;
+    });
+    return result;
+}
+
+size_t list_lsa::index_of(bytes_view pivot) const
+{
+    size_t index = 0;
+    for (auto it = _chunks.begin(); it != _chunks.end(); ++it) {
+        chunk_contents contents { it->_data, it->_compressed, it->_head, it->_raw_size, false };
+        if (contents.for_each([&index, pivot] (bytes_view e) {
+            if (e == pivot) {
+                return true;
+            }
+            ++index;
+            return false;
+        })) {
+            return index;
+        }
+    }
+    return _size;
+}
+
+void list_lsa::pop_front()
+{
+    assert(!empty());
+    auto& c = _chunks.front();
+    if (c._count == 1) {
+        erase_chunk(_chunks.begin());
+        rebalance_compression();
+    }
+    else {
+        pop_chunk_front(c);
+    }
+    --_size;
+}
+
+void list_lsa::pop_back()
+{
+    assert(!empty());
+    auto& c = _chunks.back();
+    if (c._count == 1) {
+        erase_chunk(chunk_list_type::s_iterator_to(c));
+        rebalance_compression();
+    }
+    else {
+        pop_chunk_back(c);
+    }
+    --_size;
+}
+
+size_t list_lsa::remove_equals(bytes_view data, size_t limit, bool from_head)
+{
+    size_t erased = 0;
+    size_t nchunks = _chunks.size();
+    size_t position = from_head ? 0 : nchunks - 1;
+    auto it = from_head ? _chunks.begin() : (_chunks.empty() ? _chunks.end() : std::prev(_chunks.end()));
+    while (it != _chunks.end() && (limit == 0 || erased < limit)) {
+        auto next = from_head ? std::next(it) : (it == _chunks.begin() ? _chunks.end() : std::prev(it));
+        // read only check first, most of chunks do not contain the target.
+        chunk_contents view { it->_data, it->_compressed, it->_head, it->_raw_size, false };
+        bool matched = view.for_each([data] (bytes_view e) { return e == data; });
+        if (matched) {
+            chunk_contents contents { it->_data, it->_compressed, it->_head, it->_raw_size, true };
+            auto elements = contents.elements();
+            std::vector<bytes_view> kept;
+            kept.reserve(elements.size());
+            if (from_head) {
+                for (size_t i = 0; i < elements.size(); ++i) {
+                    if (elements[i] == data && (limit == 0 || erased < limit)) {
+                        ++erased;
+                        continue;
+                    }
+                    kept.push_back(elements[i]);
+                }
+            }
+            else {
+                for (size_t i = elements.size(); i > 0; --i) {
+                    if (elements[i - 1] == data && (limit == 0 || erased < limit)) {
+                        ++erased;
+                        continue;
+                    }
+                    kept.push_back(elements[i - 1]);
+                }
+                std::reverse(kept.begin(), kept.end());
+            }
+            if (kept.empty()) {
+                erase_chunk(it);
+            }
+            else {
+                store(*it, kept, position);
+            }
+        }
+        it = next;
+        position = from_head ? position + 1 : position - 1;
+    }
+    _size -= erased;
+    if (_chunks.size() != nchunks) {
+        rebalance_compression();
+    }
+    return erased;
+}
+
+bool list_lsa::trim(size_t start, size_t end)
+{
+    if (end > _size) {
+        end = _size;
+    }
+    if (start >= end) {
+        clear();
+        return true;
+    }
+    size_t index = 0, position = 0;
+    for (auto it = _chunks.begin(); it != _chunks.end(); ++position) {
+        auto next = std::next(it);
+        size_t chunk_begin = index, chunk_end = index + it->_count;
+        index = chunk_end;
+        if (chunk_end <= start || chunk_begin >= end) {
+            erase_chunk(it);
+        }
+        else if (chunk_begin < start || chunk_end > end) {
+            chunk_contents contents { it->_data, it->_compressed, it->_head, it->_raw_size, true };
+            auto elements = contents.elements();
+            auto first = std::max(start, chunk_begin) - chunk_begin;
+            auto last = std::min(end, chunk_end) - chunk_begin;
+            std::vector<bytes_view> kept(elements.begin() + first, elements.begin() + last);
+            store(*it, kept, position);
+        }
+        it = next;
+    }
+    _size = end - start;
+    rebalance_compression();
+    return true;
+}
+
+void list_lsa::clear()
+{
+    _chunks.clear_and_dispose(current_deleter<chunk>());
+    _size = 0;
+}
+
+void list_lsa::reduce(size_t start, size_t end, std::function<void(bytes_view)>&& reduce_fn) const
+{
+    if (end > _size) {
+        end = _size;
+    }
+    if (start >= end) {
+        return;
+    }
+    size_t offset = 0, position = 0, left = end - start;
+    for (auto it = locate(start, offset, position); it != _chunks.end() && left > 0; ++it) {
+        chunk_contents contents { it->_data, it->_compressed, it->_head, it->_raw_size, false };
+        contents.for_each([&offset, &left, &reduce_fn] (bytes_view e) {
+            if (offset > 0) {
+                --offset;
+                return false;
+            }
+            reduce_fn(e);
+            return --left == 0;
+        });
+    }
+}
+}
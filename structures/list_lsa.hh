@@ -20,37 +20,71 @@
 */
 #pragma once
 #include <boost/intrusive/list.hpp>
+#include <functional>
+#include <vector>
 #include "utils/allocation_strategy.hh"
 #include "utils/managed_ref.hh"
 #include "utils/managed_bytes.hh"
+#include "utils/bytes.hh"
 namespace redis {
+// list_lsa is a doubly linked list of packed chunks (like the quicklist of redis).
+// Every chunk is a single LSA blob which holds several elements, each element
+// is encoded as [4 bytes little endian length][payload][4 bytes little endian length],
+// the trailing length lets the last element be found from the end. The pushes and
+// the pops on both ends of the list only touch the bytes of the element, the other
+// operations repack the chunk. The chunks which are far enough from both ends of
+// the list may be compressed by LZ4, because the queue-like workloads only touch
+// the head and the tail.
 class list_lsa {
-    struct internal_node {
+public:
+    struct options {
+        // the max size of the uncompressed payload of a chunk.
+        size_t _max_chunk_bytes = 8192;
+        // the max number of elements in a chunk, 0 means only the size of the
+        // payload limits the chunk.
+        size_t _max_chunk_elements = 128;
+        // the number of chunks on each end of the list that are never compressed,
+        // 0 means the compression was disabled.
+        size_t _compress_depth = 0;
+    };
+    static void configure(size_t max_chunk_bytes, size_t max_chunk_elements, size_t compress_depth);
+    static const options& get_options();
+private:
+    struct chunk {
         boost::intrusive::list_member_hook<> _link;
         managed_bytes _data;
-        internal_node(bytes_view data) noexcept : _link(), _data(data) {}
-        internal_node(internal_node&& o) noexcept
-            : _link(std::move(o._link)), _data(std::move(o._data))
+        uint32_t _count;
+        // the elements are stored in [_head, _head + _raw_size) of the _data, the bytes
+        // around them are left by the pops, or reserved for the pushes.
+        uint32_t _head;
+        uint32_t _raw_size;
+        bool _compressed;
+        chunk(bytes_view packed, uint32_t count) noexcept
+            : _link()
+            , _data(packed)
+            , _count(count)
+            , _head(0)
+            , _raw_size(packed.size())
+            , _compressed(false)
         {
         }
-        inline bool operator==(const internal_node& o) const
-        {
-            return _data == o._data;
-        }
+        chunk(chunk&& o) noexcept;
     };
-    using internal_list_type = boost::intrusive::list<internal_node,
-                                                      boost::intrusive::member_hook<internal_node, boost::intrusive::list_member_hook<>,
-                                                      &internal_node::_link>>;
-    using const_iterator = internal_list_type::const_iterator;
-    using iterator = internal_list_type::iterator;
-    internal_list_type  _list;
+    using chunk_list_type = boost::intrusive::list<chunk,
+                                                   boost::intrusive::member_hook<chunk, boost::intrusive::list_member_hook<>,
+                                                   &chunk::_link>>;
+    using iterator = chunk_list_type::iterator;
+    using const_iterator = chunk_list_type::const_iterator;
+    chunk_list_type _chunks;
+    size_t _size = 0;
 public:
     list_lsa() noexcept
     {
     }
 
-    list_lsa(list_lsa&& o) noexcept : _list(std::move(o._list))
+    list_lsa(list_lsa&& o) noexcept : _chunks(std::move(o._chunks)), _size(o._size)
     {
+        o._size = 0;
     }
 
     ~list_lsa()
@@ -58,189 +92,107 @@ public:
         clear();
     }
     // Inserts the value in the front of the list.
-    inline void insert_head(const sstring& data)
-    {
-        bytes_view v {data.data(), data.size()};
-        auto entry = current_allocator().construct<internal_node>(v);
-        _list.push_front(*entry);
-    }
+    void insert_head(bytes_view data);
 
     // Inserts the value in the back of the list.
-    inline void insert_tail(const sstring& data)
-    {
-        bytes_view v {data.data(), data.size()};
-        auto entry = current_allocator().construct<internal_node>(v);
-        _list.push_back(*entry);
-    }
+    void insert_tail(bytes_view data);
 
-    inline void insert_at(size_t index, const sstring& data)
-    {
-        assert(index < _list.size());
-        bytes_view v {data.data(), data.size()};
-        auto entry = current_allocator().construct<internal_node>(v);
-        const_iterator p = iterator_to(index);
-        _list.insert(p, *entry);
-    }
+    // Inserts the value before the element at index, index == size() appends it.
+    void insert_at(size_t index, bytes_view data);
 
-    inline size_t index_of(const std::string& pivot)
-    {
-        size_t result = _list.size();
-        for (auto i = _list.begin(); i != _list.end(); ++i, --result) {
-            if (equal(pivot, *i)) {
-                return _list.size() - result;
-            }
-        }
-        return result;
-    }
+    // Returns the index of the first element equals to pivot, or size() if not found.
+    size_t index_of(bytes_view pivot) const;
 
-    inline const managed_bytes& at(size_t index) const
-    {
-        assert(index < _list.size());
-        auto i = iterator_to(index);
-        return i->_data;
-    }
+    // Returns a copy of the element at index.
+    bytes at(size_t index) const;
 
-    inline managed_bytes& at(size_t index)
-    {
-        assert(index < _list.size());
-        iterator i = iterator_to(index);
-        return i->_data;
-    }
+    // Replaces the element at index.
+    void set(size_t index, bytes_view data);
 
-    // Returns a reference to the data of first element of the list.
-    inline const managed_bytes& front() const
+    // Returns a copy of the first element of the list.
+    bytes front() const
     {
-        auto& front_ref = _list.front();
-        return front_ref._data;
+        return at(0);
     }
 
-    // Erases the first element of the list. Destructors are called.
-    inline void pop_front()
-    {
-        _list.pop_front_and_dispose(current_deleter<internal_node>());
-    }
+    // Erases the first element of the list.
+    void pop_front();
 
-    // Returns a reference to the data of last element of the list.
-    inline const managed_bytes& back() const
+    // Returns a copy of the last element of the list.
+    bytes back() const
     {
-        auto& back_ref = _list.back();
-        return back_ref._data;
+        return at(_size - 1);
     }
 
-    // Erases the last element of the list. Destructors are called.
-    inline void pop_back()
-    {
-        _list.pop_back_and_dispose(current_deleter<internal_node>());
-    }
+    // Erases the last element of the list.
+    void pop_back();
 
     inline bool empty() const
     {
-        return _list.empty();
+        return _size == 0;
     }
 
     // Returns the number of the elements contained in the list.
     inline size_t size() const
     {
-        return static_cast<size_t>(_list.size());
+        return _size;
     }
 
-    // Erase the elements from the list.
-    inline void erase(const sstring& data)
+    // Returns the number of the chunks, for the memory statistics.
+    inline size_t chunks() const
     {
-        trem<false, true>(data, size_t{1});
+        return _chunks.size();
     }
 
-    template<bool RemoveAllEqual, bool FromHeadToTail>
-    inline size_t trem(const std::string& data, size_t count)
+    // Erase the first element equals to data.
+    inline void erase(bytes_view data)
     {
-        size_t erased = 0;
-        if (FromHeadToTail) {
-            for (auto it = _list.begin(); it != _list.end(); ++it) {
-                if (equal(*it, data)) {
-                    ++erased;
-                    const_iterator eit = it;
-                    ++it;
-                    _list.erase_and_dispose(eit, current_deleter<internal_node>());
-                    if (!RemoveAllEqual && erased == count) {
-                        break;
-                    }
-                }
-            }
-        }
-        else {
-            for (auto it = _list.rbegin(); it != _list.rend(); ++it) {
-                if (equal(*it, data)) {
-                    ++erased;
-                    auto& entry = *it;
-                    ++it;
-                    _list.remove_and_dispose(entry, current_deleter<internal_node>());
-                    if (!RemoveAllEqual && erased == count) {
-                        break;
-                    }
-                }
-            }
-        }
-        return erased;
+        trem<false, true>(data, size_t{1});
     }
 
-    inline bool trim(size_t start, size_t end)
+    template<bool RemoveAllEqual, bool FromHeadToTail>
+    inline size_t trem(bytes_view data, size_t count)
     {
-        auto i = iterator_to(start);
-        for (auto it = _list.begin(); it != i; ++it) {
-            _list.erase_and_dispose(it, current_deleter<internal_node>());
-        }
-        for (auto it = iterator_to(end); it != _list.end(); ++it) {
-            _list.erase_and_dispose(it, current_deleter<internal_node>());
-        }
-        return true;
+        return remove_equals(data, RemoveAllEqual ? 0 : count, FromHeadToTail);
     }
 
-    // Erases all the elements of the list. Destructors are called.
-    inline void clear()
-    {
-        _list.clear_and_dispose(current_deleter<internal_node>());
-    }
+    // Keeps the elements in the range [start, end), and erases the others.
+    bool trim(size_t start, size_t end);
 
-    // reduce
-    void reduce(size_t start, size_t end, std::function<void(const_iterator it)>&& reduce_fn)
-    {
-        auto start_it = iterator_to(start);
-        auto end_it = iterator_to(end);
-        for (; start_it != end_it; ++start_it) {
-            reduce_fn(start_it);
-        }
-    }
+    // Erases all the elements of the list.
+    void clear();
+
+    // Visits the elements in the range [start, end).
+    void reduce(size_t start, size_t end, std::function<void(bytes_view)>&& reduce_fn) const;
 
     bool index_out_of_range(long index) const
     {
-        return index < 0 || static_cast<size_t>(index) > _list.size();
+        return index < 0 || static_cast<size_t>(index) >= _size;
     }
 private:
-    const_iterator iterator_to(size_t index) const
-    {
-        auto i = _list.begin();
-        for (size_t idx = 0; idx < index && i != _list.end(); ++idx, ++i) {};
-        return i;
-    }
-    iterator iterator_to(size_t index)
-    {
-        auto i = _list.begin();
-        for (size_t idx = 0; idx < index && i != _list.end(); ++idx, ++i) {};
-        return i;
-    }
-
-    inline bool equal(const internal_node& n, const sstring& data) const
-    {
-        auto mb = n._data;
-        bytes_view b {mb.data(), mb.size()} ;
-        bytes_view a {data.data(), data.size()};
-        return b == a;
-    }
-
-    inline bool equal(const sstring& data, const internal_node& n) const
-    {
-        return equal(data, n);
-    }
-
+    size_t remove_equals(bytes_view data, size_t limit, bool from_head);
+    // Locates the chunk which contains the element at index, the offset in the chunk is
+    // stored in the offset. The list is walked from the nearer end.
+    const_iterator locate(size_t index, size_t& offset, size_t& position) const;
+    iterator locate(size_t index, size_t& offset, size_t& position);
+    // Replaces the content of the chunk by the elements.
+    void store(chunk& c, const std::vector<bytes_view>& elements, size_t position);
+    chunk* make_chunk(const std::vector<bytes_view>& elements);
+    void erase_chunk(iterator it);
+    // Splits the elements into chunks and inserts them before the position.
+    void insert_chunks(const_iterator pos, const std::vector<bytes_view>& elements);
+    bool interior(size_t position) const;
+    // Compress or decompress the chunks near to both ends after the shape of the list was changed.
+    void rebalance_compression();
+    void maybe_compress(chunk& c, bool interior_chunk);
+    bool fits(const chunk& c, size_t extra_bytes) const;
+    // Pushes or pops the element on the ends of the uncompressed chunk in place.
+    void push_chunk_front(chunk& c, bytes_view data);
+    void push_chunk_back(chunk& c, bytes_view data);
+    void pop_chunk_front(chunk& c);
+    void pop_chunk_back(chunk& c);
+    // Moves the elements of the chunk to a new blob, which leaves the room bytes
+    // before them.
+    void relocate(chunk& c, size_t room);
 };
 }
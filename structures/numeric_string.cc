@@ -0,0 +1,174 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#include "numeric_string.hh"
+#include <cctype>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+namespace redis {
+
+bool numeric_string::to_int64(const char* s, size_t size, int64_t& value)
+{
+    if (size == 0 || size > INT64_MAX_CHARS) {
+        return false;
+    }
+    size_t i = 0;
+    bool negative = false;
+    if (s[0] == '-') {
+        negative = true;
+        if (++i == size) {
+            return false;
+        }
+    }
+    // "0" is the only number starts with '0', so "-0" and "007" are not canonical.
+    if (s[i] == '0') {
+        if (size == 1) {
+            value = 0;
+            return true;
+        }
+        return false;
+    }
+    uint64_t v = 0;
+    for (; i < size; ++i) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+        uint64_t digit = s[i] - '0';
+        if (v > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        v = v * 10 + digit;
+    }
+    if (negative) {
+        if (v > static_cast<uint64_t>(INT64_MAX) + 1) {
+            return false;
+        }
+        value = static_cast<int64_t>(0 - v);
+    }
+    else {
+        if (v > static_cast<uint64_t>(INT64_MAX)) {
+            return false;
+        }
+        value = static_cast<int64_t>(v);
+    }
+    return true;
+}
+
+bool numeric_string::to_uint64(const char* s, size_t size, uint64_t& value)
+{
+    if (size == 0 || size > INT64_MAX_CHARS) {
+        return false;
+    }
+    if (s[0] == '0') {
+        if (size == 1) {
+            value = 0;
+            return true;
+        }
+        return false;
+    }
+    uint64_t v = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (s[i] < '0' || s[i] > '9') {
+            return false;
+        }
+        uint64_t digit = s[i] - '0';
+        if (v > (UINT64_MAX - digit) / 10) {
+            return false;
+        }
+        v = v * 10 + digit;
+    }
+    value = v;
+    return true;
+}
+
+bool numeric_string::to_double(const char* s, size_t size, double& value)
+{
+    if (size == 0 || size >= DOUBLE_MAX_CHARS || isspace(s[0])) {
+        return false;
+    }
+    char buf[DOUBLE_MAX_CHARS];
+    memcpy(buf, s, size);
+    buf[size] = '\0';
+    char* end = nullptr;
+    errno = 0;
+    value = strtod(buf, &end);
+    if (end != buf + size || (errno == ERANGE && (value == HUGE_VAL || value == -HUGE_VAL || value == 0)) || std::isnan(value)) {
+        return false;
+    }
+    return true;
+}
+
+size_t numeric_string::from_int64(char* out, int64_t value)
+{
+    char digits[INT64_MAX_CHARS];
+    size_t n = 0;
+    uint64_t v = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    do {
+        digits[n++] = '0' + static_cast<char>(v % 10);
+        v /= 10;
+    } while (v);
+    size_t size = 0;
+    if (value < 0) {
+        out[size++] = '-';
+    }
+    while (n) {
+        out[size++] = digits[--n];
+    }
+    return size;
+}
+
+size_t numeric_string::from_double(char* out, double value)
+{
+    if (std::isinf(value)) {
+        auto s = value > 0 ? "inf" : "-inf";
+        auto n = strlen(s);
+        memcpy(out, s, n);
+        return n;
+    }
+    if (value == 0) {
+        out[0] = '0';
+        return 1;
+    }
+    int n = 0;
+    for (int precision = 1; precision <= 17; ++precision) {
+        n = snprintf(out, DOUBLE_MAX_CHARS, "%.*g", precision, value);
+        if (strtod(out, nullptr) == value) {
+            break;
+        }
+    }
+    if (!memchr(out, 'e', n)) {
+        return n;
+    }
+    // no exponent as redis, the fixed notation is trimmed instead.
+    n = snprintf(out, DOUBLE_MAX_CHARS, "%.17f", value);
+    if (memchr(out, '.', n)) {
+        while (out[n - 1] == '0') {
+            --n;
+        }
+        if (out[n - 1] == '.') {
+            --n;
+        }
+    }
+    return n;
+}
+}
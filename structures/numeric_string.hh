@@ -0,0 +1,52 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#pragma once
+#include <cstddef>
+#include <cstdint>
+namespace redis {
+// The conversions between the strings and the integer (or float) encoded values,
+// they follow the rules of redis, so the encoding of a value is never visible.
+struct numeric_string
+{
+    // the max length of a formatted int64_t, with the sign.
+    static constexpr const size_t INT64_MAX_CHARS = 20;
+    // the max length of a formatted double.
+    static constexpr const size_t DOUBLE_MAX_CHARS = 5 * 1024;
+
+    // Parses the canonical integer, i.e. the string which is formatted back to itself:
+    // no spaces, no '+', no leading zeros, and it fits in int64_t.
+    static bool to_int64(const char* s, size_t size, int64_t& value);
+
+    // Parses the canonical unsigned integer, e.g. the cursor of SCAN.
+    static bool to_uint64(const char* s, size_t size, uint64_t& value);
+
+    // Parses the float, the trailing garbage, the spaces and NaN are rejected.
+    static bool to_double(const char* s, size_t size, double& value);
+
+    // Formats the integer to out, which has INT64_MAX_CHARS bytes at least, and
+    // returns the length.
+    static size_t from_int64(char* out, int64_t value);
+
+    // Formats the float in the fixed notation with the shortest digits which parse back
+    // to the same value, out has DOUBLE_MAX_CHARS bytes at least.
+    static size_t from_double(char* out, double value);
+};
+}
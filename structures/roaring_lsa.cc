@@ -0,0 +1,646 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#include "roaring_lsa.hh"
+#include "bits_kernels.hh"
+#include <algorithm>
+#include <cstring>
+namespace redis {
+
+using container_type = roaring_lsa::container_type;
+static constexpr const uint32_t CONTAINER_BITS = roaring_lsa::CONTAINER_BITS;
+static constexpr const uint32_t CONTAINER_BYTES = roaring_lsa::CONTAINER_BYTES;
+static constexpr const uint32_t ARRAY_MAX_CARDINALITY = roaring_lsa::ARRAY_MAX_CARDINALITY;
+static constexpr const size_t SERIALIZED_HEADER_SIZE = 11;
+
+static inline uint16_t read_u16(const uint8_t* p)
+{
+    return static_cast<uint16_t>(p[0] | (p[1] << 8));
+}
+
+static inline uint32_t read_u32(const uint8_t* p)
+{
+    return uint32_t(p[0]) | (uint32_t(p[1]) << 8) | (uint32_t(p[2]) << 16) | (uint32_t(p[3]) << 24);
+}
+
+static inline void append_u16(std::vector<uint8_t>& out, uint16_t v)
+{
+    out.push_back(v & 0xff);
+    out.push_back(v >> 8);
+}
+
+static inline void append_u32(std::vector<uint8_t>& out, uint32_t v)
+{
+    out.push_back(v & 0xff);
+    out.push_back((v >> 8) & 0xff);
+    out.push_back((v >> 16) & 0xff);
+    out.push_back((v >> 24) & 0xff);
+}
+
+// The 8 bytes as a big endian word, so the bit 0 of the bytes is the most significant bit.
+static inline uint64_t load_be64(const uint8_t* p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    v = __builtin_bswap64(v);
+#endif
+    return v;
+}
+
+static inline bool test_bit(const uint8_t* bits, uint32_t v)
+{
+    return (bits[v >> 3] & (0x80 >> (v & 7))) != 0;
+}
+
+static inline void set_bit(uint8_t* bits, uint32_t v)
+{
+    bits[v >> 3] |= (0x80 >> (v & 7));
+}
+
+static inline void clear_bit(uint8_t* bits, uint32_t v)
+{
+    bits[v >> 3] &= ~(0x80 >> (v & 7));
+}
+
+// Sets the bits [start, end).
+static void set_range(uint8_t* bits, uint32_t start, uint32_t end)
+{
+    while (start < end && (start & 7)) {
+        set_bit(bits, start++);
+    }
+    if (end - start >= 8) {
+        auto n = (end - start) >> 3;
+        memset(bits + (start >> 3), 0xff, n);
+        start += n << 3;
+    }
+    while (start < end) {
+        set_bit(bits, start++);
+    }
+}
+
+// Returns the position of the first bit equals to bit from the position from.
+static uint32_t next_bit(const uint8_t* bits, uint32_t from, bool bit)
+{
+    while (from < CONTAINER_BITS) {
+        auto index = from >> 6;
+        auto w = load_be64(bits + index * 8);
+        if (!bit) {
+            w = ~w;
+        }
+        w &= (~uint64_t(0)) >> (from & 63);
+        if (w) {
+            return (index << 6) + __builtin_clzll(w);
+        }
+        from = (index + 1) << 6;
+    }
+    return CONTAINER_BITS;
+}
+
+static uint32_t count_runs(const uint8_t* bits)
+{
+    uint32_t runs = 0;
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < CONTAINER_BYTES; i += 8) {
+        auto w = load_be64(bits + i);
+        runs += __builtin_popcountll(w & ~((w >> 1) | (prev << 63)));
+        prev = w & 1;
+    }
+    return runs;
+}
+
+// Chooses the smallest encoding for the decoded container, returns false if it is empty.
+static bool encode_container(const uint8_t* bits, container_type& type, uint32_t& cardinality, std::vector<uint8_t>& data)
+{
+    data.clear();
+    cardinality = bits_kernels::popcount(bits, CONTAINER_BYTES);
+    if (cardinality == 0) {
+        return false;
+    }
+    size_t array_size = cardinality <= ARRAY_MAX_CARDINALITY ? cardinality * 2 : CONTAINER_BYTES + 1;
+    size_t run_size = count_runs(bits) * 4;
+    if (run_size < array_size && run_size < CONTAINER_BYTES) {
+        type = container_type::RUN;
+        uint32_t position = 0;
+        while ((position = next_bit(bits, position, true)) < CONTAINER_BITS) {
+            auto end = next_bit(bits, position, false);
+            append_u16(data, static_cast<uint16_t>(position));
+            append_u16(data, static_cast<uint16_t>(end - position - 1));
+            position = end;
+        }
+    }
+    else if (array_size <= CONTAINER_BYTES) {
+        type = container_type::ARRAY;
+        for (uint32_t i = 0; i < CONTAINER_BYTES; i += 8) {
+            auto w = load_be64(bits + i);
+            while (w) {
+                auto bit = __builtin_clzll(w);
+                append_u16(data, static_cast<uint16_t>(i * 8 + bit));
+                w ^= uint64_t(1) << (63 - bit);
+            }
+        }
+    }
+    else {
+        type = container_type::BITMAP;
+        data.assign(bits, bits + CONTAINER_BYTES);
+    }
+    return true;
+}
+
+static void decode_container(container_type type, const uint8_t* data, size_t size, uint8_t* bits)
+{
+    if (type == container_type::BITMAP) {
+        memcpy(bits, data, CONTAINER_BYTES);
+        return;
+    }
+    memset(bits, 0, CONTAINER_BYTES);
+    if (type == container_type::ARRAY) {
+        for (size_t i = 0; i + 2 <= size; i += 2) {
+            set_bit(bits, read_u16(data + i));
+        }
+    }
+    else {
+        for (size_t i = 0; i + 4 <= size; i += 4) {
+            uint32_t start = read_u16(data + i);
+            set_range(bits, start, start + read_u16(data + i + 2) + 1);
+        }
+    }
+}
+
+static bool container_contains(container_type type, const uint8_t* data, size_t size, uint16_t low)
+{
+    switch (type) {
+        case container_type::BITMAP:
+            return test_bit(data, low);
+        case container_type::ARRAY: {
+            size_t lo = 0, hi = size / 2;
+            while (lo < hi) {
+                auto mid = (lo + hi) / 2;
+                if (read_u16(data + mid * 2) < low) lo = mid + 1; else hi = mid;
+            }
+            return lo < size / 2 && read_u16(data + lo * 2) == low;
+        }
+        case container_type::RUN: {
+            // the last run which starts before or at the low.
+            size_t lo = 0, hi = size / 4;
+            while (lo < hi) {
+                auto mid = (lo + hi) / 2;
+                if (read_u16(data + mid * 4) <= low) lo = mid + 1; else hi = mid;
+            }
+            if (lo == 0) {
+                return false;
+            }
+            uint32_t start = read_u16(data + (lo - 1) * 4);
+            return uint32_t(low) <= start + read_u16(data + (lo - 1) * 4 + 2);
+        }
+    }
+    return false;
+}
+
+struct serialized_container {
+    uint16_t _key;
+    container_type _type;
+    uint32_t _cardinality;
+    const uint8_t* _data;
+    uint32_t _size;
+};
+
+static bool next_serialized(const uint8_t*& p, const uint8_t* end, serialized_container& c)
+{
+    if (static_cast<size_t>(end - p) < SERIALIZED_HEADER_SIZE) {
+        return false;
+    }
+    c._key = read_u16(p);
+    c._type = static_cast<container_type>(p[2]);
+    c._cardinality = read_u32(p + 3);
+    c._size = read_u32(p + 7);
+    c._data = p + SERIALIZED_HEADER_SIZE;
+    if (c._size > static_cast<size_t>(end - c._data)) {
+        return false;
+    }
+    p = c._data + c._size;
+    return true;
+}
+
+static void append_serialized_container(std::vector<uint8_t>& out, uint16_t key, container_type type, uint32_t cardinality,
+                                        const uint8_t* data, uint32_t size)
+{
+    append_u16(out, key);
+    out.push_back(static_cast<uint8_t>(type));
+    append_u32(out, cardinality);
+    append_u32(out, size);
+    out.insert(out.end(), data, data + size);
+}
+
+roaring_lsa::container::container(container&& o) noexcept
+    : _link()
+    , _key(o._key)
+    , _type(o._type)
+    , _cardinality(o._cardinality)
+    , _data(std::move(o._data))
+{
+    container_set_type::node_algorithms::replace_node(o._link.this_ptr(), _link.this_ptr());
+    container_set_type::node_algorithms::init(o._link.this_ptr());
+}
+
+void roaring_lsa::store(iterator it, uint16_t key, const uint8_t* bits)
+{
+    container_type type;
+    uint32_t cardinality = 0;
+    std::vector<uint8_t> data;
+    bool nonempty = encode_container(bits, type, cardinality, data);
+    if (it != _containers.end()) {
+        if (!nonempty) {
+            erase(it);
+            return;
+        }
+        _cardinality -= it->_cardinality;
+        it->_type = type;
+        it->_cardinality = cardinality;
+        it->_data = managed_bytes(bytes_view { reinterpret_cast<const char*>(data.data()), data.size() });
+    }
+    else if (nonempty) {
+        auto c = current_allocator().construct<container>(key, type, cardinality,
+            bytes_view { reinterpret_cast<const char*>(data.data()), data.size() });
+        _containers.insert(*c);
+    }
+    _cardinality += cardinality;
+}
+
+void roaring_lsa::erase(iterator it)
+{
+    _cardinality -= it->_cardinality;
+    _containers.erase_and_dispose(it, current_deleter<container>());
+}
+
+void roaring_lsa::clear()
+{
+    _containers.clear_and_dispose(current_deleter<container>());
+    _cardinality = 0;
+    _byte_size = 0;
+}
+
+bool roaring_lsa::set(uint64_t offset, bool value)
+{
+    auto key = static_cast<uint16_t>(offset >> 16);
+    auto low = static_cast<uint16_t>(offset & 0xffff);
+    // the equivalent string grows even if the bit is cleared, as redis does.
+    _byte_size = std::max<size_t>(_byte_size, (offset >> 3) + 1);
+    auto it = _containers.find(uint32_t(key), container::compare());
+    if (it == _containers.end()) {
+        if (value) {
+            std::vector<uint8_t> data;
+            append_u16(data, low);
+            auto c = current_allocator().construct<container>(key, container_type::ARRAY, 1,
+                bytes_view { reinterpret_cast<const char*>(data.data()), data.size() });
+            _containers.insert(*c);
+            _cardinality++;
+        }
+        return false;
+    }
+    auto& c = *it;
+    bool old = container_contains(c._type, c.data(), c._data.size(), low);
+    if (old == value) {
+        return old;
+    }
+    if (c._type == container_type::ARRAY && (value ? c._cardinality < ARRAY_MAX_CARDINALITY : c._cardinality > 1)) {
+        // inserts or removes the value in the sorted array.
+        auto data = c.data();
+        size_t size = c._data.size(), i = 0;
+        while (i < size && read_u16(data + i) < low) {
+            i += 2;
+        }
+        std::vector<uint8_t> out;
+        out.reserve(size + 2);
+        out.insert(out.end(), data, data + i);
+        if (value) {
+            append_u16(out, low);
+            out.insert(out.end(), data + i, data + size);
+            c._cardinality++;
+            _cardinality++;
+        }
+        else {
+            out.insert(out.end(), data + i + 2, data + size);
+            c._cardinality--;
+            _cardinality--;
+        }
+        c._data = managed_bytes(bytes_view { reinterpret_cast<const char*>(out.data()), out.size() });
+        return old;
+    }
+    if (c._type == container_type::ARRAY && !value) {
+        // the last value was removed.
+        erase(it);
+        return old;
+    }
+    if (c._type == container_type::BITMAP) {
+        auto bits = reinterpret_cast<uint8_t*>(c._data.data());
+        if (value) {
+            set_bit(bits, low);
+            c._cardinality++;
+            _cardinality++;
+        }
+        else {
+            clear_bit(bits, low);
+            c._cardinality--;
+            _cardinality--;
+        }
+        // the bitmap is re-encoded once the array would be smaller.
+        if (c._cardinality <= ARRAY_MAX_CARDINALITY) {
+            std::vector<uint8_t> copy(bits, bits + CONTAINER_BYTES);
+            store(it, key, copy.data());
+        }
+        return old;
+    }
+    if (c._type == container_type::RUN) {
+        update_runs(c, low, value);
+        // the runs are re-encoded once they are larger than the array or the bitmap.
+        size_t array_size = c._cardinality <= ARRAY_MAX_CARDINALITY ? c._cardinality * 2 : CONTAINER_BYTES + 1;
+        if (c._cardinality == 0) {
+            erase(it);
+        }
+        else if (c._data.size() >= array_size || c._data.size() >= CONTAINER_BYTES) {
+            std::vector<uint8_t> bits(CONTAINER_BYTES);
+            decode_container(c._type, c.data(), c._data.size(), bits.data());
+            store(it, key, bits.data());
+        }
+        return old;
+    }
+    // the array is full, the container is rebuilt as a bitmap or runs.
+    std::vector<uint8_t> bits(CONTAINER_BYTES);
+    decode_container(c._type, c.data(), c._data.size(), bits.data());
+    set_bit(bits.data(), low);
+    store(it, key, bits.data());
+    return old;
+}
+
+void roaring_lsa::update_runs(container& c, uint16_t low, bool value)
+{
+    auto data = c.data();
+    size_t runs = c._data.size() / 4;
+    auto run_start = [data] (size_t r) -> uint32_t { return read_u16(data + r * 4); };
+    auto run_end = [data] (size_t r) -> uint32_t { return read_u16(data + r * 4) + read_u16(data + r * 4 + 2); };
+    // the first run which starts after the low.
+    size_t next = 0, hi = runs;
+    while (next < hi) {
+        auto mid = (next + hi) / 2;
+        if (run_start(mid) <= low) next = mid + 1; else hi = mid;
+    }
+    // the runs [first, last) are replaced by the runs in the out.
+    size_t first = next, last = next;
+    std::vector<uint8_t> out;
+    if (value) {
+        bool extends_prev = next > 0 && run_end(next - 1) + 1 == low;
+        bool extends_next = next < runs && uint32_t(low) + 1 == run_start(next);
+        if (extends_prev) {
+            first = next - 1;
+        }
+        if (extends_next) {
+            last = next + 1;
+        }
+        uint32_t start = extends_prev ? run_start(next - 1) : low;
+        uint32_t end = extends_next ? run_end(next) : low;
+        append_u16(out, static_cast<uint16_t>(start));
+        append_u16(out, static_cast<uint16_t>(end - start));
+        c._cardinality++;
+        _cardinality++;
+    }
+    else {
+        // the low is in the run before the next, which is shrunk or split.
+        first = next - 1;
+        uint32_t start = run_start(first), end = run_end(first);
+        if (low > start) {
+            append_u16(out, static_cast<uint16_t>(start));
+            append_u16(out, static_cast<uint16_t>(low - 1 - start));
+        }
+        if (low < end) {
+            append_u16(out, static_cast<uint16_t>(low + 1));
+            append_u16(out, static_cast<uint16_t>(end - low - 1));
+        }
+        c._cardinality--;
+        _cardinality--;
+    }
+    if (out.size() == (last - first) * 4) {
+        // the number of runs is unchanged, the run is updated in place.
+        c._data.write(first * 4, bytes_view { reinterpret_cast<const char*>(out.data()), out.size() });
+        return;
+    }
+    std::vector<uint8_t> updated;
+    updated.reserve(c._data.size() + 4);
+    updated.insert(updated.end(), data, data + first * 4);
+    updated.insert(updated.end(), out.begin(), out.end());
+    updated.insert(updated.end(), data + last * 4, data + runs * 4);
+    c._data = managed_bytes(bytes_view { reinterpret_cast<const char*>(updated.data()), updated.size() });
+}
+
+bool roaring_lsa::get(uint64_t offset) const
+{
+    auto it = _containers.find(uint32_t(offset >> 16), container::compare());
+    if (it == _containers.end()) {
+        return false;
+    }
+    return container_contains(it->_type, it->data(), it->_data.size(), static_cast<uint16_t>(offset & 0xffff));
+}
+
+size_t roaring_lsa::count(size_t offset, size_t length) const
+{
+    if (length == 0) {
+        return 0;
+    }
+    size_t end = offset + length, result = 0;
+    std::vector<uint8_t> bits;
+    auto it = _containers.lower_bound(uint32_t(offset / CONTAINER_BYTES), container::compare());
+    for (; it != _containers.end() && size_t(it->_key) * CONTAINER_BYTES < end; ++it) {
+        size_t base = size_t(it->_key) * CONTAINER_BYTES;
+        size_t from = std::max(offset, base) - base;
+        size_t to = std::min(end, base + CONTAINER_BYTES) - base;
+        if (from == 0 && to == CONTAINER_BYTES) {
+            result += it->_cardinality;
+            continue;
+        }
+        const uint8_t* p = it->data();
+        if (it->_type != container_type::BITMAP) {
+            bits.resize(CONTAINER_BYTES);
+            decode_container(it->_type, it->data(), it->_data.size(), bits.data());
+            p = bits.data();
+        }
+        result += bits_kernels::popcount(p + from, to - from);
+    }
+    return result;
+}
+
+long roaring_lsa::position(bool bit, size_t offset, size_t length) const
+{
+    size_t end = offset + length, position = offset;
+    std::vector<uint8_t> bits;
+    auto it = _containers.lower_bound(uint32_t(offset / CONTAINER_BYTES), container::compare());
+    while (position < end) {
+        size_t key = position / CONTAINER_BYTES;
+        size_t base = key * CONTAINER_BYTES;
+        size_t to = std::min(end, base + CONTAINER_BYTES);
+        if (it == _containers.end() || it->_key != key) {
+            // a missing container is all zeros.
+            if (!bit) {
+                return static_cast<long>(position * 8);
+            }
+            if (it == _containers.end()) {
+                return -1;
+            }
+            position = size_t(it->_key) * CONTAINER_BYTES;
+            continue;
+        }
+        const uint8_t* p = it->data();
+        if (it->_type != container_type::BITMAP) {
+            bits.resize(CONTAINER_BYTES);
+            decode_container(it->_type, it->data(), it->_data.size(), bits.data());
+            p = bits.data();
+        }
+        size_t from = position - base;
+        auto index = bits_kernels::find_first_not_of(p + from, to - position, bit ? 0x00 : 0xff);
+        if (index < to - position) {
+            auto byte = from + index;
+            return static_cast<long>((base + byte) * 8 + bits_operation::first_bit_in_byte(p[byte], bit));
+        }
+        position = to;
+        ++it;
+    }
+    return -1;
+}
+
+void roaring_lsa::copy_range(size_t offset, size_t length, uint8_t* out) const
+{
+    memset(out, 0, length);
+    size_t end = offset + length;
+    std::vector<uint8_t> bits;
+    auto it = _containers.lower_bound(uint32_t(offset / CONTAINER_BYTES), container::compare());
+    for (; it != _containers.end() && size_t(it->_key) * CONTAINER_BYTES < end; ++it) {
+        size_t base = size_t(it->_key) * CONTAINER_BYTES;
+        size_t from = std::max(offset, base);
+        size_t to = std::min(end, base + CONTAINER_BYTES);
+        const uint8_t* p = it->data();
+        if (it->_type != container_type::BITMAP) {
+            bits.resize(CONTAINER_BYTES);
+            decode_container(it->_type, it->data(), it->_data.size(), bits.data());
+            p = bits.data();
+        }
+        memcpy(out + (from - offset), p + (from - base), to - from);
+    }
+}
+
+void roaring_lsa::assign(const managed_bytes& o)
+{
+    clear();
+    std::vector<uint8_t> bits(CONTAINER_BYTES);
+    for (size_t base = 0; base < o.size(); base += CONTAINER_BYTES) {
+        auto n = std::min<size_t>(CONTAINER_BYTES, o.size() - base);
+        memset(bits.data(), 0, CONTAINER_BYTES);
+        bits_operation::copy_range(o, base, n, bits.data());
+        store(_containers.end(), static_cast<uint16_t>(base / CONTAINER_BYTES), bits.data());
+    }
+    _byte_size = o.size();
+}
+
+long roaring_lsa::serialize(uint32_t first_key, uint32_t last_key, std::vector<uint8_t>& out) const
+{
+    auto it = _containers.lower_bound(first_key, container::compare());
+    for (; it != _containers.end() && it->_key < last_key; ++it) {
+        append_serialized_container(out, it->_key, it->_type, it->_cardinality, it->data(), it->_data.size());
+    }
+    return it == _containers.end() ? -1 : static_cast<long>(it->_key);
+}
+
+void roaring_lsa::append_serialized(const uint8_t* data, size_t size)
+{
+    const uint8_t* p = data;
+    serialized_container s;
+    while (next_serialized(p, data + size, s)) {
+        auto c = current_allocator().construct<container>(s._key, s._type, s._cardinality,
+            bytes_view { reinterpret_cast<const char*>(s._data), s._size });
+        _containers.insert(_containers.end(), *c);
+        _cardinality += s._cardinality;
+    }
+}
+
+void roaring_lsa::combine(bitop_type op, const std::vector<std::pair<const uint8_t*, size_t>>& sources,
+                          uint32_t first_key, uint32_t last_key, size_t byte_size, std::vector<uint8_t>& out)
+{
+    struct cursor {
+        const uint8_t* _p;
+        const uint8_t* _end;
+        serialized_container _current;
+        bool _valid;
+    };
+    std::vector<cursor> cursors;
+    for (auto& s : sources) {
+        cursor c { s.first, s.first + s.second, serialized_container {}, false };
+        c._valid = next_serialized(c._p, c._end, c._current);
+        cursors.emplace_back(c);
+    }
+    std::vector<uint8_t> bits(CONTAINER_BYTES), other(CONTAINER_BYTES), data;
+    uint32_t key = first_key;
+    while (key < last_key) {
+        if (op != bitop_type::NOT) {
+            // only the keys which exist in any source are visited.
+            uint32_t next = last_key;
+            for (auto& c : cursors) {
+                if (c._valid) {
+                    next = std::min<uint32_t>(next, c._current._key);
+                }
+            }
+            key = std::max(key, next);
+            if (key >= last_key) {
+                break;
+            }
+        }
+        bool empty = false, first = true;
+        memset(bits.data(), 0, CONTAINER_BYTES);
+        for (auto& c : cursors) {
+            bool present = c._valid && c._current._key == key;
+            if (!present) {
+                if (op == bitop_type::AND) {
+                    empty = true;
+                }
+                continue;
+            }
+            auto target = first ? bits.data() : other.data();
+            decode_container(c._current._type, c._current._data, c._current._size, target);
+            if (!first) {
+                bits_operation::apply(op, bits.data(), other.data(), CONTAINER_BYTES);
+            }
+            first = false;
+            c._valid = next_serialized(c._p, c._end, c._current);
+        }
+        if (op == bitop_type::NOT) {
+            bits_kernels::bitwise_not(bits.data(), CONTAINER_BYTES);
+            // the bytes after the end of the string are not flipped.
+            size_t base = size_t(key) * CONTAINER_BYTES;
+            if (base + CONTAINER_BYTES > byte_size) {
+                auto valid = byte_size > base ? byte_size - base : 0;
+                memset(bits.data() + valid, 0, CONTAINER_BYTES - valid);
+            }
+        }
+        container_type type;
+        uint32_t cardinality = 0;
+        if (!empty && encode_container(bits.data(), type, cardinality, data)) {
+            append_serialized_container(out, static_cast<uint16_t>(key), type, cardinality, data.data(), data.size());
+        }
+        key++;
+    }
+}
+}
@@ -0,0 +1,173 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#pragma once
+#include <boost/intrusive/set.hpp>
+#include <vector>
+#include "utils/allocation_strategy.hh"
+#include "utils/managed_bytes.hh"
+#include "utils/bytes.hh"
+#include "structures/bits_operation.hh"
+namespace redis {
+// roaring_lsa is the roaring bitmap encoding of the bitmap values, so a sparse
+// bitmap (e.g. SETBIT key 4000000000 1) does not allocate the whole string.
+// The high 16 bits of a bit offset are the key of a container, which stores the
+// low 16 bits in one of the encodings:
+//   ARRAY  : the sorted uint16_t values, up to 4096 values.
+//   BITMAP : 65536 bits (8K bytes) in the layout of the redis string.
+//   RUN    : the sorted [start, length - 1] uint16_t pairs.
+// Every container is a single LSA blob, the bits are set or cleared in place,
+// and the encoding is chosen again only when the size of the container crosses
+// the size of another encoding. The bits are numbered as redis does: the bit 0
+// is the most significant bit of the first byte.
+class roaring_lsa {
+public:
+    static constexpr const uint32_t CONTAINER_BITS = 1 << 16;
+    static constexpr const uint32_t CONTAINER_BYTES = CONTAINER_BITS / 8;
+    static constexpr const uint32_t ARRAY_MAX_CARDINALITY = 4096;
+    // the max offset of a bit is 2^32 - 1, as redis.
+    static constexpr const uint64_t MAX_BITS = uint64_t(1) << 32;
+    enum class container_type : uint8_t {
+        ARRAY  = 0,
+        BITMAP = 1,
+        RUN    = 2,
+    };
+private:
+    struct container {
+        boost::intrusive::set_member_hook<> _link;
+        uint16_t _key;
+        container_type _type;
+        uint32_t _cardinality;
+        managed_bytes _data;
+        container(uint16_t key, container_type type, uint32_t cardinality, bytes_view data) noexcept
+            : _link()
+            , _key(key)
+            , _type(type)
+            , _cardinality(cardinality)
+            , _data(data)
+        {
+        }
+        container(container&& o) noexcept;
+        const uint8_t* data() const {
+            return reinterpret_cast<const uint8_t*>(_data.data());
+        }
+        struct compare {
+            inline bool operator () (const container& l, const container& r) const noexcept {
+                return l._key < r._key;
+            }
+            inline bool operator () (uint32_t key, const container& c) const noexcept {
+                return key < c._key;
+            }
+            inline bool operator () (const container& c, uint32_t key) const noexcept {
+                return c._key < key;
+            }
+        };
+    };
+    using container_set_type = boost::intrusive::set<container,
+                                                     boost::intrusive::member_hook<container, boost::intrusive::set_member_hook<>, &container::_link>,
+                                                     boost::intrusive::compare<container::compare>>;
+    using iterator = container_set_type::iterator;
+    using const_iterator = container_set_type::const_iterator;
+    container_set_type _containers;
+    uint64_t _cardinality = 0;
+    // the size in bytes of the equivalent redis string.
+    size_t _byte_size = 0;
+public:
+    roaring_lsa() noexcept
+    {
+    }
+
+    roaring_lsa(roaring_lsa&& o) noexcept
+        : _containers(std::move(o._containers))
+        , _cardinality(o._cardinality)
+        , _byte_size(o._byte_size)
+    {
+        o._cardinality = 0;
+        o._byte_size = 0;
+    }
+
+    ~roaring_lsa()
+    {
+        clear();
+    }
+
+    // Sets or clears the bit at offset, returns the previous value of the bit.
+    bool set(uint64_t offset, bool value);
+
+    bool get(uint64_t offset) const;
+
+    // Counts the set bits in the bytes [offset, offset + length) of the equivalent string.
+    size_t count(size_t offset, size_t length) const;
+
+    // Returns the position of the first bit equals to bit in the bytes [offset, offset + length),
+    // or -1 if not found.
+    long position(bool bit, size_t offset, size_t length) const;
+
+    // Copies the bytes [offset, offset + length) of the equivalent string.
+    void copy_range(size_t offset, size_t length, uint8_t* out) const;
+
+    // Builds the bitmap from a redis string.
+    void assign(const managed_bytes& o);
+
+    inline size_t byte_size() const
+    {
+        return _byte_size;
+    }
+
+    inline void set_byte_size(size_t size)
+    {
+        _byte_size = size;
+    }
+
+    // Returns the number of the set bits.
+    inline uint64_t cardinality() const
+    {
+        return _cardinality;
+    }
+
+    inline size_t containers() const
+    {
+        return _containers.size();
+    }
+
+    void clear();
+
+    // The serialized containers are used to run BITOP across the shards, every container
+    // is encoded as [key u16][type u8][cardinality u32][size u32][data], little endian.
+    // Appends the containers whose keys are in [first_key, last_key) to out, returns the key
+    // of the next container after them, or -1 if there is none.
+    long serialize(uint32_t first_key, uint32_t last_key, std::vector<uint8_t>& out) const;
+
+    // Appends the serialized containers, their keys must be greater than the existing ones.
+    void append_serialized(const uint8_t* data, size_t size);
+
+    // Applies the op to the serialized containers of the sources in the keys range
+    // [first_key, last_key), and appends the serialized result to out. The result of
+    // NOT is limited to the byte_size.
+    static void combine(bitop_type op, const std::vector<std::pair<const uint8_t*, size_t>>& sources,
+                        uint32_t first_key, uint32_t last_key, size_t byte_size, std::vector<uint8_t>& out);
+private:
+    void store(iterator it, uint16_t key, const uint8_t* bits);
+    // Sets or clears the low in the runs of the container: a run is extended, merged
+    // with its neighbour, shrunk or split, without decoding the container.
+    void update_runs(container& c, uint16_t low, bool value);
+    void erase(iterator it);
+};
+}
@@ -0,0 +1,123 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#include "scan.hh"
+#include <cctype>
+namespace redis {
+
+static inline char fold(char c, bool nocase)
+{
+    return nocase ? static_cast<char>(tolower(static_cast<unsigned char>(c))) : c;
+}
+
+// Matches the character with the token at pattern[p] which is not a star, and sets
+// next to the position after the token.
+static bool match_token(const char* pattern, size_t pattern_size, size_t p, char c, bool nocase, size_t& next)
+{
+    switch (pattern[p]) {
+    case '?':
+        next = p + 1;
+        return true;
+    case '\\':
+        if (p + 1 < pattern_size) {
+            next = p + 2;
+            return fold(pattern[p + 1], nocase) == fold(c, nocase);
+        }
+        next = p + 1;
+        return c == '\\';
+    case '[': {
+        size_t i = p + 1;
+        bool negate = i < pattern_size && pattern[i] == '^';
+        if (negate) {
+            ++i;
+        }
+        bool matched = false;
+        while (i < pattern_size && pattern[i] != ']') {
+            if (pattern[i] == '\\' && i + 1 < pattern_size) {
+                ++i;
+                matched |= fold(pattern[i], nocase) == fold(c, nocase);
+                ++i;
+            }
+            else if (i + 2 < pattern_size && pattern[i + 1] == '-') {
+                auto start = fold(pattern[i], nocase), end = fold(pattern[i + 2], nocase);
+                if (start > end) {
+                    std::swap(start, end);
+                }
+                auto f = fold(c, nocase);
+                matched |= f >= start && f <= end;
+                i += 3;
+            }
+            else {
+                matched |= fold(pattern[i], nocase) == fold(c, nocase);
+                ++i;
+            }
+        }
+        // an unterminated class ends at the end of the pattern, as redis.
+        next = i < pattern_size ? i + 1 : i;
+        return negate ? !matched : matched;
+    }
+    default:
+        next = p + 1;
+        return fold(pattern[p], nocase) == fold(c, nocase);
+    }
+}
+
+bool string_match(const char* pattern, size_t pattern_size, const char* s, size_t size, bool nocase)
+{
+    size_t p = 0, i = 0;
+    bool starred = false;
+    size_t star_p = 0, star_i = 0;
+    while (i < size) {
+        if (p < pattern_size && pattern[p] == '*') {
+            while (p < pattern_size && pattern[p] == '*') {
+                ++p;
+            }
+            if (p == pattern_size) {
+                return true;
+            }
+            starred = true;
+            star_p = p;
+            star_i = i;
+            continue;
+        }
+        size_t next = p;
+        if (p < pattern_size && match_token(pattern, pattern_size, p, s[i], nocase, next)) {
+            p = next;
+            ++i;
+            continue;
+        }
+        if (!starred) {
+            return false;
+        }
+        // the last star absorbs one more character.
+        p = star_p;
+        i = ++star_i;
+    }
+    while (p < pattern_size && pattern[p] == '*') {
+        ++p;
+    }
+    return p == pattern_size;
+}
+
+bool scan_options::match(const char* s, size_t size) const
+{
+    return !has_pattern || string_match(pattern.data(), pattern.size(), s, size);
+}
+}
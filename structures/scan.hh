@@ -0,0 +1,63 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#pragma once
+#include <cstddef>
+#include <functional>
+#include "core/sstring.hh"
+#include "utils/bytes.hh"
+namespace redis {
+// dict_lsa and sset_lsa order their entries by the hash of the key first, so the
+// cursor of HSCAN/SSCAN/ZSCAN is simply the hash of the next entry. Unlike the
+// cursor of a hash table, it stays valid while the entries are inserted or erased,
+// and an entry which exists during the whole scan is returned exactly once.
+
+// The key of a lookup, the hash is computed once rather than in every comparison.
+struct hashed_key {
+    const sstring& key;
+    size_t hash;
+    explicit hashed_key(const sstring& k) noexcept
+        : key(k)
+        , hash(std::hash<bytes_view>()(bytes_view { k.data(), k.size() }))
+    {
+    }
+};
+
+// The position of a cursor, i.e. the first hash which is not visited yet.
+struct hash_position {
+    size_t hash;
+};
+
+struct scan_options {
+    size_t cursor = 0;
+    // the number of the visited entries by one call, the MATCH filtering does not
+    // change it, so the work of a call is bounded.
+    size_t count = 10;
+    bool has_pattern = false;
+    sstring pattern;
+
+    bool match(const char* s, size_t size) const;
+};
+
+// Matches the glob-style pattern as redis does: '*', '?', '[...]' (with '^' and the
+// ranges) and the '\' escapes. The stars backtrack to the last one only, so the
+// time is O(pattern * size) rather than exponential.
+bool string_match(const char* pattern, size_t pattern_size, const char* s, size_t size, bool nocase = false);
+}
@@ -19,4 +19,28 @@
 *
 */
 #include  "sset_lsa.hh"
-namespace redis { }
+namespace redis {
+
+sset_entry::sset_entry(sset_entry&& o) noexcept
+    : _list_link()
+    , _set_link()
+    , _score_link()
+    , _key(std::move(o._key))
+    , _key_hash(o._key_hash)
+    , _score(o._score)
+{
+    sset_lsa::dict_type::node_algorithms::replace_node(o._set_link.this_ptr(), _set_link.this_ptr());
+    sset_lsa::dict_type::node_algorithms::init(o._set_link.this_ptr());
+    using score_algorithms = sset_lsa::score_index_type::node_algorithms;
+    if (o._score_link.is_linked()) {
+        score_algorithms::replace_node(o._score_link.this_ptr(), _score_link.this_ptr());
+        score_algorithms::init(o._score_link.this_ptr());
+    }
+    using list_algorithms = sset_lsa::list_type::node_algorithms;
+    if (o._list_link.is_linked()) {
+        list_algorithms::link_after(o._list_link.this_ptr(), _list_link.this_ptr());
+        list_algorithms::unlink(o._list_link.this_ptr());
+        list_algorithms::init(o._list_link.this_ptr());
+    }
+}
+}
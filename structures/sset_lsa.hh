@@ -28,6 +28,7 @@
 #include <boost/intrusive/list.hpp>
 #include <boost/intrusive/set.hpp>
 #include "utils/managed_bytes.hh"
+#include "structures/scan.hh"
 #include "utils/managed_ref.hh"
 #include "utils/bytes.hh"
 #include "utils/allocation_strategy.hh"
@@ -56,6 +57,7 @@ struct sset_entry
     using list_hook_type = boost::intrusive::list_member_hook<>;
     list_hook_type _list_link;
     set_hook_type _set_link;
+    set_hook_type _score_link;
     managed_bytes _key;
     size_t _key_hash;
     double _score;
@@ -63,20 +65,15 @@ struct sset_entry
     sset_entry(const sstring& key, const double score) noexcept
         : _list_link()
         , _set_link()
-        , _key(std::move(*(current_allocator().construct<managed_bytes>(bytes_view {key.data(), key.size()}))))
+        , _score_link()
+        , _key(bytes_view {key.data(), key.size()})
         , _key_hash(std::hash<managed_bytes>()(_key))
         , _score(score)
     {
     }
 
-    sset_entry(sset_entry&& o) noexcept
-        : _list_link(std::move(o._list_link))
-        , _set_link(std::move(o._set_link))
-        , _key(std::move(o._key))
-        , _key_hash(std::move(o._key_hash))
-        , _score(std::move(o._score))
-    {
-    }
+    // the hooks are relinked to the new address, as the LSA moves the entry.
+    sset_entry(sset_entry&& o) noexcept;
 
     ~sset_entry()
     {
@@ -91,14 +88,30 @@ struct sset_entry
             }
             return r < 0;
         }
+        // the entries are ordered by the hash first, see structures/scan.hh.
         inline bool operator () (const sset_entry& l, const sset_entry& r) const noexcept {
+            if (l._key_hash != r._key_hash) {
+                return l._key_hash < r._key_hash;
+            }
             return compare_impl(l.key_data(), l.key_size(), r.key_data(), r.key_size());
         }
-        inline bool operator () (const sstring& k, const sset_entry& e) const noexcept {
-            return compare_impl(k.data(), k.size(), e.key_data(), e.key_size());
+        inline bool operator () (const hashed_key& k, const sset_entry& e) const noexcept {
+            if (k.hash != e._key_hash) {
+                return k.hash < e._key_hash;
+            }
+            return compare_impl(k.key.data(), k.key.size(), e.key_data(), e.key_size());
+        }
+        inline bool operator () (const sset_entry& e, const hashed_key& k) const noexcept {
+            if (e._key_hash != k.hash) {
+                return e._key_hash < k.hash;
+            }
+            return compare_impl(e.key_data(), e.key_size(), k.key.data(), k.key.size());
+        }
+        inline bool operator () (const hash_position& p, const sset_entry& e) const noexcept {
+            return p.hash < e._key_hash;
         }
-        inline bool operator () (const sset_entry& e, const sstring& k) const noexcept {
-            return compare_impl(e.key_data(), e.key_size(), k.data(), k.size());
+        inline bool operator () (const sset_entry& e, const hash_position& p) const noexcept {
+            return e._key_hash < p.hash;
         }
         inline bool operator () (const double& score, const sset_entry& e) const noexcept {
             return score < e.score();
@@ -107,6 +120,22 @@ struct sset_entry
             return e.score() < score;
         }
     };
+    // the index of the scores orders the entries by the scores, and then by the members,
+    // as redis does.
+    struct score_compare {
+        inline bool operator () (const sset_entry& l, const sset_entry& r) const noexcept {
+            if (l._score != r._score) {
+                return l._score < r._score;
+            }
+            return compare().compare_impl(l.key_data(), l.key_size(), r.key_data(), r.key_size());
+        }
+        inline bool operator () (const double& score, const sset_entry& e) const noexcept {
+            return score < e._score;
+        }
+        inline bool operator () (const sset_entry& e, const double& score) const noexcept {
+            return e._score < score;
+        }
+    };
 
     const managed_bytes& key() const {
         return _key;
@@ -130,22 +159,41 @@ struct sset_entry
     }
 };
 
+// The position of an incremental sort, see sset_lsa::sort_by_score_step().
+struct sset_sort_cursor {
+    enum class mode { scan, merge, skip };
+    mode _mode = mode::scan;
+    bool _started = false;
+    // the runs which were merged in this pass, the entries are sorted once a pass merges none.
+    size_t _merges = 0;
+    // the members of the entries at the cursors of the left and the right runs, none is
+    // the end of the list.
+    std::experimental::optional<sstring> _left;
+    std::experimental::optional<sstring> _right;
+};
+
 class database;
 class sset_lsa final {
     friend class database;
+    friend struct sset_entry;
     using dict_type = boost::intrusive::set<sset_entry,
         boost::intrusive::member_hook<sset_entry, sset_entry::set_hook_type, &sset_entry::_set_link>,
         boost::intrusive::compare<sset_entry::compare>>;
     using list_type = boost::intrusive::list<sset_entry,
         boost::intrusive::member_hook<sset_entry, boost::intrusive::list_member_hook<>,
         &sset_entry::_list_link>>;
+    // the scores are indexed, so the range queries seek to their first entry.
+    using score_index_type = boost::intrusive::set<sset_entry,
+        boost::intrusive::member_hook<sset_entry, sset_entry::set_hook_type, &sset_entry::_score_link>,
+        boost::intrusive::compare<sset_entry::score_compare>>;
     dict_type _dict;
     list_type _list;
+    score_index_type _scores;
 public:
-    sset_lsa() noexcept : _dict(), _list()
+    sset_lsa() noexcept : _dict(), _list(), _scores()
     {
     }
-    sset_lsa(sset_lsa&& o) noexcept : _dict(std::move(o._dict)), _list(std::move(o._list))
+    sset_lsa(sset_lsa&& o) noexcept : _dict(std::move(o._dict)), _list(std::move(o._list)), _scores(std::move(o._scores))
     {
     }
     ~sset_lsa()
@@ -154,17 +202,19 @@ public:
     }
     void flush_all()
     {
+        _dict.clear();
+        _scores.clear();
         _list.clear_and_dispose(current_deleter<sset_entry>());
     }
 
     inline bool insert(sset_entry* e)
     {
         assert(e != nullptr);
-        if (insert_ordered(e)) {
-            auto r = _dict.insert(*e);
-            return r.second;
+        auto r = _dict.insert(*e);
+        if (r.second) {
+            insert_ordered(e);
         }
-        return false;
+        return r.second;
     }
 
     size_t insert_if_not_exists(std::unordered_map<sstring, double>& members)
@@ -173,7 +223,7 @@ public:
         for (auto& member : members) {
             const auto& key = member.first;
             const auto& score = member.second;
-            if (_dict.find(key, sset_entry::compare()) == _dict.end()) {
+            if (_dict.find(hashed_key(key), sset_entry::compare()) == _dict.end()) {
                 auto entry = current_allocator().construct<sset_entry>(key, score);
                 if (insert(entry)) {
                     inserted++;
@@ -192,13 +242,9 @@ public:
         for (auto& member : members) {
             const auto& key = member.first;
             const auto& score = member.second;
-            auto it = _dict.find(key, sset_entry::compare());
+            auto it = _dict.find(hashed_key(key), sset_entry::compare());
             if (it != _dict.end()) {
-                //remove it from list, update score, insert it to list again.
-                auto lit = list_type::s_iterator_to(*it);
-                _list.erase(lit);
-                it->update_score(score);
-                if (insert_ordered(&(*it))) {
+                if (update(*it, score)) {
                     inserted++;
                 }
             }
@@ -209,11 +255,10 @@ public:
     double insert_or_update(sstring& key, double delta)
     {
         double result = delta;
-        auto it = _dict.find(key, sset_entry::compare());
+        auto it = _dict.find(hashed_key(key), sset_entry::compare());
         if (it != _dict.end()) {
             result += it->score();
-            it->update_score(result);
-            update(&(*it));
+            update(*it, result);
         }
         else {
             auto entry = current_allocator().construct<sset_entry>(key, result);
@@ -228,10 +273,9 @@ public:
         for (auto& member : members) {
             const auto& key = member.first;
             const auto& score = member.second;
-            auto it = _dict.find(key, sset_entry::compare());
+            auto it = _dict.find(hashed_key(key), sset_entry::compare());
             if (it != _dict.end()) {
-                it->update_score(score);
-                if (update(&(*it))) {
+                if (update(*it, score)) {
                     inserted++;
                 }
             }
@@ -322,12 +366,9 @@ public:
         if (limit == 0) {
             limit = _list.size();
         }
-        for (auto it = _list.begin(); it != _list.end(); ++it) {
+        for (auto it = _scores.lower_bound(min, sset_entry::score_compare()); it != _scores.end(); ++it) {
             const auto& score = it->score();
-            if (score < min) {
-                continue;
-            }
-            else if (score > max) {
+            if (score > max) {
                 return;
             }
             else {
@@ -340,10 +381,162 @@ public:
         }
     }
 
+    // Visits the entries in the order of the scores from the first one whose score is
+    // not less than the min, func returns false to stop.
+    template <typename Func>
+    void scan_by_score(const double min, Func&& func) const
+    {
+        for (auto it = _scores.lower_bound(min, sset_entry::score_compare()); it != _scores.end(); ++it) {
+            if (!func(*it)) {
+                return;
+            }
+        }
+    }
+
+    // Visits up to count entries from the cursor in the order of the hashes, but never
+    // stops between the entries with the same hash. Returns the cursor of the next call,
+    // or 0 if all entries are visited.
+    template <typename Func>
+    size_t scan(size_t cursor, size_t count, Func&& func) const
+    {
+        assert(count > 0);
+        auto it = _dict.lower_bound(hash_position { cursor }, sset_entry::compare());
+        for (size_t visited = 0; it != _dict.end(); ++it, ++visited) {
+            if (visited >= count && it->_key_hash != std::prev(it)->_key_hash) {
+                return it->_key_hash;
+            }
+            func(*it);
+        }
+        return 0;
+    }
+
+    // Visits the entries whose hashes are in [first, last], in the order of the hashes.
+    template <typename Func>
+    void scan_range(size_t first, size_t last, Func&& func) const
+    {
+        for (auto it = _dict.lower_bound(hash_position { first }, sset_entry::compare()); it != _dict.end() && it->_key_hash <= last; ++it) {
+            func(*it);
+        }
+    }
+
+    // Appends the entry without keeping the order of the scores, sort_by_score_step() must
+    // be called until the entries are sorted once all entries were appended.
+    bool bulk_insert(sset_entry* e)
+    {
+        auto r = _dict.insert(*e);
+        if (r.second) {
+            _scores.insert(*e);
+            _list.push_back(*e);
+        }
+        return r.second;
+    }
+
+    // Orders the entries by the scores, and then by the members, as redis does.
+    static bool score_less(const sset_entry& l, const sset_entry& r)
+    {
+        return sset_entry::score_compare()(l, r);
+    }
+
+    // Sorts the appended entries by a natural merge sort, which merges the adjacent runs of
+    // the ordered entries pass by pass. A call visits about `steps` entries, so the sort of
+    // a large set is split to the chunks. Returns true once the entries are sorted.
+    bool sort_by_score_step(sset_sort_cursor& c, size_t steps)
+    {
+        auto i = c._started ? find_list_entry(c._left) : _list.begin();
+        auto j = c._started ? find_list_entry(c._right) : _list.begin();
+        c._started = true;
+        for (; steps > 0; --steps) {
+            if (c._mode == sset_sort_cursor::mode::scan) {
+                // j looks for the end of the left run which starts at i.
+                if (i == _list.end()) {
+                    if (c._merges == 0) {
+                        return true;
+                    }
+                    c._merges = 0;
+                    i = j = _list.begin();
+                    continue;
+                }
+                auto next = std::next(j);
+                if (next == _list.end()) {
+                    // the last run has no pair in this pass.
+                    i = j = next;
+                } else if (score_less(*next, *j)) {
+                    j = next;
+                    c._mode = sset_sort_cursor::mode::merge;
+                } else {
+                    j = next;
+                }
+            } else if (c._mode == sset_sort_cursor::mode::merge) {
+                // the right run starts at j, its entries are moved before the greater
+                // entries of the left run.
+                if (i == j) {
+                    c._mode = sset_sort_cursor::mode::skip;
+                } else if (score_less(*j, *i)) {
+                    auto next = std::next(j);
+                    bool last = next == _list.end() || score_less(*next, *j);
+                    _list.splice(i, _list, j);
+                    j = next;
+                    if (last) {
+                        ++c._merges;
+                        i = j;
+                        c._mode = sset_sort_cursor::mode::scan;
+                    }
+                } else {
+                    ++i;
+                }
+            } else {
+                // the left run is exhausted, j skips the rest of the right run.
+                auto next = std::next(j);
+                if (next == _list.end() || score_less(*next, *j)) {
+                    ++c._merges;
+                    i = j = next;
+                    c._mode = sset_sort_cursor::mode::scan;
+                } else {
+                    j = next;
+                }
+            }
+        }
+        // the LSA may move the entries before the next call, so the position is kept
+        // by the members.
+        c._left = list_entry_member(i);
+        c._right = list_entry_member(j);
+        return false;
+    }
+
+    // Visits the entries in the order of the scores from the rank, func returns false to stop.
+    template <typename Func>
+    void scan_by_rank(size_t rank, Func&& func) const
+    {
+        auto it = _list.begin();
+        for (size_t i = 0; i < rank && it != _list.end(); ++i, ++it) {}
+        for (; it != _list.end(); ++it) {
+            if (!func(*it)) {
+                return;
+            }
+        }
+    }
+
+    // Visits the entries in the order of the scores from the member if it still has the
+    // score, otherwise from the first entry whose score is not less than the score.
+    template <typename Func>
+    void scan_from_member(const sstring& member, double score, Func&& func) const
+    {
+        auto it = _dict.find(hashed_key(member), sset_entry::compare());
+        if (it == _dict.end() || it->score() != score) {
+            scan_by_score(score, std::forward<Func>(func));
+            return;
+        }
+        for (auto lit = list_type::s_iterator_to(*it); lit != _list.end(); ++lit) {
+            if (!func(*lit)) {
+                return;
+            }
+        }
+    }
+
     void fetch_by_key(const std::vector<sstring>& keys, std::vector<const sset_entry*>& entries) const
     {
         for (size_t i = 0; i < keys.size(); ++i) {
-           auto it = _dict.find(keys[i], sset_entry::compare());
+           auto it = _dict.find(hashed_key(keys[i]), sset_entry::compare());
            if (it != _dict.end()) {
                const auto& e = *it;
                entries.push_back(&e);
@@ -353,12 +546,9 @@ public:
 
     bool update_score(const sstring& key, double delta)
     {
-        auto it = _dict.find(key, sset_entry::compare());
+        auto it = _dict.find(hashed_key(key), sset_entry::compare());
         if (it != _dict.end()) {
-            auto lit = list_type::s_iterator_to(*it);
-            _list.erase(lit);
-            it->update_score(delta);
-            return insert_ordered(&(*it));
+            return update(*it, delta);
         }
         return false;
     }
@@ -369,6 +559,7 @@ public:
             auto lit = list_type::s_iterator_to(*entries[i]);
             auto dit = dict_type::s_iterator_to(*lit);
             _dict.erase(dit);
+            _scores.erase(score_index_type::s_iterator_to(*lit));
             _list.erase_and_dispose(lit, current_deleter<sset_entry>());
         }
         return entries.size();
@@ -379,10 +570,11 @@ public:
         size_t removed = 0;
         for (size_t i = 0; i < keys.size(); ++i) {
             auto& key = keys[i];
-            auto dit = _dict.find(key, sset_entry::compare());
+            auto dit = _dict.find(hashed_key(key), sset_entry::compare());
             if (dit != _dict.end()) {
                 auto lit = list_type::s_iterator_to(*dit);
                 _dict.erase(dit);
+                _scores.erase(score_index_type::s_iterator_to(*lit));
                 _list.erase_and_dispose(lit, current_deleter<sset_entry>());
                 removed++;
             }
@@ -399,24 +591,15 @@ public:
             return 0;
         }
         size_t count = 0;
-        for (auto it = _list.begin(); it != _list.end(); ++it) {
-            auto score = it->score();
-            if (score < min) {
-                continue;
-            }
-            else if (score > max) {
-                break;
-            }
-            else {
-                count++;
-            }
+        for (auto it = _scores.lower_bound(min, sset_entry::score_compare()); it != _scores.end() && it->score() <= max; ++it) {
+            count++;
         }
         return count;
     }
 
     template <typename Func>
     inline std::result_of_t<Func(const sset_entry* e)> with_entry_run(const sstring& k, Func&& func) const {
-        auto it = _dict.find(k, sset_entry::compare());
+        auto it = _dict.find(hashed_key(k), sset_entry::compare());
         if (it != _dict.end()) {
             const auto& e = *it;
             return func(&e);
@@ -428,7 +611,7 @@ public:
 
     template <typename Func>
     inline std::result_of_t<Func(sset_entry* e)> with_entry_run(const sstring& k, Func&& func) {
-        auto it = _dict.find(k, sset_entry::compare());
+        auto it = _dict.find(hashed_key(k), sset_entry::compare());
         if (it != _dict.end()) {
             auto& e = *it;
             return func(&e);
@@ -450,16 +633,19 @@ public:
 
     void erase(const sstring& key)
     {
-        auto removed = _dict.erase(_dict.find(key, sset_entry::compare()));
-        if (removed != _dict.end()) {
-            _list.erase_and_dispose(list_type::s_iterator_to(*removed), current_deleter<sset_entry>());
+        auto it = _dict.find(hashed_key(key), sset_entry::compare());
+        if (it != _dict.end()) {
+            auto& e = *it;
+            _dict.erase(it);
+            _scores.erase(score_index_type::s_iterator_to(e));
+            _list.erase_and_dispose(list_type::s_iterator_to(e), current_deleter<sset_entry>());
         }
     }
 
     std::experimental::optional<size_t> rank(const sstring& key) const
     {
         size_t rank = 0;
-        auto it = _dict.find(key, sset_entry::compare());
+        auto it = _dict.find(hashed_key(key), sset_entry::compare());
         if (it != _dict.end()) {
             auto lit = list_type::s_iterator_to(*it);
             for (auto i = _list.begin(); i != lit; ++i, ++rank) {}
@@ -470,13 +656,31 @@ public:
 
     std::experimental::optional<double> score(const sstring& key) const
     {
-        auto it = _dict.find(key, sset_entry::compare());
+        auto it = _dict.find(hashed_key(key), sset_entry::compare());
         if (it != _dict.end()) {
             return  std::experimental::optional<double>(it->score());
         }
         return  std::experimental::optional<double>();
     }
 private:
+    list_type::iterator find_list_entry(const std::experimental::optional<sstring>& member)
+    {
+        if (!member) {
+            return _list.end();
+        }
+        auto it = _dict.find(hashed_key(*member), sset_entry::compare());
+        assert(it != _dict.end());
+        return list_type::s_iterator_to(*it);
+    }
+
+    std::experimental::optional<sstring> list_entry_member(list_type::iterator it) const
+    {
+        if (it == _list.end()) {
+            return {};
+        }
+        return sstring(it->key_data(), it->key_size());
+    }
+
     inline bool score_out_of_range(double min, double max) const
     {
         return (min > _list.rbegin()->score()) || (max < _list.begin()->score());
@@ -487,42 +691,32 @@ private:
         return begin > static_cast<long>(_list.size()) || end <= 0;
     }
 
+    // Links the entry to the index of the scores, and to the list before the next entry
+    // in the index.
     inline bool insert_ordered(sset_entry* e)
     {
         assert(e != nullptr);
-        auto it = _list.begin();
-        const auto& score = e->score();
-        if (it == _list.end() || score < it->score()) {
-            _list.push_front(*e);
-            return true;
+        auto r = _scores.insert(*e);
+        if (!r.second) {
+            return false;
+        }
+        auto next = std::next(r.first);
+        if (next == _scores.end()) {
+            _list.push_back(*e);
         }
         else {
-            auto trace = it;
-            for (; it != _list.end(); ++it) {
-                if (it->score() > score) {
-                    _list.insert(it, *e);
-                    return true;
-                }
-                trace = it;
-            }
-            if (it == _list.end()) {
-                if (trace->score() > score) {
-                    _list.push_front(*e);
-                }
-                else {
-                    _list.push_back(*e);
-                }
-                return true;
-            }
+            _list.insert(list_type::s_iterator_to(*next), *e);
         }
-        return false;
+        return true;
     }
 
-    inline bool update(sset_entry* e)
+    // The entry is unlinked before its score is changed, so the index keeps its order.
+    inline bool update(sset_entry& e, double score)
     {
-        auto lit = list_type::s_iterator_to(*e);
-        _list.erase(lit);
-        return insert_ordered(e);
+        _scores.erase(score_index_type::s_iterator_to(e));
+        _list.erase(list_type::s_iterator_to(e));
+        e.update_score(score);
+        return insert_ordered(&e);
     }
 };
 }
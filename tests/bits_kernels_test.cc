@@ -0,0 +1,111 @@
+#include "tests/test-utils.hh"
+#include "structures/bits_kernels.hh"
+#include "structures/bits_operation.hh"
+#include <random>
+
+using namespace redis;
+
+static std::default_random_engine _rng { 42 };
+
+// The sizes cover the AVX2 loops and their tails.
+static const size_t _sizes[] = { 0, 1, 7, 8, 31, 32, 33, 100, 255, 4096, 4096 + 61 };
+
+static std::vector<uint8_t> random_bytes(size_t size)
+{
+    std::vector<uint8_t> data(size);
+    for (auto& b : data) {
+        b = static_cast<uint8_t>(_rng());
+    }
+    return data;
+}
+
+// Runs the func with the AVX2 kernels if the CPU supports them, and switches back
+// to the default implementation.
+template <typename Func>
+static void with_avx2(Func&& func)
+{
+    std::string selected = bits_kernels::implementation();
+    if (bits_kernels::select("avx2")) {
+        func();
+    }
+    BOOST_REQUIRE(bits_kernels::select(selected.c_str()));
+}
+
+SEASTAR_TEST_CASE(test_popcount_parity) {
+    for (auto size : _sizes) {
+        // the input starts at an unaligned address.
+        auto data = random_bytes(size + 1);
+        BOOST_REQUIRE(bits_kernels::select("words"));
+        auto expected = bits_kernels::popcount(data.data() + 1, size);
+        size_t bits = 0;
+        for (size_t i = 1; i <= size; ++i) {
+            bits += __builtin_popcount(data[i]);
+        }
+        BOOST_REQUIRE_EQUAL(expected, bits);
+        with_avx2([&] {
+            BOOST_REQUIRE_EQUAL(bits_kernels::popcount(data.data() + 1, size), expected);
+        });
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_bitop_parity) {
+    using op_type = void (*)(uint8_t*, const uint8_t*, size_t);
+    const op_type ops[] = { bits_kernels::bitwise_and, bits_kernels::bitwise_or, bits_kernels::bitwise_xor };
+    for (auto size : _sizes) {
+        auto dest = random_bytes(size + 1), src = random_bytes(size + 3);
+        for (auto op : ops) {
+            BOOST_REQUIRE(bits_kernels::select("words"));
+            auto expected = dest;
+            op(expected.data() + 1, src.data() + 3, size);
+            with_avx2([&] {
+                auto result = dest;
+                op(result.data() + 1, src.data() + 3, size);
+                BOOST_REQUIRE(result == expected);
+            });
+        }
+        BOOST_REQUIRE(bits_kernels::select("words"));
+        auto expected = dest;
+        bits_kernels::bitwise_not(expected.data() + 1, size);
+        BOOST_REQUIRE(expected[0] == dest[0]);
+        with_avx2([&] {
+            auto result = dest;
+            bits_kernels::bitwise_not(result.data() + 1, size);
+            BOOST_REQUIRE(result == expected);
+        });
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_find_first_not_of_parity) {
+    for (auto size : _sizes) {
+        for (uint8_t skip : { 0x00, 0xff }) {
+            // the position of the first other byte walks through the loops and the tail.
+            for (size_t position = 0; position <= size; position += std::max<size_t>(1, size / 16)) {
+                std::vector<uint8_t> data(size + 1, skip);
+                if (position < size) {
+                    data[position + 1] = skip ^ (1 << (position % 8));
+                }
+                BOOST_REQUIRE(bits_kernels::select("words"));
+                auto expected = bits_kernels::find_first_not_of(data.data() + 1, size, skip);
+                BOOST_REQUIRE_EQUAL(expected, position);
+                with_avx2([&] {
+                    BOOST_REQUIRE_EQUAL(bits_kernels::find_first_not_of(data.data() + 1, size, skip), expected);
+                });
+            }
+        }
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_set_extends_the_value) {
+    managed_bytes value { bytes_view { "\xff", 1 } };
+    BOOST_REQUIRE(!bits_operation::set(value, 8 * 40 + 1, true));
+    BOOST_REQUIRE_EQUAL(value.size(), 41);
+    BOOST_REQUIRE_EQUAL(bits_operation::count_range(value, 0, value.size()), 9);
+    BOOST_REQUIRE(bits_operation::get(value, 8 * 40 + 1));
+    BOOST_REQUIRE(!bits_operation::get(value, 8 * 20));
+    BOOST_REQUIRE(bits_operation::set(value, 7, false));
+    BOOST_REQUIRE_EQUAL(value.size(), 41);
+    return make_ready_future<>();
+}
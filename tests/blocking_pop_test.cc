@@ -0,0 +1,124 @@
+#include "tests/test-utils.hh"
+#include "redis.hh"
+#include "db.hh"
+#include "config.hh"
+#include "reply_builder.hh"
+#include "core/iostream.hh"
+#include "core/thread.hh"
+#include "net/packet.hh"
+
+using namespace redis;
+
+// Keeps the replies written to the connection.
+class string_sink final : public data_sink_impl {
+    sstring& _written;
+public:
+    explicit string_sink(sstring& written) : _written(written) {}
+    virtual future<> put(net::packet data) override {
+        for (auto& f : data.fragments()) {
+            _written.append(f.base, f.size);
+        }
+        return make_ready_future<>();
+    }
+    virtual future<> close() override {
+        return make_ready_future<>();
+    }
+};
+
+static request_wrapper make_request(std::vector<bytes> args)
+{
+    request_wrapper r;
+    r._args_count = args.size();
+    r._args = std::move(args);
+    return r;
+}
+
+SEASTAR_TEST_CASE(test_closed_blocked_client_leaves_pushed_elements) {
+    return seastar::async([] {
+        auto cfg = std::make_unique<redis::config>();
+        get_database().start().get();
+        get_database().invoke_on_all([c = cfg.get()] (database& db) {
+            db.configure(*c);
+        }).get();
+        get_redis_service().start().get();
+
+        sstring written;
+        output_stream<char> out(data_sink(std::make_unique<string_sink>(written)), 4096);
+        auto blpop = make_request({ bytes { "list" }, bytes { "0" } });
+        auto blocked = local_redis_service().blpop(blpop, out);
+        // the client blocks without a timeout, as the list is empty.
+        while (local_redis_service().blocked_client_count() == 0) {
+            later().get();
+        }
+        BOOST_REQUIRE(!blocked.available());
+
+        // the connection is closed, the request completes with the null reply.
+        local_redis_service().disconnect(out).get();
+        blocked.get();
+        out.flush().get();
+        BOOST_REQUIRE_EQUAL(written, sstring(msg_null_multi_bulk.data(), msg_null_multi_bulk.size()));
+        BOOST_REQUIRE_EQUAL(local_redis_service().blocked_client_count(), 0);
+
+        // the element pushed later is kept in the list, it is not handed to the closed connection.
+        sstring pushed;
+        output_stream<char> push_out(data_sink(std::make_unique<string_sink>(pushed)), 4096);
+        auto rpush = make_request({ bytes { "list" }, bytes { "a" } });
+        local_redis_service().rpush(rpush, push_out).get();
+        bytes key { "list" };
+        redis_key rk { key };
+        auto p = get_database().invoke_on(rk.get_cpu(), &database::pop_value, std::cref(rk), pop_side::HEAD).get0();
+        BOOST_REQUIRE_EQUAL(p->_status, REDIS_OK);
+        BOOST_REQUIRE(p->_value == bytes { "a" });
+
+        out.close().get();
+        push_out.close().get();
+        get_redis_service().stop().get();
+        get_database().stop().get();
+    });
+}
+
+SEASTAR_TEST_CASE(test_waiter_of_other_type_gets_error) {
+    return seastar::async([] {
+        auto cfg = std::make_unique<redis::config>();
+        get_database().start().get();
+        get_database().invoke_on_all([c = cfg.get()] (database& db) {
+            db.configure(*c);
+        }).get();
+        get_redis_service().start().get();
+
+        sstring zwritten;
+        output_stream<char> zout(data_sink(std::make_unique<string_sink>(zwritten)), 4096);
+        auto bzpopmin = make_request({ bytes { "list" }, bytes { "0" } });
+        auto zblocked = local_redis_service().bzpopmin(bzpopmin, zout);
+        while (local_redis_service().blocked_client_count() == 0) {
+            later().get();
+        }
+        sstring written;
+        output_stream<char> out(data_sink(std::make_unique<string_sink>(written)), 4096);
+        auto blpop = make_request({ bytes { "list" }, bytes { "0" } });
+        auto blocked = local_redis_service().blpop(blpop, out);
+        while (local_redis_service().blocked_client_count() == 1) {
+            later().get();
+        }
+
+        // the list is pushed, the BZPOPMIN at the head of the queue gets the error, and the
+        // BLPOP behind it is still served.
+        sstring pushed;
+        output_stream<char> push_out(data_sink(std::make_unique<string_sink>(pushed)), 4096);
+        auto rpush = make_request({ bytes { "list" }, bytes { "a" } });
+        local_redis_service().rpush(rpush, push_out).get();
+        zblocked.get();
+        blocked.get();
+        zout.flush().get();
+        out.flush().get();
+        BOOST_REQUIRE_EQUAL(zwritten, sstring(msg_type_err.data(), msg_type_err.size()));
+        BOOST_REQUIRE_EQUAL(written, sstring("*2\r\n$4\r\nlist\r\n$1\r\na\r\n"));
+        BOOST_REQUIRE_EQUAL(local_redis_service().blocked_client_count(), 0);
+
+        zout.close().get();
+        out.close().get();
+        push_out.close().get();
+        get_redis_service().stop().get();
+        get_database().stop().get();
+    });
+}
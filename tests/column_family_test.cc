@@ -0,0 +1,64 @@
+#include "tests/test-utils.hh"
+#include "tests/tmpdir.hh"
+#include "store/column_family.hh"
+#include "store/options.hh"
+#include "keys.hh"
+#include "partition.hh"
+#include "core/thread.hh"
+
+using namespace store;
+
+static redis::decorated_key make_key(bytes& key)
+{
+    redis::redis_key rk { key };
+    return redis::to_decorated_key(rk);
+}
+
+static void apply(column_family& cf, const char* k, const char* v)
+{
+    bytes key { k, strlen(k) };
+    cf.apply(make_key(key), make_serialized_partition(partition_type::string, key, bytes { v, strlen(v) }));
+}
+
+static lw_shared_ptr<partition> read(column_family& cf, const char* k)
+{
+    bytes key { k, strlen(k) };
+    auto dk = make_key(key);
+    return cf.read(read_options {}, dk).get0();
+}
+
+SEASTAR_TEST_CASE(test_read_the_newest_level_zero_sstable) {
+    return seastar::async([] {
+        tmpdir dir;
+        dirty_memory_manager dmm;
+        column_family_options opt;
+        opt._name = "cf";
+        opt._directory = dir.path;
+        column_family cf { dmm, std::move(opt) };
+        cf.start().get();
+
+        // every flush writes a level 0 sstable, the sstables overlap each other.
+        apply(cf, "a", "1");
+        apply(cf, "b", "1");
+        cf.flush().get();
+        apply(cf, "a", "2");
+        apply(cf, "c", "2");
+        cf.flush().get();
+        apply(cf, "a", "3");
+        cf.flush().get();
+
+        auto a = read(cf, "a");
+        BOOST_REQUIRE(a && !a->empty());
+        BOOST_REQUIRE(a->serialize() == bytes { "3" });
+        auto b = read(cf, "b");
+        BOOST_REQUIRE(b && !b->empty());
+        BOOST_REQUIRE(b->serialize() == bytes { "1" });
+        auto c = read(cf, "c");
+        BOOST_REQUIRE(c && !c->empty());
+        BOOST_REQUIRE(c->serialize() == bytes { "2" });
+        auto d = read(cf, "d");
+        BOOST_REQUIRE(d && d->empty());
+
+        cf.stop().get();
+    });
+}
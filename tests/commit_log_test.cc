@@ -0,0 +1,67 @@
+#include "tests/test-utils.hh"
+#include "tests/tmpdir.hh"
+#include "store/commit_log.hh"
+#include "store/commit_log_replayer.hh"
+#include "keys.hh"
+#include "partition.hh"
+#include "core/thread.hh"
+#include "core/print.hh"
+
+using namespace store;
+
+static void append(commit_log& log, const sstring& k, const sstring& v)
+{
+    bytes key { k.data(), k.size() };
+    redis::redis_key rk { key };
+    auto p = make_serialized_partition(partition_type::string, key, bytes { v.data(), v.size() });
+    log.append(redis::to_decorated_key(rk), p).get();
+}
+
+// Returns the number of the replayed records, and the segments which were found.
+static size_t replay(const sstring& dir, commit_log::adopted_segments& adopted)
+{
+    size_t records = 0;
+    commit_log_replayer replayer(dir, [&records] (std::vector<commit_log_record> batch) {
+        records += batch.size();
+        return make_ready_future<>();
+    });
+    replayer.replay().get();
+    adopted = replayer.adopted();
+    return records;
+}
+
+SEASTAR_TEST_CASE(test_replayed_segments_survive_the_next_crash) {
+    return seastar::async([] {
+        tmpdir dir;
+        commit_log::options opt;
+        opt._directory = dir.path;
+        opt._segment_size = 1024 * 1024;
+        opt._reserve_segments = 1;
+
+        auto log = make_lw_shared<commit_log>(opt);
+        log->start(commit_log::adopted_segments {}).get();
+        for (size_t i = 0; i < 10; ++i) {
+            append(*log, sprint("key-%d", i), sprint("value-%d", i));
+        }
+        log->stop().get();
+
+        commit_log::adopted_segments adopted;
+        BOOST_REQUIRE_EQUAL(replay(dir.path, adopted), 10);
+
+        // the memtable of the new records is flushed, and the server crashes before
+        // the memtables which hold the replayed records were flushed.
+        log = make_lw_shared<commit_log>(opt);
+        log->start(adopted).get();
+        append(*log, "key-new", "value-new");
+        log->discard_completed_segments(log->position());
+        log->stop().get();
+        BOOST_REQUIRE_EQUAL(replay(dir.path, adopted), 11);
+
+        // the replayed records were flushed on all shards, the segments are recycled.
+        log = make_lw_shared<commit_log>(opt);
+        log->start(adopted).get();
+        log->release_replayed_segments();
+        log->stop().get();
+        BOOST_REQUIRE_EQUAL(replay(dir.path, adopted), 0);
+    });
+}
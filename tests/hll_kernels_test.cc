@@ -0,0 +1,99 @@
+#include "tests/test-utils.hh"
+#include "structures/hll_kernels.hh"
+#include <cmath>
+#include <random>
+
+using namespace redis;
+
+static std::default_random_engine _rng { 42 };
+
+// The sizes cover the SIMD loops and their scalar tails.
+static const size_t _sizes[] = { 4, 12, 28, 36, 64, 100, 1024, 16384 };
+
+static std::vector<uint8_t> random_registers(size_t count)
+{
+    std::uniform_int_distribution<int> value { 0, 63 };
+    std::vector<uint8_t> registers(count);
+    for (auto& r : registers) {
+        // most registers are small, like the real ones.
+        r = value(_rng) % ((_rng() & 1) ? 64 : 8);
+    }
+    return registers;
+}
+
+// Runs the func with every SIMD implementation supported by the CPU, and switches
+// back to the default one.
+template <typename Func>
+static void for_each_simd_implementation(Func&& func)
+{
+    std::string selected = hll_kernels::implementation();
+    for (auto name : { "avx2", "sse4.1" }) {
+        if (hll_kernels::select(name)) {
+            func();
+        }
+    }
+    BOOST_REQUIRE(hll_kernels::select(selected.c_str()));
+}
+
+SEASTAR_TEST_CASE(test_pack_unpack_parity) {
+    for (auto count : _sizes) {
+        auto registers = random_registers(count);
+        auto packed_size = count * 6 / 8;
+        BOOST_REQUIRE(hll_kernels::select("scalar"));
+        std::vector<uint8_t> expected_packed(packed_size), expected_registers(count);
+        hll_kernels::pack(registers.data(), count, expected_packed.data());
+        hll_kernels::unpack(expected_packed.data(), packed_size, expected_registers.data());
+        BOOST_REQUIRE(expected_registers == registers);
+        for_each_simd_implementation([&] {
+            // the buffers are not aligned.
+            std::vector<uint8_t> input(count + 1), packed(packed_size + 1), unpacked(count + 1);
+            std::copy(registers.begin(), registers.end(), input.begin() + 1);
+            hll_kernels::pack(input.data() + 1, count, packed.data() + 1);
+            BOOST_REQUIRE(std::equal(expected_packed.begin(), expected_packed.end(), packed.begin() + 1));
+            hll_kernels::unpack(packed.data() + 1, packed_size, unpacked.data() + 1);
+            BOOST_REQUIRE(std::equal(registers.begin(), registers.end(), unpacked.begin() + 1));
+        });
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_max_merge_parity) {
+    for (auto count : _sizes) {
+        for (auto tail : { 0, 1, 7, 31 }) {
+            auto n = count + tail;
+            auto dest = random_registers(n), src = random_registers(n);
+            BOOST_REQUIRE(hll_kernels::select("scalar"));
+            auto expected = dest;
+            hll_kernels::max_merge(expected.data(), src.data(), n);
+            for_each_simd_implementation([&] {
+                std::vector<uint8_t> merged(n + 1);
+                std::copy(dest.begin(), dest.end(), merged.begin() + 1);
+                hll_kernels::max_merge(merged.data() + 1, src.data(), n);
+                BOOST_REQUIRE(std::equal(expected.begin(), expected.end(), merged.begin() + 1));
+            });
+        }
+    }
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_harmonic_sum_parity) {
+    for (auto count : _sizes) {
+        for (auto tail : { 0, 1, 7, 31 }) {
+            auto n = count + tail;
+            auto registers = random_registers(n);
+            BOOST_REQUIRE(hll_kernels::select("scalar"));
+            int expected_ez = 0;
+            auto expected = hll_kernels::harmonic_sum(registers.data(), n, expected_ez);
+            for_each_simd_implementation([&] {
+                std::vector<uint8_t> input(n + 1);
+                std::copy(registers.begin(), registers.end(), input.begin() + 1);
+                int ez = 0;
+                auto sum = hll_kernels::harmonic_sum(input.data() + 1, n, ez);
+                BOOST_REQUIRE_EQUAL(ez, expected_ez);
+                // the lanes are summed in another order.
+                BOOST_REQUIRE(std::abs(sum - expected) <= expected * 1e-12);
+            });
+        }
+    }
+    return make_ready_future<>();
+}
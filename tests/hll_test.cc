@@ -0,0 +1,70 @@
+#include "tests/test-utils.hh"
+#include "structures/hll.hh"
+#include "core/print.hh"
+
+using namespace redis;
+
+static std::vector<bytes> make_elements(size_t begin, size_t end)
+{
+    std::vector<bytes> elements;
+    for (size_t i = begin; i < end; ++i) {
+        auto s = sprint("element-%d", i);
+        elements.emplace_back(bytes { s.data(), s.size() });
+    }
+    return elements;
+}
+
+static bool is_sparse(managed_bytes& data)
+{
+    return hll::is_sparse(reinterpret_cast<const uint8_t*>(data.data()), data.size());
+}
+
+SEASTAR_TEST_CASE(test_sparse_promotion) {
+    hll::configure(hll::DEFAULT_SPARSE_MAX_BYTES);
+    auto empty = hll::empty();
+    managed_bytes data { bytes_view { empty } };
+    BOOST_REQUIRE(is_sparse(data));
+    BOOST_REQUIRE_EQUAL(hll::count(data), 0);
+    hll::append(data, make_elements(0, 100));
+    BOOST_REQUIRE(is_sparse(data));
+    // the sparse encoding exceeds the sparse_max_bytes long before all the registers are set.
+    for (size_t i = 100; i < 20000 && is_sparse(data); i += 100) {
+        hll::append(data, make_elements(i, i + 100));
+    }
+    BOOST_REQUIRE(!is_sparse(data));
+    auto count = hll::count(data);
+    hll::append(data, make_elements(0, 100));
+    BOOST_REQUIRE_EQUAL(hll::count(data), count);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_sparse_dense_count_parity) {
+    for (size_t n : { 1, 10, 100, 1000, 5000 }) {
+        auto elements = make_elements(0, n);
+        auto empty = hll::empty();
+
+        hll::configure(1 << 20);
+        managed_bytes sparse { bytes_view { empty } };
+        hll::append(sparse, elements);
+        BOOST_REQUIRE(is_sparse(sparse));
+
+        // the first insertion promotes the value to the dense encoding.
+        hll::configure(0);
+        managed_bytes dense { bytes_view { empty } };
+        hll::append(dense, elements);
+        BOOST_REQUIRE(!is_sparse(dense));
+
+        auto count = hll::count(sparse);
+        BOOST_REQUIRE_EQUAL(hll::count(dense), count);
+        BOOST_REQUIRE(count >= n * 0.95 && count <= n * 1.05 + 1);
+
+        // the unpacked registers of both encodings are equal.
+        std::vector<uint8_t> sparse_registers(hll::REGISTERS_COUNT, 0), dense_registers(hll::REGISTERS_COUNT, 0);
+        BOOST_REQUIRE(hll::merge_to_registers(reinterpret_cast<const uint8_t*>(sparse.data()), sparse.size(), sparse_registers.data()));
+        BOOST_REQUIRE(hll::merge_to_registers(reinterpret_cast<const uint8_t*>(dense.data()), dense.size(), dense_registers.data()));
+        BOOST_REQUIRE(sparse_registers == dense_registers);
+        BOOST_REQUIRE_EQUAL(hll::count_registers(sparse_registers.data()), count);
+    }
+    hll::configure(hll::DEFAULT_SPARSE_MAX_BYTES);
+    return make_ready_future<>();
+}
@@ -0,0 +1,212 @@
+#include "tests/test-utils.hh"
+#include "tests/tmpdir.hh"
+#include "store/level_manifest.hh"
+#include "store/compaction_strategy.hh"
+#include "store/version_edit.hh"
+#include "core/fstream.hh"
+#include "core/reactor.hh"
+#include "core/seastar.hh"
+#include "core/thread.hh"
+#include "core/print.hh"
+
+using namespace store;
+
+static bytes to_key(const char* s)
+{
+    return bytes { s, strlen(s) };
+}
+
+static lw_shared_ptr<sstable_meta> make_meta(uint64_t generation, const char* smallest, const char* largest, uint64_t size = 1024)
+{
+    auto m = make_lw_shared<sstable_meta>();
+    m->_generation = generation;
+    m->_sequence = generation;
+    m->_smallest_key = to_key(smallest);
+    m->_largest_key = to_key(largest);
+    m->_file_size = size;
+    return m;
+}
+
+static void write_file(const sstring& name, const sstring& content)
+{
+    auto f = open_file_dma(name, open_flags::wo | open_flags::create | open_flags::truncate).get0();
+    auto out = make_file_output_stream(std::move(f));
+    out.write(content).get();
+    out.flush().get();
+    out.close().get();
+}
+
+SEASTAR_TEST_CASE(test_version_edit_round_trip) {
+    version_edit edit;
+    edit.set_next_generation(42);
+    edit.add_file(0, make_meta(7, "a", "m"));
+    edit.add_file(3, make_meta(9, "n", "z", 4096));
+    edit.delete_file(1, 5);
+    bytes encoded;
+    edit.encode_to(encoded);
+
+    version_edit decoded;
+    BOOST_REQUIRE(decoded.decode_from(encoded));
+    BOOST_REQUIRE(decoded.has_next_generation());
+    BOOST_REQUIRE_EQUAL(decoded.next_generation(), 42);
+    BOOST_REQUIRE_EQUAL(decoded.new_files().size(), 2);
+    BOOST_REQUIRE_EQUAL(decoded.new_files()[1].first, 3);
+    BOOST_REQUIRE_EQUAL(decoded.new_files()[1].second->_generation, 9);
+    BOOST_REQUIRE_EQUAL(decoded.new_files()[1].second->_sequence, 9);
+    BOOST_REQUIRE_EQUAL(decoded.new_files()[1].second->_file_size, 4096);
+    BOOST_REQUIRE(decoded.new_files()[1].second->_largest_key == to_key("z"));
+    BOOST_REQUIRE_EQUAL(decoded.deleted_files().size(), 1);
+    BOOST_REQUIRE_EQUAL(decoded.deleted_files()[0].second, 5);
+
+    // a truncated edit is rejected.
+    BOOST_REQUIRE(!decoded.decode_from(bytes_view { encoded.data(), encoded.size() - 1 }));
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_manifest_persist_and_load) {
+    return seastar::async([] {
+        tmpdir tmp;
+        auto& dir = tmp.path;
+        level_manifest m;
+        version_edit edit;
+        edit.add_file(0, make_meta(1, "a", "k"));
+        edit.add_file(1, make_meta(2, "l", "z"));
+        m.apply(edit);
+        m.persist(dir, "cf").get();
+
+        level_manifest loaded;
+        loaded.load(dir, "cf").get();
+        BOOST_REQUIRE_EQUAL(loaded.level(0).size(), 1);
+        BOOST_REQUIRE_EQUAL(loaded.level(1).size(), 1);
+        BOOST_REQUIRE_EQUAL(loaded.level(1).front()->_generation, 2);
+        BOOST_REQUIRE_EQUAL(loaded.level(1).front()->_file_name, level_manifest::sstable_file_name(dir, "cf", 2));
+        BOOST_REQUIRE_EQUAL(loaded.next_generation(), 3);
+
+        // a missing manifest is an empty one.
+        level_manifest empty;
+        empty.load(dir, "other").get();
+        BOOST_REQUIRE(empty.level(0).empty());
+    });
+}
+
+SEASTAR_TEST_CASE(test_manifest_torn_swap_keeps_previous) {
+    return seastar::async([] {
+        tmpdir tmp;
+        auto& dir = tmp.path;
+        level_manifest m;
+        version_edit edit;
+        edit.add_file(0, make_meta(1, "a", "k"));
+        m.apply(edit);
+        m.persist(dir, "cf").get();
+
+        // the crash happened while the next manifest was written, before the rename.
+        auto tmp = level_manifest::manifest_file_name(dir, "cf") + ".tmp";
+        write_file(tmp, "torn");
+
+        level_manifest loaded;
+        loaded.load(dir, "cf").get();
+        BOOST_REQUIRE_EQUAL(loaded.level(0).size(), 1);
+        BOOST_REQUIRE_EQUAL(loaded.level(0).front()->_generation, 1);
+        BOOST_REQUIRE(!file_exists(tmp).get0());
+
+        // the swap which completed replaces the manifest.
+        version_edit next;
+        next.delete_file(0, 1);
+        next.add_file(1, make_meta(2, "a", "k"));
+        loaded.apply(next);
+        loaded.persist(dir, "cf").get();
+        level_manifest reloaded;
+        reloaded.load(dir, "cf").get();
+        BOOST_REQUIRE(reloaded.level(0).empty());
+        BOOST_REQUIRE_EQUAL(reloaded.level(1).size(), 1);
+    });
+}
+
+SEASTAR_TEST_CASE(test_manifest_corruption_is_detected) {
+    return seastar::async([] {
+        tmpdir tmp;
+        auto& dir = tmp.path;
+        write_file(level_manifest::manifest_file_name(dir, "cf"), "not a manifest");
+        level_manifest loaded;
+        BOOST_REQUIRE_THROW(loaded.load(dir, "cf").get(), redis::io_exception);
+    });
+}
+
+SEASTAR_TEST_CASE(test_leveled_pick_compaction) {
+    leveled_compaction_strategy strategy { compaction_strategy_options {} };
+    level_manifest m;
+    version_edit edit;
+    for (uint64_t g = 1; g <= 4; ++g) {
+        edit.add_file(0, make_meta(g, "c", "f"));
+    }
+    edit.add_file(1, make_meta(5, "a", "d"));
+    edit.add_file(1, make_meta(6, "x", "z"));
+    m.apply(edit);
+
+    auto desc = strategy.pick_compaction(m);
+    BOOST_REQUIRE_EQUAL(desc._level, 0);
+    BOOST_REQUIRE_EQUAL(desc._output_level, 1);
+    // the level 0 sstables from the newest one, then the overlapping level 1 sstable.
+    BOOST_REQUIRE_EQUAL(desc._inputs.size(), 5);
+    BOOST_REQUIRE_EQUAL(desc._inputs.front()->_generation, 4);
+    BOOST_REQUIRE_EQUAL(desc._inputs.back()->_generation, 5);
+    BOOST_REQUIRE(!desc._trivial_move);
+    BOOST_REQUIRE(desc._drop_tombstones);
+
+    // a level 1 sstable which overlaps nothing in the level 2 is moved.
+    level_manifest oversized;
+    version_edit big;
+    big.add_file(1, make_meta(1, "a", "b", 20 * 1024 * 1024));
+    oversized.apply(big);
+    auto move = strategy.pick_compaction(oversized);
+    BOOST_REQUIRE_EQUAL(move._level, 1);
+    BOOST_REQUIRE(move._trivial_move);
+
+    level_manifest small;
+    BOOST_REQUIRE(strategy.pick_compaction(small).empty());
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_size_tiered_pick_compaction) {
+    compaction_strategy_options opt;
+    opt._type = compaction_strategy_type::size_tiered;
+    opt.set_options({ { "min_threshold", "3" }, { "min_sstable_size", "1024" } });
+    auto strategy = make_compaction_strategy(opt);
+    BOOST_REQUIRE_EQUAL(sstring(strategy->name()), "SizeTieredCompactionStrategy");
+
+    // a large sstable, then a run of three similar ones, then a small one.
+    level_manifest m;
+    version_edit edit;
+    edit.add_file(0, make_meta(1, "a", "z", 100000));
+    edit.add_file(0, make_meta(2, "a", "z", 10000));
+    edit.add_file(0, make_meta(3, "a", "z", 12000));
+    edit.add_file(0, make_meta(4, "a", "z", 9000));
+    edit.add_file(0, make_meta(5, "a", "z", 2000));
+    m.apply(edit);
+
+    auto desc = strategy->pick_compaction(m);
+    BOOST_REQUIRE_EQUAL(desc._level, 0);
+    BOOST_REQUIRE_EQUAL(desc._output_level, 0);
+    BOOST_REQUIRE_EQUAL(desc._inputs.size(), 3);
+    BOOST_REQUIRE_EQUAL(desc._inputs.front()->_generation, 4);
+    BOOST_REQUIRE_EQUAL(desc._inputs.back()->_generation, 2);
+    // the oldest sstable may hold the keys of the removed partitions.
+    BOOST_REQUIRE(!desc._drop_tombstones);
+
+    // the output takes the place of the inputs among the level 0 sstables.
+    version_edit merged;
+    for (auto& d : desc._deleted) {
+        merged.delete_file(d.first, d.second);
+    }
+    auto output = make_meta(6, "a", "z", 31000);
+    output->_sequence = 4;
+    merged.add_file(0, output);
+    m.apply(merged);
+    BOOST_REQUIRE_EQUAL(m.level(0).size(), 3);
+    BOOST_REQUIRE_EQUAL(m.level(0)[1]->_generation, 6);
+    BOOST_REQUIRE(strategy->pick_compaction(m).empty());
+
+    BOOST_REQUIRE_THROW(opt.set_options({ { "bucket_low", "x" } }), std::invalid_argument);
+    BOOST_REQUIRE_THROW(opt.set_options({ { "unknown", "1" } }), std::invalid_argument);
+    return make_ready_future<>();
+}
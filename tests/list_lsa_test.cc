@@ -0,0 +1,175 @@
+#include "tests/test-utils.hh"
+#include "structures/list_lsa.hh"
+#include "utils/logalloc.hh"
+#include <deque>
+#include <random>
+
+using namespace redis;
+
+static bytes to_bytes(const sstring& s)
+{
+    return bytes { s.data(), s.size() };
+}
+
+static bytes make_value(size_t i)
+{
+    return to_bytes(sprint("value-%d", i));
+}
+
+// Runs the list operations in a region, and checks them against a deque.
+class list_holder : private logalloc::region {
+    list_lsa* _list;
+    std::deque<bytes> _model;
+public:
+    list_holder(size_t max_chunk_bytes, size_t max_chunk_elements, size_t compress_depth)
+    {
+        list_lsa::configure(max_chunk_bytes, max_chunk_elements, compress_depth);
+        _list = with_allocator(allocator(), [] {
+            return current_allocator().construct<list_lsa>();
+        });
+    }
+    ~list_holder()
+    {
+        with_allocator(allocator(), [this] {
+            current_allocator().destroy(_list);
+        });
+        list_lsa::configure(8192, 128, 0);
+    }
+    template <typename Func>
+    void run(Func&& func)
+    {
+        with_allocator(allocator(), [this, &func] {
+            func(*_list, _model);
+        });
+    }
+    void check()
+    {
+        BOOST_REQUIRE_EQUAL(_list->size(), _model.size());
+        for (size_t i = 0; i < _model.size(); ++i) {
+            BOOST_REQUIRE(_list->at(i) == _model[i]);
+        }
+        std::vector<bytes> visited;
+        _list->reduce(0, _list->size(), [&visited] (bytes_view e) {
+            visited.emplace_back(bytes { e.data(), e.size() });
+        });
+        BOOST_REQUIRE(std::equal(visited.begin(), visited.end(), _model.begin(), _model.end()));
+    }
+    size_t chunks() const
+    {
+        return _list->chunks();
+    }
+};
+
+SEASTAR_TEST_CASE(test_push_pop_across_chunks) {
+    list_holder h { 8192, 4, 0 };
+    h.run([] (list_lsa& l, std::deque<bytes>& m) {
+        for (size_t i = 0; i < 10; ++i) {
+            l.insert_tail(make_value(i));
+            m.push_back(make_value(i));
+            l.insert_head(make_value(100 + i));
+            m.push_front(make_value(100 + i));
+        }
+    });
+    h.check();
+    BOOST_REQUIRE_EQUAL(h.chunks(), 5);
+    h.run([] (list_lsa& l, std::deque<bytes>& m) {
+        for (size_t i = 0; i < 7; ++i) {
+            BOOST_REQUIRE(l.front() == m.front());
+            l.pop_front();
+            m.pop_front();
+            BOOST_REQUIRE(l.back() == m.back());
+            l.pop_back();
+            m.pop_back();
+        }
+    });
+    h.check();
+    h.run([] (list_lsa& l, std::deque<bytes>& m) {
+        while (!l.empty()) {
+            l.pop_back();
+            m.pop_back();
+        }
+    });
+    h.check();
+    BOOST_REQUIRE_EQUAL(h.chunks(), 0);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_chunk_bytes_limit) {
+    // the values of 7 bytes take 15 bytes with their lengths, so every chunk holds 2 of them.
+    list_holder h { 32, 0, 0 };
+    h.run([] (list_lsa& l, std::deque<bytes>& m) {
+        for (size_t i = 0; i < 9; ++i) {
+            l.insert_tail(make_value(i));
+            m.push_back(make_value(i));
+        }
+    });
+    h.check();
+    BOOST_REQUIRE_EQUAL(h.chunks(), 5);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_index_and_trim_across_chunks) {
+    list_holder h { 8192, 3, 0 };
+    h.run([] (list_lsa& l, std::deque<bytes>& m) {
+        for (size_t i = 0; i < 20; ++i) {
+            l.insert_tail(make_value(i));
+            m.push_back(make_value(i));
+        }
+        BOOST_REQUIRE_EQUAL(l.index_of(make_value(13)), 13);
+        BOOST_REQUIRE_EQUAL(l.index_of(make_value(99)), l.size());
+        l.insert_at(7, make_value(50));
+        m.insert(m.begin() + 7, make_value(50));
+        l.set(11, make_value(51));
+        m[11] = make_value(51);
+    });
+    h.check();
+    h.run([] (list_lsa& l, std::deque<bytes>& m) {
+        l.trim(4, 17);
+        m.erase(m.begin() + 17, m.end());
+        m.erase(m.begin(), m.begin() + 4);
+        l.insert_head(make_value(60));
+        m.push_front(make_value(60));
+        l.insert_tail(make_value(61));
+        m.push_back(make_value(61));
+    });
+    h.check();
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_random_operations_with_compression) {
+    list_holder h { 128, 0, 1 };
+    std::default_random_engine rng { 7 };
+    h.run([&rng] (list_lsa& l, std::deque<bytes>& m) {
+        std::uniform_int_distribution<int> op { 0, 5 };
+        for (size_t i = 0; i < 2000; ++i) {
+            // the values are repeated, so the interior chunks are compressed.
+            auto v = to_bytes(sprint("value-value-value-%d", i % 17));
+            switch (op(rng)) {
+            case 0:
+            case 1:
+                l.insert_head(v);
+                m.push_front(v);
+                break;
+            case 2:
+            case 3:
+                l.insert_tail(v);
+                m.push_back(v);
+                break;
+            case 4:
+                if (!m.empty()) {
+                    l.pop_front();
+                    m.pop_front();
+                }
+                break;
+            default:
+                if (!m.empty()) {
+                    l.pop_back();
+                    m.pop_back();
+                }
+                break;
+            }
+        }
+    });
+    h.check();
+    return make_ready_future<>();
+}
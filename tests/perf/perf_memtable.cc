@@ -0,0 +1,103 @@
+/*
+* Pedis is free software: you can redistribute it and/or modify
+* it under the terms of the GNU Affero General Public License as published by
+* the Free Software Foundation, either version 3 of the License, or
+* (at your option) any later version.
+*
+* You may obtain a copy of the License at
+*
+*     http://www.gnu.org/licenses
+*
+* Unless required by applicable law or agreed to in writing,
+* software distributed under the License is distributed on an
+* "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+* KIND, either express or implied.  See the License for the
+* specific language governing permissions and limitations
+* under the License.
+*
+*  Copyright (c) 2016-2026, Peng Jian, pstack@163.com. All rights reserved.
+*
+*/
+#include "core/app-template.hh"
+#include "core/thread.hh"
+#include "core/print.hh"
+#include "store/memtable.hh"
+#include "store/reader.hh"
+#include "partition.hh"
+#include "keys.hh"
+#include <chrono>
+#include <random>
+#include <vector>
+
+using namespace store;
+
+// Measures the throughput of the memtable: inserts the partitions in random order,
+// looks them up, then iterates the sealed memtable as the flush does.
+static bytes make_key(size_t i) {
+    return bytes { sprint("key:%016d", i).c_str() };
+}
+
+static redis::decorated_key make_decorated_key(const bytes& key) {
+    return redis::decorated_key { managed_bytes { bytes_view { key } }, redis::token {} };
+}
+
+template <typename Func>
+static void run(const sstring& name, size_t ops, Func&& func) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    auto elapsed = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+    print("%-10s: %d ops in %.3f s, %.0f ops/s\n", name, ops, elapsed, ops / elapsed);
+}
+
+int main(int ac, char** av) {
+    namespace bpo = boost::program_options;
+    app_template app;
+    app.add_options()
+        ("partitions", bpo::value<size_t>()->default_value(1000000), "number of partitions")
+        ("value-size", bpo::value<size_t>()->default_value(64), "size of a value in bytes")
+        ;
+    return app.run(ac, av, [&app] {
+        return seastar::async([&app] {
+            auto&& opts = app.configuration();
+            auto partitions = opts["partitions"].as<size_t>();
+            bytes value(bytes::initialized_later(), opts["value-size"].as<size_t>());
+            std::fill(value.begin(), value.end(), 'v');
+
+            std::vector<bytes> keys;
+            keys.reserve(partitions);
+            for (size_t i = 0; i < partitions; ++i) {
+                keys.emplace_back(make_key(i));
+            }
+            std::shuffle(keys.begin(), keys.end(), std::default_random_engine(0));
+
+            dirty_memory_manager dmm;
+            auto mt = make_lw_shared<memtable>(dmm);
+            run("insert", partitions, [&] {
+                for (auto& k : keys) {
+                    mt->insert(make_decorated_key(k), make_sstring_partition(k, value));
+                }
+            });
+            print("dirty memory: %d bytes, %d partitions\n", dmm.dirty_memory(), mt->partition_count());
+
+            std::shuffle(keys.begin(), keys.end(), std::default_random_engine(1));
+            size_t found = 0;
+            run("lookup", partitions, [&] {
+                for (auto& k : keys) {
+                    found += bool(mt->get(make_decorated_key(k)));
+                }
+            });
+            assert(found == partitions);
+
+            mt->disable_write();
+            auto r = make_flush_reader(mt);
+            size_t flushed = 0;
+            run("flush-scan", partitions, [&] {
+                for (r->seek_to_first().get(); !r->eof(); r->next().get()) {
+                    ++flushed;
+                }
+            });
+            assert(flushed == partitions);
+            print("dirty memory after flush: %d bytes\n", dmm.dirty_memory());
+        });
+    });
+}
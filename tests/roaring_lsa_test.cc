@@ -0,0 +1,106 @@
+#include "tests/test-utils.hh"
+#include "structures/roaring_lsa.hh"
+#include <random>
+#include <set>
+
+using namespace redis;
+
+using container_type = roaring_lsa::container_type;
+
+// The type of the first container, read from its serialized header.
+static container_type first_container_type(const roaring_lsa& r)
+{
+    std::vector<uint8_t> out;
+    r.serialize(0, 1 << 16, out);
+    BOOST_REQUIRE(out.size() > 2);
+    return static_cast<container_type>(out[2]);
+}
+
+static void check_bits(const roaring_lsa& r, const std::set<uint64_t>& bits, uint64_t limit)
+{
+    BOOST_REQUIRE_EQUAL(r.cardinality(), bits.size());
+    for (uint64_t i = 0; i < limit; ++i) {
+        BOOST_REQUIRE_EQUAL(r.get(i), bits.count(i) > 0);
+    }
+    BOOST_REQUIRE_EQUAL(r.count(0, r.byte_size()), bits.size());
+}
+
+SEASTAR_TEST_CASE(test_array_bitmap_threshold) {
+    roaring_lsa r;
+    std::set<uint64_t> bits;
+    // the bits are not adjacent, so the runs are never the smallest encoding.
+    for (uint64_t i = 0; i < roaring_lsa::ARRAY_MAX_CARDINALITY; ++i) {
+        r.set(i * 3, true);
+        bits.insert(i * 3);
+    }
+    BOOST_REQUIRE(first_container_type(r) == container_type::ARRAY);
+    r.set(20000, true);
+    bits.insert(20000);
+    BOOST_REQUIRE(first_container_type(r) == container_type::BITMAP);
+    check_bits(r, bits, 1 << 16);
+    r.set(3, false);
+    bits.erase(3);
+    BOOST_REQUIRE(first_container_type(r) == container_type::ARRAY);
+    check_bits(r, bits, 1 << 16);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_run_threshold) {
+    roaring_lsa r;
+    std::set<uint64_t> bits;
+    for (uint64_t i = 0; i < 10000; ++i) {
+        r.set(i, true);
+        bits.insert(i);
+    }
+    BOOST_REQUIRE(first_container_type(r) == container_type::RUN);
+    // the runs are split, extended and merged in place.
+    for (uint64_t i : { 5000, 5002, 0, 9999, 5001, 5000, 12000, 10000, 10001 }) {
+        bool value = bits.count(i) == 0;
+        BOOST_REQUIRE_EQUAL(r.set(i, value), !value);
+        if (value) {
+            bits.insert(i);
+        }
+        else {
+            bits.erase(i);
+        }
+        BOOST_REQUIRE(first_container_type(r) == container_type::RUN);
+    }
+    check_bits(r, bits, 1 << 16);
+    // clearing every other bit makes the runs larger than the bitmap.
+    for (uint64_t i = 0; i < 10000; i += 2) {
+        r.set(i, false);
+        bits.erase(i);
+    }
+    BOOST_REQUIRE(first_container_type(r) == container_type::BITMAP);
+    check_bits(r, bits, 1 << 16);
+    // and larger than the array once the bitmap became an array.
+    for (uint64_t i = 1; i < 3000; i += 2) {
+        r.set(i, false);
+        bits.erase(i);
+    }
+    BOOST_REQUIRE(first_container_type(r) == container_type::ARRAY);
+    check_bits(r, bits, 1 << 16);
+    return make_ready_future<>();
+}
+
+SEASTAR_TEST_CASE(test_random_bits) {
+    roaring_lsa r;
+    std::set<uint64_t> bits;
+    std::default_random_engine rng { 11 };
+    // the bits are clustered, so the containers go through all the encodings.
+    std::uniform_int_distribution<uint64_t> cluster { 0, 3 }, offset { 0, 20000 };
+    for (size_t i = 0; i < 200000; ++i) {
+        auto bit = cluster(rng) * (1 << 16) + offset(rng);
+        bool value = (rng() % 3) != 0;
+        BOOST_REQUIRE_EQUAL(r.set(bit, value), bits.count(bit) > 0);
+        if (value) {
+            bits.insert(bit);
+        }
+        else {
+            bits.erase(bit);
+        }
+    }
+    check_bits(r, bits, 4 << 16);
+    r.clear();
+    return make_ready_future<>();
+}
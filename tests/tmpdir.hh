@@ -0,0 +1,28 @@
+#pragma once
+#include "core/sstring.hh"
+#include <boost/filesystem.hpp>
+#include <stdlib.h>
+#include <stdexcept>
+
+// A temporary directory of a test, it is removed with its files once the test ends.
+struct tmpdir {
+    sstring path;
+
+    tmpdir()
+    {
+        char tmp[] = "/tmp/pedis-test-XXXXXX";
+        auto dir = ::mkdtemp(tmp);
+        if (dir == nullptr) {
+            throw std::runtime_error("failed to create the temporary directory");
+        }
+        path = dir;
+    }
+    tmpdir(const tmpdir&) = delete;
+    tmpdir& operator = (const tmpdir&) = delete;
+
+    ~tmpdir()
+    {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(boost::filesystem::path(path.c_str()), ec);
+    }
+};
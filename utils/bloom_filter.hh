@@ -67,6 +67,8 @@ public:
 
     virtual void add(const bytes_view& key) override;
 
+    void add(hashed_key key);
+
     virtual bool is_present(const bytes_view& key) override;
 
     virtual bool is_present(hashed_key key) override;
@@ -48,3 +48,76 @@ managed_bytes::do_linearize() const {
     return i->second.get();
 }
 
+
+void
+managed_bytes::extend(blob_storage::size_type n) {
+    if (!n) {
+        return;
+    }
+    auto& alctr = current_allocator();
+    auto maxseg = max_seg(alctr);
+    if (!external()) {
+        size_type old_size = _u.small.size;
+        if (size_t(old_size) + n <= max_inline_size) {
+            _u.small.size += n;
+            return;
+        }
+        // moves the inline bytes to a blob which has the spare capacity.
+        small_blob small = _u.small;
+        auto capacity = next_capacity(maxseg, max_inline_size, size_t(old_size) + n);
+        _u.small.size = -1;
+        try {
+            auto b = alloc_blob(alctr, &_u.ptr, old_size, old_size, capacity);
+            memcpy(b->data, small.data, old_size);
+        } catch (...) {
+            _u.small = small;
+            throw;
+        }
+    }
+    blob_storage* first = _u.ptr;
+    if (first->next && _linearization_context._nesting) {
+        _linearization_context.forget(first);
+    }
+    blob_storage* last = first;
+    while (last->next) {
+        last = last->next;
+    }
+    size_t remaining = n;
+    if (last->capacity - last->frag_size < remaining && last->capacity < maxseg) {
+        // only the last fragment is copied.
+        auto capacity = next_capacity(maxseg, last->capacity, size_t(last->frag_size) + remaining);
+        auto b = alloc_blob(alctr, last->backref, last->size, last->frag_size, capacity);
+        memcpy(b->data, last->data, last->frag_size);
+        alctr.destroy(last);
+        last = b;
+        first = _u.ptr;
+    }
+    auto now = std::min<size_t>(remaining, last->capacity - last->frag_size);
+    remaining -= now;
+    // the new fragments are allocated before the value is changed, so the value is
+    // intact if the allocation throws.
+    blob_storage::ref_type tail(nullptr);
+    if (remaining) {
+        blob_storage::ref_type* backref = &tail;
+        auto rest = remaining;
+        try {
+            while (rest) {
+                auto frag = std::min(rest, maxseg);
+                auto b = alloc_blob(alctr, backref, 0, frag, next_capacity(maxseg, frag, frag));
+                backref = &b->next;
+                rest -= frag;
+            }
+        } catch (...) {
+            if (tail) {
+                free_chain(tail);
+            }
+            throw;
+        }
+    }
+    last->frag_size += now;
+    if (tail) {
+        last->next = tail;
+        tail->backref = &last->next;
+    }
+    first->size += n;
+}
@@ -46,13 +46,21 @@ struct blob_storage {
     ref_type* backref;
     size_type size;
     size_type frag_size;
+    // the allocated size of data, the bytes after frag_size are the spare capacity.
+    size_type capacity;
     ref_type next;
     char_type data[];
 
     blob_storage(ref_type* backref, size_type size, size_type frag_size) noexcept
+        : blob_storage(backref, size, frag_size, frag_size)
+    {
+    }
+
+    blob_storage(ref_type* backref, size_type size, size_type frag_size, size_type capacity) noexcept
         : backref(backref)
         , size(size)
         , frag_size(frag_size)
+        , capacity(capacity)
         , next(nullptr)
     {
         *backref = this;
@@ -62,6 +70,7 @@ struct blob_storage {
         : backref(o.backref)
         , size(o.size)
         , frag_size(o.frag_size)
+        , capacity(o.capacity)
         , next(o.next)
     {
         *backref = this;
@@ -153,6 +162,21 @@ private:
         return a->data[index];
     }
     const bytes_view::value_type* do_linearize() const;
+    // The capacity of a growing fragment is doubled, up to max_seg.
+    static size_t next_capacity(size_t maxseg, size_t capacity, size_t needed) {
+        return std::min(maxseg, std::max(needed, 2 * capacity));
+    }
+    blob_storage* alloc_blob(allocation_strategy& alctr, blob_storage::ref_type* backref,
+                             blob_storage::size_type size, blob_storage::size_type frag_size, size_t capacity) {
+        void* p = alctr.alloc(&standard_migrator<blob_storage>::object,
+            sizeof(blob_storage) + capacity, alignof(blob_storage));
+        return new (p) blob_storage(backref, size, frag_size, capacity);
+    }
+    // Extends the value by n bytes whose content is undefined. Only the last fragment
+    // grows, it is reallocated with a doubled capacity (or new fragments are chained
+    // once it reaches max_seg), so a sequence of appends costs amortized O(appended bytes),
+    // and the other fragments are never copied.
+    void extend(blob_storage::size_type n);
 public:
     using size_type = blob_storage::size_type;
     struct initialized_later {};
@@ -349,6 +373,75 @@ public:
                 const_cast<managed_bytes*>(this)->value_at_index(index));
     }
 
+    // Visits the fragments which overlap [offset, offset + length) without linearizing,
+    // func(char_type* data, size_t size) is called with the part inside the range and
+    // returns false to stop the visit.
+    template <typename Func>
+    void for_each_fragment(size_type offset, size_type length, Func&& func) {
+        if (!external()) {
+            func(_u.small.data + offset, length);
+            return;
+        }
+        blob_storage* a = _u.ptr;
+        while (a && offset >= a->frag_size) {
+            offset -= a->frag_size;
+            a = a->next;
+        }
+        while (a && length > 0) {
+            auto n = std::min<size_type>(a->frag_size - offset, length);
+            if (!func(a->data + offset, n)) {
+                return;
+            }
+            length -= n;
+            offset = 0;
+            a = a->next;
+        }
+    }
+
+    template <typename Func>
+    void for_each_fragment(size_type offset, size_type length, Func&& func) const {
+        const_cast<managed_bytes*>(this)->for_each_fragment(offset, length, [&func] (blob_storage::char_type* data, size_t size) {
+            return func(const_cast<const blob_storage::char_type*>(data), size);
+        });
+    }
+
+    // Appends the bytes to the end of the value.
+    void append(bytes_view v) {
+        auto offset = size();
+        extend(v.size());
+        write(offset, v);
+    }
+
+    // Overwrites the bytes at offset with v, without linearizing the value. The value
+    // is extended if v goes beyond its end, and the gap is filled by zeros.
+    void write(size_type offset, bytes_view v) {
+        auto old_size = size();
+        if (size_t(offset) + v.size() > old_size) {
+            extend(offset + v.size() - old_size);
+            if (offset > old_size) {
+                for_each_fragment(old_size, offset - old_size, [] (blob_storage::char_type* data, size_t size) {
+                    memset(data, 0, size);
+                    return true;
+                });
+            }
+        }
+        auto p = v.data();
+        for_each_fragment(offset, v.size(), [&p] (blob_storage::char_type* data, size_t size) {
+            memcpy(data, p, size);
+            p += size;
+            return true;
+        });
+    }
+
+    // Copies the bytes [offset, offset + length) to out, without linearizing the value.
+    void copy_to(size_type offset, size_type length, blob_storage::char_type* out) const {
+        for_each_fragment(offset, length, [&out] (const blob_storage::char_type* data, size_t size) {
+            memcpy(out, data, size);
+            out += size;
+            return true;
+        });
+    }
+
     size_type size() const {
         if (external()) {
             return _u.ptr->size;
@@ -396,7 +489,7 @@ public:
             size_t mem = 0;
             blob_storage* blob = _u.ptr;
             while (blob) {
-                mem += blob->frag_size + sizeof(blob_storage);
+                mem += blob->capacity + sizeof(blob_storage);
                 blob = blob->next;
             }
             return mem;
@@ -433,5 +526,5 @@ struct hash<managed_bytes> {
 inline
 size_t
 size_for_allocation_strategy(const blob_storage& bs) {
-    return sizeof(bs) + bs.frag_size;
+    return sizeof(bs) + bs.capacity;
 }